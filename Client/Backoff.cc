@@ -14,15 +14,24 @@
  */
 
 #include "Client/Backoff.h"
+#include "Core/Random.h"
 
 namespace LogCabin {
 namespace Client {
 
+const std::chrono::nanoseconds
+Backoff::MIN_OVERLOAD_DELAY = std::chrono::milliseconds(1);
+
+const std::chrono::nanoseconds
+Backoff::MAX_OVERLOAD_DELAY = std::chrono::seconds(1);
+
 Backoff::Backoff(uint64_t windowCount, uint64_t windowNanos)
     : mutex()
     , windowCount(std::max(1UL, windowCount))
     , windowDuration(windowNanos)
     , startTimes()
+    , overloadDelay(0)
+    , overloadedUntil(TimePoint::min())
 {
     for (uint64_t i = 0; i < windowCount; ++i)
         startTimes.push_back(TimePoint::min());
@@ -35,23 +44,52 @@ Backoff::~Backoff()
 void
 Backoff::delayAndBegin(TimePoint timeout)
 {
-    std::lock_guard<std::mutex> lockGuard(mutex);
-    TimePoint now = Clock::now();
-    if (now > timeout)
-        return;
-    TimePoint oldest = startTimes.at(0);
-    TimePoint permissible = oldest + windowDuration;
-    if (permissible > now) {
-        if (permissible > timeout) { // now < timeout < permissible
-            Core::Time::sleep(timeout);
+    // Decide when to start under the lock, but sleep without it, so that
+    // threads waiting here don't queue up behind each other's sleeps.
+    TimePoint now;
+    TimePoint wake;
+    {
+        std::lock_guard<std::mutex> lockGuard(mutex);
+        now = Clock::now();
+        if (now > timeout)
             return;
-        } else { // now < permissible < timeout
-            Core::Time::sleep(permissible);
-            now = Clock::now();
+        TimePoint oldest = startTimes.at(0);
+        TimePoint permissible = std::max(oldest + windowDuration,
+                                         overloadedUntil);
+        if (permissible > timeout) { // now < timeout < permissible
+            wake = timeout;
+        } else {
+            // Claim the operation's start time now, so that other threads
+            // arriving while this one sleeps wait for the next opening.
+            wake = std::max(now, permissible);
+            startTimes.pop_front();
+            startTimes.push_back(wake);
         }
     }
-    startTimes.pop_front();
-    startTimes.push_back(now);
+    if (wake > now)
+        Core::Time::sleep(wake);
+}
+
+void
+Backoff::noteOverloaded()
+{
+    std::lock_guard<std::mutex> lockGuard(mutex);
+    if (overloadDelay == std::chrono::nanoseconds::zero())
+        overloadDelay = MIN_OVERLOAD_DELAY;
+    else
+        overloadDelay = std::min(overloadDelay * 2, MAX_OVERLOAD_DELAY);
+    // Full jitter: sleep anywhere from 0 up to the current bound.
+    std::chrono::nanoseconds delay(
+        Core::Random::randomRange(0, uint64_t(overloadDelay.count())));
+    overloadedUntil = Clock::now() + delay;
+}
+
+void
+Backoff::noteSuccess()
+{
+    std::lock_guard<std::mutex> lockGuard(mutex);
+    overloadDelay = std::chrono::nanoseconds::zero();
+    overloadedUntil = TimePoint::min();
 }
 
 } // namespace LogCabin::Client
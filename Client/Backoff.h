@@ -27,7 +27,8 @@ namespace Client {
 
 /**
  * A simple backoff mechanism. Currently used in the client library to
- * rate-limit the creation of new TCP connections.
+ * rate-limit the creation of new TCP connections, and to back off from a
+ * leader that is shedding load (see noteOverloaded()).
  */
 class Backoff {
   public:
@@ -56,13 +57,38 @@ class Backoff {
     /**
      * This is invoked before beginning a new operation. If the operation may
      * not proceed yet, this method sleeps until starting the operation becomes
-     * permissible.
+     * permissible. Concurrent callers don't wait on each other's sleeps.
      * \param timeout
      *      Maximum time at which to stop sleeping and return, without marking
      *      the operation as having started.
      */
     void delayAndBegin(TimePoint timeout);
 
+    /**
+     * This is invoked when a server rejected an operation because it was
+     * overloaded. Until noteSuccess() is called, each following call to
+     * delayAndBegin() will first sleep for a randomized delay that doubles
+     * with every consecutive overload (up to a limit), so that many clients
+     * don't all retry at once.
+     */
+    void noteOverloaded();
+
+    /**
+     * This is invoked when an operation succeeds. It undoes the effect of
+     * noteOverloaded().
+     */
+    void noteSuccess();
+
+    /**
+     * The delay used after the first overload; see noteOverloaded().
+     */
+    static const std::chrono::nanoseconds MIN_OVERLOAD_DELAY;
+
+    /**
+     * The longest delay noteOverloaded() will grow to.
+     */
+    static const std::chrono::nanoseconds MAX_OVERLOAD_DELAY;
+
   private:
 
     /**
@@ -88,6 +114,17 @@ class Backoff {
      * most recent.
      */
     std::deque<TimePoint> startTimes;
+
+    /**
+     * The upper bound on the next randomized delay after an overload, or 0 if
+     * the last operation did not report an overload.
+     */
+    std::chrono::nanoseconds overloadDelay;
+
+    /**
+     * delayAndBegin() will not begin an operation before this time.
+     */
+    TimePoint overloadedUntil;
 };
 
 } // namespace LogCabin::Client
@@ -14,6 +14,7 @@
  */
 
 #include <gtest/gtest.h>
+#include <thread>
 
 #include "Client/Backoff.h"
 
@@ -79,6 +80,52 @@ TEST(ClientBackoffTest, timeout_TimingSensitive) {
     EXPECT_GT(t7 + slop, t8);
 }
 
+TEST(ClientBackoffTest, noteOverloaded) {
+    Backoff backoff(1000, 0);
+    EXPECT_EQ(TimePoint::min(), backoff.overloadedUntil);
+    backoff.noteOverloaded();
+    EXPECT_EQ(Backoff::MIN_OVERLOAD_DELAY, backoff.overloadDelay);
+    TimePoint now = Clock::now();
+    EXPECT_GE(now + Backoff::MIN_OVERLOAD_DELAY, backoff.overloadedUntil);
+    backoff.noteOverloaded();
+    EXPECT_EQ(Backoff::MIN_OVERLOAD_DELAY * 2, backoff.overloadDelay);
+    for (uint32_t i = 0; i < 20; ++i)
+        backoff.noteOverloaded();
+    EXPECT_EQ(Backoff::MAX_OVERLOAD_DELAY, backoff.overloadDelay);
+    backoff.noteSuccess();
+    EXPECT_EQ(0, backoff.overloadDelay.count());
+    EXPECT_EQ(TimePoint::min(), backoff.overloadedUntil);
+}
+
+TEST(ClientBackoffTest, noteOverloaded_delay_TimingSensitive) {
+    Backoff backoff(1000, 0);
+    backoff.overloadDelay = std::chrono::milliseconds(10);
+    backoff.overloadedUntil = Clock::now() + std::chrono::milliseconds(10);
+    TimePoint t1 = Clock::now();
+    backoff.delayAndBegin(TimePoint::max()); // delay about 10ms
+    TimePoint t2 = Clock::now();
+    backoff.delayAndBegin(TimePoint::max()); // still delayed, about 0ms
+    TimePoint t3 = Clock::now();
+    std::chrono::milliseconds slop(5);
+    EXPECT_LT(t1 + std::chrono::milliseconds(9), t2);
+    EXPECT_GT(t1 + std::chrono::milliseconds(10) + slop, t2);
+    EXPECT_GT(t2 + slop, t3);
+}
+
+TEST(ClientBackoffTest, delayAndBegin_concurrent_TimingSensitive) {
+    // Threads sleeping for the same overload don't wait for each other.
+    Backoff backoff(1000, 0);
+    backoff.overloadedUntil = Clock::now() + std::chrono::milliseconds(20);
+    TimePoint t1 = Clock::now();
+    std::thread thread([&backoff]() {
+        backoff.delayAndBegin(TimePoint::max());
+    });
+    backoff.delayAndBegin(TimePoint::max());
+    thread.join();
+    TimePoint t2 = Clock::now();
+    EXPECT_GT(t1 + std::chrono::milliseconds(35), t2);
+}
+
 } // namespace LogCabin::Client::<anonymous>
 } // namespace LogCabin::Client
 } // namespace LogCabin
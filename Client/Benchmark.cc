@@ -0,0 +1,819 @@
+/* Copyright (c) 2012-2014 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * \file
+ * This is a load generator for measuring LogCabin's latency and throughput.
+ *
+ * It issues a mix of reads, writes, and conditional writes over a set of
+ * keys, either as fast as each thread can (closed loop) or at a fixed arrival
+ * rate (open loop). In open-loop mode, each operation's latency is measured
+ * from the time it was scheduled to start, not from the time it was actually
+ * sent, so that a slow server can't hide its stalls by delaying the load
+ * (that is, the results are free of coordinated omission).
+ *
+ * Unlike the programs in Examples, this reuses LogCabin's internal histograms
+ * to summarize latencies, so it lives alongside logcabinctl.
+ */
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "build/Protocol/ServerStats.pb.h"
+#include "Core/CompatAtomic.h"
+#include "Core/Histogram.h"
+#include "Core/StringUtil.h"
+#include "include/LogCabin/Client.h"
+#include "include/LogCabin/Debug.h"
+#include "include/LogCabin/Util.h"
+
+namespace {
+
+using LogCabin::Client::Cluster;
+using LogCabin::Client::Result;
+using LogCabin::Client::Status;
+using LogCabin::Client::Tree;
+using LogCabin::Client::Util::parseNonNegativeDuration;
+using LogCabin::Core::Histogram;
+using LogCabin::Core::StringUtil::format;
+
+typedef std::chrono::steady_clock Clock;
+typedef Clock::time_point TimePoint;
+
+/**
+ * Parses argv for the main function.
+ */
+class OptionParser {
+  public:
+    OptionParser(int& argc, char**& argv)
+        : argc(argc)
+        , argv(argv)
+        , cluster("logcabin:5254")
+        , logPolicy("")
+        , size(1024)
+        , maxSize(0)
+        , threads(1)
+        , totalOps(1000)
+        , wait(0)
+        , rate(0)
+        , readPercent(0)
+        , conditionPercent(0)
+        , keys(1)
+        , distribution("uniform")
+        , zipfTheta(0.99)
+        , seed(1)
+        , jsonPath("")
+        , timeout(parseNonNegativeDuration("30s"))
+    {
+        while (true) {
+            static struct option longOptions[] = {
+               {"cluster",  required_argument, NULL, 'c'},
+               {"conditions",  required_argument, NULL, 257},
+               {"distribution",  required_argument, NULL, 258},
+               {"help",  no_argument, NULL, 'h'},
+               {"json",  required_argument, NULL, 259},
+               {"keys",  required_argument, NULL, 'k'},
+               {"max-size",  required_argument, NULL, 260},
+               {"rate",  required_argument, NULL, 'r'},
+               {"reads",  required_argument, NULL, 261},
+               {"seed",  required_argument, NULL, 262},
+               {"size",  required_argument, NULL, 's'},
+               {"threads",  required_argument, NULL, 't'},
+               {"timeout",  required_argument, NULL, 'd'},
+               {"wait",  required_argument, NULL, 'z'},
+               {"writes",  required_argument, NULL, 'w'},
+               {"ops",  required_argument, NULL, 'w'},
+               {"zipf-theta",  required_argument, NULL, 263},
+               {"verbose",  no_argument, NULL, 'v'},
+               {"verbosity",  required_argument, NULL, 256},
+               {0, 0, 0, 0}
+            };
+            int c = getopt_long(argc, argv, "c:hk:r:s:t:w:v",
+                                longOptions, NULL);
+
+            // Detect the end of the options.
+            if (c == -1)
+                break;
+
+            switch (c) {
+                case 'c':
+                    cluster = optarg;
+                    break;
+                case 'd':
+                    timeout = parseNonNegativeDuration(optarg);
+                    break;
+                case 'h':
+                    usage();
+                    exit(0);
+                case 'k':
+                    keys = uint64_t(atol(optarg));
+                    break;
+                case 'r':
+                    rate = atof(optarg);
+                    break;
+                case 's':
+                    size = uint64_t(atol(optarg));
+                    break;
+                case 't':
+                    threads = uint64_t(atol(optarg));
+                    break;
+                case 'w':
+                    totalOps = uint64_t(atol(optarg));
+                    break;
+                case 'z':
+                    wait = uint32_t(atol(optarg));
+                    break;
+                case 'v':
+                    logPolicy = "VERBOSE";
+                    break;
+                case 256:
+                    logPolicy = optarg;
+                    break;
+                case 257:
+                    conditionPercent = atof(optarg);
+                    break;
+                case 258:
+                    distribution = optarg;
+                    break;
+                case 259:
+                    jsonPath = optarg;
+                    break;
+                case 260:
+                    maxSize = uint64_t(atol(optarg));
+                    break;
+                case 261:
+                    readPercent = atof(optarg);
+                    break;
+                case 262:
+                    seed = uint64_t(atol(optarg));
+                    break;
+                case 263:
+                    zipfTheta = atof(optarg);
+                    break;
+                case '?':
+                default:
+                    // getopt_long already printed an error message.
+                    usage();
+                    exit(1);
+            }
+        }
+        if (maxSize < size)
+            maxSize = size;
+        std::string error;
+        if (threads == 0)
+            error = "--threads must be at least 1";
+        else if (keys == 0)
+            error = "--keys must be at least 1";
+        else if (rate < 0)
+            error = "--rate must not be negative";
+        else if (readPercent < 0 || conditionPercent < 0 ||
+                 readPercent + conditionPercent > 100)
+            error = "--reads and --conditions must add up to at most 100";
+        else if (distribution != "uniform" && distribution != "zipf")
+            error = "--distribution must be uniform or zipf";
+        else if (!(zipfTheta > 0 && zipfTheta < 1))
+            error = "--zipf-theta must be between 0 and 1 (exclusive)";
+        if (!error.empty()) {
+            std::cerr << error << std::endl;
+            usage();
+            exit(1);
+        }
+    }
+
+    void usage() {
+        std::cout
+            << "Issues a mix of reads and writes to LogCabin and reports "
+            << "their latency."
+            << std::endl
+            << "Stops once it reaches the given number of operations or "
+            << "the timeout,"
+            << std::endl
+            << "whichever comes first."
+            << std::endl
+            << std::endl
+            << "This program is subject to change (it is not part of "
+            << "LogCabin's stable API)."
+            << std::endl
+            << std::endl
+
+            << "Usage: " << argv[0] << " [options]"
+            << std::endl
+            << std::endl
+
+            << "Options:"
+            << std::endl
+
+            << "  -c <addresses>, --cluster=<addresses>  "
+            << "Network addresses of the LogCabin"
+            << std::endl
+            << "                                         "
+            << "servers, comma-separated"
+            << std::endl
+            << "                                         "
+            << "[default: logcabin:5254]"
+            << std::endl
+
+            << "  --conditions <percent>  "
+            << "Percentage of operations that are conditional"
+            << std::endl
+            << "                          "
+            << "writes [default: 0]"
+            << std::endl
+
+            << "  --distribution <name>   "
+            << "How keys are chosen: uniform or zipf"
+            << std::endl
+            << "                          "
+            << "[default: uniform]"
+            << std::endl
+
+            << "  -h, --help              "
+            << "Print this usage information"
+            << std::endl
+
+            << "  --json <file>           "
+            << "Write results as JSON to the given file, or to"
+            << std::endl
+            << "                          "
+            << "stdout if '-'"
+            << std::endl
+
+            << "  --keys <num>            "
+            << "Number of distinct keys [default: 1]"
+            << std::endl
+
+            << "  --max-size <bytes>      "
+            << "If larger than --size, each write's value size is"
+            << std::endl
+            << "                          "
+            << "chosen uniformly from [size, max-size]"
+            << std::endl
+
+            << "  --rate <ops/s>          "
+            << "Target arrival rate across all threads, or 0 to"
+            << std::endl
+            << "                          "
+            << "send each operation as soon as the previous one"
+            << std::endl
+            << "                          "
+            << "on the same thread completes [default: 0]"
+            << std::endl
+
+            << "  --reads <percent>       "
+            << "Percentage of operations that are reads [default: 0]"
+            << std::endl
+
+            << "  --seed <num>            "
+            << "Seed for the random number generators [default: 1]"
+            << std::endl
+
+            << "  --size <bytes>          "
+            << "Size of value in each write [default: 1024]"
+            << std::endl
+
+            << "  --threads <num>         "
+            << "Number of concurrent clients [default: 1]"
+            << std::endl
+
+            << "  --timeout <time>        "
+            << "Time after which to exit, 0 for no timeout [default: 30s]"
+            << std::endl
+
+            << "  --writes <num>, --ops <num>  "
+            << "Number of total operations [default: 1000]"
+            << std::endl
+
+            << "  --wait <us>             "
+            << "Time each thread sleeps before each operation when"
+            << std::endl
+            << "                          "
+            << "--rate is 0 [default: 0]"
+            << std::endl
+
+            << "  --zipf-theta <theta>    "
+            << "Skew of the zipf distribution [default: 0.99]"
+            << std::endl
+
+            << "  -v, --verbose           "
+            << "Same as --verbosity=VERBOSE"
+            << std::endl
+
+            << "  --verbosity=<policy>    "
+            << "Set which log messages are shown."
+            << std::endl
+            << "                          "
+            << "Comma-separated LEVEL or PATTERN@LEVEL rules."
+            << std::endl
+            << "                          "
+            << "Levels: SILENT, ERROR, WARNING, NOTICE, VERBOSE."
+            << std::endl
+            << "                          "
+            << "Patterns match filename prefixes or suffixes."
+            << std::endl
+            << "                          "
+            << "Example: Client@NOTICE,Test.cc@SILENT,VERBOSE."
+            << std::endl;
+    }
+
+    int& argc;
+    char**& argv;
+    std::string cluster;
+    std::string logPolicy;
+    uint64_t size;
+    uint64_t maxSize;
+    uint64_t threads;
+    uint64_t totalOps;
+    uint32_t wait;
+    double rate;
+    double readPercent;
+    double conditionPercent;
+    uint64_t keys;
+    std::string distribution;
+    double zipfTheta;
+    uint64_t seed;
+    std::string jsonPath;
+    uint64_t timeout;
+};
+
+/**
+ * Chooses key numbers in [0, n) following a Zipfian distribution, where key 0
+ * is the most popular. This is the algorithm from "Quickly Generating
+ * Billion-Record Synthetic Databases" by Gray et al., as used in YCSB.
+ */
+class ZipfGenerator {
+  public:
+    ZipfGenerator(uint64_t n, double theta)
+        : n(n)
+        , theta(theta)
+        , alpha(1.0 / (1.0 - theta))
+        , zetan(zeta(n, theta))
+        , eta((1.0 - pow(2.0 / double(n), 1.0 - theta)) /
+              (1.0 - zeta(2, theta) / zetan))
+    {
+    }
+
+    /**
+     * Map a number drawn uniformly from [0, 1) to a key number.
+     */
+    uint64_t next(double u) const {
+        double uz = u * zetan;
+        if (uz < 1.0)
+            return 0;
+        if (uz < 1.0 + pow(0.5, theta))
+            return std::min(n - 1, uint64_t(1));
+        uint64_t key = uint64_t(double(n) * pow(eta * u - eta + 1.0, alpha));
+        return std::min(n - 1, key);
+    }
+
+  private:
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; ++i)
+            sum += 1.0 / pow(double(i), theta);
+        return sum;
+    }
+    const uint64_t n;
+    const double theta;
+    const double alpha;
+    const double zetan;
+    const double eta;
+};
+
+/**
+ * The kinds of operations issued.
+ */
+enum OpType {
+    READ = 0,
+    WRITE,
+    CONDITIONAL_WRITE,
+    NUM_OP_TYPES,
+};
+
+const char* opTypeNames[NUM_OP_TYPES] = {
+    "read",
+    "write",
+    "conditional_write",
+};
+
+/**
+ * Results shared by all threads. Histograms and counters are updated with
+ * relaxed atomics, so no locking is needed.
+ */
+struct Stats {
+    Stats()
+        : latency()
+        , serviceTime()
+        , latencyByType()
+        , completedByType()
+        , errorsByStatus()
+        , errorsMutex()
+        , completed(0)
+        , latencySum(0)
+    {
+        for (uint32_t i = 0; i < NUM_OP_TYPES; ++i)
+            completedByType[i] = 0;
+    }
+    /**
+     * Nanoseconds from when each operation was scheduled to start until it
+     * completed. In closed-loop mode, this is the same as serviceTime.
+     */
+    Histogram latency;
+    /**
+     * Nanoseconds from when each operation was sent until it completed.
+     */
+    Histogram serviceTime;
+    /**
+     * Like latency, broken down by OpType.
+     */
+    Histogram latencyByType[NUM_OP_TYPES];
+    /**
+     * Number of operations completed, by OpType.
+     */
+    std::atomic<uint64_t> completedByType[NUM_OP_TYPES];
+    /**
+     * Number of operations that returned each non-OK status (other than
+     * CONDITION_NOT_MET for conditional writes, which is expected).
+     */
+    std::map<std::string, uint64_t> errorsByStatus;
+    /**
+     * Protects errorsByStatus.
+     */
+    std::mutex errorsMutex;
+    /**
+     * Total number of operations completed.
+     */
+    std::atomic<uint64_t> completed;
+    /**
+     * Sum of latency, used by the progress reporter.
+     */
+    std::atomic<uint64_t> latencySum;
+};
+
+/**
+ * Return the name of the given client status, for error counts.
+ */
+std::string
+statusName(Status status)
+{
+    std::stringstream ss;
+    ss << status;
+    return ss.str();
+}
+
+/**
+ * Return the path of the given key number.
+ */
+std::string
+keyPath(uint64_t key)
+{
+    return format("/bench/key%lu", key);
+}
+
+/**
+ * The main function for a single client thread.
+ * \param id
+ *      Unique ID for this thread, counting from 0.
+ * \param options
+ *      Arguments describing benchmark.
+ * \param tree
+ *      Interface to LogCabin.
+ * \param start
+ *      When the benchmark started; the schedule of open-loop operations is
+ *      relative to this.
+ * \param exit
+ *      When this becomes true, this thread should exit.
+ * \param stats
+ *      Where results are recorded.
+ */
+void
+clientThreadMain(uint64_t id,
+                 const OptionParser& options,
+                 Tree tree,
+                 TimePoint start,
+                 std::atomic<bool>& exit,
+                 Stats& stats)
+{
+    uint64_t numOps = options.totalOps / options.threads;
+    // assign any odd leftover operations in a balanced way
+    if (options.totalOps - numOps * options.threads > id)
+        numOps += 1;
+
+    std::mt19937_64 random(options.seed * 1000003 + id);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::uniform_int_distribution<uint64_t> uniformKey(0, options.keys - 1);
+    std::uniform_int_distribution<uint64_t> uniformSize(options.size,
+                                                        options.maxSize);
+    std::unique_ptr<ZipfGenerator> zipf;
+    if (options.distribution == "zipf")
+        zipf.reset(new ZipfGenerator(options.keys, options.zipfTheta));
+    const std::string maxValue(options.maxSize, 'v');
+    std::string contents;
+
+    for (uint64_t i = 0; i < numOps; ++i) {
+        if (exit)
+            break;
+
+        // Decide when this operation should start. Operations are dealt out
+        // to threads round-robin, so the threads together follow the target
+        // rate.
+        TimePoint scheduled;
+        if (options.rate > 0) {
+            double offsetSeconds =
+                double(i * options.threads + id) / options.rate;
+            scheduled = start + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(offsetSeconds));
+            std::this_thread::sleep_until(scheduled);
+        } else {
+            if (options.wait > 0)
+                usleep(options.wait);
+            scheduled = Clock::now();
+        }
+
+        double r = uniform(random) * 100;
+        OpType type = (r < options.readPercent ? READ :
+                       r < options.readPercent + options.conditionPercent
+                         ? CONDITIONAL_WRITE
+                         : WRITE);
+        uint64_t key = zipf ? zipf->next(uniform(random))
+                            : uniformKey(random);
+        std::string path = keyPath(key);
+        uint64_t size = uniformSize(random);
+
+        TimePoint sent = Clock::now();
+        Result result;
+        switch (type) {
+            case READ:
+                result = tree.read(path, contents);
+                break;
+            case WRITE:
+                result = tree.write(path, std::string(maxValue, 0, size));
+                break;
+            case CONDITIONAL_WRITE:
+                // Succeeds if the previous write to this key happened to use
+                // the same size.
+                tree.setCondition(path, std::string(maxValue, 0, size));
+                result = tree.write(path, std::string(maxValue, 0, size));
+                tree.setCondition("", "");
+                break;
+            case NUM_OP_TYPES:
+                assert(false);
+        }
+        TimePoint done = Clock::now();
+
+        uint64_t latencyNanos = uint64_t(
+            std::chrono::nanoseconds(done - scheduled).count());
+        stats.latency.push(latencyNanos);
+        stats.latencyByType[type].push(latencyNanos);
+        stats.serviceTime.push(uint64_t(
+            std::chrono::nanoseconds(done - sent).count()));
+        stats.latencySum.fetch_add(latencyNanos, std::memory_order_relaxed);
+        stats.completedByType[type].fetch_add(1, std::memory_order_relaxed);
+        stats.completed.fetch_add(1, std::memory_order_relaxed);
+        if (result.status != Status::OK &&
+            !(type == CONDITIONAL_WRITE &&
+              result.status == Status::CONDITION_NOT_MET)) {
+            std::lock_guard<std::mutex> lockGuard(stats.errorsMutex);
+            ++stats.errorsByStatus[statusName(result.status)];
+        }
+    }
+}
+
+/**
+ * Main function for the timer thread, whose job is to print progress once a
+ * second and to set 'exit' to true once a particular timeout elapses.
+ * \param timeout
+ *      Nanoseconds to wait before setting exit to true, or 0 for no timeout.
+ * \param stats
+ *      Progress is read from here.
+ * \param[in,out] exit
+ *      If this is set to true from another thread, the timer thread will exit
+ *      soonish. Also, if the timeout elapses, the timer thread will set this
+ *      to true and exit.
+ */
+void
+timerThreadMain(uint64_t timeout, const Stats& stats, std::atomic<bool>& exit)
+{
+    TimePoint start = Clock::now();
+    TimePoint lastReport = start;
+    uint64_t lastCompleted = 0;
+    uint64_t lastLatencySum = 0;
+    while (!exit) {
+        usleep(50 * 1000);
+        TimePoint now = Clock::now();
+        if (timeout > 0 &&
+            uint64_t(std::chrono::nanoseconds(now - start).count()) >
+                timeout) {
+            exit = true;
+        }
+        if (now - lastReport >= std::chrono::seconds(1)) {
+            // Prints operations per second, then mean latency in
+            // milliseconds, over the last interval.
+            uint64_t completed = stats.completed.load();
+            uint64_t latencySum = stats.latencySum.load();
+            double seconds = std::chrono::duration<double>(
+                now - lastReport).count();
+            uint64_t ops = completed - lastCompleted;
+            std::cout << double(ops) / seconds
+                      << "\t\t"
+                      << (ops == 0 ? 0.0 :
+                          double(latencySum - lastLatencySum) / 1e6 /
+                          double(ops))
+                      << std::endl;
+            lastReport = now;
+            lastCompleted = completed;
+            lastLatencySum = latencySum;
+        }
+    }
+}
+
+/**
+ * Append a JSON object describing the given histogram to 'os'.
+ */
+void
+histogramToJSON(const Histogram& histogram, std::ostream& os)
+{
+    LogCabin::Protocol::Histogram message;
+    histogram.updateProtoBuf(message);
+    os << "{\"count\":" << message.count()
+       << ",\"p50\":" << message.p50()
+       << ",\"p90\":" << message.p90()
+       << ",\"p99\":" << message.p99()
+       << ",\"p999\":" << message.p999()
+       << ",\"max\":" << histogram.getPercentile(100)
+       << ",\"buckets\":[";
+    for (int i = 0; i < message.bucket_size(); ++i) {
+        const LogCabin::Protocol::Histogram::Bucket& bucket =
+            message.bucket(i);
+        os << (i == 0 ? "" : ",")
+           << "[" << bucket.min()
+           << "," << bucket.max()
+           << "," << bucket.count() << "]";
+    }
+    os << "]}";
+}
+
+/**
+ * Return the results as a JSON document.
+ */
+std::string
+resultsToJSON(const OptionParser& options,
+              const Stats& stats,
+              double seconds)
+{
+    std::stringstream os;
+    os << "{\"config\":{"
+       << "\"threads\":" << options.threads
+       << ",\"ops\":" << options.totalOps
+       << ",\"rate\":" << options.rate
+       << ",\"reads_percent\":" << options.readPercent
+       << ",\"conditions_percent\":" << options.conditionPercent
+       << ",\"keys\":" << options.keys
+       << ",\"distribution\":\"" << options.distribution << "\""
+       << ",\"zipf_theta\":" << options.zipfTheta
+       << ",\"size\":" << options.size
+       << ",\"max_size\":" << options.maxSize
+       << ",\"seed\":" << options.seed
+       << "}";
+    os << ",\"seconds\":" << seconds;
+    os << ",\"completed\":" << stats.completed.load();
+    os << ",\"throughput\":"
+       << (seconds > 0 ? double(stats.completed.load()) / seconds : 0.0);
+    os << ",\"errors\":{";
+    for (auto it = stats.errorsByStatus.begin();
+         it != stats.errorsByStatus.end();
+         ++it) {
+        os << (it == stats.errorsByStatus.begin() ? "" : ",")
+           << "\"" << it->first << "\":" << it->second;
+    }
+    os << "}";
+    os << ",\"latency_nanos\":";
+    histogramToJSON(stats.latency, os);
+    os << ",\"service_time_nanos\":";
+    histogramToJSON(stats.serviceTime, os);
+    os << ",\"by_type\":{";
+    for (uint32_t i = 0; i < NUM_OP_TYPES; ++i) {
+        os << (i == 0 ? "" : ",")
+           << "\"" << opTypeNames[i] << "\":{\"completed\":"
+           << stats.completedByType[i].load()
+           << ",\"latency_nanos\":";
+        histogramToJSON(stats.latencyByType[i], os);
+        os << "}";
+    }
+    os << "}}" << std::endl;
+    return os.str();
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char** argv)
+{
+    try {
+
+        OptionParser options(argc, argv);
+        LogCabin::Client::Debug::setLogPolicy(
+            LogCabin::Client::Debug::logPolicyFromString(
+                options.logPolicy));
+
+        std::map<std::string, std::string> opts;
+        opts["tcpConnectTimeoutMilliseconds"] = "10000";
+        opts["tcpHeartbeatTimeoutMilliseconds"] = "5000";
+
+        Cluster cluster = Cluster(options.cluster, opts);
+        Tree tree = cluster.getTree();
+
+        // Create every key first, so that reads and conditions find them.
+        tree.makeDirectoryEx("/bench");
+        {
+            std::string value(options.size, 'v');
+            for (uint64_t key = 0; key < options.keys; ++key)
+                tree.writeEx(keyPath(key), value);
+        }
+
+        Stats stats;
+        std::atomic<bool> exit(false);
+        std::vector<std::thread> threads;
+        TimePoint start = Clock::now();
+        std::thread timer(timerThreadMain, options.timeout,
+                          std::ref(stats), std::ref(exit));
+        for (uint64_t i = 0; i < options.threads; ++i) {
+            threads.emplace_back(clientThreadMain, i, std::ref(options),
+                                 tree, start, std::ref(exit),
+                                 std::ref(stats));
+        }
+        for (uint64_t i = 0; i < options.threads; ++i)
+            threads.at(i).join();
+        TimePoint end = Clock::now();
+        exit = true;
+        timer.join();
+
+        for (uint64_t key = 0; key < options.keys; ++key)
+            tree.removeFile(keyPath(key));
+        tree.removeDirectory("/bench");
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        std::cerr << "Benchmark took "
+                  << seconds * 1e3
+                  << " ms to complete "
+                  << stats.completed.load()
+                  << " operations"
+                  << std::endl
+                  << "Latency (ns):"
+                  << std::endl
+                  << stats.latency;
+        if (!stats.errorsByStatus.empty()) {
+            std::cerr << "Errors:" << std::endl;
+            for (auto it = stats.errorsByStatus.begin();
+                 it != stats.errorsByStatus.end();
+                 ++it) {
+                std::cerr << it->first << ": " << it->second << std::endl;
+            }
+        }
+
+        if (!options.jsonPath.empty()) {
+            std::string json = resultsToJSON(options, stats, seconds);
+            if (options.jsonPath == "-") {
+                std::cout << json;
+            } else {
+                std::ofstream file(options.jsonPath.c_str());
+                file << json;
+                if (!file) {
+                    std::cerr << "Could not write "
+                              << options.jsonPath
+                              << std::endl;
+                    return 1;
+                }
+            }
+        }
+        return 0;
+
+    } catch (const LogCabin::Client::Exception& e) {
+        std::cerr << "Exiting due to LogCabin::Client::Exception: "
+                  << e.what()
+                  << std::endl;
+        exit(1);
+    }
+}
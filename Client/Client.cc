@@ -83,6 +83,7 @@ GetConfigurationResult::GetConfigurationResult()
     : status(OK)
     , configuration(0)
     , servers()
+    , learners()
     , error()
 {
 }
@@ -196,6 +197,8 @@ class TreeDetails {
         , workingDirectory(workingDirectory)
         , condition()
         , timeoutNanos(0)
+        , readConsistency(ReadConsistency::LINEARIZABLE)
+        , maxStalenessNanos(0)
     {
     }
     /**
@@ -215,6 +218,14 @@ class TreeDetails {
      * If nonzero, a relative timeout in nanoseconds for all Tree operations.
      */
     uint64_t timeoutNanos;
+    /**
+     * Which servers may answer read-only Tree operations.
+     */
+    ReadConsistency readConsistency;
+    /**
+     * Staleness bound in nanoseconds for BOUNDED_STALENESS reads.
+     */
+    uint64_t maxStalenessNanos;
 };
 
 
@@ -355,6 +366,31 @@ Tree::setTimeout(uint64_t nanoseconds)
     treeDetails = newTreeDetails;
 }
 
+ReadConsistency
+Tree::getReadConsistency() const
+{
+    std::shared_ptr<const TreeDetails> treeDetails = getTreeDetails();
+    return treeDetails->readConsistency;
+}
+
+uint64_t
+Tree::getMaxStaleness() const
+{
+    std::shared_ptr<const TreeDetails> treeDetails = getTreeDetails();
+    return treeDetails->maxStalenessNanos;
+}
+
+void
+Tree::setReadConsistency(ReadConsistency consistency,
+                         uint64_t maxStalenessNanos)
+{
+    std::lock_guard<std::mutex> lockGuard(mutex);
+    std::shared_ptr<TreeDetails> newTreeDetails(new TreeDetails(*treeDetails));
+    newTreeDetails->readConsistency = consistency;
+    newTreeDetails->maxStalenessNanos = maxStalenessNanos;
+    treeDetails = newTreeDetails;
+}
+
 Result
 Tree::makeDirectory(const std::string& path)
 {
@@ -381,6 +417,8 @@ Tree::listDirectory(const std::string& path,
         path,
         treeDetails->workingDirectory,
         treeDetails->condition,
+        treeDetails->readConsistency,
+        treeDetails->maxStalenessNanos,
         ClientImpl::absTimeout(treeDetails->timeoutNanos),
         children);
 }
@@ -436,6 +474,8 @@ Tree::read(const std::string& path, std::string& contents) const
         path,
         treeDetails->workingDirectory,
         treeDetails->condition,
+        treeDetails->readConsistency,
+        treeDetails->maxStalenessNanos,
         ClientImpl::absTimeout(treeDetails->timeoutNanos),
         contents);
 }
@@ -465,6 +505,24 @@ Tree::removeFileEx(const std::string& path)
     throwException(removeFile(path));
 }
 
+Result
+Tree::importDirectory(const std::string& path, const std::string& contents)
+{
+    std::shared_ptr<const TreeDetails> treeDetails = getTreeDetails();
+    return treeDetails->clientImpl->importDirectory(
+        path,
+        treeDetails->workingDirectory,
+        contents,
+        treeDetails->condition,
+        ClientImpl::absTimeout(treeDetails->timeoutNanos));
+}
+
+void
+Tree::importDirectoryEx(const std::string& path, const std::string& contents)
+{
+    throwException(importDirectory(path, contents));
+}
+
 std::shared_ptr<const TreeDetails>
 Tree::getTreeDetails() const
 {
@@ -565,7 +623,8 @@ Cluster::setConfiguration2(uint64_t oldId,
                            uint64_t timeoutNanoseconds)
 {
     return clientImpl->setConfiguration(
-        oldId, newConfiguration, ClientImpl::absTimeout(timeoutNanoseconds));
+        oldId, newConfiguration, false, Configuration(),
+        ClientImpl::absTimeout(timeoutNanoseconds));
 }
 
 ConfigurationResult
@@ -588,6 +647,17 @@ Cluster::setConfiguration2Ex(uint64_t oldId,
     return result;
 }
 
+ConfigurationResult
+Cluster::setConfiguration2(uint64_t oldId,
+                           const Configuration& newConfiguration,
+                           const Configuration& newLearners,
+                           uint64_t timeoutNanoseconds)
+{
+    return clientImpl->setConfiguration(
+        oldId, newConfiguration, true, newLearners,
+        ClientImpl::absTimeout(timeoutNanoseconds));
+}
+
 Result
 Cluster::getServerInfo(const std::string& host,
                        uint64_t timeoutNanoseconds,
@@ -103,61 +103,45 @@ setCondition(Message& request, const Condition& condition)
 void
 split(const std::string& path, std::vector<std::string>& components)
 {
-    std::string word;
-    for (auto it = path.begin(); it != path.end(); ++it) {
-        if (*it == '/') {
-            if (!word.empty()) {
-                components.push_back(word);
-                word.clear();
-            }
-        } else {
-            word += *it;
-        }
+    size_t start = 0;
+    while (start < path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+            end = path.size();
+        if (end > start)
+            components.emplace_back(path, start, end - start);
+        start = end + 1;
     }
-    if (!word.empty())
-        components.push_back(word);
 }
 
 /**
- * Wrapper around LeaderRPC::call() that repackages a timeout as a
- * ReadOnlyTree status and error message.
+ * Return true if the path is absolute and already in canonical form: no
+ * empty, "." or ".." components, and no trailing slash (unless it's "/").
+ * Helper for ClientImpl::canonicalize, which returns such paths as is
+ * without splitting them.
  */
-void
-treeCall(LeaderRPCBase& leaderRPC,
-         const Protocol::Client::ReadOnlyTree::Request& request,
-         Protocol::Client::ReadOnlyTree::Response& response,
-         ClientImpl::TimePoint timeout)
+bool
+isCanonical(const std::string& path)
 {
-    VERBOSE("Calling read-only tree query with request:\n%s",
-            Core::StringUtil::trim(
-                Core::ProtoBuf::dumpString(request)).c_str());
-    LeaderRPC::Status status;
-    Protocol::Client::StateMachineQuery::Request qrequest;
-    Protocol::Client::StateMachineQuery::Response qresponse;
-    *qrequest.mutable_tree() = request;
-    status = leaderRPC.call(Protocol::Client::OpCode::STATE_MACHINE_QUERY,
-                            qrequest, qresponse, timeout);
-    switch (status) {
-        case LeaderRPC::Status::OK:
-            response = *qresponse.mutable_tree();
-            VERBOSE("Reply to read-only tree query:\n%s",
-                    Core::StringUtil::trim(
-                        Core::ProtoBuf::dumpString(response)).c_str());
-            break;
-        case LeaderRPC::Status::TIMEOUT:
-            response.set_status(Protocol::Client::Status::TIMEOUT);
-            response.set_error("Client-specified timeout elapsed");
-            VERBOSE("Timeout elapsed on read-only tree query");
-            break;
-        case LeaderRPC::Status::INVALID_REQUEST:
-            // TODO(ongaro): Once any new Tree request types are introduced,
-            // this PANIC will need to move up the call stack, so that we can
-            // try a new-style request and then ask for forgiveness if it
-            // fails. Same for the read-write tree calls below.
-            PANIC("The server and/or replicated state machine doesn't support "
-                  "the read-only tree query or claims the request is "
-                  "malformed. Request is: %s",
-                  Core::ProtoBuf::dumpString(request).c_str());
+    if (path.empty() || path.at(0) != '/')
+        return false;
+    if (path.size() == 1)
+        return true;
+    size_t start = 1;
+    while (true) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+            end = path.size();
+        size_t length = end - start;
+        if (length == 0)
+            return false;
+        if (path.compare(start, length, ".") == 0 ||
+            path.compare(start, length, "..") == 0) {
+            return false;
+        }
+        if (end == path.size())
+            return true;
+        start = end + 1;
     }
 }
 
@@ -456,6 +440,8 @@ ClientImpl::ClientImpl(const std::map<std::string, std::string>& options)
                              100UL * 1000 * 1000) // 100 ms
     , hosts()
     , leaderRPC()             // set in init()
+    , readRPC()               // set in init()
+    , lastReadIndex(0)
     , exactlyOnceRPCHelper(this)
     , eventLoopThread()
 {
@@ -500,6 +486,13 @@ ClientImpl::initDerived()
             sessionCreationBackoff,
             sessionManager));
     }
+    if (!readRPC) {
+        readRPC.reset(new LeaderRPC(
+            RPC::Address(hosts, Protocol::Common::DEFAULT_PORT),
+            clusterUUID,
+            sessionCreationBackoff,
+            sessionManager));
+    }
 }
 
 GetConfigurationResult
@@ -516,6 +509,12 @@ ClientImpl::getConfiguration(TimePoint timeout)
          ++it) {
         configuration.push_back({it->server_id(), it->addresses()});
     }
+    Configuration learners;
+    for (auto it = response.learners().begin();
+         it != response.learners().end();
+         ++it) {
+        learners.push_back({it->server_id(), it->addresses()});
+    }
     GetConfigurationResult result;
     if (status == RPCStatus::TIMEOUT) {
         result.status = GetConfigurationResult::Status::TIMEOUT;
@@ -526,6 +525,7 @@ ClientImpl::getConfiguration(TimePoint timeout)
         result.status = GetConfigurationResult::Status::OK;
         result.configuration = response.id();
         result.servers = configuration;
+        result.learners = learners;
         return result;
     }
 }
@@ -533,6 +533,8 @@ ClientImpl::getConfiguration(TimePoint timeout)
 ConfigurationResult
 ClientImpl::setConfiguration(uint64_t oldId,
                              const Configuration& newConfiguration,
+                             bool replaceLearners,
+                             const Configuration& newLearners,
                              TimePoint timeout)
 {
     Protocol::Client::SetConfiguration::Request request;
@@ -544,6 +546,14 @@ ClientImpl::setConfiguration(uint64_t oldId,
         s->set_server_id(it->serverId);
         s->set_addresses(it->addresses);
     }
+    request.set_replace_learners(replaceLearners);
+    for (auto it = newLearners.begin();
+         it != newLearners.end();
+         ++it) {
+        Protocol::Client::Server* s = request.add_new_learners();
+        s->set_server_id(it->serverId);
+        s->set_addresses(it->addresses);
+    }
     Protocol::Client::SetConfiguration::Response response;
     typedef LeaderRPCBase::Status RPCStatus;
     RPCStatus status = leaderRPC->call(
@@ -647,6 +657,10 @@ ClientImpl::canonicalize(const std::string& path,
                          const std::string& workingDirectory,
                          std::string& canonical)
 {
+    if (isCanonical(path)) {
+        canonical = path;
+        return Result();
+    }
     canonical = "";
     std::vector<std::string> components;
     if (!path.empty() && *path.begin() != '/') {
@@ -726,6 +740,8 @@ Result
 ClientImpl::listDirectory(const std::string& path,
                           const std::string& workingDirectory,
                           const Condition& condition,
+                          ReadConsistency consistency,
+                          uint64_t maxStalenessNanos,
                           TimePoint timeout,
                           std::vector<std::string>& children)
 {
@@ -738,8 +754,8 @@ ClientImpl::listDirectory(const std::string& path,
     setCondition(request, condition);
     request.mutable_list_directory()->set_path(realPath);
     Protocol::Client::ReadOnlyTree::Response response;
-    treeCall(*leaderRPC,
-             request, response, timeout);
+    readOnlyTreeCall(request, consistency, maxStalenessNanos,
+                     timeout, response);
     if (response.status() != Protocol::Client::Status::OK)
         return treeError(response);
     children = std::vector<std::string>(
@@ -802,6 +818,8 @@ Result
 ClientImpl::read(const std::string& path,
                  const std::string& workingDirectory,
                  const Condition& condition,
+                 ReadConsistency consistency,
+                 uint64_t maxStalenessNanos,
                  TimePoint timeout,
                  std::string& contents)
 {
@@ -814,8 +832,8 @@ ClientImpl::read(const std::string& path,
     setCondition(request, condition);
     request.mutable_read()->set_path(realPath);
     Protocol::Client::ReadOnlyTree::Response response;
-    treeCall(*leaderRPC,
-             request, response, timeout);
+    readOnlyTreeCall(request, consistency, maxStalenessNanos,
+                     timeout, response);
     if (response.status() != Protocol::Client::Status::OK)
         return treeError(response);
     contents = response.read().contents();
@@ -846,6 +864,98 @@ ClientImpl::removeFile(const std::string& path,
     return Result();
 }
 
+Result
+ClientImpl::importDirectory(const std::string& path,
+                            const std::string& workingDirectory,
+                            const std::string& contents,
+                            const Condition& condition,
+                            TimePoint timeout)
+{
+    std::string realPath;
+    Result result = canonicalize(path, workingDirectory, realPath);
+    if (result.status != Status::OK)
+        return result;
+    Protocol::Client::ReadWriteTree::Request request;
+    *request.mutable_exactly_once() =
+        exactlyOnceRPCHelper.getRPCInfo(timeout);
+    setCondition(request, condition);
+    request.mutable_import_directory()->set_path(realPath);
+    request.mutable_import_directory()->set_contents(contents);
+    Protocol::Client::ReadWriteTree::Response response;
+    treeCall(*leaderRPC,
+             request, response, timeout);
+    exactlyOnceRPCHelper.doneWithRPC(request.exactly_once());
+    if (response.status() != Protocol::Client::Status::OK)
+        return treeError(response);
+    return Result();
+}
+
+void
+ClientImpl::readOnlyTreeCall(
+        const Protocol::Client::ReadOnlyTree::Request& request,
+        ReadConsistency consistency,
+        uint64_t maxStalenessNanos,
+        TimePoint timeout,
+        Protocol::Client::ReadOnlyTree::Response& response)
+{
+    VERBOSE("Calling read-only tree query with request:\n%s",
+            Core::StringUtil::trim(
+                Core::ProtoBuf::dumpString(request)).c_str());
+    Protocol::Client::StateMachineQuery::Request qrequest;
+    Protocol::Client::StateMachineQuery::Response qresponse;
+    *qrequest.mutable_tree() = request;
+    LeaderRPCBase* rpc = leaderRPC.get();
+    switch (consistency) {
+        case ReadConsistency::LINEARIZABLE:
+            break;
+        case ReadConsistency::BOUNDED_STALENESS:
+            qrequest.set_consistency(
+                Protocol::Client::ReadConsistency::BOUNDED_STALENESS);
+            qrequest.set_max_staleness_nanos(maxStalenessNanos);
+            break;
+        case ReadConsistency::ANY_REPLICA:
+            qrequest.set_consistency(
+                Protocol::Client::ReadConsistency::ANY_REPLICA);
+            break;
+    }
+    if (consistency != ReadConsistency::LINEARIZABLE && readRPC)
+        rpc = readRPC.get();
+    uint64_t minIndex = lastReadIndex.load();
+    if (minIndex > 0)
+        qrequest.set_min_index(minIndex);
+
+    LeaderRPCBase::Status status =
+        rpc->call(Protocol::Client::OpCode::STATE_MACHINE_QUERY,
+                  qrequest, qresponse, timeout);
+    switch (status) {
+        case LeaderRPCBase::Status::OK:
+            response = *qresponse.mutable_tree();
+            // Raise lastReadIndex to applied_index, unless another thread
+            // has already raised it further.
+            while (minIndex < qresponse.applied_index() &&
+                   !lastReadIndex.compare_exchange_weak(
+                        minIndex, qresponse.applied_index())) {
+            }
+            VERBOSE("Reply to read-only tree query:\n%s",
+                    Core::StringUtil::trim(
+                        Core::ProtoBuf::dumpString(response)).c_str());
+            break;
+        case LeaderRPCBase::Status::TIMEOUT:
+            response.set_status(Protocol::Client::Status::TIMEOUT);
+            response.set_error("Client-specified timeout elapsed");
+            VERBOSE("Timeout elapsed on read-only tree query");
+            break;
+        case LeaderRPCBase::Status::INVALID_REQUEST:
+            // With a weaker consistency level, this query may have gone to a
+            // follower rather than the leader, so the server rejecting it
+            // need not be the one that handles writes.
+            PANIC("The server and/or replicated state machine doesn't support "
+                  "the read-only tree query or claims the request is "
+                  "malformed. Request is: %s",
+                  Core::ProtoBuf::dumpString(request).c_str());
+    }
+}
+
 Result
 ClientImpl::serverControl(const std::string& host,
                           TimePoint timeout,
@@ -19,11 +19,13 @@
 #include <string>
 #include <thread>
 
+#include "build/Protocol/Client.pb.h"
 #include "build/Protocol/ServerControl.pb.h"
 #include "include/LogCabin/Client.h"
 #include "Client/Backoff.h"
 #include "Client/LeaderRPC.h"
 #include "Client/SessionManager.h"
+#include "Core/CompatAtomic.h"
 #include "Core/ConditionVariable.h"
 #include "Core/Config.h"
 #include "Core/Mutex.h"
@@ -90,6 +92,8 @@ class ClientImpl {
     ConfigurationResult setConfiguration(
                             uint64_t oldId,
                             const Configuration& newConfiguration,
+                            bool replaceLearners,
+                            const Configuration& newLearners,
                             TimePoint timeout);
 
     /// See Cluster::getServerInfo.
@@ -121,6 +125,8 @@ class ClientImpl {
     Result listDirectory(const std::string& path,
                          const std::string& workingDirectory,
                          const Condition& condition,
+                         ReadConsistency consistency,
+                         uint64_t maxStalenessNanos,
                          TimePoint timeout,
                          std::vector<std::string>& children);
 
@@ -141,6 +147,8 @@ class ClientImpl {
     Result read(const std::string& path,
                 const std::string& workingDirectory,
                 const Condition& condition,
+                ReadConsistency consistency,
+                uint64_t maxStalenessNanos,
                 TimePoint timeout,
                 std::string& contents);
 
@@ -150,6 +158,13 @@ class ClientImpl {
                       const Condition& condition,
                       TimePoint timeout);
 
+    /// See Tree::importDirectory.
+    Result importDirectory(const std::string& path,
+                           const std::string& workingDirectory,
+                           const std::string& contents,
+                           const Condition& condition,
+                           TimePoint timeout);
+
     /**
      * Low-level interface to ServerControl service used by
      * Client/ServerControl.cc.
@@ -162,6 +177,28 @@ class ClientImpl {
 
   protected:
 
+    /**
+     * Send a read-only tree query to the cluster and repackage a timeout as a
+     * ReadOnlyTree status and error message.
+     * \param request
+     *      The query.
+     * \param consistency
+     *      Which servers may answer the query. Non-linearizable queries are
+     *      sent through #readRPC.
+     * \param maxStalenessNanos
+     *      Staleness bound for BOUNDED_STALENESS queries.
+     * \param timeout
+     *      When to give up.
+     * \param[out] response
+     *      The query's result.
+     */
+    void readOnlyTreeCall(
+            const Protocol::Client::ReadOnlyTree::Request& request,
+            ReadConsistency consistency,
+            uint64_t maxStalenessNanos,
+            TimePoint timeout,
+            Protocol::Client::ReadOnlyTree::Response& response);
+
     /**
      * Options/settings.
      */
@@ -203,6 +240,21 @@ class ClientImpl {
      */
     std::unique_ptr<LeaderRPCBase> leaderRPC;
 
+    /**
+     * Used to send reads that need not be linearizable. This starts out
+     * talking to a random server, so that reads from many clients spread
+     * across the cluster; servers that are too stale redirect it to the
+     * leader. If NULL, #leaderRPC is used instead.
+     */
+    std::unique_ptr<LeaderRPCBase> readRPC;
+
+    /**
+     * The largest log index of any state machine state returned to a query so
+     * far. Sent along with future queries so that reads never go backwards
+     * in time, even as they move between servers.
+     */
+    std::atomic<uint64_t> lastReadIndex;
+
     /**
      * This class helps with providing exactly-once semantics for read-write
      * RPCs. For example, it assigns sequence numbers to RPCs, which servers
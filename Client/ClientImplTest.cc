@@ -338,6 +338,8 @@ TEST_F(ClientClientImplTest, listDirectory_timeout) {
         client.listDirectory("/",
                              "/",
                              Client::Condition {"", ""},
+                             Client::ReadConsistency::LINEARIZABLE,
+                             0,
                              TimePoint::min(),
                              children);
     EXPECT_EQ(Client::Status::TIMEOUT, result.status);
@@ -345,6 +347,65 @@ TEST_F(ClientClientImplTest, listDirectory_timeout) {
     EXPECT_EQ(std::vector<std::string> { }, children);
 }
 
+TEST_F(ClientClientImplTest, read_consistency) {
+    typedef Client::LeaderRPCMock::OpCode OpCode;
+    Client::LeaderRPCMock* leaderMock = new Client::LeaderRPCMock();
+    Client::LeaderRPCMock* readMock = new Client::LeaderRPCMock();
+    client.leaderRPC = std::unique_ptr<Client::LeaderRPCBase>(leaderMock);
+    client.readRPC = std::unique_ptr<Client::LeaderRPCBase>(readMock);
+    std::string contents;
+
+    readMock->expect(OpCode::STATE_MACHINE_QUERY,
+        fromString<Protocol::Client::StateMachineQuery::Response>(
+            "tree { status: OK, read { contents: 'a' } } "
+            "applied_index: 7"));
+    EXPECT_EQ(Client::Status::OK,
+              client.read("/foo", "/", Client::Condition {"", ""},
+                          Client::ReadConsistency::BOUNDED_STALENESS,
+                          1000,
+                          TimePoint::max(),
+                          contents).status);
+    EXPECT_EQ("a", contents);
+    EXPECT_EQ("tree { read { path: '/foo' } } "
+              "consistency: BOUNDED_STALENESS "
+              "max_staleness_nanos: 1000",
+              *readMock->popRequest());
+    EXPECT_EQ(7U, client.lastReadIndex);
+
+    // linearizable reads still go to the leader, and carry the index
+    leaderMock->expect(OpCode::STATE_MACHINE_QUERY,
+        fromString<Protocol::Client::StateMachineQuery::Response>(
+            "tree { status: OK, read { contents: 'b' } } "
+            "applied_index: 5"));
+    EXPECT_EQ(Client::Status::OK,
+              client.read("/foo", "/", Client::Condition {"", ""},
+                          Client::ReadConsistency::LINEARIZABLE,
+                          0,
+                          TimePoint::max(),
+                          contents).status);
+    EXPECT_EQ("b", contents);
+    EXPECT_EQ("tree { read { path: '/foo' } } "
+              "min_index: 7",
+              *leaderMock->popRequest());
+    EXPECT_EQ(7U, client.lastReadIndex);
+
+    readMock->expect(OpCode::STATE_MACHINE_QUERY,
+        fromString<Protocol::Client::StateMachineQuery::Response>(
+            "tree { status: OK, read { contents: 'c' } } "
+            "applied_index: 9"));
+    EXPECT_EQ(Client::Status::OK,
+              client.read("/foo", "/", Client::Condition {"", ""},
+                          Client::ReadConsistency::ANY_REPLICA,
+                          0,
+                          TimePoint::max(),
+                          contents).status);
+    EXPECT_EQ("tree { read { path: '/foo' } } "
+              "consistency: ANY_REPLICA "
+              "min_index: 7",
+              *readMock->popRequest());
+    EXPECT_EQ(9U, client.lastReadIndex);
+}
+
 TEST_F(ClientClientImplServiceMockTest, serverControl) {
     Protocol::ServerControl::ServerInfoGet::Request request;
     Protocol::ServerControl::ServerInfoGet::Response response;
@@ -474,6 +535,16 @@ TEST_F(ClientClientImplCanonicalizeTest, canonicalize)
     // leading or trailing slash, duplicate slashes
     EXPECT_OK(client.canonicalize("bar////baz//", "///", real));
     EXPECT_EQ("/bar/baz", real);
+
+    // absolute paths that aren't canonical
+    EXPECT_OK(client.canonicalize("/foo//bar/", "invalid", real));
+    EXPECT_EQ("/foo/bar", real);
+    EXPECT_OK(client.canonicalize("/foo/./bar/..", "invalid", real));
+    EXPECT_EQ("/foo", real);
+    EXPECT_OK(client.canonicalize("/.../..x", "invalid", real));
+    EXPECT_EQ("/.../..x", real);
+    EXPECT_OK(client.canonicalize("/", "invalid", real));
+    EXPECT_EQ("/", real);
 }
 
 
@@ -25,6 +25,7 @@
 #include "Core/StringUtil.h"
 #include "build/Protocol/Client.pb.h"
 #include "include/LogCabin/Client.h"
+#include "Tree/Tree.h"
 
 namespace LogCabin {
 namespace {
@@ -168,6 +169,24 @@ TEST_F(ClientTreeTest, setTimeout)
     EXPECT_EQ(0UL, tree.getTimeout());
 }
 
+TEST_F(ClientTreeTest, setReadConsistency)
+{
+    EXPECT_EQ(Client::ReadConsistency::LINEARIZABLE, tree.getReadConsistency());
+    EXPECT_EQ(0UL, tree.getMaxStaleness());
+    tree.setReadConsistency(Client::ReadConsistency::BOUNDED_STALENESS, 43UL);
+    EXPECT_EQ(Client::ReadConsistency::BOUNDED_STALENESS,
+              tree.getReadConsistency());
+    EXPECT_EQ(43UL, tree.getMaxStaleness());
+    Client::Tree tree2 = tree;
+    EXPECT_EQ(Client::ReadConsistency::BOUNDED_STALENESS,
+              tree2.getReadConsistency());
+    // reads are served by the mock regardless of the consistency level
+    EXPECT_OK(tree.write("/foo", "bar"));
+    EXPECT_EQ("bar", tree.readEx("/foo"));
+    tree.setReadConsistency(Client::ReadConsistency::LINEARIZABLE, 0UL);
+    EXPECT_EQ(Client::ReadConsistency::LINEARIZABLE, tree.getReadConsistency());
+}
+
 TEST_F(ClientTreeTest, makeDirectory)
 {
     EXPECT_OK(tree.makeDirectory("/foo"));
@@ -239,6 +258,29 @@ TEST_F(ClientTreeTest, removeFile)
               children);
 }
 
+TEST_F(ClientTreeTest, importDirectory)
+{
+    LogCabin::Tree::Tree source;
+    source.makeDirectory("/x/y");
+    source.write("/x/y/z", "zz");
+    source.write("/x/w", "ww");
+    std::string contents;
+    EXPECT_EQ(LogCabin::Tree::Status::OK,
+              source.exportDirectory("/x", contents).status);
+
+    EXPECT_EQ(Status::INVALID_ARGUMENT,
+              tree.importDirectory("/..", contents).status);
+    EXPECT_EQ(Status::INVALID_ARGUMENT,
+              tree.importDirectory("/a", "garbage").status);
+    EXPECT_OK(tree.makeDirectory("/a/old"));
+    EXPECT_OK(tree.importDirectory("/a", contents));
+    std::vector<std::string> children;
+    EXPECT_OK(tree.listDirectory("/a", children));
+    EXPECT_EQ((std::vector<std::string>{"y/", "w"}),
+              children);
+    EXPECT_EQ("zz", tree.readEx("/a/y/z"));
+}
+
 TEST_F(ClientTreeTest, conditions)
 {
     tree.setCondition("/a", "c");
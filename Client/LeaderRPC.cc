@@ -75,6 +75,7 @@ operator<<(std::ostream& os, const LeaderRPCBase::Call::Status& status)
 
 LeaderRPC::Call::Call(LeaderRPC& leaderRPC)
     : leaderRPC(leaderRPC)
+    , overloadBackoff(1, 0)
     , cachedSession()
     , rpc()
 {
@@ -89,11 +90,14 @@ LeaderRPC::Call::start(OpCode opCode,
                        const google::protobuf::Message& request,
                        TimePoint timeout)
 {
+    // Hold off if the leader recently said it was overloaded.
+    overloadBackoff.delayAndBegin(timeout);
     // Save a reference to the leaderSession
     cachedSession = leaderRPC.getSession(timeout);
+    // Version 2 errors include OVERLOADED.
     rpc = RPC::ClientRPC(cachedSession,
                          Protocol::Common::ServiceId::CLIENT_SERVICE,
-                         1,
+                         2,
                          opCode,
                          request);
 }
@@ -116,6 +120,7 @@ LeaderRPC::Call::wait(google::protobuf::Message& response,
     // Decode the response
     switch (status) {
         case RPCStatus::OK:
+            overloadBackoff.noteSuccess();
             leaderRPC.reportSuccess(cachedSession);
             return Call::Status::OK;
         case RPCStatus::SERVICE_SPECIFIC_ERROR:
@@ -129,6 +134,11 @@ LeaderRPC::Call::wait(google::protobuf::Message& response,
                         leaderRPC.reportNotLeader(cachedSession);
                     }
                     break;
+                case Protocol::Client::Error::OVERLOADED:
+                    // The leader is shedding load and did not start the
+                    // operation. Stick with it, but retry after a delay.
+                    overloadBackoff.noteOverloaded();
+                    break;
                 default:
                     // Hmm, we don't know what this server is trying to tell
                     // us, but something is wrong. The server shouldn't reply
@@ -189,8 +199,9 @@ LeaderRPC::call(OpCode opCode,
                 google::protobuf::Message& response,
                 TimePoint timeout)
 {
+    // The same Call is restarted on each retry, so that it can back off.
+    Call c(*this);
     while (true) {
-        Call c(*this);
         c.start(opCode, request, timeout);
 
         // we should not wait ! cause ix runs to completion
@@ -20,6 +20,7 @@
 #include <mutex>
 
 #include "build/Protocol/Client.pb.h"
+#include "Client/Backoff.h"
 #include "Client/SessionManager.h"
 #include "Core/ConditionVariable.h"
 #include "RPC/Address.h"
@@ -267,6 +268,13 @@ class LeaderRPC : public LeaderRPCBase {
         Status wait(google::protobuf::Message& response,
                     TimePoint timeout);
         LeaderRPC& leaderRPC;
+        /**
+         * Delays restarting this call after the leader reports that it is
+         * overloaded. This is kept per call, rather than shared by every
+         * caller of the LeaderRPC, so that one caller's success doesn't cut
+         * short another's backoff.
+         */
+        Backoff overloadBackoff;
         /**
          * Copy of leaderSession when the RPC was started (might have changed
          * since).
@@ -235,6 +235,33 @@ TEST_F(ClientLeaderRPCTest, Call_wait_notLeader) {
     EXPECT_EQ(expResponse, response);
 }
 
+TEST_F(ClientLeaderRPCTest, Call_wait_overloaded) {
+    init();
+    Protocol::Client::Error error;
+    error.set_error_code(Protocol::Client::Error::OVERLOADED);
+    service->serviceSpecificError(OpCode::STATE_MACHINE_QUERY, request, error);
+    service->reply(OpCode::STATE_MACHINE_QUERY, request, expResponse);
+
+    std::unique_ptr<LeaderRPCBase::Call> call = leaderRPC->makeCall();
+    call->start(OpCode::STATE_MACHINE_QUERY, request, TimePoint::max());
+    EXPECT_EQ(LeaderRPCBase::Call::Status::RETRY,
+              call->wait(response, TimePoint::max()));
+    // sticks with the same leader, but this call backs off
+    EXPECT_TRUE(leaderRPC->leaderSession.get());
+    LeaderRPC::Call& leaderCall = dynamic_cast<LeaderRPC::Call&>(*call);
+    EXPECT_LT(0, leaderCall.overloadBackoff.overloadDelay.count());
+    // other calls don't
+    std::unique_ptr<LeaderRPCBase::Call> call2 = leaderRPC->makeCall();
+    EXPECT_EQ(0, dynamic_cast<LeaderRPC::Call&>(*call2).
+                    overloadBackoff.overloadDelay.count());
+
+    call->start(OpCode::STATE_MACHINE_QUERY, request, TimePoint::max());
+    EXPECT_EQ(LeaderRPCBase::Call::Status::OK,
+              call->wait(response, TimePoint::max()));
+    EXPECT_EQ(expResponse, response);
+    EXPECT_EQ(0, leaderCall.overloadBackoff.overloadDelay.count());
+}
+
 TEST_F(ClientLeaderRPCTest, Call_wait_timeout) {
     std::unique_ptr<LeaderRPCBase::Call> call = leaderRPC->makeCall();
     call->start(OpCode::STATE_MACHINE_QUERY, request, TimePoint::max());
@@ -14,6 +14,7 @@
  */
 
 #include <cassert>
+#include <cstdlib>
 #include <getopt.h>
 #include <iostream>
 #include <string>
@@ -182,6 +183,14 @@ class OptionParser {
             << "Rotate the server's debug log file."
             << std::endl
 
+            << ospace("leadership transfer [<id>]")
+            << "Hand off leadership from this server (which"
+            << std::endl << space
+            << "must be the leader) to the server with the"
+            << std::endl << space
+            << "given ID [default: most up-to-date server]."
+            << std::endl
+
             << ospace("snapshot inhibit get")
             << "Print the remaining time for which the server"
             << std::endl << space
@@ -227,6 +236,14 @@ class OptionParser {
             << std::endl << space
             << "log."
             << std::endl
+
+            << ospace("stats trace")
+            << "Print the server's recently sampled client"
+            << std::endl << space
+            << "writes in Chrome's trace event JSON format,"
+            << std::endl << space
+            << "for viewing in chrome://tracing."
+            << std::endl
             << std::endl;
 
         std::cout << "Options:" << std::endl;
@@ -322,9 +339,11 @@ class ServerControl {
     DEFINE_RPC(DebugPolicyGet,         DEBUG_POLICY_GET)
     DEFINE_RPC(DebugPolicySet,         DEBUG_POLICY_SET)
     DEFINE_RPC(DebugRotate,            DEBUG_ROTATE)
+    DEFINE_RPC(LeadershipTransfer,     LEADERSHIP_TRANSFER)
     DEFINE_RPC(ServerInfoGet,          SERVER_INFO_GET)
     DEFINE_RPC(ServerStatsDump,        SERVER_STATS_DUMP)
     DEFINE_RPC(ServerStatsGet,         SERVER_STATS_GET)
+    DEFINE_RPC(ServerStatsTraceGet,    SERVER_STATS_TRACE_GET)
     DEFINE_RPC(SnapshotControl,        SNAPSHOT_CONTROL)
     DEFINE_RPC(SnapshotInhibitGet,     SNAPSHOT_INHIBIT_GET)
     DEFINE_RPC(SnapshotInhibitSet,     SNAPSHOT_INHIBIT_SET)
@@ -419,6 +438,23 @@ main(int argc, char** argv)
                     error(response.error());
                 return 0;
             }
+        } else if (options.at(0) == "leadership") {
+            if (options.at(1) == "transfer") {
+                Proto::LeadershipTransfer::Request request;
+                std::string id = options.remaining(2);
+                if (!id.empty()) {
+                    char* end = NULL;
+                    uint64_t serverId = strtoull(id.c_str(), &end, 10);
+                    if (*end != '\0' || serverId == 0)
+                        options.usageError("Invalid server ID: " + id);
+                    request.set_server_id(serverId);
+                }
+                Proto::LeadershipTransfer::Response response;
+                server.LeadershipTransfer(request, response);
+                if (response.has_error())
+                    error(response.error());
+                return 0;
+            }
         } else if (options.at(0) == "snapshot") {
             using Proto::SnapshotCommand;
             if (options.at(1) == "start") {
@@ -478,6 +514,13 @@ main(int argc, char** argv)
                 Proto::ServerStatsDump::Response response;
                 server.ServerStatsDump(request, response);
                 return 0;
+            } else if (options.at(1) == "trace") {
+                options.done();
+                Proto::ServerStatsTraceGet::Request request;
+                Proto::ServerStatsTraceGet::Response response;
+                server.ServerStatsTraceGet(request, response);
+                std::cout << response.chrome_trace();
+                return 0;
             }
         }
         options.usageError("Unknown command");
@@ -0,0 +1,440 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "Core/Buffer.h"
+#include "Core/Compression.h"
+#include "Core/Debug.h"
+#include "Core/Endian.h"
+#include "Core/StringUtil.h"
+
+namespace LogCabin {
+namespace Core {
+namespace Compression {
+
+using Core::StringUtil::format;
+
+namespace {
+
+/// Matches shorter than this are not worth encoding.
+const uint64_t MIN_MATCH = 4;
+/// The LZ4 block format requires the last 5 bytes to be literals.
+const uint64_t LAST_LITERALS = 5;
+/// The LZ4 block format requires the last match to start this far from the
+/// end of the block.
+const uint64_t MF_LIMIT = 12;
+/// Matches can refer back at most this many bytes.
+const uint64_t MAX_OFFSET = 65535;
+/// log2 of the number of entries in the match-finding hash table.
+const uint32_t HASH_LOG = 14;
+/// Marks an empty slot in the hash table.
+const uint32_t NO_POSITION = ~0U;
+
+/// Set in the stored length field of a block header if the block's bytes
+/// are stored uncompressed.
+const uint32_t STORED_RAW = 1U << 31;
+
+uint32_t
+read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t
+hash(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/**
+ * Append the bytes that extend a length beyond its 4-bit token field.
+ */
+void
+writeExtraLength(std::string& out, uint64_t length)
+{
+    while (length >= 255) {
+        out.push_back(char(255));
+        length -= 255;
+    }
+    out.push_back(char(length));
+}
+
+/**
+ * Append one sequence (literals followed by a match) to 'out'.
+ * \param matchLength
+ *      Zero for the final sequence, which has no match.
+ */
+void
+writeSequence(std::string& out,
+              const uint8_t* literals, uint64_t numLiterals,
+              uint64_t offset, uint64_t matchLength)
+{
+    uint64_t matchCode = matchLength == 0 ? 0 : matchLength - MIN_MATCH;
+    uint8_t token = uint8_t((std::min<uint64_t>(numLiterals, 15) << 4) |
+                            std::min<uint64_t>(matchCode, 15));
+    out.push_back(char(token));
+    if (numLiterals >= 15)
+        writeExtraLength(out, numLiterals - 15);
+    out.append(reinterpret_cast<const char*>(literals), numLiterals);
+    if (matchLength == 0)
+        return;
+    out.push_back(char(offset & 0xff));
+    out.push_back(char(offset >> 8));
+    if (matchCode >= 15)
+        writeExtraLength(out, matchCode - 15);
+}
+
+/**
+ * Read the bytes that extend a length beyond its 4-bit token field.
+ * \return
+ *      False if the input ran out.
+ */
+bool
+readExtraLength(const uint8_t* in, uint64_t inLength, uint64_t& pos,
+                uint64_t& length)
+{
+    uint8_t b;
+    do {
+        if (pos >= inLength)
+            return false;
+        b = in[pos];
+        ++pos;
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+} // namespace LogCabin::Core::Compression::<anonymous>
+
+std::string
+compress(const void* data, uint64_t length)
+{
+    assert(length < STORED_RAW);
+    const uint8_t* in = static_cast<const uint8_t*>(data);
+    std::string out;
+    out.reserve(length / 2 + 16);
+    uint64_t anchor = 0; // start of pending literals
+    uint64_t pos = 0;
+
+    if (length > MF_LIMIT) {
+        std::vector<uint32_t> table(1U << HASH_LOG, NO_POSITION);
+        const uint64_t matchStartLimit = length - MF_LIMIT;
+        const uint64_t matchEndLimit = length - LAST_LITERALS;
+        while (pos < matchStartLimit) {
+            uint32_t sequence = read32(in + pos);
+            uint32_t& slot = table[hash(sequence)];
+            uint64_t candidate = slot;
+            slot = uint32_t(pos);
+            if (candidate == NO_POSITION ||
+                pos - candidate > MAX_OFFSET ||
+                read32(in + candidate) != sequence) {
+                ++pos;
+                continue;
+            }
+            // extend the match forwards, then backwards over the literals
+            uint64_t matchEnd = pos + MIN_MATCH;
+            while (matchEnd < matchEndLimit &&
+                   in[matchEnd] == in[candidate + (matchEnd - pos)]) {
+                ++matchEnd;
+            }
+            while (pos > anchor && candidate > 0 &&
+                   in[pos - 1] == in[candidate - 1]) {
+                --pos;
+                --candidate;
+            }
+            writeSequence(out, in + anchor, pos - anchor,
+                          pos - candidate, matchEnd - pos);
+            pos = matchEnd;
+            anchor = pos;
+        }
+    }
+    writeSequence(out, in + anchor, length - anchor, 0, 0);
+    return out;
+}
+
+bool
+decompress(const void* data, uint64_t length,
+           void* output, uint64_t outputLength)
+{
+    const uint8_t* in = static_cast<const uint8_t*>(data);
+    uint8_t* out = static_cast<uint8_t*>(output);
+    uint64_t ip = 0;
+    uint64_t op = 0;
+    while (true) {
+        if (ip >= length)
+            return false;
+        uint8_t token = in[ip];
+        ++ip;
+
+        uint64_t numLiterals = token >> 4;
+        if (numLiterals == 15 &&
+            !readExtraLength(in, length, ip, numLiterals)) {
+            return false;
+        }
+        if (numLiterals > length - ip || numLiterals > outputLength - op)
+            return false;
+        memcpy(out + op, in + ip, numLiterals);
+        ip += numLiterals;
+        op += numLiterals;
+        if (ip == length) // the final sequence has no match
+            break;
+
+        if (length - ip < 2)
+            return false;
+        uint64_t offset = uint64_t(in[ip]) | (uint64_t(in[ip + 1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return false;
+        uint64_t matchLength = token & 15;
+        if (matchLength == 15 &&
+            !readExtraLength(in, length, ip, matchLength)) {
+            return false;
+        }
+        matchLength += MIN_MATCH;
+        if (matchLength > outputLength - op)
+            return false;
+        // byte-at-a-time, since the match may overlap the bytes it produces
+        for (uint64_t i = 0; i < matchLength; ++i)
+            out[op + i] = out[op - offset + i];
+        op += matchLength;
+    }
+    return op == outputLength;
+}
+
+////////// CompressedOutputStream //////////
+
+CompressedOutputStream::CompressedOutputStream(ProtoBuf::OutputStream& stream,
+                                               uint32_t blockSize)
+    : stream(stream)
+    , blockSize(blockSize)
+    , buffer()
+    , bytesWritten(0)
+    , finished(false)
+{
+    assert(blockSize > 0 && blockSize <= MAX_BLOCK_SIZE);
+    buffer.reserve(blockSize);
+}
+
+CompressedOutputStream::~CompressedOutputStream()
+{
+}
+
+void
+CompressedOutputStream::finish()
+{
+    assert(!finished);
+    flushBlock();
+    uint32_t endMarker[2] = {0, 0};
+    stream.writeRaw(endMarker, sizeof(endMarker));
+    finished = true;
+}
+
+uint64_t
+CompressedOutputStream::getBytesWritten() const
+{
+    return bytesWritten;
+}
+
+void
+CompressedOutputStream::writeMessage(const google::protobuf::Message& message)
+{
+    Core::Buffer buf;
+    ProtoBuf::serialize(message, buf);
+    uint32_t beSize = htobe32(uint32_t(buf.getLength()));
+    writeRaw(&beSize, sizeof(beSize));
+    writeRaw(buf.getData(), buf.getLength());
+}
+
+void
+CompressedOutputStream::writeRaw(const void* data, uint64_t length)
+{
+    assert(!finished);
+    const char* p = static_cast<const char*>(data);
+    bytesWritten += length;
+    while (length > 0) {
+        uint64_t n = std::min<uint64_t>(length, blockSize - buffer.size());
+        buffer.append(p, n);
+        p += n;
+        length -= n;
+        if (buffer.size() == blockSize)
+            flushBlock();
+    }
+}
+
+void
+CompressedOutputStream::flushBlock()
+{
+    if (buffer.empty())
+        return;
+    std::string compressed = compress(buffer.data(), buffer.size());
+    uint32_t header[2];
+    header[0] = htobe32(uint32_t(buffer.size()));
+    if (compressed.size() < buffer.size()) {
+        header[1] = htobe32(uint32_t(compressed.size()));
+        stream.writeRaw(header, sizeof(header));
+        stream.writeRaw(compressed.data(), compressed.size());
+    } else {
+        header[1] = htobe32(uint32_t(buffer.size()) | STORED_RAW);
+        stream.writeRaw(header, sizeof(header));
+        stream.writeRaw(buffer.data(), buffer.size());
+    }
+    buffer.clear();
+}
+
+////////// CompressedInputStream //////////
+
+CompressedInputStream::CompressedInputStream(ProtoBuf::InputStream& stream)
+    : stream(stream)
+    , block()
+    , blockOffset(0)
+    , bytesRead(0)
+    , atEnd(false)
+{
+}
+
+CompressedInputStream::~CompressedInputStream()
+{
+}
+
+uint64_t
+CompressedInputStream::getBytesRead() const
+{
+    return bytesRead;
+}
+
+std::string
+CompressedInputStream::readMessage(google::protobuf::Message& message)
+{
+    uint32_t length = 0;
+    uint64_t r = readRaw(&length, sizeof(length));
+    if (r < sizeof(length)) {
+        return format("Could only read %lu bytes of %lu-byte length field "
+                      "(at uncompressed offset %lu)",
+                      r,
+                      sizeof(length),
+                      bytesRead - r);
+    }
+    length = be32toh(length);
+    // The length hasn't been checked against anything yet, so grow the
+    // buffer as the bytes actually arrive rather than trusting it up front.
+    std::string contents;
+    while (contents.size() < length) {
+        uint64_t offset = contents.size();
+        uint64_t chunk = std::min<uint64_t>(length - offset,
+                                            DEFAULT_BLOCK_SIZE);
+        contents.resize(offset + chunk);
+        r = readRaw(&contents[offset], chunk);
+        if (r < chunk) {
+            r += offset;
+            return format("ProtoBuf is %u bytes long but only %lu bytes "
+                          "remain (at uncompressed offset %lu)",
+                          length,
+                          r,
+                          bytesRead - r);
+        }
+    }
+    const Core::Buffer buf(&contents[0], length, NULL);
+    if (!ProtoBuf::parse(buf, message)) {
+        return format("Could not parse ProtoBuf at uncompressed bytes "
+                      "%lu-%lu (inclusive)",
+                      bytesRead - length,
+                      bytesRead - 1);
+    }
+    return "";
+}
+
+uint64_t
+CompressedInputStream::readRaw(void* data, uint64_t length)
+{
+    char* p = static_cast<char*>(data);
+    uint64_t total = 0;
+    while (total < length) {
+        if (blockOffset == block.size() && !nextBlock())
+            break;
+        uint64_t n = std::min<uint64_t>(length - total,
+                                        block.size() - blockOffset);
+        memcpy(p + total, block.data() + blockOffset, n);
+        blockOffset += n;
+        total += n;
+    }
+    bytesRead += total;
+    return total;
+}
+
+bool
+CompressedInputStream::nextBlock()
+{
+    block.clear();
+    blockOffset = 0;
+    if (atEnd)
+        return false;
+    uint32_t header[2];
+    uint64_t r = stream.readRaw(header, sizeof(header));
+    if (r < sizeof(header)) {
+        WARNING("Compressed stream ended without an end marker");
+        atEnd = true;
+        return false;
+    }
+    uint32_t rawLength = be32toh(header[0]);
+    uint32_t storedLength = be32toh(header[1]);
+    if (rawLength == 0) {
+        atEnd = true;
+        return false;
+    }
+    bool storedRaw = (storedLength & STORED_RAW) != 0;
+    storedLength &= ~STORED_RAW;
+    // Check the lengths before allocating anything: they come from the
+    // stream, which may be corrupt. Blocks are only compressed if that makes
+    // them smaller.
+    if (rawLength > MAX_BLOCK_SIZE) {
+        PANIC("Compressed block claims to hold %u bytes, more than the "
+              "maximum block size of %u bytes",
+              rawLength, uint32_t(MAX_BLOCK_SIZE));
+    }
+    if (storedLength > rawLength) {
+        PANIC("Compressed block is %u bytes long, more than the %u bytes it "
+              "claims to decompress to",
+              storedLength, rawLength);
+    }
+
+    std::string stored(storedLength, '\0');
+    r = stream.readRaw(&stored[0], storedLength);
+    if (r < storedLength) {
+        PANIC("Compressed block is %u bytes long but only %lu bytes remain",
+              storedLength, r);
+    }
+    if (storedRaw) {
+        if (storedLength != rawLength) {
+            PANIC("Uncompressed block has length %u but claims %u",
+                  storedLength, rawLength);
+        }
+        block.swap(stored);
+    } else {
+        block.resize(rawLength);
+        if (!decompress(stored.data(), storedLength, &block[0], rawLength))
+            PANIC("Compressed block is corrupt");
+    }
+    return true;
+}
+
+} // namespace LogCabin::Core::Compression
+} // namespace LogCabin::Core
+} // namespace LogCabin
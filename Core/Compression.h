@@ -0,0 +1,174 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cinttypes>
+#include <string>
+
+#include "Core/ProtoBuf.h"
+
+#ifndef LOGCABIN_CORE_COMPRESSION_H
+#define LOGCABIN_CORE_COMPRESSION_H
+
+namespace LogCabin {
+namespace Core {
+
+/**
+ * Fast, dependency-free block compression, plus ProtoBuf streams that
+ * compress everything that passes through them. Blocks are encoded in the
+ * LZ4 block format; matches are found with a single-probe hash table, which
+ * trades some compression ratio for speed.
+ */
+namespace Compression {
+
+/**
+ * Compress a block of data.
+ * \param data
+ *      The bytes to compress.
+ * \param length
+ *      The number of bytes in 'data'. Must be less than 2GB.
+ * \return
+ *      The compressed block, which may be slightly larger than the input if
+ *      the input is not compressible.
+ */
+std::string compress(const void* data, uint64_t length);
+
+/**
+ * Decompress a block of data that was produced by compress().
+ * \param data
+ *      The compressed block.
+ * \param length
+ *      The number of bytes in 'data'.
+ * \param[out] output
+ *      Where to place the decompressed bytes.
+ * \param outputLength
+ *      The exact number of bytes that the block decompresses to.
+ * \return
+ *      True if successful; false if the block is malformed or does not
+ *      decompress to exactly outputLength bytes.
+ */
+bool decompress(const void* data, uint64_t length,
+                void* output, uint64_t outputLength);
+
+/**
+ * Default number of uncompressed bytes per block in CompressedOutputStream.
+ */
+enum { DEFAULT_BLOCK_SIZE = 256 * 1024 };
+
+/**
+ * Largest number of uncompressed bytes per block that CompressedOutputStream
+ * may be configured to write. CompressedInputStream rejects longer blocks
+ * before allocating memory for them, since the lengths come from the stream.
+ */
+enum { MAX_BLOCK_SIZE = 16 * 1024 * 1024 };
+
+/**
+ * An OutputStream that buffers what is written to it, then compresses it one
+ * block at a time into another OutputStream. Each block is preceded by an
+ * 8-byte header giving its uncompressed and stored lengths; blocks that do
+ * not compress are stored as is. The caller must call finish() once done
+ * writing.
+ */
+class CompressedOutputStream : public ProtoBuf::OutputStream {
+  public:
+    /**
+     * Constructor.
+     * \param stream
+     *      Compressed blocks are written here. This must remain valid for the
+     *      lifetime of this object.
+     * \param blockSize
+     *      The number of uncompressed bytes to accumulate before compressing
+     *      a block. At most MAX_BLOCK_SIZE.
+     */
+    explicit CompressedOutputStream(ProtoBuf::OutputStream& stream,
+                                    uint32_t blockSize = DEFAULT_BLOCK_SIZE);
+    /// Destructor.
+    ~CompressedOutputStream();
+    /**
+     * Compress and write any buffered bytes, followed by an end marker.
+     * Nothing may be written to this stream afterwards.
+     */
+    void finish();
+    // See ProtoBuf::OutputStream. This counts uncompressed bytes.
+    uint64_t getBytesWritten() const;
+    // See ProtoBuf::OutputStream.
+    void writeMessage(const google::protobuf::Message& message);
+    // See ProtoBuf::OutputStream.
+    void writeRaw(const void* data, uint64_t length);
+  private:
+    /**
+     * Compress and write out #buffer as one block (if it's not empty).
+     */
+    void flushBlock();
+    /// See constructor.
+    ProtoBuf::OutputStream& stream;
+    /// See constructor.
+    const uint32_t blockSize;
+    /// Uncompressed bytes that have not yet been written out.
+    std::string buffer;
+    /// The number of uncompressed bytes written to this stream.
+    uint64_t bytesWritten;
+    /// Set once finish() has been called.
+    bool finished;
+};
+
+/**
+ * An InputStream that decompresses blocks written by CompressedOutputStream
+ * from another InputStream.
+ */
+class CompressedInputStream : public ProtoBuf::InputStream {
+  public:
+    /**
+     * Constructor.
+     * \param stream
+     *      Compressed blocks are read from here. This must remain valid for
+     *      the lifetime of this object.
+     */
+    explicit CompressedInputStream(ProtoBuf::InputStream& stream);
+    /// Destructor.
+    ~CompressedInputStream();
+    // See ProtoBuf::InputStream. This counts uncompressed bytes.
+    uint64_t getBytesRead() const;
+    // See ProtoBuf::InputStream.
+    std::string readMessage(google::protobuf::Message& message);
+    /**
+     * See ProtoBuf::InputStream. This PANICs if a corrupt block is
+     * encountered.
+     */
+    uint64_t readRaw(void* data, uint64_t length);
+  private:
+    /**
+     * Read and decompress the next block into #block.
+     * \return
+     *      False if the end marker was reached (or the underlying stream
+     *      ended), true otherwise.
+     */
+    bool nextBlock();
+    /// See constructor.
+    ProtoBuf::InputStream& stream;
+    /// The uncompressed contents of the current block.
+    std::string block;
+    /// The number of bytes of #block that have been read.
+    uint64_t blockOffset;
+    /// The number of uncompressed bytes read from this stream.
+    uint64_t bytesRead;
+    /// Set once the end marker has been read.
+    bool atEnd;
+};
+
+} // namespace LogCabin::Core::Compression
+} // namespace LogCabin::Core
+} // namespace LogCabin
+
+#endif /* LOGCABIN_CORE_COMPRESSION_H */
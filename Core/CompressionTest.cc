@@ -0,0 +1,181 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <endian.h>
+#include <gtest/gtest.h>
+
+#include "build/Core/ProtoBufTest.pb.h"
+#include "Core/Compression.h"
+#include "Core/Random.h"
+#include "Core/StringUtil.h"
+
+namespace LogCabin {
+namespace Core {
+namespace {
+
+using namespace Compression; // NOLINT
+
+std::string
+roundTrip(const std::string& input)
+{
+    std::string compressed = compress(input.data(), input.size());
+    std::string output(input.size(), '\0');
+    EXPECT_TRUE(decompress(compressed.data(), compressed.size(),
+                           &output[0], output.size()));
+    return output;
+}
+
+std::string
+randomBytes(uint64_t length)
+{
+    std::string s;
+    for (uint64_t i = 0; i < length; ++i)
+        s.push_back(char(Random::random8()));
+    return s;
+}
+
+TEST(CoreCompressionTest, compress) {
+    EXPECT_EQ("", roundTrip(""));
+    EXPECT_EQ("a", roundTrip("a"));
+    EXPECT_EQ("abcdefghijklmn", roundTrip("abcdefghijklmn"));
+
+    std::string json;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        json += StringUtil::format("{\"id\": %u, \"name\": \"server%u\", "
+                                   "\"status\": \"ok\"}\n", i, i % 7);
+    }
+    EXPECT_EQ(json, roundTrip(json));
+    EXPECT_GT(json.size() / 4,
+              compress(json.data(), json.size()).size());
+
+    // long runs exercise overlapping matches and extra length bytes
+    std::string run(100000, 'x');
+    EXPECT_EQ(run, roundTrip(run));
+    EXPECT_GT(1000U, compress(run.data(), run.size()).size());
+
+    std::string noise = randomBytes(10000);
+    EXPECT_EQ(noise, roundTrip(noise));
+}
+
+TEST(CoreCompressionTest, decompress_corrupt) {
+    std::string input(1000, 'x');
+    std::string compressed = compress(input.data(), input.size());
+    std::string output(input.size(), '\0');
+    // wrong output length
+    EXPECT_FALSE(decompress(compressed.data(), compressed.size(),
+                            &output[0], output.size() - 1));
+    // truncated input
+    EXPECT_FALSE(decompress(compressed.data(), compressed.size() - 1,
+                            &output[0], output.size()));
+    EXPECT_FALSE(decompress(compressed.data(), 0,
+                            &output[0], output.size()));
+    // match offset before the start of the output
+    std::string bad("\x10" "a" "\x05\x00", 4);
+    EXPECT_FALSE(decompress(bad.data(), bad.size(),
+                            &output[0], 5));
+}
+
+TEST(CoreCompressionTest, streams) {
+    LogCabin::ProtoBuf::TestMessage m;
+    m.set_field_a(3);
+    m.set_field_b(5);
+    std::string text(3000, 'y');
+    std::string noise = randomBytes(100);
+
+    std::string bytes;
+    {
+        ProtoBuf::StringOutputStream underlying(bytes);
+        CompressedOutputStream out(underlying, 1024);
+        out.writeMessage(m);
+        out.writeRaw(text.data(), text.size());
+        out.writeRaw(noise.data(), noise.size());
+        out.writeMessage(m);
+        EXPECT_EQ(8U + 3000U + 100U + 8U, out.getBytesWritten());
+        out.finish();
+    }
+    EXPECT_GT(1000U, bytes.size());
+
+    ProtoBuf::MemoryInputStream underlying(bytes.data(), bytes.size());
+    CompressedInputStream in(underlying);
+    LogCabin::ProtoBuf::TestMessage m2;
+    EXPECT_EQ("", in.readMessage(m2));
+    EXPECT_EQ(m, m2);
+    std::string text2(text.size(), '\0');
+    EXPECT_EQ(text.size(), in.readRaw(&text2[0], text2.size()));
+    EXPECT_EQ(text, text2);
+    std::string noise2(noise.size(), '\0');
+    EXPECT_EQ(noise.size(), in.readRaw(&noise2[0], noise2.size()));
+    EXPECT_EQ(noise, noise2);
+    m2.Clear();
+    EXPECT_EQ("", in.readMessage(m2));
+    EXPECT_EQ(m, m2);
+    EXPECT_EQ(8U + 3000U + 100U + 8U, in.getBytesRead());
+    char c;
+    EXPECT_EQ(0U, in.readRaw(&c, 1));
+    EXPECT_EQ(0U, underlying.getBytesRemaining());
+    EXPECT_EQ("Could only read 0 bytes of 4-byte length field "
+              "(at uncompressed offset 3116)",
+              in.readMessage(m2));
+}
+
+TEST(CoreCompressionTest, readMessage_corruptLength) {
+    // A length field claiming nearly 4 GB must not be allocated up front.
+    std::string bytes;
+    {
+        ProtoBuf::StringOutputStream underlying(bytes);
+        CompressedOutputStream out(underlying);
+        std::string length("\xff\xff\xff\xf0" "abc", 7);
+        out.writeRaw(length.data(), length.size());
+        out.finish();
+    }
+    ProtoBuf::MemoryInputStream underlying(bytes.data(), bytes.size());
+    CompressedInputStream in(underlying);
+    LogCabin::ProtoBuf::TestMessage m;
+    EXPECT_EQ("ProtoBuf is 4294967280 bytes long but only 3 bytes remain "
+              "(at uncompressed offset 4)",
+              in.readMessage(m));
+}
+
+TEST(CoreCompressionTest, nextBlock_corruptHeader) {
+    // Lengths in a block header must not be allocated up front either.
+    uint32_t header[2];
+    header[0] = htobe32(uint32_t(MAX_BLOCK_SIZE) + 1);
+    header[1] = htobe32(10);
+    std::string bytes(reinterpret_cast<char*>(header), sizeof(header));
+    bytes += "0123456789";
+    {
+        ProtoBuf::MemoryInputStream underlying(bytes.data(), bytes.size());
+        CompressedInputStream in(underlying);
+        char c;
+        EXPECT_DEATH(in.readRaw(&c, 1),
+                     "more than the maximum block size");
+    }
+
+    header[0] = htobe32(5);
+    header[1] = htobe32(0x7ffffff0);
+    bytes.replace(0, sizeof(header),
+                  reinterpret_cast<char*>(header), sizeof(header));
+    {
+        ProtoBuf::MemoryInputStream underlying(bytes.data(), bytes.size());
+        CompressedInputStream in(underlying);
+        char c;
+        EXPECT_DEATH(in.readRaw(&c, 1),
+                     "more than the 5 bytes it claims to decompress to");
+    }
+}
+
+} // namespace LogCabin::Core::<anonymous>
+} // namespace LogCabin::Core
+} // namespace LogCabin
@@ -0,0 +1,162 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cmath>
+
+#include "build/Protocol/ServerStats.pb.h"
+#include "Core/Histogram.h"
+
+namespace LogCabin {
+namespace Core {
+
+Histogram::Histogram()
+    : buckets()
+{
+    reset();
+}
+
+Histogram::Histogram(const Histogram& other)
+    : buckets()
+{
+    *this = other;
+}
+
+Histogram&
+Histogram::operator=(const Histogram& other)
+{
+    for (uint32_t i = 0; i < NUM_BUCKETS; ++i) {
+        buckets[i].store(other.buckets[i].load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+    }
+    return *this;
+}
+
+Histogram::~Histogram()
+{
+}
+
+uint64_t
+Histogram::getCount() const
+{
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < NUM_BUCKETS; ++i)
+        count += buckets[i].load(std::memory_order_relaxed);
+    return count;
+}
+
+uint64_t
+Histogram::getPercentile(double percentile) const
+{
+    uint64_t count = getCount();
+    if (count == 0)
+        return 0;
+    uint64_t rank = uint64_t(ceil(percentile / 100.0 * double(count)));
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < NUM_BUCKETS; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return bucketMax(i);
+    }
+    // Only reachable if values were pushed concurrently.
+    return bucketMax(NUM_BUCKETS - 1);
+}
+
+void
+Histogram::push(uint64_t value)
+{
+    buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+Histogram::merge(const Histogram& other)
+{
+    for (uint32_t i = 0; i < NUM_BUCKETS; ++i) {
+        buckets[i].fetch_add(other.buckets[i].load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+    }
+}
+
+void
+Histogram::reset()
+{
+    for (uint32_t i = 0; i < NUM_BUCKETS; ++i)
+        buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void
+Histogram::updateProtoBuf(Protocol::Histogram& message) const
+{
+    message.set_count(getCount());
+    if (message.count() > 0) {
+        message.set_p50(getPercentile(50));
+        message.set_p90(getPercentile(90));
+        message.set_p99(getPercentile(99));
+        message.set_p999(getPercentile(99.9));
+    }
+    for (uint32_t i = 0; i < NUM_BUCKETS; ++i) {
+        uint64_t count = buckets[i].load(std::memory_order_relaxed);
+        if (count > 0) {
+            Protocol::Histogram::Bucket& bucket = *message.add_bucket();
+            bucket.set_min(bucketMin(i));
+            bucket.set_max(bucketMax(i));
+            bucket.set_count(count);
+        }
+    }
+}
+
+std::ostream&
+operator<<(std::ostream& os, const Histogram& histogram)
+{
+    os << "p50: " << histogram.getPercentile(50) << std::endl;
+    os << "p90: " << histogram.getPercentile(90) << std::endl;
+    os << "p99: " << histogram.getPercentile(99) << std::endl;
+    os << "p999: " << histogram.getPercentile(99.9) << std::endl;
+    return os;
+}
+
+uint32_t
+Histogram::bucketIndex(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+        return uint32_t(value);
+    uint32_t exponent = 63 - uint32_t(__builtin_clzll(value));
+    uint64_t subBucket = value >> (exponent - SUB_BUCKET_BITS);
+    return ((exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS +
+            uint32_t(subBucket - SUB_BUCKETS));
+}
+
+uint64_t
+Histogram::bucketMin(uint32_t index)
+{
+    if (index < SUB_BUCKETS)
+        return index;
+    uint32_t exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t subBucket = index % SUB_BUCKETS + SUB_BUCKETS;
+    return subBucket << (exponent - SUB_BUCKET_BITS);
+}
+
+uint64_t
+Histogram::bucketMax(uint32_t index)
+{
+    if (index < SUB_BUCKETS)
+        return index;
+    uint32_t exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    return bucketMin(index) + ((1UL << (exponent - SUB_BUCKET_BITS)) - 1);
+}
+
+} // namespace LogCabin::Core
+} // namespace LogCabin
@@ -0,0 +1,154 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LOGCABIN_CORE_HISTOGRAM_H
+#define LOGCABIN_CORE_HISTOGRAM_H
+
+#include <cinttypes>
+#include <iostream>
+
+#include "Core/CompatAtomic.h"
+
+namespace LogCabin {
+
+// forward declaration
+namespace Protocol {
+class Histogram;
+}
+
+namespace Core {
+
+/**
+ * Counts how many times values in each of a fixed set of ranges were
+ * reported, which is enough to estimate percentiles (like the 99th percentile
+ * latency) later.
+ *
+ * The ranges are log-linear, in the style of HdrHistogram: values below 8
+ * each get their own bucket, and every power-of-two range above that is split
+ * into 8 equal buckets. Any value can thus be recovered to within 12.5%,
+ * using about 4 KB of memory and no allocation. That's coarse, but it's
+ * enough to tell tail latencies apart, and it keeps the histograms embedded
+ * in every RollingStat small.
+ *
+ * Recording a value is a single relaxed atomic increment, so push() may be
+ * called from multiple threads without any additional locking. Readers may
+ * see a slightly inconsistent snapshot if values are pushed concurrently.
+ */
+class Histogram {
+  public:
+    enum {
+        /**
+         * log2 of the number of buckets each power-of-two range is split into.
+         */
+        SUB_BUCKET_BITS = 3,
+        /**
+         * The number of buckets each power-of-two range is split into.
+         */
+        SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+        /**
+         * The total number of buckets needed to cover every uint64_t.
+         */
+        NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS,
+    };
+
+    /**
+     * Constructor.
+     */
+    Histogram();
+
+    /**
+     * Copy constructor.
+     */
+    Histogram(const Histogram& other);
+
+    /**
+     * Assignment.
+     */
+    Histogram& operator=(const Histogram& other);
+
+    /**
+     * Destructor.
+     */
+    ~Histogram();
+
+    /**
+     * Return the number of values reported.
+     */
+    uint64_t getCount() const;
+
+    /**
+     * Estimate a percentile of the values reported.
+     * \param percentile
+     *      A number between 0 and 100, such as 99.9.
+     * \return
+     *      The largest value in the bucket containing the given percentile,
+     *      or 0 if no values have been reported. This may overstate the
+     *      actual value by up to 1/SUB_BUCKETS (12.5%).
+     */
+    uint64_t getPercentile(double percentile) const;
+
+    /**
+     * Report a value.
+     */
+    void push(uint64_t value);
+
+    /**
+     * Report all the values that were reported to another histogram.
+     */
+    void merge(const Histogram& other);
+
+    /**
+     * Forget all the values reported so far.
+     */
+    void reset();
+
+    /**
+     * Serialize the non-empty buckets and some common percentiles into the
+     * given empty ProtoBuf message.
+     */
+    void updateProtoBuf(Protocol::Histogram& message) const;
+
+    /**
+     * Print common percentiles.
+     */
+    friend std::ostream& operator<<(std::ostream& os,
+                                    const Histogram& histogram);
+
+    /**
+     * Return the index of the bucket that counts the given value.
+     */
+    static uint32_t bucketIndex(uint64_t value);
+
+    /**
+     * Return the smallest value counted by the given bucket.
+     */
+    static uint64_t bucketMin(uint32_t index);
+
+    /**
+     * Return the largest value counted by the given bucket.
+     */
+    static uint64_t bucketMax(uint32_t index);
+
+  private:
+    /**
+     * The number of values reported in each bucket.
+     */
+    std::atomic<uint64_t> buckets[NUM_BUCKETS];
+};
+
+} // namespace LogCabin::Core
+} // namespace LogCabin
+
+#endif /* LOGCABIN_CORE_HISTOGRAM_H */
@@ -0,0 +1,135 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+#include "build/Protocol/ServerStats.pb.h"
+#include "Core/Histogram.h"
+#include "Core/ProtoBuf.h"
+
+namespace LogCabin {
+namespace {
+
+using Core::Histogram;
+
+TEST(CoreHistogramTest, buckets) {
+    for (uint64_t i = 0; i < 8; ++i) {
+        EXPECT_EQ(i, Histogram::bucketIndex(i));
+        EXPECT_EQ(i, Histogram::bucketMin(uint32_t(i)));
+        EXPECT_EQ(i, Histogram::bucketMax(uint32_t(i)));
+    }
+    EXPECT_EQ(8U, Histogram::bucketIndex(8));
+    EXPECT_EQ(15U, Histogram::bucketIndex(15));
+    EXPECT_EQ(16U, Histogram::bucketIndex(16));
+    EXPECT_EQ(16U, Histogram::bucketIndex(17));
+    EXPECT_EQ(17U, Histogram::bucketIndex(18));
+    EXPECT_EQ(16U, Histogram::bucketMin(16));
+    EXPECT_EQ(17U, Histogram::bucketMax(16));
+    EXPECT_EQ(Histogram::NUM_BUCKETS - 1,
+              Histogram::bucketIndex(~0UL));
+    EXPECT_EQ(~0UL, Histogram::bucketMax(Histogram::NUM_BUCKETS - 1));
+
+    // buckets are contiguous and each value falls in its own bucket
+    for (uint32_t i = 1; i < Histogram::NUM_BUCKETS; ++i) {
+        EXPECT_EQ(Histogram::bucketMax(i - 1) + 1, Histogram::bucketMin(i));
+        EXPECT_EQ(i, Histogram::bucketIndex(Histogram::bucketMin(i)));
+        EXPECT_EQ(i, Histogram::bucketIndex(Histogram::bucketMax(i)));
+    }
+
+    // the documented precision: no bucket is wider than 1/SUB_BUCKETS of
+    // its smallest value
+    for (uint32_t i = 1; i < Histogram::NUM_BUCKETS; ++i) {
+        uint64_t width = Histogram::bucketMax(i) - Histogram::bucketMin(i);
+        EXPECT_LE(width, Histogram::bucketMin(i) / Histogram::SUB_BUCKETS)
+            << i;
+    }
+}
+
+TEST(CoreHistogramTest, getPercentile) {
+    Histogram h;
+    EXPECT_EQ(0U, h.getCount());
+    EXPECT_EQ(0U, h.getPercentile(50));
+    for (uint64_t i = 1; i <= 100; ++i)
+        h.push(i);
+    EXPECT_EQ(100U, h.getCount());
+    EXPECT_EQ(1U, h.getPercentile(0));
+    EXPECT_EQ(5U, h.getPercentile(5));
+    EXPECT_EQ(31U, h.getPercentile(31));
+    EXPECT_EQ(51U, h.getPercentile(50));
+    EXPECT_EQ(103U, h.getPercentile(99));
+    EXPECT_EQ(103U, h.getPercentile(100));
+
+    h.push(1000000000);
+    EXPECT_NEAR(1e9, double(h.getPercentile(100)), 1e9 / 8);
+
+    Histogram copy(h);
+    EXPECT_EQ(101U, copy.getCount());
+    h.reset();
+    EXPECT_EQ(0U, h.getCount());
+    EXPECT_EQ(101U, copy.getCount());
+}
+
+TEST(CoreHistogramTest, merge) {
+    Histogram h1;
+    Histogram h2;
+    h1.push(10);
+    h2.push(20);
+    h2.push(1000);
+    h1.merge(h2);
+    EXPECT_EQ(3U, h1.getCount());
+    EXPECT_EQ(10U, h1.getPercentile(0));
+    EXPECT_EQ(21U, h1.getPercentile(50));
+    EXPECT_EQ(2U, h2.getCount());
+}
+
+TEST(CoreHistogramTest, push_concurrent) {
+    Histogram h;
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < 4; ++i) {
+        threads.emplace_back([&h]() {
+            for (uint64_t j = 0; j < 10000; ++j)
+                h.push(j);
+        });
+    }
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+        it->join();
+    EXPECT_EQ(40000U, h.getCount());
+}
+
+TEST(CoreHistogramTest, updateProtoBuf) {
+    Histogram h;
+    Protocol::Histogram empty;
+    h.updateProtoBuf(empty);
+    EXPECT_EQ("count: 0", empty);
+
+    h.push(3);
+    h.push(3);
+    h.push(100);
+    Protocol::Histogram pb;
+    h.updateProtoBuf(pb);
+    EXPECT_EQ("count: 3 "
+              "p50: 3 "
+              "p90: 103 "
+              "p99: 103 "
+              "p999: 103 "
+              "bucket { min: 3, max: 3, count: 2 } "
+              "bucket { min: 96, max: 103, count: 1 }",
+              pb);
+}
+
+} // namespace LogCabin::<anonymous>
+} // namespace LogCabin
@@ -0,0 +1,172 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cinttypes>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "Core/CompatAtomic.h"
+
+#ifndef LOGCABIN_CORE_MPSCQUEUE_H
+#define LOGCABIN_CORE_MPSCQUEUE_H
+
+namespace LogCabin {
+namespace Core {
+
+/**
+ * A bounded, lock-free queue for handing values from any number of producer
+ * threads to a single consumer thread, without either side blocking.
+ *
+ * This is a ring of slots, each with a sequence number that says whether the
+ * slot is ready for the producer or the consumer of a given position (after
+ * Dmitry Vyukov's bounded MPMC queue, simplified for a single consumer).
+ * Producers claim positions with a compare-and-swap on the tail; the consumer
+ * owns the head outright.
+ *
+ * \tparam T
+ *      The type of values queued. Must be default-constructible and
+ *      move-assignable; moved-from values are left in the slots until they
+ *      are overwritten.
+ */
+template<typename T>
+class MPSCQueue {
+  public:
+    /**
+     * Constructor.
+     * \param minCapacity
+     *      The queue holds at least this many values (rounded up to a power
+     *      of two).
+     */
+    explicit MPSCQueue(size_t minCapacity)
+        : capacity(roundUpToPowerOfTwo(minCapacity))
+        , slots(new Slot[capacity])
+        , head(0)
+        , tail(0)
+    {
+        for (size_t i = 0; i < capacity; ++i)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /**
+     * Try to add a value to the back of the queue. Safe to call from any
+     * thread.
+     * \param value
+     *      Moved from if this returns true; untouched otherwise.
+     * \return
+     *      True if the value was queued, false if the queue was full.
+     */
+    bool tryPush(T& value) {
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & (capacity - 1)];
+            uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+            int64_t diff = int64_t(sequence - pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+                    break;
+                }
+                // pos was reloaded by the failed compare_exchange
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = std::move(value);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Try to remove the value at the front of the queue. Must only be called
+     * from the consumer thread.
+     * \param[out] value
+     *      Assigned the value if this returns true.
+     * \return
+     *      True if a value was dequeued, false if the queue was empty (or the
+     *      producer of the next value has not quite finished writing it).
+     */
+    bool tryPop(T& value) {
+        Slot& slot = slots[head & (capacity - 1)];
+        uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != head + 1)
+            return false;
+        value = std::move(slot.value);
+        slot.sequence.store(head + capacity, std::memory_order_release);
+        ++head;
+        return true;
+    }
+
+    /**
+     * Return the number of values the queue can hold.
+     */
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+  private:
+    /**
+     * Return the smallest power of two that is at least n (and at least 2).
+     */
+    static size_t roundUpToPowerOfTwo(size_t n) {
+        size_t power = 2;
+        while (power < n)
+            power *= 2;
+        return power;
+    }
+
+    /**
+     * One position in the ring. A slot at index i holds the value for
+     * position p (where p % capacity == i) when its sequence is p + 1, and is
+     * free for position p when its sequence is p.
+     */
+    struct Slot {
+        Slot() : sequence(0), value() {}
+        std::atomic<uint64_t> sequence;
+        T value;
+    };
+
+    /**
+     * The number of slots, a power of two.
+     */
+    const size_t capacity;
+
+    /**
+     * The ring itself.
+     */
+    std::unique_ptr<Slot[]> slots;
+
+    /**
+     * The next position to pop. Only touched by the consumer.
+     */
+    alignas(64) uint64_t head;
+
+    /**
+     * The next position to push.
+     */
+    alignas(64) std::atomic<uint64_t> tail;
+
+    // MPSCQueue is non-copyable.
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+};
+
+} // namespace LogCabin::Core
+} // namespace LogCabin
+
+#endif /* LOGCABIN_CORE_MPSCQUEUE_H */
@@ -0,0 +1,120 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Core/MPSCQueue.h"
+
+namespace LogCabin {
+namespace Core {
+namespace {
+
+TEST(CoreMPSCQueueTest, constructor) {
+    EXPECT_EQ(2U, MPSCQueue<int>(0).getCapacity());
+    EXPECT_EQ(8U, MPSCQueue<int>(8).getCapacity());
+    EXPECT_EQ(16U, MPSCQueue<int>(9).getCapacity());
+}
+
+TEST(CoreMPSCQueueTest, pushPop) {
+    MPSCQueue<std::string> queue(4);
+    std::string value;
+    EXPECT_FALSE(queue.tryPop(value));
+    std::string a = "a";
+    std::string b = "b";
+    EXPECT_TRUE(queue.tryPush(a));
+    EXPECT_TRUE(queue.tryPush(b));
+    EXPECT_TRUE(queue.tryPop(value));
+    EXPECT_EQ("a", value);
+    EXPECT_TRUE(queue.tryPop(value));
+    EXPECT_EQ("b", value);
+    EXPECT_FALSE(queue.tryPop(value));
+}
+
+TEST(CoreMPSCQueueTest, tryPush_full) {
+    MPSCQueue<std::string> queue(2);
+    std::string value = "x";
+    EXPECT_TRUE(queue.tryPush(value));
+    value = "y";
+    EXPECT_TRUE(queue.tryPush(value));
+    value = "z";
+    EXPECT_FALSE(queue.tryPush(value));
+    EXPECT_EQ("z", value); // not moved from on failure
+    std::string out;
+    EXPECT_TRUE(queue.tryPop(out));
+    EXPECT_EQ("x", out);
+    EXPECT_TRUE(queue.tryPush(value));
+}
+
+TEST(CoreMPSCQueueTest, wraparound) {
+    MPSCQueue<int> queue(4);
+    int out = 0;
+    for (int i = 0; i < 100; ++i) {
+        int a = i;
+        int b = i + 1000;
+        EXPECT_TRUE(queue.tryPush(a));
+        EXPECT_TRUE(queue.tryPush(b));
+        EXPECT_TRUE(queue.tryPop(out));
+        EXPECT_EQ(i, out);
+        EXPECT_TRUE(queue.tryPop(out));
+        EXPECT_EQ(i + 1000, out);
+    }
+    EXPECT_FALSE(queue.tryPop(out));
+}
+
+void
+producerMain(MPSCQueue<uint64_t>* queue, uint64_t producer, uint64_t count)
+{
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t value = (producer << 32) | i;
+        while (!queue->tryPush(value))
+            std::this_thread::yield();
+    }
+}
+
+TEST(CoreMPSCQueueTest, multipleProducers) {
+    const uint64_t numProducers = 4;
+    const uint64_t count = 20000;
+    MPSCQueue<uint64_t> queue(64);
+    std::vector<std::thread> producers;
+    for (uint64_t p = 0; p < numProducers; ++p)
+        producers.emplace_back(producerMain, &queue, p, count);
+
+    // Each producer's values must come out in the order it pushed them.
+    std::vector<uint64_t> next(numProducers, 0);
+    uint64_t received = 0;
+    while (received < numProducers * count) {
+        uint64_t value;
+        if (!queue.tryPop(value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        uint64_t producer = value >> 32;
+        ASSERT_LT(producer, numProducers);
+        ASSERT_EQ(next[producer], value & 0xFFFFFFFF);
+        ++next[producer];
+        ++received;
+    }
+    for (auto it = producers.begin(); it != producers.end(); ++it)
+        it->join();
+    uint64_t value;
+    EXPECT_FALSE(queue.tryPop(value));
+}
+
+} // namespace LogCabin::Core::<anonymous>
+} // namespace LogCabin::Core
+} // namespace LogCabin
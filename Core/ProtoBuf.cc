@@ -13,11 +13,14 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <algorithm>
+#include <cstring>
 #include <google/protobuf/text_format.h>
 #include <memory>
 #include <sstream>
 
 #include "Core/Debug.h"
+#include "Core/Endian.h"
 #include "Core/ProtoBuf.h"
 #include "Core/StringUtil.h"
 #include "Core/Util.h"
@@ -173,6 +176,118 @@ serialize(const google::protobuf::Message& from,
     to.setData(data, skipBytes + length, Core::Buffer::deleteArrayFn<char>);
 }
 
+////////// MemoryInputStream //////////
+
+MemoryInputStream::MemoryInputStream(const void* data, uint64_t length)
+    : data(static_cast<const char*>(data))
+    , length(length)
+    , bytesRead(0)
+{
+}
+
+MemoryInputStream::~MemoryInputStream()
+{
+}
+
+uint64_t
+MemoryInputStream::getBytesRead() const
+{
+    return bytesRead;
+}
+
+std::string
+MemoryInputStream::readMessage(google::protobuf::Message& message)
+{
+    uint32_t messageLength = 0;
+    uint64_t r = readRaw(&messageLength, sizeof(messageLength));
+    if (r < sizeof(messageLength)) {
+        return StringUtil::format("Could only read %lu bytes of %lu-byte "
+                                  "length field (at offset %lu of %lu bytes)",
+                                  r,
+                                  sizeof(messageLength),
+                                  bytesRead - r,
+                                  length);
+    }
+    messageLength = be32toh(messageLength);
+    if (getBytesRemaining() < messageLength) {
+        return StringUtil::format("ProtoBuf is %u bytes long but there are "
+                                  "only %lu bytes remaining (at offset %lu)",
+                                  messageLength,
+                                  getBytesRemaining(),
+                                  bytesRead);
+    }
+    const Core::Buffer buf(const_cast<char*>(data + bytesRead),
+                           messageLength,
+                           NULL);
+    std::string error;
+    if (!parse(buf, message)) {
+        error = StringUtil::format("Could not parse ProtoBuf at bytes "
+                                   "%lu-%lu (inclusive) of %lu",
+                                   bytesRead,
+                                   bytesRead + messageLength - 1,
+                                   length);
+    }
+    bytesRead += messageLength;
+    return error;
+}
+
+uint64_t
+MemoryInputStream::readRaw(void* buf, uint64_t count)
+{
+    uint64_t r = std::min(count, getBytesRemaining());
+    memcpy(buf, data + bytesRead, r);
+    bytesRead += r;
+    return r;
+}
+
+uint64_t
+MemoryInputStream::getBytesRemaining() const
+{
+    return length - bytesRead;
+}
+
+uint64_t
+MemoryInputStream::skip(uint64_t count)
+{
+    uint64_t r = std::min(count, getBytesRemaining());
+    bytesRead += r;
+    return r;
+}
+
+////////// StringOutputStream //////////
+
+StringOutputStream::StringOutputStream(std::string& output)
+    : output(output)
+    , bytesWritten(0)
+{
+}
+
+StringOutputStream::~StringOutputStream()
+{
+}
+
+uint64_t
+StringOutputStream::getBytesWritten() const
+{
+    return bytesWritten;
+}
+
+void
+StringOutputStream::writeMessage(const google::protobuf::Message& message)
+{
+    Core::Buffer buf;
+    serialize(message, buf);
+    uint32_t beSize = htobe32(uint32_t(buf.getLength()));
+    writeRaw(&beSize, sizeof(beSize));
+    writeRaw(buf.getData(), buf.getLength());
+}
+
+void
+StringOutputStream::writeRaw(const void* data, uint64_t length)
+{
+    output.append(static_cast<const char*>(data), length);
+    bytesWritten += length;
+}
 
 } // namespace LogCabin::Core::ProtoBuf
 } // namespace LogCabin::Core
@@ -197,6 +197,81 @@ struct OutputStream {
     virtual void writeRaw(const void* data, uint64_t length) = 0;
 };
 
+/**
+ * An InputStream that reads from a region of memory. Messages are framed the
+ * same way as in Storage::SnapshotFile: each is preceded by its length as a
+ * 32-bit big-endian integer.
+ */
+class MemoryInputStream : public InputStream {
+  public:
+    /**
+     * Constructor.
+     * \param data
+     *      The bytes to read. These are not copied, so they must remain
+     *      valid for the lifetime of this object.
+     * \param length
+     *      The number of bytes in 'data'.
+     */
+    MemoryInputStream(const void* data, uint64_t length);
+    /// Destructor.
+    ~MemoryInputStream();
+    // See InputStream.
+    uint64_t getBytesRead() const;
+    // See InputStream.
+    std::string readMessage(google::protobuf::Message& message);
+    // See InputStream.
+    uint64_t readRaw(void* data, uint64_t length);
+    /// Return the number of bytes that have not yet been read.
+    uint64_t getBytesRemaining() const;
+    /**
+     * Advance past bytes without copying them out.
+     * \param length
+     *      The number of bytes to skip. If fewer remain, skips to the end.
+     * \return
+     *      The number of bytes skipped.
+     */
+    uint64_t skip(uint64_t length);
+  private:
+    /// See constructor.
+    const char* data;
+    /// See constructor.
+    uint64_t length;
+    /// The number of bytes read from 'data' so far.
+    uint64_t bytesRead;
+
+    // MemoryInputStream is non-copyable.
+    MemoryInputStream(const MemoryInputStream&) = delete;
+    MemoryInputStream& operator=(const MemoryInputStream&) = delete;
+};
+
+/**
+ * An OutputStream that appends to a string in memory, using the same framing
+ * as MemoryInputStream.
+ */
+class StringOutputStream : public OutputStream {
+  public:
+    /**
+     * Constructor.
+     * \param output
+     *      Bytes written to the stream are appended here. This must remain
+     *      valid for the lifetime of this object.
+     */
+    explicit StringOutputStream(std::string& output);
+    /// Destructor.
+    ~StringOutputStream();
+    // See OutputStream.
+    uint64_t getBytesWritten() const;
+    // See OutputStream.
+    void writeMessage(const google::protobuf::Message& message);
+    // See OutputStream.
+    void writeRaw(const void* data, uint64_t length);
+  private:
+    /// See constructor.
+    std::string& output;
+    /// The number of bytes written to 'output' by this stream.
+    uint64_t bytesWritten;
+};
+
 } // namespace LogCabin::Core::ProtoBuf
 } // namespace LogCabin::Core
 } // namespace LogCabin
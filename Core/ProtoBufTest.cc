@@ -114,6 +114,43 @@ TEST(CoreProtoBufTest, serialize) {
     EXPECT_EQ("field_a: 3 field_b: 5", m.ShortDebugString());
 }
 
+TEST(CoreProtoBufTest, memoryStreams) {
+    std::string bytes;
+    {
+        ProtoBuf::StringOutputStream out(bytes);
+        out.writeRaw("x", 1);
+        out.writeMessage(fromString<TestMessage>("field_a: 3, field_b: 5"));
+        EXPECT_EQ(bytes.size(), out.getBytesWritten());
+    }
+    ProtoBuf::MemoryInputStream in(bytes.data(), bytes.size());
+    char x = 0;
+    EXPECT_EQ(1U, in.readRaw(&x, 1));
+    EXPECT_EQ('x', x);
+    TestMessage m;
+    EXPECT_EQ("", in.readMessage(m));
+    EXPECT_EQ("field_a: 3 field_b: 5", m.ShortDebugString());
+    EXPECT_EQ(bytes.size(), in.getBytesRead());
+    EXPECT_EQ(0U, in.getBytesRemaining());
+    EXPECT_EQ(0U, in.readRaw(&x, 1));
+    EXPECT_EQ("Could only read 0 bytes of 4-byte length field "
+              "(at offset 9 of 9 bytes)",
+              in.readMessage(m));
+
+    // truncated message
+    ProtoBuf::MemoryInputStream in2(bytes.data(), bytes.size() - 1);
+    EXPECT_EQ(1U, in2.readRaw(&x, 1));
+    EXPECT_EQ("ProtoBuf is 4 bytes long but there are only 3 bytes "
+              "remaining (at offset 5)",
+              in2.readMessage(m));
+
+    // skip
+    ProtoBuf::MemoryInputStream in3(bytes.data(), bytes.size());
+    EXPECT_EQ(5U, in3.skip(5));
+    EXPECT_EQ(5U, in3.getBytesRead());
+    EXPECT_EQ(4U, in3.skip(10));
+    EXPECT_EQ(0U, in3.getBytesRemaining());
+}
+
 // See https://github.com/logcabin/logcabin/issues/89:
 //
 // If we have a required enum field, an unknown value will cause the field to
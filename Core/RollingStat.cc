@@ -13,6 +13,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <algorithm>
 #include <cmath>
 
 #include "build/Protocol/ServerStats.pb.h"
@@ -27,6 +28,7 @@ RollingStat::RollingStat()
     , ewma2(0)
     , ewma4(0)
     , exceptionalCount(0)
+    , histogram()
     , last(0)
     , lastExceptional()
     , max(0)
@@ -98,6 +100,14 @@ RollingStat::getMax() const
     return max;
 }
 
+uint64_t
+RollingStat::getPercentile(double percentile) const
+{
+    // The histogram's buckets are approximate, but the largest value is known
+    // exactly.
+    return std::min(histogram.getPercentile(percentile), max);
+}
+
 uint64_t
 RollingStat::getSum() const
 {
@@ -137,6 +147,8 @@ RollingStat::push(uint64_t value)
     else
         ewma4 = 0.25 * double(value) + 0.75 * ewma4;
 
+    histogram.push(value);
+
     last = value;
 
     if (value > max)
@@ -163,6 +175,12 @@ RollingStat::updateProtoBuf(Protocol::RollingStat& message) const
         message.set_max(getMax());
         message.set_sum(getSum());
         message.set_stddev(getStdDev());
+        Protocol::Histogram& h = *message.mutable_histogram();
+        histogram.updateProtoBuf(h);
+        h.set_p50(getPercentile(50));
+        h.set_p90(getPercentile(90));
+        h.set_p99(getPercentile(99));
+        h.set_p999(getPercentile(99.9));
     }
     message.set_exceptional_count(getExceptionalCount());
     Core::Time::SteadyTimeConverter timeConverter;
@@ -189,6 +207,10 @@ operator<<(std::ostream& os, const RollingStat& stat)
         os << "max: " << stat.getMax() << std::endl;
         os << "sum: " << stat.getSum() << std::endl;
         os << "stddev: " << stat.getStdDev() << std::endl;
+        os << "p50: " << stat.getPercentile(50) << std::endl;
+        os << "p90: " << stat.getPercentile(90) << std::endl;
+        os << "p99: " << stat.getPercentile(99) << std::endl;
+        os << "p999: " << stat.getPercentile(99.9) << std::endl;
     }
     os << "exceptional: " << stat.getExceptionalCount() << std::endl;
     if (!stat.lastExceptional.empty()) {
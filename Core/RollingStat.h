@@ -20,6 +20,7 @@
 #include <iostream>
 #include <deque>
 
+#include "Core/Histogram.h"
 #include "Core/Time.h"
 
 namespace LogCabin {
@@ -33,9 +34,10 @@ namespace Core {
 
 /**
  * This class gathers statistics about a given metric over time, like its
- * average, standard deviation, and exponentially weighted moving average. This
- * class also keeps track of the last 5 "exceptional" values, typically those
- * that are above some pre-defined threshold.
+ * average, standard deviation, exponentially weighted moving average, and
+ * distribution (see Histogram). This class also keeps track of the last 5
+ * "exceptional" values, typically those that are above some pre-defined
+ * threshold.
  *
  * This currently assumes your metric is a uint64_t. It could probably be
  * abstracted out in some way, but most metrics in LogCabin seem to fit this
@@ -100,6 +102,11 @@ class RollingStat {
      * Return the largest value reported, or 0 if no values reported.
      */
     uint64_t getMax() const;
+    /**
+     * Estimate a percentile of the values reported, or return 0 if no values
+     * reported. See Histogram::getPercentile().
+     */
+    uint64_t getPercentile(double percentile) const;
     /**
      * Return the cumulative total of all values reported, or 0 if no values
      * reported.
@@ -144,6 +151,7 @@ class RollingStat {
     double ewma2;
     double ewma4;
     uint64_t exceptionalCount;
+    Histogram histogram;
     uint64_t last;
     std::deque<std::pair<TimePoint, uint64_t>> lastExceptional;
     uint64_t max;
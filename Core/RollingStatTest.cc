@@ -54,10 +54,32 @@ TEST(CoreRollingStatTest, basics) {
               "min: 0 "
               "max: 3 "
               "sum: 6 "
-              "stddev: 1.1180339887498949",
+              "stddev: 1.1180339887498949 "
+              "histogram { "
+              "    count: 4 "
+              "    p50: 1 "
+              "    p90: 3 "
+              "    p99: 3 "
+              "    p999: 3 "
+              "    bucket { min: 0, max: 0, count: 1 } "
+              "    bucket { min: 1, max: 1, count: 1 } "
+              "    bucket { min: 2, max: 2, count: 1 } "
+              "    bucket { min: 3, max: 3, count: 1 } "
+              "}",
               pb);
 }
 
+TEST(CoreRollingStatTest, getPercentile) {
+    Core::RollingStat stat;
+    EXPECT_EQ(0U, stat.getPercentile(99));
+    for (uint64_t i = 1; i <= 1000; ++i)
+        stat.push(i * 1000);
+    EXPECT_NEAR(500000, double(stat.getPercentile(50)), 500000 / 8);
+    EXPECT_NEAR(990000, double(stat.getPercentile(99)), 990000 / 8);
+    // capped at the largest value reported
+    EXPECT_EQ(1000000U, stat.getPercentile(100));
+}
+
 TEST(CoreRollingStatTest, initial) {
     Core::RollingStat stat;
     EXPECT_EQ(0, stat.getAverage());
@@ -70,6 +92,7 @@ TEST(CoreRollingStatTest, initial) {
     EXPECT_EQ(0U, stat.getMax());
     EXPECT_EQ(0U, stat.getSum());
     EXPECT_EQ(0, stat.getStdDev());
+    EXPECT_EQ(0U, stat.getPercentile(50));
 }
 
 TEST(CoreRollingStatTest, exceptional) {
@@ -30,6 +30,7 @@ namespace {
 using LogCabin::Client::Cluster;
 using LogCabin::Client::Configuration;
 using LogCabin::Client::ConfigurationResult;
+using LogCabin::Client::GetConfigurationResult;
 using LogCabin::Client::Result;
 using LogCabin::Client::Server;
 using LogCabin::Client::Status;
@@ -45,16 +46,20 @@ class OptionParser {
         , cluster("logcabin:5254")
         , logPolicy("")
         , servers()
+        , learners()
+        , replaceLearners(false)
     {
         while (true) {
             static struct option longOptions[] = {
                {"cluster",  required_argument, NULL, 'c'},
                {"help",  no_argument, NULL, 'h'},
+               {"learner",  required_argument, NULL, 'l'},
+               {"no-learners",  no_argument, NULL, 257},
                {"verbose",  no_argument, NULL, 'v'},
                {"verbosity",  required_argument, NULL, 256},
                {0, 0, 0, 0}
             };
-            int c = getopt_long(argc, argv, "c:hv", longOptions, NULL);
+            int c = getopt_long(argc, argv, "c:hl:v", longOptions, NULL);
 
             // Detect the end of the options.
             if (c == -1)
@@ -67,6 +72,13 @@ class OptionParser {
                 case 'h':
                     usage();
                     exit(0);
+                case 'l':
+                    learners.push_back(optarg);
+                    replaceLearners = true;
+                    break;
+                case 257:
+                    replaceLearners = true;
+                    break;
                 case 'v':
                     logPolicy = "VERBOSE";
                     break;
@@ -133,6 +145,23 @@ class OptionParser {
             << "Print this usage information"
             << std::endl
 
+            << "  -l <server>, --learner=<server>        "
+            << "Make <server> a non-voting learner."
+            << std::endl
+            << "                                         "
+            << "May be repeated. If given, replaces the"
+            << std::endl
+            << "                                         "
+            << "existing learners; otherwise they are"
+            << std::endl
+            << "                                         "
+            << "kept"
+            << std::endl
+
+            << "  --no-learners                          "
+            << "Remove all existing learners"
+            << std::endl
+
             << "  -v, --verbose                  "
             << "Same as --verbosity=VERBOSE (added in v1.1.0)"
             << std::endl
@@ -162,45 +191,42 @@ class OptionParser {
     std::string cluster;
     std::string logPolicy;
     std::vector<std::string> servers;
+    std::vector<std::string> learners;
+    bool replaceLearners;
 };
 
 void
-printConfiguration(const std::pair<uint64_t, Configuration>& configuration)
+printConfiguration(const GetConfigurationResult& configuration)
 {
-    std::cout << "Configuration " << configuration.first << ":" << std::endl;
-    for (auto it = configuration.second.begin();
-         it != configuration.second.end();
+    std::cout << "Configuration " << configuration.configuration << ":"
+              << std::endl;
+    for (auto it = configuration.servers.begin();
+         it != configuration.servers.end();
          ++it) {
         std::cout << "- " << it->serverId << ": " << it->addresses
                   << std::endl;
     }
+    for (auto it = configuration.learners.begin();
+         it != configuration.learners.end();
+         ++it) {
+        std::cout << "- " << it->serverId << ": " << it->addresses
+                  << " (learner)" << std::endl;
+    }
     std::cout << std::endl;
 }
 
-
-} // anonymous namespace
-
-int
-main(int argc, char** argv)
+/**
+ * Look up the IDs of the given servers.
+ * \return
+ *      False if any server couldn't be reached.
+ */
+bool
+getServerInfos(Cluster& cluster,
+               const std::vector<std::string>& addresses,
+               const std::string& suffix,
+               Configuration& servers)
 {
-    OptionParser options(argc, argv);
-    LogCabin::Client::Debug::setLogPolicy(
-        LogCabin::Client::Debug::logPolicyFromString(
-            options.logPolicy));
-    Cluster cluster(options.cluster);
-
-    std::pair<uint64_t, Configuration> configuration =
-        cluster.getConfiguration();
-    uint64_t id = configuration.first;
-    std::cout << "Current configuration:" << std::endl;
-    printConfiguration(configuration);
-
-    std::cout << "Attempting to change cluster membership to the following:"
-              << std::endl;
-    Configuration servers;
-    for (auto it = options.servers.begin();
-         it != options.servers.end();
-         ++it) {
+    for (auto it = addresses.begin(); it != addresses.end(); ++it) {
         Server info;
         Result result = cluster.getServerInfo(*it,
                                               /* timeout = 2s */ 2000000000UL,
@@ -209,7 +235,7 @@ main(int argc, char** argv)
             case Status::OK:
                 std::cout << info.serverId << ": "
                           << info.addresses
-                          << " (given as " << *it << ")"
+                          << " (given as " << *it << ")" << suffix
                           << std::endl;
                 servers.emplace_back(info.serverId, info.addresses);
                 break;
@@ -217,17 +243,50 @@ main(int argc, char** argv)
                 std::cout << "Could not fetch server info from "
                           << *it << " (" << result.error << "). Aborting."
                           << std::endl;
-                return 1;
+                return false;
             default:
                 std::cout << "Unknown error from "
                           << *it << " (" << result.error << "). Aborting."
                           << std::endl;
-                return 1;
+                return false;
         }
     }
+    return true;
+}
+
+
+} // anonymous namespace
+
+int
+main(int argc, char** argv)
+{
+    OptionParser options(argc, argv);
+    LogCabin::Client::Debug::setLogPolicy(
+        LogCabin::Client::Debug::logPolicyFromString(
+            options.logPolicy));
+    Cluster cluster(options.cluster);
+
+    GetConfigurationResult configuration = cluster.getConfiguration2(0);
+    uint64_t id = configuration.configuration;
+    std::cout << "Current configuration:" << std::endl;
+    printConfiguration(configuration);
+
+    std::cout << "Attempting to change cluster membership to the following:"
+              << std::endl;
+    Configuration servers;
+    Configuration learners;
+    if (!getServerInfos(cluster, options.servers, "", servers) ||
+        !getServerInfos(cluster, options.learners, " as a learner",
+                        learners)) {
+        return 1;
+    }
     std::cout << std::endl;
 
-    ConfigurationResult result = cluster.setConfiguration(id, servers);
+    ConfigurationResult result;
+    if (options.replaceLearners)
+        result = cluster.setConfiguration2(id, servers, learners, 0);
+    else
+        result = cluster.setConfiguration(id, servers);
     std::cout << "Membership change result: ";
     if (result.status == ConfigurationResult::OK) {
         std::cout << "OK" << std::endl;
@@ -245,7 +304,7 @@ main(int argc, char** argv)
     std::cout << std::endl;
 
     std::cout << "Current configuration:" << std::endl;
-    printConfiguration(cluster.getConfiguration());
+    printConfiguration(cluster.getConfiguration2(0));
 
     if (result.status == ConfigurationResult::OK)
         return 0;
@@ -38,6 +38,7 @@ enum class Command {
     WRITE,
     READ,
     REMOVE,
+    IMPORT,
 };
 
 /**
@@ -138,6 +139,8 @@ class OptionParser {
         } else if (cmdStr == "remove" || cmdStr == "rm" ||
                    cmdStr == "removeFile") {
             command = Command::REMOVE;
+        } else if (cmdStr == "import") {
+            command = Command::IMPORT;
         } else {
             std::cout << "Unknown command: " << cmdStr << std::endl;
             usage();
@@ -203,6 +206,12 @@ class OptionParser {
             << "  remove <path>   Remove file at <path>, if any. Alias: rm, "
             << "removefile."
             << std::endl
+            << "  import <path>   Replace directory at <path> with a "
+            << "prebuilt directory read"
+            << std::endl
+            << "                  from stdin (see logcabin-import "
+            << "--output)."
+            << std::endl
             << std::endl;
 
         std::cout << "Options:" << std::endl;
@@ -375,6 +384,9 @@ main(int argc, char** argv)
             case Command::REMOVE:
                 tree.removeFileEx(path);
                 break;
+            case Command::IMPORT:
+                tree.importDirectoryEx(path, readStdin());
+                break;
         }
         return 0;
 
@@ -99,6 +99,13 @@ enum {
      * a server.
      */
     CONTROL_SERVICE = 3,
+
+    /**
+     * Servers that host more than one Raft group (see the 'raftGroups'
+     * config option) run the consensus protocol for group g > 0 over service
+     * RAFT_GROUP_SERVICE_BASE + g; group 0 keeps using RAFT_SERVICE.
+     */
+    RAFT_GROUP_SERVICE_BASE = 256,
 };
 }
 
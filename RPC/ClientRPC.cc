@@ -39,15 +39,21 @@ ClientRPC::ClientRPC(std::shared_ptr<RPC::ClientSession> session,
                      uint8_t serviceSpecificErrorVersion,
                      uint16_t opCode,
                      const google::protobuf::Message& request)
+    : ClientRPC(session, service, serviceSpecificErrorVersion, opCode,
+                serializeRequest(request))
+{
+}
+
+ClientRPC::ClientRPC(std::shared_ptr<RPC::ClientSession> session,
+                     uint16_t service,
+                     uint8_t serviceSpecificErrorVersion,
+                     uint16_t opCode,
+                     Core::Buffer requestBuffer)
     : service(service)
     , opCode(opCode)
     , opaqueRPC() // placeholder, set again below
 {
-
-    // Serialize the request into a Buffer
-    Core::Buffer requestBuffer;
-    Core::ProtoBuf::serialize(request, requestBuffer,
-                              sizeof(RequestHeaderVersion1));
+    assert(requestBuffer.getLength() >= sizeof(RequestHeaderVersion1));
     auto& requestHeader =
         *static_cast<RequestHeaderVersion1*>(requestBuffer.getData());
     requestHeader.prefix.version = 1;
@@ -62,6 +68,15 @@ ClientRPC::ClientRPC(std::shared_ptr<RPC::ClientSession> session,
     opaqueRPC = session->sendRequest(std::move(requestBuffer));
 }
 
+Core::Buffer
+ClientRPC::serializeRequest(const google::protobuf::Message& request)
+{
+    Core::Buffer requestBuffer;
+    Core::ProtoBuf::serialize(request, requestBuffer,
+                              sizeof(RequestHeaderVersion1));
+    return requestBuffer;
+}
+
 ClientRPC::ClientRPC()
     : service(0)
     , opCode(0)
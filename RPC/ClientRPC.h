@@ -20,6 +20,7 @@
 #include <memory>
 #include <string>
 
+#include "Core/Buffer.h"
 #include "RPC/OpaqueClientRPC.h"
 
 #ifndef LOGCABIN_RPC_CLIENTRPC_H
@@ -68,6 +69,37 @@ class ClientRPC {
               uint16_t opCode,
               const google::protobuf::Message& request);
 
+    /**
+     * Issue an RPC to a remote service, with a request that was serialized
+     * earlier by serializeRequest(). This is useful when the request can only
+     * be read safely for a limited time (for example, while holding a lock),
+     * but the session it will be sent on isn't available yet.
+     * \param session
+     *      A connection to the remote server.
+     * \param service
+     *      See above.
+     * \param serviceSpecificErrorVersion
+     *      See above.
+     * \param opCode
+     *      See above.
+     * \param request
+     *      The return value of serializeRequest().
+     */
+    ClientRPC(std::shared_ptr<RPC::ClientSession> session,
+              uint16_t service,
+              uint8_t serviceSpecificErrorVersion,
+              uint16_t opCode,
+              Core::Buffer request);
+
+    /**
+     * Serialize the arguments to a remote procedure, leaving room for the
+     * header that the constructor above fills in.
+     * \param request
+     *      The arguments to the remote procedure.
+     */
+    static Core::Buffer
+    serializeRequest(const google::protobuf::Message& request);
+
     /**
      * Default constructor. This doesn't create a valid RPC, but it is useful
      * as a placeholder.
@@ -140,6 +140,31 @@ TEST_F(RPCClientRPCTest, constructor) {
     EXPECT_EQ(payload, actual);
 }
 
+TEST_F(RPCClientRPCTest, constructor_serialized) {
+    Core::Buffer request = ClientRPC::serializeRequest(payload);
+    payload.set_field_a(99);
+    ClientRPC rpc(session, 2, 3, 4, std::move(request));
+    while (!rpc.isReady()) {
+        /* spin -- can't call waitForReply because it will PANIC */;
+        usleep(100);
+    }
+    Protocol::RequestHeaderVersion1 header =
+        *static_cast<Protocol::RequestHeaderVersion1*>(
+            rpcHandler.lastRequest.getData());
+    header.prefix.fromBigEndian();
+    EXPECT_EQ(1U, header.prefix.version);
+    header.fromBigEndian();
+    EXPECT_EQ(2U, header.service);
+    EXPECT_EQ(3U, header.serviceSpecificErrorVersion);
+    EXPECT_EQ(4U, header.opCode);
+    LogCabin::ProtoBuf::TestMessage actual;
+    EXPECT_TRUE(Core::ProtoBuf::parse(
+        rpcHandler.lastRequest, actual,
+        sizeof(Protocol::RequestHeaderVersion1)));
+    EXPECT_EQ(3U, actual.field_a());
+}
+
+// serializeRequest: tested above
 // default constructor: nothing to test
 // move constructor: nothing to test
 // destructor: nothing to test
@@ -4,9 +4,11 @@
 #include <unistd.h>
 
 #include "Core/Debug.h"
+#include "Core/StringUtil.h"
 #include "Core/ThreadId.h"
 #include "Core/Mutex.h"
 #include "Core/ConditionVariable.h"
+#include "Core/MPSCQueue.h"
 
 #include "RPC/InterfaceIX.h"
 
@@ -46,6 +48,10 @@ struct ix_conn {
     struct ixev_ctx ctx;
 
     size_t bytes_so_far;
+    // True from when an outbound message is handed to the connection until
+    // its last byte is sent (including while a client connection is being
+    // dialed). Another message must not be filled in meanwhile.
+    bool sending;
     Header header;
     Core::Buffer message;
 
@@ -66,6 +72,7 @@ static void dialed_cb(struct ixev_ctx *ctx, long ret);
 static void readable(struct ixev_ctx *ctx, unsigned int reason);
 static void writable(struct ixev_ctx *ctx, unsigned int reason);
 static void timer_handler (void* arg);
+static void flushSendQueue();
 
 // helpers
 static int _parse_ip_addr(const char *str, uint32_t *addr);
@@ -85,6 +92,21 @@ static struct ixev_timer timer_struct;
 
 static struct timeval tv = {.tv_sec = 0, .tv_usec = 8L};
 
+// The thread that called initializeIx(), the only one that may touch ixev.
+// Zero until then.
+static std::atomic<uint64_t> mainThreadId(0);
+
+// From sys_wake_init() on the main thread: other threads pass it to
+// sys_wake() to end the main thread's ixev_wait(). Negative if the backend
+// cannot do that, in which case the main thread polls on a timer instead.
+static std::atomic<int> mainThreadWakeId(-1);
+
+static bool
+onMainThread()
+{
+    return Core::ThreadId::getId() == mainThreadId.load();
+}
+
 // container for queue elements.
 // could probably be done in an easier manner.
 // But do not replace with a queue of ix_conn*,
@@ -140,8 +162,19 @@ class queue_elem {
     Core::Buffer message;
 };
 
-static Core::Mutex send_queue_mutex;
-static std::deque<queue_elem> send_queue;
+// Outbound messages from any thread to the main thread. Producers never
+// block on a lock; the main thread drains the whole ring after every
+// ixev_wait() rather than one message per timer tick.
+static Core::MPSCQueue<queue_elem> send_queue(4096);
+
+// Set by producers after pushing onto send_queue, cleared by the main
+// thread before draining it, so that an idle loop iteration costs a single
+// atomic exchange. The producer that sets it also wakes the main thread.
+static std::atomic<bool> send_doorbell(false);
+
+// Messages popped from send_queue whose connection was still sending an
+// earlier message. Only accessed by the main thread, in order.
+static std::deque<queue_elem> send_deferred;
 
 static struct ixev_conn_ops ix_conn_ops = {
     .accept     = &accept_cb,
@@ -191,12 +224,44 @@ setServerHandler(Handler* handler) {
     SERVER_HANDLER = handler;
 }
 
+std::string
+selectBackend(const std::string& backend, const std::string& listenAddress)
+{
+    if (ix_set_backend(backend.c_str()) != 0)
+        return "Unknown IX backend '" + backend + "'";
+    if (backend != "epoll")
+        return "";
+
+    std::string host = listenAddress;
+    uint16_t port = LogCabin::Protocol::Common::DEFAULT_PORT;
+    size_t colon = listenAddress.find(':');
+    if (colon != std::string::npos) {
+        host = listenAddress.substr(0, colon);
+        port = uint16_t(atoi(listenAddress.substr(colon + 1).c_str()));
+    }
+    uint32_t ip;
+    if (_parse_ip_addr(host.c_str(), &ip) != 0)
+        return "Bad IPv4 address '" + host + "'";
+    int ret = ix_epoll_listen(ip, port);
+    if (ret != 0) {
+        return Core::StringUtil::format("Could not listen on %s: %s",
+                                        listenAddress.c_str(),
+                                        strerror(-ret));
+    }
+    NOTICE("Emulating IX over epoll, listening on %s",
+           listenAddress.c_str());
+    return "";
+}
+
 void
 initializeIx() {
 
     int ret;
 
-    if (Core::ThreadId::getId() != 1) {
+    uint64_t expected = 0;
+    if (!mainThreadId.compare_exchange_strong(expected,
+                                              Core::ThreadId::getId()) &&
+        !onMainThread()) {
         ERROR("Only main thread can access this function");
         return;
     }
@@ -230,7 +295,7 @@ initializeThread() {
 
     int ret;
 
-    if (Core::ThreadId::getId() != 1) {
+    if (!onMainThread()) {
         ERROR("Only main thread can access this function");
         return;
     }
@@ -247,20 +312,23 @@ initializeThread() {
         return;//
     }
 
+    mainThreadWakeId = sys_wake_init();
 }
 
 // This should be called once
 void
 waitForever() {
 
-    if (Core::ThreadId::getId() != 1) {
+    if (!onMainThread()) {
         ERROR("Only main thread can access this function");
         return;
     }
 
-    // hack: timer that allows to wake up main thread
-    ixev_timer_init(&timer_struct, &timer_handler, NULL);
-    ixev_timer_add(&timer_struct, tv);
+    // hack: without a way to wake the main thread, poll on a timer
+    if (mainThreadWakeId < 0) {
+        ixev_timer_init(&timer_struct, &timer_handler, NULL);
+        ixev_timer_add(&timer_struct, tv);
+    }
 
     // need to do this dynamically and join threads when needed
     for(int i=0; i < THREADS; i++) {
@@ -270,7 +338,7 @@ waitForever() {
 
     while (1) {
         ixev_wait();
-
+        flushSendQueue();
     }
     return;
 
@@ -280,9 +348,23 @@ waitForever() {
 void
 sendMessage(ixev_ctx* ctx, MessageId messageId, Core::Buffer contents)
 {
-    { // Place the message on the outbound queue.
-        std::lock_guard<Core::Mutex> lock(send_queue_mutex);
-        send_queue.emplace_back(ctx, messageId, std::move(contents));
+    queue_elem e(ctx, messageId, std::move(contents));
+    // Place the message on the outbound queue. If it is full, the main
+    // thread is behind; wait for it (or, if this is the main thread, make
+    // room itself).
+    bool main = onMainThread();
+    while (!send_queue.tryPush(e)) {
+        if (main)
+            flushSendQueue();
+        else
+            std::this_thread::yield();
+    }
+    // Only the first producer since the main thread last drained the queue
+    // needs to wake it; the main thread flushes after every ixev_wait().
+    if (!send_doorbell.exchange(true, std::memory_order_acq_rel) && !main) {
+        int wakeId = mainThreadWakeId;
+        if (wakeId >= 0)
+            sys_wake(wakeId);
     }
 }
 
@@ -308,6 +390,7 @@ initClientConnection(Handler* handler,
 
     client_conn->id.dst_port = (uint16_t) atoi(port.c_str());
     client_conn->type = FIRST_REQUEST;
+    client_conn->sending = false;
     client_conn->client_handler = handler;
 
     ixev_ctx_init(&client_conn->ctx);
@@ -330,32 +413,27 @@ close(struct ixev_ctx *ctx)
 
 void
 timer_handler (void* arg) {
+    // Messages are sent by flushSendQueue() after every ixev_wait(); when
+    // sys_wake() is unavailable, this timer makes sure ixev_wait() returns
+    // periodically so that a message queued while the main thread is idle
+    // is not stuck.
+    ixev_timer_add(&timer_struct, tv);
+}
 
-    // sends one message at the time because we want to be back on the
-    // event loop in case ixev_send didn't send all the message in once
-
-    queue_elem e;
-    {
-        // Here the main thread can block, this is against the Ix paradigm.
-        // However, it is unlikely to block for a long time.
-        std::lock_guard<Core::Mutex> lock(send_queue_mutex);
-        if (send_queue.empty()) {
-            //repeat timer
-            ixev_timer_add(&timer_struct, tv);
-            return;
-        }
-        e = std::move(send_queue.front());
-        send_queue.pop_front();
-    }
-
+// Hand one queued message to its connection, or return false if the
+// connection is still sending a previous message.
+static bool
+startSend(queue_elem& e)
+{
     struct ix_conn *conn =
         container_of(e.ctx, struct ix_conn, ctx);
-
+    if (conn->sending)
+        return false;
 
     _fill_message(conn, e.messageId,
                   std::move(e.message));
-
     conn->bytes_so_far = 0;
+    conn->sending = true;
 
     if(conn->type == FIRST_REQUEST) {
         conn->type = CLIENT;
@@ -363,10 +441,37 @@ timer_handler (void* arg) {
     }
     else
         writable(&conn->ctx, IXEVOUT);
+    return true;
+}
 
-    ixev_timer_add(&timer_struct, tv);
-    return;
+void
+flushSendQueue()
+{
+    // Retry messages held back by a busy connection first, preserving the
+    // order of messages on each connection.
+    if (!send_deferred.empty()) {
+        std::deque<queue_elem> retry;
+        std::swap(retry, send_deferred);
+        for (auto it = retry.begin(); it != retry.end(); ++it) {
+            if (!startSend(*it))
+                send_deferred.push_back(std::move(*it));
+        }
+    }
 
+    if (!send_doorbell.exchange(false, std::memory_order_acquire))
+        return;
+    queue_elem e;
+    while (send_queue.tryPop(e)) {
+        bool blocked = false;
+        for (auto it = send_deferred.begin(); it != send_deferred.end(); ++it) {
+            if (it->ctx == e.ctx) {
+                blocked = true;
+                break;
+            }
+        }
+        if (blocked || !startSend(e))
+            send_deferred.push_back(std::move(e));
+    }
 }
 
 struct ixev_ctx*
@@ -379,6 +484,7 @@ accept_cb(struct ip_tuple *id)
     conn->id = *id;
 
     conn->bytes_so_far = 0;
+    conn->sending = false;
     ixev_ctx_init(&conn->ctx);
 
 
@@ -407,14 +513,17 @@ release_cb(struct ixev_ctx *ctx)
 
     // clear both queues
     {
-        std::lock_guard<Core::Mutex> lock(send_queue_mutex);
-        // we need to erase all pending message from the closed context
-        auto it = send_queue.begin();
-        while(it != send_queue.end()) {
+        // Move everything queued so far where it can be searched, then
+        // erase all pending messages for the closed context.
+        queue_elem e;
+        while (send_queue.tryPop(e))
+            send_deferred.push_back(std::move(e));
+        auto it = send_deferred.begin();
+        while(it != send_deferred.end()) {
             if (it->ctx == ctx) {
                 it->message.reset();
                 // erasing gives next valid iterator
-                it = send_queue.erase(it);
+                it = send_deferred.erase(it);
             }
             else
                 it ++;
@@ -555,8 +664,8 @@ readable(struct ixev_ctx *ctx, unsigned int reason)
                 }
             }
             else {
-                SERVER_HANDLER->handleReceivedMessage(ctx, conn->header.messageId,
-                                                      std::move(conn->message));
+                SERVER_HANDLER->handleReceivedMessage(
+                    ctx, conn->header.messageId, std::move(conn->message));
             }
         }
         else {
@@ -607,6 +716,11 @@ writable(struct ixev_ctx *ctx, unsigned int reason)
         if (bytesSend != -EAGAIN){
             ixev_close(ctx);
         }
+        else {
+            // try again once there is room, or this connection would stay
+            // busy (and its later messages deferred) forever
+            ixev_set_handler(ctx, IXEVOUT, &writable);
+        }
         return;
     }
 
@@ -614,11 +728,12 @@ writable(struct ixev_ctx *ctx, unsigned int reason)
     if(conn->bytes_so_far >= total_bytes) {
 
         conn->bytes_so_far = 0;
+        conn->sending = false;
         ixev_set_handler(ctx, IXEVIN, &readable);
     }
     else {
-        // otherwise come back here on IXEVOUT
-        // This is not ok if the timer handle writes more than one message
+        // otherwise come back here on IXEVOUT; flushSendQueue() holds back
+        // further messages for this connection until this one is done
         ixev_set_handler(ctx, IXEVOUT, &writable);
     }
 }
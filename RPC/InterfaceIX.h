@@ -52,6 +52,24 @@ class Handler {
 
 
 void setServerHandler(Handler* handler);
+
+/**
+ * Choose how libix reaches the network: "ix" runs on the IX dataplane kernel,
+ * while "epoll" emulates IX over ordinary Linux sockets, so that this code
+ * path can be tested and profiled on a stock kernel. This must be called
+ * before initializeIx().
+ * \param backend
+ *      "ix" or "epoll".
+ * \param listenAddress
+ *      For "epoll", the IPv4 address to accept connections on, with an
+ *      optional port ("192.168.2.1" or "192.168.2.1:5254"). IX assigns
+ *      addresses through its own configuration, so this is unused for "ix".
+ * \return
+ *      An error message, or the empty string on success.
+ */
+std::string selectBackend(const std::string& backend,
+                          const std::string& listenAddress);
+
 void initializeIx();
 void initializeThread();
 void waitForever();
@@ -60,6 +60,7 @@ Server::RPCHandler::handleRPC(OpaqueServerRPC opaqueRPC)
 Server::Server(Event::Loop& eventLoop, uint32_t maxMessageLength)
     : mutex()
     , services()
+    , dispatcher(std::make_shared<ThreadDispatchService>(0))
     , rpcHandler(*this)
     , opaqueServer(rpcHandler, eventLoop, maxMessageLength)
 {
@@ -78,11 +79,18 @@ Server::bind(const Address& listenAddress)
 void
 Server::registerService(uint16_t serviceId,
                         std::shared_ptr<Service> service,
-                        uint32_t maxThreads)
+                        uint32_t maxThreads,
+                        ThreadDispatchService::Priority priority)
 {
     std::lock_guard<std::mutex> lockGuard(mutex);
-    services[serviceId] =
-        std::make_shared<ThreadDispatchService>(service, 0, maxThreads);
+    dispatcher->addService(serviceId, service, priority, maxThreads);
+    services[serviceId] = dispatcher;
+}
+
+void
+Server::updateServerStats(LogCabin::Protocol::ServerStats& serverStats) const
+{
+    dispatcher->updateServerStats(serverStats);
 }
 
 } // namespace LogCabin::RPC
@@ -21,6 +21,7 @@
 
 #include "RPC/OpaqueServer.h"
 #include "RPC/Service.h"
+#include "RPC/ThreadDispatchService.h"
 
 #ifndef LOGCABIN_RPC_SERVER_H
 #define LOGCABIN_RPC_SERVER_H
@@ -75,10 +76,23 @@ class Server {
      * \param maxThreads
      *      The maximum number of threads to execute RPCs concurrently inside
      *      the service.
+     * \param priority
+     *      Queued RPCs for services with higher priority are started before
+     *      those for services with lower priority. Each service's threads
+     *      are budgeted separately, so a busy low-priority service never
+     *      delays the higher-priority ones.
      */
     void registerService(uint16_t serviceId,
                          std::shared_ptr<Service> service,
-                         uint32_t maxThreads);
+                         uint32_t maxThreads,
+                         ThreadDispatchService::Priority priority =
+                            ThreadDispatchService::Priority::NORMAL);
+
+    /**
+     * Add the state of the RPC thread pool to the given stats. This may be
+     * called from any thread.
+     */
+    void updateServerStats(LogCabin::Protocol::ServerStats& serverStats) const;
 
   private:
     /**
@@ -107,6 +121,12 @@ class Server {
      */
     std::unordered_map<uint16_t, std::shared_ptr<Service>> services;
 
+    /**
+     * The thread pool shared by all registered services. Every entry in
+     * #services points to this.
+     */
+    std::shared_ptr<ThreadDispatchService> dispatcher;
+
     /**
      * Deals with RPCs created by #opaqueServer.
      */
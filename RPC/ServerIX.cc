@@ -60,6 +60,7 @@ Server::RPCHandler::handleRPC(OpaqueServerRPC opaqueRPC)
 Server::Server(uint32_t maxMessageLength)
     : mutex()
     , services()
+    , dispatcher(std::make_shared<ThreadDispatchService>(0))
     , rpcHandler(*this)
     , opaqueServer(rpcHandler, maxMessageLength)
 {
@@ -85,12 +86,13 @@ Server::set_and_wait()
 void
 Server::registerService(uint16_t serviceId,
                         std::shared_ptr<Service> service,
-                        uint32_t maxThreads)
+                        uint32_t maxThreads,
+                        ThreadDispatchService::Priority priority)
 {
     // dispatch service enabled
     std::lock_guard<std::mutex> lockGuard(mutex);
-    services[serviceId] =
-        std::make_shared<ThreadDispatchService>(service, 0, maxThreads);
+    dispatcher->addService(serviceId, service, priority, maxThreads);
+    services[serviceId] = dispatcher;
 
     // comment out to disable service dispatch
     // want one thread here as we already dispatch on handleReceivedMessage
@@ -32,6 +32,8 @@ ServerRPC::ServerRPC(OpaqueServerRPC opaqueRPC)
     , service(0)
     , serviceSpecificErrorVersion(0)
     , opCode(0)
+    , receivedAt(Core::Time::SteadyClock::now())
+    , dispatchedAt(Core::Time::SteadyClock::time_point::min())
 {
     const Core::Buffer& request = this->opaqueRPC.request;
 
@@ -63,6 +65,8 @@ ServerRPC::ServerRPC()
     , service(0)
     , serviceSpecificErrorVersion(0)
     , opCode(0)
+    , receivedAt()
+    , dispatchedAt(Core::Time::SteadyClock::time_point::min())
 {
 }
 
@@ -72,6 +76,8 @@ ServerRPC::ServerRPC(ServerRPC&& other)
     , service(other.service)
     , serviceSpecificErrorVersion(other.serviceSpecificErrorVersion)
     , opCode(other.opCode)
+    , receivedAt(other.receivedAt)
+    , dispatchedAt(other.dispatchedAt)
 {
     other.active = false;
 }
@@ -94,6 +100,8 @@ ServerRPC::operator=(ServerRPC&& other)
     service = other.service;
     serviceSpecificErrorVersion = other.serviceSpecificErrorVersion;
     opCode = other.opCode;
+    receivedAt = other.receivedAt;
+    dispatchedAt = other.dispatchedAt;
     return *this;
 }
 
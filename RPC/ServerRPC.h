@@ -17,6 +17,7 @@
 #include <cinttypes>
 #include <google/protobuf/message.h>
 
+#include "Core/Time.h"
 #include "RPC/Protocol.h"
 
 #ifndef IX_TARGET_BUILD
@@ -104,6 +105,30 @@ class ServerRPC {
         return opCode;
     }
 
+    /**
+     * Return the time at which the request was received, before it waited
+     * for a thread to handle it.
+     */
+    Core::Time::SteadyClock::time_point getReceivedAt() const {
+        return receivedAt;
+    }
+
+    /**
+     * Return the time at which a thread picked up the request to handle it,
+     * as recorded by setDispatchedAt(), or time_point::min() if it wasn't.
+     */
+    Core::Time::SteadyClock::time_point getDispatchedAt() const {
+        return dispatchedAt;
+    }
+
+    /**
+     * Record the time at which a thread picked up the request to handle it
+     * (see getDispatchedAt()). Called by the ThreadDispatchService.
+     */
+    void setDispatchedAt(Core::Time::SteadyClock::time_point when) {
+        dispatchedAt = when;
+    }
+
     /**
      * Parse the request out of the RPC.
      * \param[out] request
@@ -184,6 +209,16 @@ class ServerRPC {
     /// See getOpCode().
     uint16_t opCode;
 
+    /**
+     * See getReceivedAt().
+     */
+    Core::Time::SteadyClock::time_point receivedAt;
+
+    /**
+     * See getDispatchedAt().
+     */
+    Core::Time::SteadyClock::time_point dispatchedAt;
+
     friend class Server;
 
     // ServerRPC is non-copyable.
@@ -115,6 +115,8 @@ TEST_F(RPCServerRPCTest, constructor_normal) {
     EXPECT_EQ(3U, serverRPC.getServiceSpecificErrorVersion());
     EXPECT_EQ(4U, serverRPC.getOpCode());
     EXPECT_TRUE(serverRPC.needsReply());
+    EXPECT_LT(Core::Time::SteadyClock::time_point(),
+              serverRPC.getReceivedAt());
     serverRPC.closeSession();
 }
 
@@ -13,8 +13,10 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <algorithm>
 #include <assert.h>
 
+#include "build/Protocol/ServerStats.pb.h"
 #include "Core/StringUtil.h"
 #include "Core/ThreadId.h"
 #include "RPC/ThreadDispatchService.h"
@@ -22,23 +24,81 @@
 namespace LogCabin {
 namespace RPC {
 
+const std::chrono::milliseconds
+ThreadDispatchService::DEFAULT_IDLE_TIMEOUT = std::chrono::seconds(10);
+
+////////// ThreadDispatchService::Class //////////
+
+ThreadDispatchService::Class::Class(uint16_t serviceId,
+                                    std::shared_ptr<Service> service,
+                                    Priority priority,
+                                    uint32_t maxThreads)
+    : serviceId(serviceId)
+    , service(service)
+    , priority(priority)
+    , maxThreads(maxThreads)
+    , numActive(0)
+    , rpcQueue()
+    , maxQueueDepth(0)
+    , numDispatched(0)
+    , waitNanos()
+{
+}
+
+////////// ThreadDispatchService //////////
+
 ThreadDispatchService::ThreadDispatchService(
         std::shared_ptr<Service> threadSafeService,
         uint32_t minThreads,
         uint32_t maxThreads)
-    : threadSafeService(threadSafeService)
-    , maxThreads(maxThreads)
+    : minThreads(minThreads)
+    , idleTimeout(DEFAULT_IDLE_TIMEOUT)
     , mutex()
     , threads()
+    , numLiveWorkers(0)
+    , exitedWorkers()
     , numFreeWorkers(0)
     , conditionVariable()
     , exit(false)
-    , rpcQueue()
+    , classes()
+    , defaultClass(NULL)
+    , classesByServiceId()
+    , maxThreads(maxThreads)
 {
     assert(minThreads <= maxThreads);
     assert(0 < maxThreads);
-    for (uint32_t i = 0; i < minThreads; ++i)
+    classes.emplace_back(new Class(0, threadSafeService,
+                                   Priority::NORMAL, maxThreads));
+    defaultClass = classes.back().get();
+    std::lock_guard<std::mutex> lockGuard(mutex);
+    for (uint32_t i = 0; i < minThreads; ++i) {
         threads.emplace_back(&ThreadDispatchService::workerMain, this);
+        ++numLiveWorkers;
+    }
+}
+
+ThreadDispatchService::ThreadDispatchService(
+        uint32_t minThreads,
+        std::chrono::nanoseconds idleTimeout)
+    : minThreads(minThreads)
+    , idleTimeout(idleTimeout)
+    , mutex()
+    , threads()
+    , numLiveWorkers(0)
+    , exitedWorkers()
+    , numFreeWorkers(0)
+    , conditionVariable()
+    , exit(false)
+    , classes()
+    , defaultClass(NULL)
+    , classesByServiceId()
+    , maxThreads(minThreads)
+{
+    std::lock_guard<std::mutex> lockGuard(mutex);
+    for (uint32_t i = 0; i < minThreads; ++i) {
+        threads.emplace_back(&ThreadDispatchService::workerMain, this);
+        ++numLiveWorkers;
+    }
 }
 
 ThreadDispatchService::~ThreadDispatchService()
@@ -57,10 +117,46 @@ ThreadDispatchService::~ThreadDispatchService()
     }
 
     // Close the sessions of any remaining RPCs that didn't get processed.
-    while (!rpcQueue.empty()) {
-        rpcQueue.front().closeSession();
-        rpcQueue.pop();
+    for (auto it = classes.begin(); it != classes.end(); ++it) {
+        Class& c = **it;
+        while (!c.rpcQueue.empty()) {
+            c.rpcQueue.front().first.closeSession();
+            c.rpcQueue.pop_front();
+        }
+    }
+}
+
+void
+ThreadDispatchService::addService(uint16_t serviceId,
+                                  std::shared_ptr<Service> threadSafeService,
+                                  Priority priority,
+                                  uint32_t maxThreads)
+{
+    assert(0 < maxThreads);
+    std::lock_guard<std::mutex> lockGuard(mutex);
+    auto it = classesByServiceId.find(serviceId);
+    if (it != classesByServiceId.end()) {
+        // Keep the class (and any queued RPCs), but it may move to a
+        // different spot in the priority order.
+        Class& c = *it->second;
+        c.service = threadSafeService;
+        c.priority = priority;
+        c.maxThreads = maxThreads;
+    } else {
+        classes.emplace_back(new Class(serviceId, threadSafeService,
+                                       priority, maxThreads));
+        classesByServiceId[serviceId] = classes.back().get();
     }
+    std::stable_sort(classes.begin(), classes.end(),
+                     [] (const std::unique_ptr<Class>& a,
+                         const std::unique_ptr<Class>& b) {
+                         return a->priority < b->priority;
+                     });
+    uint32_t total = 0;
+    for (auto it2 = classes.begin(); it2 != classes.end(); ++it2)
+        total += (*it2)->maxThreads;
+    this->maxThreads = std::max(total, minThreads);
+    conditionVariable.notify_all();
 }
 
 void
@@ -68,16 +164,104 @@ ThreadDispatchService::handleRPC(ServerRPC serverRPC)
 {
     std::lock_guard<std::mutex> lockGuard(mutex);
     assert(!exit);
-    rpcQueue.push(std::move(serverRPC));
-    if (numFreeWorkers == 0 && threads.size() < maxThreads)
+    reapThreads();
+    Class* c = defaultClass;
+    auto it = classesByServiceId.find(serverRPC.getService());
+    if (it != classesByServiceId.end())
+        c = it->second;
+    if (c == NULL) {
+        serverRPC.rejectInvalidService();
+        return;
+    }
+    c->rpcQueue.emplace_back(std::move(serverRPC), Clock::now());
+    c->maxQueueDepth = std::max(c->maxQueueDepth,
+                                uint64_t(c->rpcQueue.size()));
+    if (numFreeWorkers < numRunnable() && numLiveWorkers < maxThreads) {
         threads.emplace_back(&ThreadDispatchService::workerMain, this);
+        ++numLiveWorkers;
+    }
     conditionVariable.notify_one();
 }
 
 std::string
 ThreadDispatchService::getName() const
 {
-    return threadSafeService->getName();
+    std::lock_guard<std::mutex> lockGuard(mutex);
+    if (defaultClass != NULL)
+        return defaultClass->service->getName();
+    return "ThreadDispatchService";
+}
+
+void
+ThreadDispatchService::updateServerStats(
+        LogCabin::Protocol::ServerStats& serverStats) const
+{
+    std::lock_guard<std::mutex> lockGuard(mutex);
+    TimePoint now = Clock::now();
+    LogCabin::Protocol::ServerStats::Dispatch& stats =
+        *serverStats.mutable_dispatch();
+    stats.set_num_threads(numLiveWorkers);
+    stats.set_num_free_threads(numFreeWorkers);
+    for (auto it = classes.begin(); it != classes.end(); ++it) {
+        const Class& c = **it;
+        LogCabin::Protocol::ServerStats::Dispatch::Service& s =
+            *stats.add_service();
+        if (&c != defaultClass)
+            s.set_service_id(c.serviceId);
+        s.set_name(c.service->getName());
+        s.set_priority(uint32_t(c.priority));
+        s.set_max_threads(c.maxThreads);
+        s.set_active_threads(c.numActive);
+        s.set_queue_depth(c.rpcQueue.size());
+        s.set_max_queue_depth(c.maxQueueDepth);
+        s.set_num_dispatched(c.numDispatched);
+        if (!c.rpcQueue.empty()) {
+            s.set_oldest_wait_nanos(uint64_t(std::chrono::nanoseconds(
+                now - c.rpcQueue.front().second).count()));
+        }
+        c.waitNanos.updateProtoBuf(*s.mutable_wait_nanos());
+    }
+}
+
+ThreadDispatchService::Class*
+ThreadDispatchService::findRunnable()
+{
+    for (auto it = classes.begin(); it != classes.end(); ++it) {
+        if ((*it)->isRunnable())
+            return it->get();
+    }
+    return NULL;
+}
+
+uint64_t
+ThreadDispatchService::numRunnable() const
+{
+    uint64_t count = 0;
+    for (auto it = classes.begin(); it != classes.end(); ++it) {
+        const Class& c = **it;
+        if (c.numActive < c.maxThreads) {
+            count += std::min(uint64_t(c.rpcQueue.size()),
+                              uint64_t(c.maxThreads - c.numActive));
+        }
+    }
+    return count;
+}
+
+void
+ThreadDispatchService::reapThreads()
+{
+    // Workers add themselves to exitedWorkers just before returning, after
+    // which they no longer need the mutex, so joining them here is quick.
+    for (auto id = exitedWorkers.begin(); id != exitedWorkers.end(); ++id) {
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            if (it->get_id() == *id) {
+                it->join();
+                threads.erase(it);
+                break;
+            }
+        }
+    }
+    exitedWorkers.clear();
 }
 
 void
@@ -85,23 +269,56 @@ ThreadDispatchService::workerMain()
 {
     Core::ThreadId::setName(
         Core::StringUtil::format("%s(%lu)",
-                                 threadSafeService->getName().c_str(),
+                                 getName().c_str(),
                                  Core::ThreadId::getId()));
+    // The thread is named after the service whose RPC it last handled, since
+    // workers in a shared pool run RPCs for every service.
+    const Class* namedAfter = NULL;
+    std::unique_lock<std::mutex> lockGuard(mutex);
     while (true) {
-        ServerRPC rpc;
-        { // find an RPC to process
-            std::unique_lock<std::mutex> lockGuard(mutex);
-            ++numFreeWorkers;
-            while (!exit && rpcQueue.empty())
+        // find an RPC to process
+        Class* c = NULL;
+        ++numFreeWorkers;
+        TimePoint idleDeadline = Clock::now() + idleTimeout;
+        while (!exit && (c = findRunnable()) == NULL) {
+            if (numLiveWorkers <= minThreads) {
                 conditionVariable.wait(lockGuard);
-            --numFreeWorkers;
-            if (exit)
+                continue;
+            }
+            if (Clock::now() >= idleDeadline) {
+                --numFreeWorkers;
+                --numLiveWorkers;
+                exitedWorkers.push_back(std::this_thread::get_id());
                 return;
-            rpc = std::move(rpcQueue.front());
-            rpcQueue.pop();
+            }
+            conditionVariable.wait_until(lockGuard, idleDeadline);
         }
+        --numFreeWorkers;
+        if (exit)
+            return;
+        ServerRPC rpc = std::move(c->rpcQueue.front().first);
+        TimePoint now = Clock::now();
+        rpc.setDispatchedAt(now);
+        c->waitNanos.push(uint64_t(std::chrono::nanoseconds(
+            now - c->rpcQueue.front().second).count()));
+        c->rpcQueue.pop_front();
+        ++c->numActive;
+        ++c->numDispatched;
+        std::shared_ptr<Service> service = c->service;
+
         // execute RPC handler
-        threadSafeService->handleRPC(std::move(rpc));
+        lockGuard.unlock();
+        if (c != namedAfter) {
+            Core::ThreadId::setName(
+                Core::StringUtil::format("%s(%lu)",
+                                         service->getName().c_str(),
+                                         Core::ThreadId::getId()));
+            namedAfter = c;
+        }
+        service->handleRPC(std::move(rpc));
+        lockGuard.lock();
+
+        --c->numActive;
     }
 }
 
@@ -14,12 +14,16 @@
  */
 
 #include <cinttypes>
+#include <deque>
+#include <map>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <vector>
 
 #include "Core/ConditionVariable.h"
+#include "Core/Histogram.h"
+#include "Core/Time.h"
 #include "RPC/ServerRPC.h"
 #include "RPC/Service.h"
 
@@ -27,22 +31,62 @@
 #define LOGCABIN_RPC_THREADDISPATCHSERVICE_H
 
 namespace LogCabin {
+
+// forward declaration
+namespace Protocol {
+class ServerStats;
+}
+
 namespace RPC {
 
 /**
  * This class is an adaptor to enable multi-threaded services.
  * This Service is intended to plug into a Server and run directly on the
- * Event::Loop thread. You provide it with another Service on the constructor,
- * and the job of this class is to manage a thread pool on which to call
- * your Service's handleRPC() method.
+ * Event::Loop thread. You provide it with one or more other Services, and the
+ * job of this class is to manage a thread pool on which to call your
+ * Services' handleRPC() methods.
+ *
+ * Each Service is assigned a priority class with its own queue and its own
+ * budget of threads. Whenever a worker is free, it takes the oldest RPC from
+ * the highest-priority queue whose class is under its budget. Because the
+ * pool may grow to the sum of all the budgets, a class that has used up its
+ * own budget (for example, client RPCs blocked waiting for their commands to
+ * commit) never prevents a higher-priority RPC from starting right away.
+ * Workers beyond the minimum exit after sitting idle for a while.
  */
 class ThreadDispatchService : public Service {
   public:
     /**
-     * Constructor.
+     * Scheduling classes, from most to least urgent.
+     */
+    enum class Priority {
+        /**
+         * For RPCs that keep the cluster healthy, such as Raft's heartbeats
+         * and elections, which should never wait behind other work.
+         */
+        HIGH = 0,
+        /**
+         * For administrative RPCs.
+         */
+        NORMAL = 1,
+        /**
+         * For client RPCs, which may be plentiful and long-running.
+         */
+        LOW = 2,
+    };
+
+    /**
+     * Default for how long workers beyond the minimum may sit idle before
+     * exiting.
+     */
+    static const std::chrono::milliseconds DEFAULT_IDLE_TIMEOUT;
+
+    /**
+     * Constructor for dispatching to a single service.
      * \param threadSafeService
      *      The underlying service that will handle RPCs inside of worker
-     *      threads spawned by this class.
+     *      threads spawned by this class. RPCs for any service ID are sent
+     *      to it, unless another service is added with addService().
      * \param minThreads
      *      The number of threads with which to start the thread pool.
      *      These will be created in the constructor.
@@ -55,44 +99,169 @@ class ThreadDispatchService : public Service {
     ThreadDispatchService(std::shared_ptr<Service> threadSafeService,
                           uint32_t minThreads, uint32_t maxThreads);
 
+    /**
+     * Constructor for dispatching to multiple services, which must be added
+     * with addService().
+     * \param minThreads
+     *      The number of threads with which to start the thread pool.
+     *      These will be created in the constructor and are never reaped.
+     * \param idleTimeout
+     *      How long workers beyond 'minThreads' may wait for work before
+     *      exiting.
+     */
+    explicit ThreadDispatchService(
+        uint32_t minThreads,
+        std::chrono::nanoseconds idleTimeout = DEFAULT_IDLE_TIMEOUT);
+
     /**
      * Destructor. This will attempt to join all threads and will close
      * sessions on RPCs that have not been serviced.
      */
     ~ThreadDispatchService();
 
+    /**
+     * Start dispatching RPCs for the given service ID. If a service has
+     * already been added for this ID, this will replace it and its priority
+     * and budget.
+     * \param serviceId
+     *      RPCs with this service ID will be handled by 'threadSafeService'.
+     * \param threadSafeService
+     *      The underlying service that will handle RPCs inside of worker
+     *      threads spawned by this class.
+     * \param priority
+     *      Determines which queued RPCs are started first.
+     * \param maxThreads
+     *      The maximum number of RPCs for this service that may execute
+     *      concurrently. Must be more than 0.
+     */
+    void addService(uint16_t serviceId,
+                    std::shared_ptr<Service> threadSafeService,
+                    Priority priority,
+                    uint32_t maxThreads);
+
     void handleRPC(ServerRPC serverRPC);
     std::string getName() const;
 
+    /**
+     * Add the queue depths, thread counts, and queueing delays for each
+     * service to the given stats.
+     */
+    void updateServerStats(LogCabin::Protocol::ServerStats& serverStats) const;
+
   private:
+    typedef Core::Time::SteadyClock Clock;
+    typedef Clock::time_point TimePoint;
+
+    /**
+     * The state kept for each service.
+     */
+    struct Class {
+        Class(uint16_t serviceId,
+              std::shared_ptr<Service> service,
+              Priority priority,
+              uint32_t maxThreads);
+
+        /**
+         * Return true if a worker could start one of this class's RPCs now.
+         */
+        bool isRunnable() const {
+            return !rpcQueue.empty() && numActive < maxThreads;
+        }
+
+        /**
+         * The service ID this class is registered under (unused for the
+         * default class).
+         */
+        const uint16_t serviceId;
+        /**
+         * The service that will handle RPCs inside worker threads.
+         */
+        std::shared_ptr<Service> service;
+        /**
+         * See addService().
+         */
+        Priority priority;
+        /**
+         * See addService().
+         */
+        uint32_t maxThreads;
+        /**
+         * The number of RPCs currently being handled by workers.
+         */
+        uint32_t numActive;
+        /**
+         * The RPCs waiting for a worker, along with when they were queued.
+         */
+        std::deque<std::pair<ServerRPC, TimePoint>> rpcQueue;
+        /**
+         * The largest rpcQueue has ever been.
+         */
+        uint64_t maxQueueDepth;
+        /**
+         * The number of RPCs handed to workers.
+         */
+        uint64_t numDispatched;
+        /**
+         * How long RPCs waited in rpcQueue.
+         */
+        Core::Histogram waitNanos;
+    };
+
     /**
      * The main loop executed in workers.
      */
     void workerMain();
 
     /**
-     * The service that will handle RPCs inside of worker thread spawned by
-     * this class.
+     * Return the highest-priority class with an RPC that can be started now,
+     * or NULL if there is none.
+     */
+    Class* findRunnable();
+
+    /**
+     * Return the number of RPCs that could be started now if there were
+     * enough free workers.
+     */
+    uint64_t numRunnable() const;
+
+    /**
+     * Join threads whose workers have exited.
      */
-    std::shared_ptr<Service> threadSafeService;
+    void reapThreads();
 
     /**
-     * The maximum number of threads this class is allowed to use for its
-     * thread pool.
+     * The number of threads started in the constructor, which are never
+     * reaped.
      */
-    const uint32_t maxThreads;
+    const uint32_t minThreads;
+
+    /**
+     * See the constructor.
+     */
+    const std::chrono::nanoseconds idleTimeout;
 
     /**
      * This mutex protects all of the members of this class defined below this
      * point.
      */
-    std::mutex mutex;
+    mutable std::mutex mutex;
 
     /**
-     * The thread pool of workers that process RPCs.
+     * The thread pool of workers that process RPCs. This may include workers
+     * that have exited but have not yet been joined.
      */
     std::vector<std::thread> threads;
 
+    /**
+     * The number of workers that have not exited.
+     */
+    uint32_t numLiveWorkers;
+
+    /**
+     * Workers that have exited and need to be joined.
+     */
+    std::vector<std::thread::id> exitedWorkers;
+
     /**
      * The number of workers that are waiting for work (on the condition
      * variable). This is used to dynamically launch new workers when
@@ -112,9 +281,27 @@ class ThreadDispatchService : public Service {
     bool exit;
 
     /**
-     * The queue of work that worker threads pull from.
+     * Every class, ordered by priority (then by when it was added).
+     */
+    std::vector<std::unique_ptr<Class>> classes;
+
+    /**
+     * The class for RPCs whose service ID was not given to addService(), or
+     * NULL to reject such RPCs. Points into #classes.
+     */
+    Class* defaultClass;
+
+    /**
+     * Maps service IDs given to addService() to their classes. Points into
+     * #classes.
+     */
+    std::map<uint16_t, Class*> classesByServiceId;
+
+    /**
+     * The sum of all the classes' thread budgets (but at least minThreads):
+     * the thread pool never grows past this.
      */
-    std::queue<ServerRPC> rpcQueue;
+    uint32_t maxThreads;
 
     // ThreadDispatchService is non-copyable.
     ThreadDispatchService(const ThreadDispatchService&) = delete;
@@ -16,6 +16,7 @@
 #include <gtest/gtest.h>
 #include <unistd.h>
 
+#include "build/Protocol/ServerStats.pb.h"
 #include "Core/CompatAtomic.h"
 #include "RPC/ThreadDispatchService.h"
 
@@ -27,10 +28,13 @@ class EchoService : public RPC::Service {
     EchoService()
         : sleepMicros(0)
         , count(0)
+        , numDispatchedAtSet(0)
     {
     }
     void handleRPC(RPC::ServerRPC serverRPC) {
         usleep(sleepMicros);
+        if (serverRPC.getDispatchedAt() >= serverRPC.getReceivedAt())
+            ++numDispatchedAtSet;
         ++count;
     }
     std::string getName() const {
@@ -38,6 +42,7 @@ class EchoService : public RPC::Service {
     }
     std::atomic<uint32_t> sleepMicros;
     std::atomic<uint32_t> count;
+    std::atomic<uint32_t> numDispatchedAtSet;
 };
 
 
@@ -88,12 +93,139 @@ TEST_F(RPCThreadDispatchServiceTest, handleRPC)
     while (echoService->count < 10)
         usleep(1000);
     EXPECT_EQ(10U, echoService->count);
+    EXPECT_EQ(10U, echoService->numDispatchedAtSet);
     EXPECT_EQ(2U, dispatchService.threads.size());
 }
 
-TEST_F(RPCThreadDispatchServiceTest, workerMain)
+TEST_F(RPCThreadDispatchServiceTest, handleRPC_budgets)
 {
-    // most of this is tested already in the other tests
+    // A service that has used up its budget doesn't hold up another.
+    ThreadDispatchService dispatchService(0);
+    auto slowService = std::make_shared<EchoService>();
+    slowService->sleepMicros = 100000;
+    dispatchService.addService(0, slowService,
+                               ThreadDispatchService::Priority::LOW, 1);
+    dispatchService.addService(1, echoService,
+                               ThreadDispatchService::Priority::HIGH, 1);
+    dispatchService.handleRPC(ServerRPC());
+    dispatchService.handleRPC(ServerRPC());
+    ServerRPC rpc;
+    rpc.service = 1;
+    dispatchService.handleRPC(std::move(rpc));
+    while (echoService->count < 1)
+        usleep(1000);
+    EXPECT_EQ(0U, slowService->count);
+    slowService->sleepMicros = 0;
+    while (slowService->count < 2)
+        usleep(1000);
+    std::lock_guard<std::mutex> lockGuard(dispatchService.mutex);
+    EXPECT_EQ(2U, dispatchService.threads.size());
+}
+
+TEST_F(RPCThreadDispatchServiceTest, addService)
+{
+    ThreadDispatchService dispatchService(0);
+    auto lowService = std::make_shared<EchoService>();
+    dispatchService.addService(3, lowService,
+                               ThreadDispatchService::Priority::LOW, 2);
+    dispatchService.addService(4, echoService,
+                               ThreadDispatchService::Priority::NORMAL, 3);
+    EXPECT_EQ(5U, dispatchService.maxThreads);
+    ASSERT_EQ(2U, dispatchService.classes.size());
+    EXPECT_EQ(4U, dispatchService.classes.at(0)->serviceId);
+    EXPECT_EQ(3U, dispatchService.classes.at(1)->serviceId);
+    // replace
+    dispatchService.addService(3, lowService,
+                               ThreadDispatchService::Priority::HIGH, 1);
+    EXPECT_EQ(4U, dispatchService.maxThreads);
+    ASSERT_EQ(2U, dispatchService.classes.size());
+    EXPECT_EQ(3U, dispatchService.classes.at(0)->serviceId);
+    EXPECT_EQ(4U, dispatchService.classes.at(1)->serviceId);
+}
+
+TEST_F(RPCThreadDispatchServiceTest, findRunnable)
+{
+    typedef ThreadDispatchService::TimePoint TimePoint;
+    ThreadDispatchService dispatchService(0);
+    dispatchService.addService(1, echoService,
+                               ThreadDispatchService::Priority::LOW, 1);
+    dispatchService.addService(2, echoService,
+                               ThreadDispatchService::Priority::HIGH, 1);
+    std::lock_guard<std::mutex> lockGuard(dispatchService.mutex);
+    ThreadDispatchService::Class* low =
+        dispatchService.classesByServiceId.at(1);
+    ThreadDispatchService::Class* high =
+        dispatchService.classesByServiceId.at(2);
+    EXPECT_TRUE(NULL == dispatchService.findRunnable());
+    low->rpcQueue.emplace_back(ServerRPC(), TimePoint());
+    low->rpcQueue.emplace_back(ServerRPC(), TimePoint());
+    EXPECT_EQ(low, dispatchService.findRunnable());
+    EXPECT_EQ(1U, dispatchService.numRunnable());
+    high->rpcQueue.emplace_back(ServerRPC(), TimePoint());
+    EXPECT_EQ(high, dispatchService.findRunnable());
+    EXPECT_EQ(2U, dispatchService.numRunnable());
+    high->numActive = 1;
+    EXPECT_EQ(low, dispatchService.findRunnable());
+    low->numActive = 1;
+    EXPECT_TRUE(NULL == dispatchService.findRunnable());
+    EXPECT_EQ(0U, dispatchService.numRunnable());
+    low->numActive = 0;
+    high->numActive = 0;
+    low->rpcQueue.clear();
+    high->rpcQueue.clear();
+}
+
+TEST_F(RPCThreadDispatchServiceTest, updateServerStats)
+{
+    ThreadDispatchService dispatchService(0);
+    dispatchService.addService(1, echoService,
+                               ThreadDispatchService::Priority::HIGH, 2);
+    ServerRPC rpc;
+    rpc.service = 1;
+    dispatchService.handleRPC(std::move(rpc));
+    while (echoService->count < 1)
+        usleep(1000);
+    LogCabin::Protocol::ServerStats stats;
+    dispatchService.updateServerStats(stats);
+    ASSERT_EQ(1, stats.dispatch().service_size());
+    const LogCabin::Protocol::ServerStats::Dispatch::Service& s =
+        stats.dispatch().service(0);
+    EXPECT_EQ(1U, s.service_id());
+    EXPECT_EQ("EchoService", s.name());
+    EXPECT_EQ(0U, s.priority());
+    EXPECT_EQ(2U, s.max_threads());
+    EXPECT_EQ(1U, s.max_queue_depth());
+    EXPECT_EQ(1U, s.num_dispatched());
+    EXPECT_EQ(1U, s.wait_nanos().count());
+    EXPECT_EQ(1U, stats.dispatch().num_threads());
+}
+
+TEST_F(RPCThreadDispatchServiceTest, workerMain_idle)
+{
+    ThreadDispatchService dispatchService(1, std::chrono::milliseconds(1));
+    dispatchService.addService(1, echoService,
+                               ThreadDispatchService::Priority::HIGH, 3);
+    for (uint32_t i = 0; i < 3; ++i) {
+        ServerRPC rpc;
+        rpc.service = 1;
+        dispatchService.handleRPC(std::move(rpc));
+    }
+    // Extra workers exit once idle, down to the minimum.
+    for (uint32_t i = 0; i < 1000; ++i) {
+        {
+            std::lock_guard<std::mutex> lockGuard(dispatchService.mutex);
+            if (echoService->count == 3 &&
+                dispatchService.numLiveWorkers == 1) {
+                break;
+            }
+        }
+        usleep(1000);
+    }
+    std::lock_guard<std::mutex> lockGuard(dispatchService.mutex);
+    EXPECT_EQ(3U, echoService->count);
+    EXPECT_EQ(1U, dispatchService.numLiveWorkers);
+    dispatchService.reapThreads();
+    EXPECT_EQ(1U, dispatchService.threads.size());
 }
 
 } // namespace LogCabin::RPC::<anonymous>
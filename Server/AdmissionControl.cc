@@ -0,0 +1,130 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "build/Protocol/ServerStats.pb.h"
+#include "Core/Config.h"
+#include "Core/Debug.h"
+#include "Server/AdmissionControl.h"
+
+namespace LogCabin {
+namespace Server {
+
+AdmissionControl::AdmissionControl()
+    : mutex()
+    , maxInFlightBytes(0)
+    , maxUncommittedEntries(0)
+    , queueDelayTarget(0)
+    , queueDelayInterval(0)
+    , inFlightBytes(0)
+    , sheddingStartsAt(TimePoint::max())
+    , numAdmitted(0)
+    , numShed()
+{
+}
+
+AdmissionControl::~AdmissionControl()
+{
+}
+
+void
+AdmissionControl::init(const Core::Config& config)
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    maxInFlightBytes =
+        config.read<uint64_t>("clientMaxInFlightBytes", 0);
+    maxUncommittedEntries =
+        config.read<uint64_t>("clientMaxUncommittedEntries", 0);
+    queueDelayTarget = std::chrono::milliseconds(
+        config.read<uint64_t>("clientQueueDelayTargetMilliseconds", 0));
+    queueDelayInterval = std::chrono::milliseconds(
+        config.read<uint64_t>("clientQueueDelayIntervalMilliseconds", 100));
+}
+
+AdmissionControl::Result
+AdmissionControl::admit(uint64_t bytes,
+                        TimePoint receivedAt,
+                        uint64_t uncommittedEntries,
+                        TimePoint now)
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    Result result = ADMITTED;
+
+    if (queueDelayTarget.count() > 0) {
+        if (now - receivedAt < queueDelayTarget) {
+            sheddingStartsAt = TimePoint::max();
+        } else if (sheddingStartsAt == TimePoint::max()) {
+            sheddingStartsAt = now + queueDelayInterval;
+        } else if (now >= sheddingStartsAt) {
+            result = SHED_QUEUE_DELAY;
+        }
+    }
+
+    if (result == ADMITTED &&
+        maxUncommittedEntries > 0 &&
+        uncommittedEntries >= maxUncommittedEntries) {
+        result = SHED_UNCOMMITTED_ENTRIES;
+    }
+
+    if (result == ADMITTED &&
+        maxInFlightBytes > 0 &&
+        inFlightBytes > 0 &&
+        inFlightBytes + bytes > maxInFlightBytes) {
+        result = SHED_IN_FLIGHT_BYTES;
+    }
+
+    if (result == ADMITTED) {
+        inFlightBytes += bytes;
+        ++numAdmitted;
+    } else {
+        ++numShed[result];
+    }
+    return result;
+}
+
+void
+AdmissionControl::release(uint64_t bytes)
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    if (bytes > inFlightBytes) {
+        PANIC("Releasing %lu bytes but only %lu are in flight",
+              bytes, inFlightBytes);
+    }
+    inFlightBytes -= bytes;
+}
+
+uint64_t
+AdmissionControl::getInFlightBytes() const
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    return inFlightBytes;
+}
+
+void
+AdmissionControl::updateServerStats(Protocol::ServerStats& serverStats) const
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    Protocol::ServerStats::Admission& stats = *serverStats.mutable_admission();
+    stats.set_max_in_flight_bytes(maxInFlightBytes);
+    stats.set_max_uncommitted_entries(maxUncommittedEntries);
+    stats.set_queue_delay_target_nanos(uint64_t(queueDelayTarget.count()));
+    stats.set_in_flight_bytes(inFlightBytes);
+    stats.set_num_admitted(numAdmitted);
+    stats.set_num_shed_in_flight_bytes(numShed[SHED_IN_FLIGHT_BYTES]);
+    stats.set_num_shed_uncommitted_entries(numShed[SHED_UNCOMMITTED_ENTRIES]);
+    stats.set_num_shed_queue_delay(numShed[SHED_QUEUE_DELAY]);
+}
+
+} // namespace LogCabin::Server
+} // namespace LogCabin
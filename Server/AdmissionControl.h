@@ -0,0 +1,194 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LOGCABIN_SERVER_ADMISSIONCONTROL_H
+#define LOGCABIN_SERVER_ADMISSIONCONTROL_H
+
+#include <cinttypes>
+
+#include "Core/Mutex.h"
+#include "Core/Time.h"
+
+namespace LogCabin {
+
+// forward declarations
+namespace Core {
+class Config;
+}
+namespace Protocol {
+class ServerStats;
+}
+
+namespace Server {
+
+/**
+ * Decides whether the ClientService should start processing a client write or
+ * turn it away, so that a leader that is receiving more writes than it can
+ * commit sheds the excess quickly instead of letting queues and latencies grow
+ * without bound. Rejected clients are told to retry later (see
+ * Protocol::Client::Error::OVERLOADED), and they back off before doing so.
+ *
+ * A write is rejected if admitting it would exceed any of these limits:
+ *  - The total size of the writes admitted but not yet replied to.
+ *  - The number of log entries that have been appended but not yet committed.
+ *  - The time RPCs wait for a thread before being handled. Like CoDel, this
+ *    tolerates short bursts: writes are only rejected once the wait has stayed
+ *    above the target for a full interval, and rejection stops as soon as an
+ *    RPC arrives that waited less than the target.
+ * Each limit is disabled when set to 0, which is the default.
+ *
+ * This class is thread-safe.
+ */
+class AdmissionControl {
+  public:
+    typedef Core::Time::SteadyClock Clock;
+    typedef Clock::time_point TimePoint;
+
+    /**
+     * The outcome of admit().
+     */
+    enum Result {
+        /**
+         * The write may proceed; the caller must call release() once done.
+         */
+        ADMITTED = 0,
+        /**
+         * Rejected because too many bytes are in flight.
+         */
+        SHED_IN_FLIGHT_BYTES,
+        /**
+         * Rejected because too many entries are uncommitted.
+         */
+        SHED_UNCOMMITTED_ENTRIES,
+        /**
+         * Rejected because RPCs have been queued too long.
+         */
+        SHED_QUEUE_DELAY,
+    };
+
+    /**
+     * Constructor. All limits are disabled until init() is called.
+     */
+    AdmissionControl();
+
+    /**
+     * Destructor.
+     */
+    ~AdmissionControl();
+
+    /**
+     * Read the limits from the server's configuration.
+     */
+    void init(const Core::Config& config);
+
+    /**
+     * Decide whether to process a client write.
+     * \param bytes
+     *      The size of the write's request.
+     * \param receivedAt
+     *      When the RPC arrived at the server.
+     * \param uncommittedEntries
+     *      The number of entries in the leader's log past its commit index.
+     * \param now
+     *      The current time.
+     * \return
+     *      ADMITTED if the write may proceed, in which case the caller must
+     *      later call release() with the same number of bytes. Otherwise, the
+     *      reason the write was rejected.
+     */
+    Result admit(uint64_t bytes,
+                 TimePoint receivedAt,
+                 uint64_t uncommittedEntries,
+                 TimePoint now = Clock::now());
+
+    /**
+     * Note that a write that was admitted has been replied to.
+     * \param bytes
+     *      The number of bytes that were passed to admit().
+     */
+    void release(uint64_t bytes);
+
+    /**
+     * Return the number of bytes currently admitted.
+     */
+    uint64_t getInFlightBytes() const;
+
+    /**
+     * Add admission counters to the given stats.
+     */
+    void updateServerStats(Protocol::ServerStats& serverStats) const;
+
+  private:
+    /**
+     * Protects all of the following members.
+     */
+    mutable Core::Mutex mutex;
+
+    /**
+     * Upper bound on inFlightBytes, or 0 for no limit. A write larger than
+     * this is still admitted when nothing else is in flight, so that it can
+     * make progress.
+     */
+    uint64_t maxInFlightBytes;
+
+    /**
+     * Upper bound on the number of uncommitted entries, or 0 for no limit.
+     */
+    uint64_t maxUncommittedEntries;
+
+    /**
+     * Queueing delay that RPCs are expected to stay under, or 0 to disable
+     * the queueing delay check.
+     */
+    std::chrono::nanoseconds queueDelayTarget;
+
+    /**
+     * How long the queueing delay must stay above queueDelayTarget before
+     * writes are rejected.
+     */
+    std::chrono::nanoseconds queueDelayInterval;
+
+    /**
+     * The total size of the writes admitted but not yet released.
+     */
+    uint64_t inFlightBytes;
+
+    /**
+     * If the queueing delay has been above the target since some time, this
+     * is that time plus queueDelayInterval: writes are rejected after it.
+     * TimePoint::max() while the delay is below the target.
+     */
+    TimePoint sheddingStartsAt;
+
+    /**
+     * The number of writes admitted.
+     */
+    uint64_t numAdmitted;
+
+    /**
+     * Indexed by Result: the number of writes rejected for each reason. The
+     * ADMITTED entry is unused.
+     */
+    uint64_t numShed[SHED_QUEUE_DELAY + 1];
+
+    // AdmissionControl is non-copyable.
+    AdmissionControl(const AdmissionControl&) = delete;
+    AdmissionControl& operator=(const AdmissionControl&) = delete;
+};
+
+} // namespace LogCabin::Server
+} // namespace LogCabin
+
+#endif /* LOGCABIN_SERVER_ADMISSIONCONTROL_H */
@@ -0,0 +1,132 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "build/Protocol/ServerStats.pb.h"
+#include "Core/Config.h"
+#include "Core/ProtoBuf.h"
+#include "Server/AdmissionControl.h"
+
+namespace LogCabin {
+namespace Server {
+namespace {
+
+typedef AdmissionControl::TimePoint TimePoint;
+
+TimePoint
+at(uint64_t millis)
+{
+    return TimePoint(std::chrono::milliseconds(1000000 + millis));
+}
+
+TEST(ServerAdmissionControlTest, disabled) {
+    AdmissionControl admission;
+    EXPECT_EQ(AdmissionControl::ADMITTED,
+              admission.admit(1 << 30, at(0), 1 << 30, at(100000)));
+    EXPECT_EQ(1U << 30, admission.getInFlightBytes());
+    admission.release(1 << 30);
+    EXPECT_EQ(0U, admission.getInFlightBytes());
+}
+
+TEST(ServerAdmissionControlTest, admit_inFlightBytes) {
+    Core::Config config;
+    config.set("clientMaxInFlightBytes", "100");
+    AdmissionControl admission;
+    admission.init(config);
+    // a large write is let through on its own
+    EXPECT_EQ(AdmissionControl::ADMITTED,
+              admission.admit(150, at(0), 0, at(0)));
+    EXPECT_EQ(AdmissionControl::SHED_IN_FLIGHT_BYTES,
+              admission.admit(1, at(0), 0, at(0)));
+    admission.release(150);
+    EXPECT_EQ(AdmissionControl::ADMITTED,
+              admission.admit(60, at(0), 0, at(0)));
+    EXPECT_EQ(AdmissionControl::ADMITTED,
+              admission.admit(40, at(0), 0, at(0)));
+    EXPECT_EQ(AdmissionControl::SHED_IN_FLIGHT_BYTES,
+              admission.admit(1, at(0), 0, at(0)));
+    EXPECT_EQ(100U, admission.getInFlightBytes());
+}
+
+TEST(ServerAdmissionControlTest, admit_uncommittedEntries) {
+    Core::Config config;
+    config.set("clientMaxUncommittedEntries", "10");
+    AdmissionControl admission;
+    admission.init(config);
+    EXPECT_EQ(AdmissionControl::ADMITTED,
+              admission.admit(1, at(0), 9, at(0)));
+    EXPECT_EQ(AdmissionControl::SHED_UNCOMMITTED_ENTRIES,
+              admission.admit(1, at(0), 10, at(0)));
+    EXPECT_EQ(1U, admission.getInFlightBytes());
+}
+
+TEST(ServerAdmissionControlTest, admit_queueDelay) {
+    Core::Config config;
+    config.set("clientQueueDelayTargetMilliseconds", "5");
+    config.set("clientQueueDelayIntervalMilliseconds", "100");
+    AdmissionControl admission;
+    admission.init(config);
+    // above target, but not yet for a full interval
+    EXPECT_EQ(AdmissionControl::ADMITTED,
+              admission.admit(1, at(0), 0, at(10)));
+    EXPECT_EQ(AdmissionControl::ADMITTED,
+              admission.admit(1, at(50), 0, at(109)));
+    EXPECT_EQ(AdmissionControl::SHED_QUEUE_DELAY,
+              admission.admit(1, at(100), 0, at(110)));
+    EXPECT_EQ(AdmissionControl::SHED_QUEUE_DELAY,
+              admission.admit(1, at(150), 0, at(160)));
+    // one RPC under the target resets the interval
+    EXPECT_EQ(AdmissionControl::ADMITTED,
+              admission.admit(1, at(160), 0, at(161)));
+    EXPECT_EQ(AdmissionControl::ADMITTED,
+              admission.admit(1, at(160), 0, at(170)));
+}
+
+TEST(ServerAdmissionControlTest, release_tooMuch) {
+    AdmissionControl admission;
+    admission.admit(5, at(0), 0, at(0));
+    EXPECT_DEATH(admission.release(6),
+                 "Releasing 6 bytes but only 5 are in flight");
+}
+
+TEST(ServerAdmissionControlTest, updateServerStats) {
+    Core::Config config;
+    config.set("clientMaxInFlightBytes", "10");
+    config.set("clientMaxUncommittedEntries", "20");
+    config.set("clientQueueDelayTargetMilliseconds", "3");
+    AdmissionControl admission;
+    admission.init(config);
+    admission.admit(10, at(0), 0, at(0));
+    admission.admit(1, at(0), 0, at(0));
+    admission.admit(1, at(0), 20, at(0));
+    Protocol::ServerStats stats;
+    admission.updateServerStats(stats);
+    EXPECT_EQ("admission { "
+              "  max_in_flight_bytes: 10 "
+              "  max_uncommitted_entries: 20 "
+              "  queue_delay_target_nanos: 3000000 "
+              "  in_flight_bytes: 10 "
+              "  num_admitted: 1 "
+              "  num_shed_in_flight_bytes: 1 "
+              "  num_shed_uncommitted_entries: 1 "
+              "  num_shed_queue_delay: 0 "
+              "}",
+              stats);
+}
+
+} // namespace LogCabin::Server::<anonymous>
+} // namespace LogCabin::Server
+} // namespace LogCabin
@@ -15,11 +15,15 @@
  */
 
 #include <string.h>
+#include <vector>
 
 #include "build/Protocol/Client.pb.h"
 #include "Core/Buffer.h"
 #include "Core/ProtoBuf.h"
+#include "Core/StringUtil.h"
 #include "Core/Time.h"
+#include "Protocol/Common.h"
+#include "RPC/Address.h"
 #include "RPC/ServerRPC.h"
 #include "Server/RaftConsensus.h"
 #include "Server/ClientService.h"
@@ -31,8 +35,78 @@ namespace Server {
 
 typedef RaftConsensus::ClientResult Result;
 
+namespace {
+
+/**
+ * Return the path that a read-write tree request operates on, which decides
+ * the Raft group that handles it. Requests without an operation (such as
+ * keep-alives) use their condition's path, or "" for the root group.
+ */
+const std::string&
+getPath(const Protocol::Client::ReadWriteTree::Request& request)
+{
+    static const std::string none;
+    if (request.has_make_directory())
+        return request.make_directory().path();
+    if (request.has_remove_directory())
+        return request.remove_directory().path();
+    if (request.has_write())
+        return request.write().path();
+    if (request.has_remove_file())
+        return request.remove_file().path();
+    if (request.has_import_directory())
+        return request.import_directory().path();
+    if (request.has_condition())
+        return request.condition().path();
+    return none;
+}
+
+/**
+ * Return the path that a read-only tree request operates on. See above.
+ */
+const std::string&
+getPath(const Protocol::Client::ReadOnlyTree::Request& request)
+{
+    static const std::string none;
+    if (request.has_list_directory())
+        return request.list_directory().path();
+    if (request.has_read())
+        return request.read().path();
+    if (request.has_condition())
+        return request.condition().path();
+    return none;
+}
+
+/**
+ * Return the Raft group that should handle a tree request, or NULL if its
+ * condition refers to a different group than its operation (the groups'
+ * trees can't be checked atomically together).
+ */
+template<typename TreeRequest>
+const Globals::RaftGroup*
+findGroup(const Globals& globals, const TreeRequest& request)
+{
+    const Globals::RaftGroup& group = globals.findGroup(getPath(request));
+    if (request.has_condition() &&
+        &globals.findGroup(request.condition().path()) != &group) {
+        return NULL;
+    }
+    return &group;
+}
+
+} // anonymous namespace
+
 ClientService::ClientService(Globals& globals)
     : globals(globals)
+    , sessionManager(
+#ifndef IX_TARGET_BUILD
+        globals.eventLoop,
+#endif
+        globals.config)
+    , rootKeepAliveInterval(std::chrono::seconds(60))
+    , rootKeepAliveMutex()
+    , lastRootKeepAlive()
+    , nextRootKeepAliveCleanup(Core::Time::SteadyClock::time_point::min())
 {
 }
 
@@ -46,7 +120,10 @@ ClientService::handleRPC(RPC::ServerRPC rpc)
     using Protocol::Client::OpCode;
 
     // Call the appropriate RPC handler based on the request's opCode.
-    switch (rpc.getOpCode()) {
+    Core::Time::SteadyClock::time_point start =
+        Core::Time::SteadyClock::now();
+    uint16_t opCode = rpc.getOpCode();
+    switch (opCode) {
         case OpCode::GET_SERVER_INFO:
             getServerInfo(std::move(rpc));
             break;
@@ -71,6 +148,12 @@ ClientService::handleRPC(RPC::ServerRPC rpc)
                     rpc.getOpCode());
             rpc.rejectInvalidRequest();
     }
+#ifndef IX_TARGET_BUILD
+    globals.serverStats.noteRPCNanos(
+        Protocol::Common::ServiceId::CLIENT_SERVICE, opCode,
+        uint64_t(std::chrono::nanoseconds(
+            Core::Time::SteadyClock::now() - start).count()));
+#endif
 }
 
 std::string
@@ -110,8 +193,10 @@ ClientService::getConfiguration(RPC::ServerRPC rpc)
 {
     PRELUDE(GetConfiguration);
     Protocol::Raft::SimpleConfiguration configuration;
+    Protocol::Raft::SimpleConfiguration learners;
     uint64_t id;
-    Result result = globals.raft->getConfiguration(configuration, id);
+    Result result = globals.raft->getConfiguration(configuration, learners,
+                                                   id);
     if (result == Result::RETRY || result == Result::NOT_LEADER) {
         Protocol::Client::Error error;
         error.set_error_code(Protocol::Client::Error::NOT_LEADER);
@@ -129,6 +214,13 @@ ClientService::getConfiguration(RPC::ServerRPC rpc)
         server->set_server_id(it->server_id());
         server->set_addresses(it->addresses());
     }
+    for (auto it = learners.servers().begin();
+         it != learners.servers().end();
+         ++it) {
+        Protocol::Client::Server* server = response.add_learners();
+        server->set_server_id(it->server_id());
+        server->set_addresses(it->addresses());
+    }
     rpc.reply(response);
 }
 
@@ -136,6 +228,28 @@ void
 ClientService::setConfiguration(RPC::ServerRPC rpc)
 {
     PRELUDE(SetConfiguration);
+    if (request.has_raft_group()) {
+        // Forwarded from the root group's leader by setGroupConfigurations().
+        uint64_t groupId = request.raft_group();
+        if (groupId == 0 || groupId >= globals.groups.size()) {
+            WARNING("Received SetConfiguration request for unknown Raft "
+                    "group %lu: rejecting it as invalid request", groupId);
+            rpc.rejectInvalidRequest();
+            return;
+        }
+        if (!setGroupConfiguration(groupId, request, response)) {
+            Protocol::Client::Error error;
+            error.set_error_code(Protocol::Client::Error::NOT_LEADER);
+            std::string leaderHint =
+                globals.groups.at(groupId).raft->getLeaderHint();
+            if (!leaderHint.empty())
+                error.set_leader_hint(leaderHint);
+            rpc.returnError(error);
+            return;
+        }
+        rpc.reply(response);
+        return;
+    }
     Result result = globals.raft->setConfiguration(request, response);
     if (result == Result::RETRY || result == Result::NOT_LEADER) {
         Protocol::Client::Error error;
@@ -146,20 +260,326 @@ ClientService::setConfiguration(RPC::ServerRPC rpc)
         rpc.returnError(error);
         return;
     }
+    if (response.has_ok()) {
+        std::string error;
+        if (!setGroupConfigurations(request, error)) {
+            // The client will see the root group's new configuration ID and
+            // retry, which reapplies the membership to every group.
+            WARNING("%s", error.c_str());
+            response.clear_ok();
+            response.mutable_configuration_changed()->set_error(error);
+        }
+    }
     rpc.reply(response);
 }
 
+bool
+ClientService::setGroupConfigurations(
+        const Protocol::Client::SetConfiguration::Request& request,
+        std::string& error)
+{
+    bool ok = true;
+    for (uint64_t groupId = 1; groupId < globals.groups.size(); ++groupId) {
+        Protocol::Client::SetConfiguration::Response groupResponse;
+        if (!setGroupConfiguration(groupId, request, groupResponse)) {
+            Protocol::Client::SetConfiguration::Request groupRequest =
+                request;
+            groupRequest.set_raft_group(groupId);
+            std::string forwardError;
+            if (!forwardToLeader(groupId,
+                                 Protocol::Client::OpCode::SET_CONFIGURATION,
+                                 groupRequest, groupResponse, forwardError)) {
+                error += Core::StringUtil::format(
+                    "Could not change the membership of Raft group %lu: "
+                    "%s. ", groupId, forwardError.c_str());
+                ok = false;
+                continue;
+            }
+        }
+        if (!groupResponse.has_ok()) {
+            error += Core::StringUtil::format(
+                "Could not change the membership of Raft group %lu: %s. ",
+                groupId, Core::ProtoBuf::dumpString(groupResponse).c_str());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool
+ClientService::setGroupConfiguration(
+        uint64_t groupId,
+        const Protocol::Client::SetConfiguration::Request& request,
+        Protocol::Client::SetConfiguration::Response& response)
+{
+    const Globals::RaftGroup& group = globals.groups.at(groupId);
+    Protocol::Raft::SimpleConfiguration configuration;
+    Protocol::Raft::SimpleConfiguration learners;
+    Protocol::Client::SetConfiguration::Request groupRequest = request;
+    groupRequest.clear_raft_group();
+    uint64_t id;
+    Result result = group.raft->getConfiguration(configuration, learners,
+                                                 id);
+    if (result != Result::SUCCESS)
+        return false;
+    groupRequest.set_old_id(id);
+    result = group.raft->setConfiguration(groupRequest, response);
+    if (result != Result::SUCCESS)
+        return false;
+    if (!response.has_ok())
+        return true;
+    // Spread the groups' leaders across the new membership, so that one
+    // server doesn't carry every group's writes.
+    const Protocol::Client::Server& target =
+        request.new_servers(
+            int(group.id % uint64_t(request.new_servers_size())));
+    if (target.server_id() != globals.serverId) {
+        NOTICE("Transferring leadership of Raft group %lu to server %lu",
+               group.id, target.server_id());
+        group.raft->transferLeadership(target.server_id());
+    }
+    return true;
+}
+
+bool
+ClientService::copySessions(uint64_t groupId,
+                            uint64_t clientId,
+                            std::string& error)
+{
+    Protocol::Client::StateMachineCommand::Request command;
+    Protocol::Client::OpenSession::Request& copy =
+        *command.mutable_open_session();
+    std::vector<uint64_t> clientIds;
+    uint64_t rootIndex =
+        globals.groups.front().stateMachine->getOpenSessions(clientIds);
+    if (rootIndex < clientId) {
+        error = Core::StringUtil::format(
+            "this server's root group has only applied entries through %lu, "
+            "not yet the one that opened client %lu's session",
+            rootIndex, clientId);
+        return false;
+    }
+    copy.set_raft_group(groupId);
+    copy.set_root_index(rootIndex);
+    for (auto it = clientIds.begin(); it != clientIds.end(); ++it)
+        copy.add_client_ids(*it);
+
+    const Globals::RaftGroup& group = globals.groups.at(groupId);
+    Protocol::Client::StateMachineCommand::Response response;
+    Core::Buffer cmdBuffer;
+    Core::ProtoBuf::serialize(command, cmdBuffer);
+    std::pair<Result, uint64_t> result = group.raft->replicate(cmdBuffer);
+    if (result.first == Result::SUCCESS) {
+        group.stateMachine->waitForResponse(result.second, command, response);
+        return true;
+    }
+    return forwardToLeader(groupId,
+                           Protocol::Client::OpCode::STATE_MACHINE_COMMAND,
+                           command, response, error);
+}
+
+bool
+ClientService::keepRootSessionAlive(
+        const Protocol::Client::ExactlyOnceRPCInfo& rpcInfo)
+{
+    typedef Core::Time::SteadyClock Clock;
+    Clock::time_point now = Clock::now();
+    {
+        std::lock_guard<std::mutex> lockGuard(rootKeepAliveMutex);
+        auto it = lastRootKeepAlive.find(rpcInfo.client_id());
+        if (it != lastRootKeepAlive.end() &&
+            now - it->second < rootKeepAliveInterval) {
+            return true;
+        }
+        if (now >= nextRootKeepAliveCleanup) {
+            for (it = lastRootKeepAlive.begin();
+                 it != lastRootKeepAlive.end();) {
+                if (now - it->second >= rootKeepAliveInterval)
+                    it = lastRootKeepAlive.erase(it);
+                else
+                    ++it;
+            }
+            nextRootKeepAliveCleanup = now + rootKeepAliveInterval;
+        }
+    }
+
+    // This is the same no-op that clients send as keep-alives (see
+    // ClientImpl::ExactlyOnceRPCHelper::keepAliveThreadMain()). It reuses the
+    // client's RPC number, which the root group would otherwise never see.
+    Protocol::Client::StateMachineCommand::Request command;
+    Protocol::Client::ReadWriteTree::Request& keepAlive =
+        *command.mutable_tree();
+    *keepAlive.mutable_exactly_once() = rpcInfo;
+    keepAlive.mutable_condition()->set_path("keepalive");
+    keepAlive.mutable_condition()->set_contents(
+        "this is just a no-op to keep the client's session active; "
+        "the condition is expected to fail");
+    keepAlive.mutable_write()->set_path("keepalive");
+    keepAlive.mutable_write()->set_contents("you shouldn't see this!");
+    Protocol::Client::StateMachineCommand::Response response;
+    const Globals::RaftGroup& root = globals.groups.front();
+    Core::Buffer cmdBuffer;
+    Core::ProtoBuf::serialize(command, cmdBuffer);
+    std::pair<Result, uint64_t> result = root.raft->replicate(cmdBuffer);
+    std::string error;
+    if (result.first == Result::SUCCESS) {
+        root.stateMachine->waitForResponse(result.second, command, response);
+    } else if (!forwardToLeader(0,
+                                Protocol::Client::OpCode::STATE_MACHINE_COMMAND,
+                                command, response, error)) {
+        WARNING("Could not keep client %lu's session alive in the root Raft "
+                "group: %s",
+                rpcInfo.client_id(), error.c_str());
+        return true;
+    }
+    if (response.tree().status() == Protocol::Client::Status::SESSION_EXPIRED)
+        return false;
+    std::lock_guard<std::mutex> lockGuard(rootKeepAliveMutex);
+    lastRootKeepAlive[rpcInfo.client_id()] = now;
+    return true;
+}
+
+bool
+ClientService::forwardToLeader(uint64_t groupId,
+                               Protocol::Client::OpCode opCode,
+                               const google::protobuf::Message& request,
+                               google::protobuf::Message& response,
+                               std::string& error)
+{
+    const Globals::RaftGroup& group = globals.groups.at(groupId);
+    std::string leaderHint = group.raft->getLeaderHint();
+    if (leaderHint.empty()) {
+        error = "its leader is unknown";
+        return false;
+    }
+    // Like Peer::getSession(), bound the time spent connecting, since
+    // creating a session isn't interruptible.
+    RPC::Address::TimePoint timeout =
+        RPC::Address::Clock::now() +
+        std::chrono::milliseconds(
+            globals.config.read<uint64_t>("electionTimeoutMilliseconds",
+                                          500));
+    RPC::Address address(leaderHint, Protocol::Common::DEFAULT_PORT);
+    address.refresh(timeout);
+    std::shared_ptr<RPC::ClientSession> session =
+        sessionManager.createSession(address, timeout, &globals.clusterUUID);
+    // Service-specific error version 1: the leader's admission control must
+    // not turn this away, since the root group has already committed.
+    RPC::ClientRPC rpc(session,
+                       Protocol::Common::ServiceId::CLIENT_SERVICE,
+                       1,
+                       opCode,
+                       request);
+    Protocol::Client::Error serviceError;
+    RPC::ClientRPC::Status status =
+        rpc.waitForReply(&response, &serviceError,
+                         RPC::ClientRPC::TimePoint::max());
+    switch (status) {
+        case RPC::ClientRPC::Status::OK:
+            return true;
+        case RPC::ClientRPC::Status::SERVICE_SPECIFIC_ERROR:
+            error = Core::StringUtil::format(
+                "leader %s returned %s",
+                leaderHint.c_str(),
+                Core::ProtoBuf::dumpString(serviceError).c_str());
+            return false;
+        default:
+            error = Core::StringUtil::format(
+                "RPC to leader %s failed: %s",
+                leaderHint.c_str(),
+                rpc.getErrorMessage().c_str());
+            return false;
+    }
+}
+
 void
 ClientService::stateMachineCommand(RPC::ServerRPC rpc)
 {
     PRELUDE(StateMachineCommand);
+    const Globals::RaftGroup* group = &globals.groups.front();
+    if (request.has_tree()) {
+        group = findGroup(globals, request.tree());
+        if (group == NULL) {
+            Protocol::Client::ReadWriteTree::Response& treeResponse =
+                *response.mutable_tree();
+            treeResponse.set_status(
+                Protocol::Client::Status::INVALID_ARGUMENT);
+            treeResponse.set_error("Condition and operation paths are owned "
+                                   "by different Raft groups");
+            rpc.reply(response);
+            return;
+        }
+    } else if (request.has_open_session() &&
+               (request.open_session().has_root_index() ||
+                request.open_session().has_raft_group())) {
+        // Forwarded from another server by copySessions().
+        uint64_t groupId = request.open_session().raft_group();
+        if (!request.open_session().has_root_index() ||
+            groupId == 0 || groupId >= globals.groups.size()) {
+            WARNING("Received OpenSession copy for unknown Raft group %lu: "
+                    "rejecting it as invalid request", groupId);
+            rpc.rejectInvalidRequest();
+            return;
+        }
+        group = &globals.groups.at(groupId);
+    }
+    if (request.has_tree() &&
+        request.tree().has_import_directory() &&
+        group->stateMachine->getRunningVersion() < 3) {
+        // Don't fill the log with entries that apply() would reject.
+        Protocol::Client::ReadWriteTree::Response& treeResponse =
+            *response.mutable_tree();
+        treeResponse.set_status(Protocol::Client::Status::INVALID_ARGUMENT);
+        treeResponse.set_error("Importing directories requires state "
+                               "machine version 3");
+        rpc.reply(response);
+        return;
+    }
+    if (group->id != 0 && request.has_tree()) {
+        const Protocol::Client::ExactlyOnceRPCInfo& rpcInfo =
+            request.tree().exactly_once();
+        if (!keepRootSessionAlive(rpcInfo)) {
+            response.mutable_tree()->set_status(
+                Protocol::Client::Status::SESSION_EXPIRED);
+            rpc.reply(response);
+            return;
+        }
+        std::string copyError;
+        if (!group->stateMachine->hasSession(rpcInfo.client_id()) &&
+            !copySessions(group->id, rpcInfo.client_id(), copyError)) {
+            // The client will retry, by which time the copy may succeed.
+            WARNING("Could not copy sessions into Raft group %lu: %s",
+                    group->id, copyError.c_str());
+            Protocol::Client::Error error;
+            error.set_error_code(Protocol::Client::Error::NOT_LEADER);
+            rpc.returnError(error);
+            return;
+        }
+    }
+    RaftConsensus& raft = *group->raft;
     Core::Buffer cmdBuffer;
     rpc.getRequest(cmdBuffer);
-    std::pair<Result, uint64_t> result = globals.raft->replicate(cmdBuffer);
+    // Clients that predate the OVERLOADED error can't be turned away.
+    uint64_t admittedBytes = 0;
+    if (rpc.getServiceSpecificErrorVersion() >= 2) {
+        AdmissionControl::Result admission = globals.admissionControl.admit(
+            cmdBuffer.getLength(),
+            rpc.getReceivedAt(),
+            raft.getNumUncommittedEntries());
+        if (admission != AdmissionControl::ADMITTED) {
+            Protocol::Client::Error error;
+            error.set_error_code(Protocol::Client::Error::OVERLOADED);
+            rpc.returnError(error);
+            return;
+        }
+        admittedBytes = cmdBuffer.getLength();
+    }
+    std::pair<Result, uint64_t> result = raft.replicate(cmdBuffer);
     if (result.first == Result::RETRY || result.first == Result::NOT_LEADER) {
+        globals.admissionControl.release(admittedBytes);
         Protocol::Client::Error error;
         error.set_error_code(Protocol::Client::Error::NOT_LEADER);
-        std::string leaderHint = globals.raft->getLeaderHint();
+        std::string leaderHint = raft.getLeaderHint();
         if (!leaderHint.empty())
             error.set_leader_hint(leaderHint);
         rpc.returnError(error);
@@ -167,10 +587,30 @@ ClientService::stateMachineCommand(RPC::ServerRPC rpc)
     }
     assert(result.first == Result::SUCCESS);
     uint64_t logIndex = result.second;
-    if (!globals.stateMachine->waitForResponse(logIndex, request, response)) {
+    bool ok = group->stateMachine->waitForResponse(logIndex,
+                                                    request, response);
+    globals.admissionControl.release(admittedBytes);
+    if (!ok) {
         rpc.rejectInvalidRequest();
         return;
     }
+    if (group->id == 0 && request.has_open_session()) {
+        // Copying the new session now saves the client a round trip later.
+        // If this fails, it's copied when the client first uses the group.
+        for (uint64_t groupId = 1;
+             groupId < globals.groups.size();
+             ++groupId) {
+            std::string copyError;
+            if (!copySessions(groupId, response.open_session().client_id(),
+                              copyError)) {
+                WARNING("Could not copy sessions into Raft group %lu: %s",
+                        groupId, copyError.c_str());
+            }
+        }
+    }
+    if (group->id == 0)
+        globals.entryTracer.finish(logIndex, rpc.getReceivedAt(),
+                                   rpc.getDispatchedAt());
     rpc.reply(response);
 }
 
@@ -178,11 +618,57 @@ void
 ClientService::stateMachineQuery(RPC::ServerRPC rpc)
 {
     PRELUDE(StateMachineQuery);
-    std::pair<Result, uint64_t> result = globals.raft->getLastCommitIndex();
+    const Globals::RaftGroup* group = &globals.groups.front();
+    if (request.has_tree()) {
+        group = findGroup(globals, request.tree());
+        if (group == NULL) {
+            Protocol::Client::ReadOnlyTree::Response& treeResponse =
+                *response.mutable_tree();
+            treeResponse.set_status(
+                Protocol::Client::Status::INVALID_ARGUMENT);
+            treeResponse.set_error("Condition and operation paths are owned "
+                                   "by different Raft groups");
+            rpc.reply(response);
+            return;
+        }
+    }
+    RaftConsensus& raft = *group->raft;
+    // Each group has its own log indexes, so min_index and applied_index
+    // can't be compared across requests when there's more than one group.
+    bool singleGroup = (globals.groups.size() == 1);
+    std::pair<Result, uint64_t> result;
+    switch (request.consistency()) {
+        case Protocol::Client::ReadConsistency::LINEARIZABLE:
+            result = raft.getLastCommitIndex();
+            break;
+        case Protocol::Client::ReadConsistency::BOUNDED_STALENESS: {
+            std::chrono::nanoseconds maxStaleness =
+                std::chrono::nanoseconds::max();
+            if (request.max_staleness_nanos() <
+                uint64_t(maxStaleness.count())) {
+                maxStaleness = std::chrono::nanoseconds(
+                    request.max_staleness_nanos());
+            }
+            result = raft.getStaleReadIndex(maxStaleness);
+            break;
+        }
+        case Protocol::Client::ReadConsistency::ANY_REPLICA:
+            result = raft.getStaleReadIndex(
+                std::chrono::nanoseconds::max());
+            break;
+    }
+    // A server that is too far behind for this client is treated like any
+    // other server that cannot answer: the client will be redirected to the
+    // leader.
+    if (singleGroup &&
+        result.first == Result::SUCCESS &&
+        result.second < request.min_index()) {
+        result.first = Result::NOT_LEADER;
+    }
     if (result.first == Result::RETRY || result.first == Result::NOT_LEADER) {
         Protocol::Client::Error error;
         error.set_error_code(Protocol::Client::Error::NOT_LEADER);
-        std::string leaderHint = globals.raft->getLeaderHint();
+        std::string leaderHint = raft.getLeaderHint();
         if (!leaderHint.empty())
             error.set_leader_hint(leaderHint);
         rpc.returnError(error);
@@ -190,9 +676,11 @@ ClientService::stateMachineQuery(RPC::ServerRPC rpc)
     }
     assert(result.first == Result::SUCCESS);
     uint64_t logIndex = result.second;
-    globals.stateMachine->wait(logIndex);
-    if (!globals.stateMachine->query(request, response))
+    group->stateMachine->wait(logIndex);
+    if (!group->stateMachine->query(request, response))
         rpc.rejectInvalidRequest();
+    if (!singleGroup)
+        response.clear_applied_index();
     rpc.reply(response);
 }
 
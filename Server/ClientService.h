@@ -13,13 +13,18 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <mutex>
+#include <unordered_map>
+
 #include "RPC/Service.h"
 
 
 #include "build/Protocol/Client.pb.h"
 #include "build/Protocol/Raft.pb.h"
+#include "Client/SessionManager.h"
 #include "Core/Debug.h"
 #include "Core/ProtoBuf.h"
+#include "Core/Time.h"
 #include "RPC/ClientRPC.h"
 #include "Protocol/Common.h"
 #ifndef IX_TARGET_BUILD
@@ -63,11 +68,132 @@ class ClientService : public RPC::Service {
     void stateMachineQuery(RPC::ServerRPC rpc);
     void verifyRecipient(RPC::ServerRPC rpc);
 
+    /**
+     * Called after the root Raft group's membership has been changed, to
+     * give every other group the same membership: directly for the groups
+     * that this server leads, and through their leaders for the rest.
+     * \param request
+     *      The request that changed the root group's membership.
+     * \param[out] error
+     *      If this returns false, set to which groups failed and why.
+     * \return
+     *      True if every group's membership was changed.
+     */
+    bool setGroupConfigurations(
+        const Protocol::Client::SetConfiguration::Request& request,
+        std::string& error);
+
+    /**
+     * Give a Raft group that this server leads the membership in 'request',
+     * regardless of its old_id. If that succeeds, the group's leadership is
+     * then handed to a different server in the new configuration, so that
+     * one server doesn't carry every group's writes.
+     * \param groupId
+     *      Index into globals.groups.
+     * \param request
+     *      The new membership.
+     * \param[out] response
+     *      The outcome, if this returns true.
+     * \return
+     *      True if this server is the group's leader, false otherwise.
+     */
+    bool setGroupConfiguration(
+        uint64_t groupId,
+        const Protocol::Client::SetConfiguration::Request& request,
+        Protocol::Client::SetConfiguration::Response& response);
+
+    /**
+     * Copy the list of sessions open in this server's replica of the root
+     * Raft group into another group: directly if this server leads the group,
+     * and through its leader otherwise. Called after a session is opened, and
+     * before a client uses a session that the group doesn't have yet.
+     * \param groupId
+     *      Index into globals.groups of the group to copy the sessions into.
+     * \param clientId
+     *      The copy fails unless this server's replica of the root group has
+     *      applied the entry that opened this session (its client ID is that
+     *      entry's index).
+     * \param[out] error
+     *      If this returns false, set to a description of what went wrong.
+     * \return
+     *      True if the group applied the copy.
+     */
+    bool copySessions(uint64_t groupId, uint64_t clientId, std::string& error);
+
+    /**
+     * Called before a client's command is replicated in a Raft group other
+     * than the root group. Only the root group expires sessions, so this
+     * keeps the client's session alive there by replicating a keep-alive
+     * into it, at most once per #rootKeepAliveInterval for each client.
+     * \param rpcInfo
+     *      The client's command's session information.
+     * \return
+     *      False if the root group has expired the session; true otherwise,
+     *      including when the keep-alive couldn't be sent (it is sent again
+     *      with the client's next command).
+     */
+    bool keepRootSessionAlive(
+        const Protocol::Client::ExactlyOnceRPCInfo& rpcInfo);
+
+    /**
+     * Send a ClientService RPC to the leader of one of this server's Raft
+     * groups, and wait for its reply.
+     * \param groupId
+     *      Index into globals.groups: the group whose leader (as far as this
+     *      server knows) is sent the RPC.
+     * \param opCode
+     *      The RPC to invoke.
+     * \param request
+     *      The RPC's arguments.
+     * \param[out] response
+     *      The leader's reply, if this returns true.
+     * \param[out] error
+     *      If this returns false, set to a description of what went wrong.
+     * \return
+     *      True if the leader replied normally, false otherwise.
+     */
+    bool forwardToLeader(uint64_t groupId,
+                         Protocol::Client::OpCode opCode,
+                         const google::protobuf::Message& request,
+                         google::protobuf::Message& response,
+                         std::string& error);
+
     /**
      * The LogCabin daemon's top-level objects.
      */
     Globals& globals;
 
+    /**
+     * Used to connect to the leaders of other Raft groups; see
+     * forwardToLeader().
+     */
+    Client::SessionManager sessionManager;
+
+    /**
+     * See keepRootSessionAlive(). This matches how often idle clients send
+     * keep-alives of their own, and is far shorter than the session timeout.
+     * Const except for unit tests.
+     */
+    std::chrono::milliseconds rootKeepAliveInterval;
+
+    /**
+     * Protects #lastRootKeepAlive and #nextRootKeepAliveCleanup.
+     */
+    std::mutex rootKeepAliveMutex;
+
+    /**
+     * Client ID to the last time that keepRootSessionAlive() sent a
+     * keep-alive for it into the root Raft group.
+     */
+    std::unordered_map<uint64_t, Core::Time::SteadyClock::time_point>
+        lastRootKeepAlive;
+
+    /**
+     * When keepRootSessionAlive() should next drop the entries in
+     * #lastRootKeepAlive that are older than #rootKeepAliveInterval.
+     */
+    Core::Time::SteadyClock::time_point nextRootKeepAliveCleanup;
+
     // ClientService is non-copyable.
     ClientService(const ClientService&) = delete;
     ClientService& operator=(const ClientService&) = delete;
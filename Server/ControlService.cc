@@ -17,6 +17,9 @@
 
 #include "build/Protocol/ServerControl.pb.h"
 #include "Core/Debug.h"
+#include "Core/Time.h"
+#include "Core/StringUtil.h"
+#include "Protocol/Common.h"
 #include "RPC/ServerRPC.h"
 #include "Server/ControlService.h"
 #include "Server/Globals.h"
@@ -41,7 +44,10 @@ ControlService::handleRPC(RPC::ServerRPC rpc)
     using Protocol::ServerControl::OpCode;
 
     // Call the appropriate RPC handler based on the request's opCode.
-    switch (rpc.getOpCode()) {
+    Core::Time::SteadyClock::time_point start =
+        Core::Time::SteadyClock::now();
+    uint16_t opCode = rpc.getOpCode();
+    switch (opCode) {
         case OpCode::DEBUG_FILENAME_GET:
             debugFilenameGet(std::move(rpc));
             break;
@@ -57,6 +63,9 @@ ControlService::handleRPC(RPC::ServerRPC rpc)
         case OpCode::DEBUG_ROTATE:
             debugRotate(std::move(rpc));
             break;
+        case OpCode::LEADERSHIP_TRANSFER:
+            leadershipTransfer(std::move(rpc));
+            break;
         case OpCode::SERVER_INFO_GET:
             serverInfoGet(std::move(rpc));
             break;
@@ -66,6 +75,9 @@ ControlService::handleRPC(RPC::ServerRPC rpc)
         case OpCode::SERVER_STATS_GET:
             serverStatsGet(std::move(rpc));
             break;
+        case OpCode::SERVER_STATS_TRACE_GET:
+            serverStatsTraceGet(std::move(rpc));
+            break;
         case OpCode::SNAPSHOT_CONTROL:
             snapshotControl(std::move(rpc));
             break;
@@ -80,6 +92,12 @@ ControlService::handleRPC(RPC::ServerRPC rpc)
                     "ControlService", rpc.getOpCode());
             rpc.rejectInvalidRequest();
     }
+#ifndef IX_TARGET_BUILD
+    globals.serverStats.noteRPCNanos(
+        Protocol::Common::ServiceId::CONTROL_SERVICE, opCode,
+        uint64_t(std::chrono::nanoseconds(
+            Core::Time::SteadyClock::now() - start).count()));
+#endif
 }
 
 std::string
@@ -167,6 +185,33 @@ ControlService::debugRotate(RPC::ServerRPC rpc)
     rpc.reply(response);
 }
 
+void
+ControlService::leadershipTransfer(RPC::ServerRPC rpc)
+{
+    PRELUDE(LeadershipTransfer);
+    NOTICE("Requested leadership transfer to server %lu",
+           request.server_id());
+    typedef RaftConsensus::ClientResult Result;
+    Result result = globals.raft->transferLeadership(request.server_id());
+    switch (result) {
+        case Result::SUCCESS:
+            break;
+        case Result::NOT_LEADER:
+            response.set_error(Core::StringUtil::format(
+                "Server is not the leader (leader hint: %s)",
+                globals.raft->getLeaderHint().c_str()));
+            break;
+        case Result::FAIL: // fallthrough
+        default:
+            response.set_error("Leadership transfer failed: the target is "
+                               "not another voting server, another transfer "
+                               "is in progress, or no new leader was elected "
+                               "within an election timeout");
+            break;
+    }
+    rpc.reply(response);
+}
+
 void
 ControlService::serverInfoGet(RPC::ServerRPC rpc)
 {
@@ -206,25 +251,40 @@ ControlService::serverStatsGet(RPC::ServerRPC rpc)
 #endif
 }
 
+void
+ControlService::serverStatsTraceGet(RPC::ServerRPC rpc)
+{
+    PRELUDE(ServerStatsTraceGet);
+    response.set_chrome_trace(
+        globals.entryTracer.dumpChromeTrace(globals.serverId));
+    rpc.reply(response);
+}
+
 void
 ControlService::snapshotControl(RPC::ServerRPC rpc)
 {
     PRELUDE(SnapshotControl);
     using Protocol::ServerControl::SnapshotCommand;
-    switch (request.command()) {
-        case SnapshotCommand::START_SNAPSHOT:
-            globals.stateMachine->startTakingSnapshot();
-            break;
-        case SnapshotCommand::STOP_SNAPSHOT:
-            globals.stateMachine->stopTakingSnapshot();
-            break;
-        case SnapshotCommand::RESTART_SNAPSHOT:
-            globals.stateMachine->stopTakingSnapshot();
-            globals.stateMachine->startTakingSnapshot();
+    // This applies to every Raft group hosted by the server.
+    for (auto it = globals.groups.begin(); it != globals.groups.end(); ++it) {
+        StateMachine& stateMachine = *it->stateMachine;
+        switch (request.command()) {
+            case SnapshotCommand::START_SNAPSHOT:
+                stateMachine.startTakingSnapshot();
+                break;
+            case SnapshotCommand::STOP_SNAPSHOT:
+                stateMachine.stopTakingSnapshot();
+                break;
+            case SnapshotCommand::RESTART_SNAPSHOT:
+                stateMachine.stopTakingSnapshot();
+                stateMachine.startTakingSnapshot();
+                break;
+            case SnapshotCommand::UNKNOWN_SNAPSHOT_COMMAND: // fallthrough
+            default:
+                response.set_error("Unknown SnapshotControl command");
+        }
+        if (response.has_error())
             break;
-        case SnapshotCommand::UNKNOWN_SNAPSHOT_COMMAND: // fallthrough
-        default:
-            response.set_error("Unknown SnapshotControl command");
     }
     rpc.reply(response);
 }
@@ -256,9 +316,11 @@ ControlService::snapshotInhibitSet(RPC::ServerRPC rpc)
     } else {
         duration = std::chrono::nanoseconds::max();
     }
-    globals.stateMachine->setInhibit(duration);
-    if (abort) {
-        globals.stateMachine->stopTakingSnapshot();
+    for (auto it = globals.groups.begin(); it != globals.groups.end(); ++it) {
+        it->stateMachine->setInhibit(duration);
+        if (abort) {
+            it->stateMachine->stopTakingSnapshot();
+        }
     }
     rpc.reply(response);
 }
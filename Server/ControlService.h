@@ -57,9 +57,11 @@ class ControlService : public RPC::Service {
     void debugPolicyGet(RPC::ServerRPC rpc);
     void debugPolicySet(RPC::ServerRPC rpc);
     void debugRotate(RPC::ServerRPC rpc);
+    void leadershipTransfer(RPC::ServerRPC rpc);
     void serverInfoGet(RPC::ServerRPC rpc);
     void serverStatsDump(RPC::ServerRPC rpc);
     void serverStatsGet(RPC::ServerRPC rpc);
+    void serverStatsTraceGet(RPC::ServerRPC rpc);
     void snapshotControl(RPC::ServerRPC rpc);
     void snapshotInhibitGet(RPC::ServerRPC rpc);
     void snapshotInhibitSet(RPC::ServerRPC rpc);
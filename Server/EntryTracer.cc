@@ -0,0 +1,227 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sstream>
+
+#include "build/Protocol/ServerStats.pb.h"
+#include "Core/Debug.h"
+#include "Core/StringUtil.h"
+#include "Server/EntryTracer.h"
+
+namespace LogCabin {
+namespace Server {
+
+namespace {
+
+/**
+ * Return the number of nanoseconds from 'start' to 'end', or 0 if 'end' is
+ * earlier (which can happen when two stages are noted by different threads
+ * at nearly the same time).
+ */
+uint64_t
+nanosBetween(EntryTracer::TimePoint start, EntryTracer::TimePoint end)
+{
+    if (end <= start)
+        return 0;
+    return uint64_t(std::chrono::nanoseconds(end - start).count());
+}
+
+} // anonymous namespace
+
+//// class EntryTracer::Trace ////
+
+EntryTracer::Trace::Trace()
+    : index(0)
+    , at()
+{
+    for (uint32_t i = 0; i < NUM_STAGES; ++i)
+        at[i] = TimePoint::min();
+}
+
+//// class EntryTracer ////
+
+EntryTracer::EntryTracer()
+    : sampleInterval(0)
+    , mutex()
+    , active()
+    , recent()
+    , numFinished(0)
+    , stageNanos()
+    , totalNanos()
+{
+}
+
+EntryTracer::~EntryTracer()
+{
+}
+
+const char*
+EntryTracer::getStageName(Stage stage)
+{
+    switch (stage) {
+        case RECEIVED:  return "RECEIVED";
+        case DISPATCHED: return "DISPATCHED";
+        case APPENDED:  return "APPENDED";
+        case SYNCED:    return "SYNCED";
+        case COMMITTED: return "COMMITTED";
+        case APPLIED:   return "APPLIED";
+        case REPLIED:   return "REPLIED";
+        case NUM_STAGES: break;
+    }
+    PANIC("Unknown stage %d", int(stage));
+}
+
+void
+EntryTracer::setSampleInterval(uint64_t interval)
+{
+    sampleInterval.store(interval, std::memory_order_relaxed);
+}
+
+bool
+EntryTracer::isSampled(uint64_t index) const
+{
+    uint64_t interval = sampleInterval.load(std::memory_order_relaxed);
+    return interval > 0 && index % interval == 0;
+}
+
+void
+EntryTracer::noteAppended(uint64_t index, TimePoint when)
+{
+    if (!isSampled(index))
+        return;
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    if (active.size() >= MAX_ACTIVE && active.find(index) == active.end())
+        active.erase(active.begin());
+    Trace& trace = active[index];
+    trace = Trace();
+    trace.index = index;
+    trace.at[APPENDED] = when;
+}
+
+void
+EntryTracer::note(Stage stage, uint64_t firstIndex, uint64_t lastIndex,
+                  TimePoint when)
+{
+    uint64_t interval = sampleInterval.load(std::memory_order_relaxed);
+    if (interval == 0 || firstIndex > lastIndex)
+        return;
+    // Skip the lock unless some multiple of interval is in range.
+    uint64_t firstSampled = (firstIndex + interval - 1) / interval * interval;
+    if (firstSampled > lastIndex || firstSampled < firstIndex)
+        return;
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    for (auto it = active.lower_bound(firstIndex);
+         it != active.end() && it->first <= lastIndex;
+         ++it) {
+        Trace& trace = it->second;
+        if (trace.at[stage] == TimePoint::min())
+            trace.at[stage] = when;
+    }
+}
+
+void
+EntryTracer::finish(uint64_t index, TimePoint receivedAt,
+                    TimePoint dispatchedAt, TimePoint when)
+{
+    if (!isSampled(index))
+        return;
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    auto it = active.find(index);
+    if (it == active.end())
+        return;
+    Trace trace = it->second;
+    active.erase(it);
+    trace.at[RECEIVED] = receivedAt;
+    trace.at[DISPATCHED] = dispatchedAt;
+    trace.at[REPLIED] = when;
+
+    TimePoint previous = receivedAt;
+    for (uint32_t i = RECEIVED + 1; i < NUM_STAGES; ++i) {
+        if (trace.at[i] == TimePoint::min())
+            continue;
+        stageNanos[i].push(nanosBetween(previous, trace.at[i]));
+        previous = std::max(previous, trace.at[i]);
+    }
+    totalNanos.push(nanosBetween(receivedAt, when));
+    ++numFinished;
+
+    recent.push_back(trace);
+    if (recent.size() > MAX_RECENT)
+        recent.pop_front();
+}
+
+uint64_t
+EntryTracer::getNumFinished() const
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    return numFinished;
+}
+
+void
+EntryTracer::updateServerStats(Protocol::ServerStats& serverStats) const
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    Protocol::ServerStats::EntryTrace& stats =
+        *serverStats.mutable_entry_trace();
+    stats.set_sample_interval(
+        sampleInterval.load(std::memory_order_relaxed));
+    stats.set_num_finished(numFinished);
+    for (uint32_t i = RECEIVED + 1; i < NUM_STAGES; ++i) {
+        Protocol::ServerStats::EntryTrace::Stage& stage = *stats.add_stage();
+        stage.set_name(getStageName(Stage(i)));
+        stageNanos[i].updateProtoBuf(*stage.mutable_nanos());
+    }
+    totalNanos.updateProtoBuf(*stats.mutable_total_nanos());
+}
+
+std::string
+EntryTracer::dumpChromeTrace(uint64_t processId) const
+{
+    using Core::StringUtil::format;
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    Core::Time::SteadyTimeConverter converter;
+    std::stringstream os;
+    os << "{\"traceEvents\":[";
+    bool first = true;
+    for (auto it = recent.begin(); it != recent.end(); ++it) {
+        const Trace& trace = *it;
+        os << (first ? "\n" : ",\n");
+        first = false;
+        os << format("{\"name\":\"thread_name\",\"ph\":\"M\","
+                     "\"pid\":%lu,\"tid\":%lu,"
+                     "\"args\":{\"name\":\"entry %lu\"}}",
+                     processId, trace.index, trace.index);
+        TimePoint previous = trace.at[RECEIVED];
+        for (uint32_t i = RECEIVED + 1; i < NUM_STAGES; ++i) {
+            if (trace.at[i] == TimePoint::min())
+                continue;
+            TimePoint end = std::max(previous, trace.at[i]);
+            os << format(",\n{\"name\":\"%s\",\"cat\":\"entry\","
+                         "\"ph\":\"X\",\"pid\":%lu,\"tid\":%lu,"
+                         "\"ts\":%.3f,\"dur\":%.3f,"
+                         "\"args\":{\"index\":%lu}}",
+                         getStageName(Stage(i)), processId, trace.index,
+                         double(converter.unixNanos(previous)) / 1e3,
+                         double(nanosBetween(previous, end)) / 1e3,
+                         trace.index);
+            previous = end;
+        }
+    }
+    os << "\n]}\n";
+    return os.str();
+}
+
+} // namespace LogCabin::Server
+} // namespace LogCabin
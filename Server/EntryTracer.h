@@ -0,0 +1,254 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LOGCABIN_SERVER_ENTRYTRACER_H
+#define LOGCABIN_SERVER_ENTRYTRACER_H
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include "Core/CompatAtomic.h"
+#include "Core/Histogram.h"
+#include "Core/Mutex.h"
+#include "Core/Time.h"
+
+namespace LogCabin {
+
+// forward declaration
+namespace Protocol {
+class ServerStats;
+}
+
+namespace Server {
+
+/**
+ * Records when a sample of client writes reach each stage on their way
+ * through the leader, from the ClientService receiving the RPC to the
+ * StateMachine applying the entry and the reply going out. Traces are keyed
+ * by log index: only entries whose index is a multiple of the sample interval
+ * are traced, so the common case of an untraced entry costs a single
+ * division and no locking.
+ *
+ * The time between consecutive stages of every completed trace is aggregated
+ * into histograms that are exported through ServerStats, and the most recent
+ * completed traces are kept so that they can be dumped in the Chrome trace
+ * event format (viewable in chrome://tracing).
+ *
+ * This class is thread-safe; its mutex is never held while calling into
+ * other modules.
+ */
+class EntryTracer {
+  public:
+    typedef Core::Time::SteadyClock Clock;
+    typedef Clock::time_point TimePoint;
+
+    /**
+     * The points in a write's life that are timestamped, in the order they
+     * normally happen.
+     */
+    enum Stage {
+        /**
+         * The RPC arrived at the server, before waiting for a thread in the
+         * ThreadDispatchService.
+         */
+        RECEIVED = 0,
+        /**
+         * A ThreadDispatchService worker picked up the RPC, after which it
+         * runs the handler. The time until this is spent queued.
+         */
+        DISPATCHED,
+        /**
+         * The leader appended the entry to its log, after which it is sent
+         * to followers.
+         */
+        APPENDED,
+        /**
+         * The leader's disk thread finished flushing the entry.
+         */
+        SYNCED,
+        /**
+         * The leader learned that the entry was committed, which requires
+         * AppendEntries round trips to a majority of the cluster.
+         */
+        COMMITTED,
+        /**
+         * The StateMachine applied the entry.
+         */
+        APPLIED,
+        /**
+         * The ClientService was about to reply to the client.
+         */
+        REPLIED,
+        /**
+         * The number of stages (not a valid stage).
+         */
+        NUM_STAGES,
+    };
+
+    /**
+     * The maximum number of traces that may be in progress at once. If
+     * leadership is lost, some traces never complete; the oldest in-progress
+     * trace is discarded to make room for a new one.
+     */
+    enum { MAX_ACTIVE = 1024 };
+
+    /**
+     * The number of completed traces kept for dumpChromeTrace().
+     */
+    enum { MAX_RECENT = 1000 };
+
+    /**
+     * Constructor. Tracing is disabled until setSampleInterval() is called.
+     */
+    EntryTracer();
+
+    /**
+     * Destructor.
+     */
+    ~EntryTracer();
+
+    /**
+     * Return the name of the given stage, such as "COMMITTED".
+     */
+    static const char* getStageName(Stage stage);
+
+    /**
+     * Set which entries are traced.
+     * \param interval
+     *      Trace entries whose log index is a multiple of this, or none if
+     *      this is 0.
+     */
+    void setSampleInterval(uint64_t interval);
+
+    /**
+     * Return true if the entry at the given index would be traced.
+     */
+    bool isSampled(uint64_t index) const;
+
+    /**
+     * Start a trace for a newly appended entry, if it is sampled. Any earlier
+     * trace for the same index (from a previous term) is discarded.
+     * \param index
+     *      The entry's log index.
+     * \param when
+     *      The time the entry was appended.
+     */
+    void noteAppended(uint64_t index, TimePoint when = Clock::now());
+
+    /**
+     * Timestamp the given stage for every in-progress trace in a range of
+     * indexes that has not yet reached that stage. This is cheap when no
+     * index in the range is sampled.
+     * \param stage
+     *      SYNCED, COMMITTED, or APPLIED.
+     * \param firstIndex
+     *      The first index in the range.
+     * \param lastIndex
+     *      The last index in the range (inclusive).
+     * \param when
+     *      The time the entries reached the stage.
+     */
+    void note(Stage stage, uint64_t firstIndex, uint64_t lastIndex,
+              TimePoint when = Clock::now());
+
+    /**
+     * Complete the trace for the given index, if any, and add it to the
+     * aggregated stats.
+     * \param index
+     *      The entry's log index.
+     * \param receivedAt
+     *      The time the client's RPC was received.
+     * \param dispatchedAt
+     *      The time a worker thread picked up the client's RPC, or
+     *      TimePoint::min() if unknown (in which case the queueing time is
+     *      counted as part of APPENDED).
+     * \param when
+     *      The time the reply was ready.
+     */
+    void finish(uint64_t index, TimePoint receivedAt, TimePoint dispatchedAt,
+                TimePoint when = Clock::now());
+
+    /**
+     * Return the number of traces completed so far.
+     */
+    uint64_t getNumFinished() const;
+
+    /**
+     * Add the aggregated stage latencies to the given stats.
+     */
+    void updateServerStats(Protocol::ServerStats& serverStats) const;
+
+    /**
+     * Return the recently completed traces as a JSON document in the Chrome
+     * trace event format. Each trace appears as its own thread (named after
+     * its log index), with one span per stage.
+     * \param processId
+     *      Used as the process ID of every event, typically the server ID.
+     */
+    std::string dumpChromeTrace(uint64_t processId) const;
+
+  private:
+    /**
+     * The timestamps recorded for one entry. Stages that have not happened
+     * yet are TimePoint::min().
+     */
+    struct Trace {
+        Trace();
+        uint64_t index;
+        TimePoint at[NUM_STAGES];
+    };
+
+    /**
+     * See setSampleInterval().
+     */
+    std::atomic<uint64_t> sampleInterval;
+
+    /**
+     * Protects all of the following members.
+     */
+    mutable Core::Mutex mutex;
+
+    /**
+     * Traces that have been started but not finished, keyed by log index.
+     */
+    std::map<uint64_t, Trace> active;
+
+    /**
+     * The most recently finished traces, oldest first.
+     */
+    std::deque<Trace> recent;
+
+    /**
+     * The number of traces finished.
+     */
+    uint64_t numFinished;
+
+    /**
+     * Indexed by stage: the time from the previous stage that was recorded
+     * to this one. The RECEIVED entry is unused.
+     */
+    Core::Histogram stageNanos[NUM_STAGES];
+
+    /**
+     * The time from RECEIVED to REPLIED.
+     */
+    Core::Histogram totalNanos;
+};
+
+} // namespace LogCabin::Server
+} // namespace LogCabin
+
+#endif /* LOGCABIN_SERVER_ENTRYTRACER_H */
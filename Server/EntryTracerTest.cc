@@ -0,0 +1,106 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "build/Protocol/ServerStats.pb.h"
+#include "Server/EntryTracer.h"
+
+namespace LogCabin {
+namespace Server {
+namespace {
+
+typedef EntryTracer::TimePoint TimePoint;
+
+TimePoint
+at(uint64_t micros)
+{
+    return TimePoint(std::chrono::microseconds(1000000 + micros));
+}
+
+TEST(ServerEntryTracerTest, isSampled) {
+    EntryTracer tracer;
+    EXPECT_FALSE(tracer.isSampled(0));
+    EXPECT_FALSE(tracer.isSampled(10));
+    tracer.setSampleInterval(10);
+    EXPECT_TRUE(tracer.isSampled(10));
+    EXPECT_TRUE(tracer.isSampled(20));
+    EXPECT_FALSE(tracer.isSampled(11));
+}
+
+TEST(ServerEntryTracerTest, finish) {
+    EntryTracer tracer;
+    tracer.setSampleInterval(5);
+    tracer.noteAppended(4, at(1));
+    tracer.noteAppended(5, at(2));
+    tracer.noteAppended(10, at(2));
+    tracer.note(EntryTracer::SYNCED, 1, 5, at(3));
+    tracer.note(EntryTracer::COMMITTED, 1, 7, at(5));
+    tracer.note(EntryTracer::SYNCED, 6, 9, at(100)); // no sampled index
+    tracer.note(EntryTracer::APPLIED, 5, 5, at(6));
+    // stages are only noted once
+    tracer.note(EntryTracer::COMMITTED, 5, 5, at(50));
+    tracer.finish(4, at(0), at(1), at(8)); // not sampled
+    tracer.finish(5, at(0), at(1), at(8));
+    tracer.finish(5, at(0), at(1), at(9)); // already finished
+    EXPECT_EQ(1U, tracer.getNumFinished());
+
+    Protocol::ServerStats stats;
+    tracer.updateServerStats(stats);
+    const Protocol::ServerStats::EntryTrace& trace = stats.entry_trace();
+    EXPECT_EQ(5U, trace.sample_interval());
+    EXPECT_EQ(1U, trace.num_finished());
+    ASSERT_EQ(6, trace.stage_size());
+    EXPECT_EQ("DISPATCHED", trace.stage(0).name());
+    EXPECT_LE(1000U, trace.stage(0).nanos().p50());
+    EXPECT_GT(1200U, trace.stage(0).nanos().p50());
+    EXPECT_EQ("APPENDED", trace.stage(1).name());
+    EXPECT_LE(1000U, trace.stage(1).nanos().p50());
+    EXPECT_GT(1200U, trace.stage(1).nanos().p50());
+    EXPECT_EQ("SYNCED", trace.stage(2).name());
+    EXPECT_EQ("COMMITTED", trace.stage(3).name());
+    EXPECT_EQ(1U, trace.stage(3).nanos().count());
+    EXPECT_EQ("APPLIED", trace.stage(4).name());
+    EXPECT_EQ("REPLIED", trace.stage(5).name());
+    EXPECT_EQ(1U, trace.total_nanos().count());
+    EXPECT_LE(8000U, trace.total_nanos().p50());
+
+    std::string json = tracer.dumpChromeTrace(3);
+    EXPECT_EQ(0U, json.find("{\"traceEvents\":["));
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"entry 5\""));
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"COMMITTED\""));
+    EXPECT_NE(std::string::npos, json.find("\"pid\":3,\"tid\":5"));
+    EXPECT_EQ(std::string::npos, json.find("entry 10"));
+}
+
+TEST(ServerEntryTracerTest, noteAppended_evict) {
+    EntryTracer tracer;
+    tracer.setSampleInterval(1);
+    for (uint64_t i = 1; i <= EntryTracer::MAX_ACTIVE + 1; ++i)
+        tracer.noteAppended(i);
+    tracer.finish(1, at(0), EntryTracer::TimePoint::min());
+    EXPECT_EQ(0U, tracer.getNumFinished());
+    tracer.finish(2, at(0), EntryTracer::TimePoint::min());
+    EXPECT_EQ(1U, tracer.getNumFinished());
+}
+
+TEST(ServerEntryTracerTest, dumpChromeTrace_empty) {
+    EntryTracer tracer;
+    EXPECT_EQ("{\"traceEvents\":[\n]}\n", tracer.dumpChromeTrace(1));
+}
+
+} // namespace LogCabin::Server::<anonymous>
+} // namespace LogCabin::Server
+} // namespace LogCabin
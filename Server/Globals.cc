@@ -18,6 +18,7 @@
 
 #include "Core/Debug.h"
 #include "Core/StringUtil.h"
+#include "Core/Util.h"
 #include "Protocol/Common.h"
 #include "Server/ClientService.h"
 #include "Server/ControlService.h"
@@ -28,6 +29,7 @@
 #ifndef IX_TARGET_BUILD
 #include "RPC/Server.h"
 #else
+#include "RPC/InterfaceIX.h"
 #include "RPC/ServerIX.h"
 #endif
 
@@ -72,12 +74,31 @@ Globals::LogRotateHandler::handleSignalEvent()
 }
 
 
+////////// Globals::RaftGroup //////////
+
+Globals::RaftGroup::RaftGroup()
+    : id(0)
+    , path()
+    , raft()
+    , stateMachine()
+    , raftService()
+{
+}
+
+Globals::RaftGroup::~RaftGroup()
+{
+}
+
 ////////// Globals //////////
 
 Globals::Globals()
     : config()
 #ifndef IX_TARGET_BUILD
     , serverStats(*this)
+#endif
+    , entryTracer()
+    , admissionControl()
+#ifndef IX_TARGET_BUILD
     , eventLoop()
     , sigIntBlocker(SIGINT)
     , sigTermBlocker(SIGTERM)
@@ -94,6 +115,7 @@ Globals::Globals()
     , serverId(~0UL)
     , raft()
     , stateMachine()
+    , groups()
     , controlService()
     , raftService()
     , clientService()
@@ -116,6 +138,9 @@ Globals::init()
         clusterUUID.set(uuid);
     serverId = config.read<uint64_t>("serverId");
     Core::Debug::processName = Core::StringUtil::format("%lu", serverId);
+    entryTracer.setSampleInterval(
+        config.read<uint64_t>("entryTraceSampleInterval", 1000));
+    admissionControl.init(config);
 #ifndef IX_TARGET_BUILD
     {
         ServerStats::Lock serverStatsLock(serverStats);
@@ -132,7 +157,37 @@ Globals::init()
     }
 
     if (!raftService) {
-        raftService.reset(new RaftService(*this));
+        raftService.reset(new RaftService(*this, raft));
+    }
+
+    if (groups.empty()) {
+        groups.emplace_back();
+        groups.back().path = "/";
+        std::vector<std::string> paths = Core::StringUtil::split(
+            config.read<std::string>("raftGroups", ""), ',');
+        for (auto it = paths.begin(); it != paths.end(); ++it) {
+            const std::string& path = *it;
+            if (path.size() < 2 || path.at(0) != '/' ||
+                path.at(path.size() - 1) == '/') {
+                EXIT("Bad path for Raft group %lu in raftGroups: '%s' (must "
+                     "be absolute, and not / or end in /)",
+                     groups.size(), path.c_str());
+            }
+            for (auto it2 = groups.begin(); it2 != groups.end(); ++it2) {
+                if (it2->path == path) {
+                    EXIT("Path %s is listed twice in raftGroups",
+                         path.c_str());
+                }
+            }
+            groups.emplace_back();
+            RaftGroup& group = groups.back();
+            group.id = groups.size() - 1;
+            group.path = path;
+            group.raft.reset(new RaftConsensus(*this));
+            group.raft->serverId = serverId;
+            group.raft->groupId = group.id;
+            group.raftService.reset(new RaftService(*this, group.raft));
+        }
     }
 
     if (!clientService) {
@@ -148,15 +203,32 @@ Globals::init()
 
         uint32_t maxThreads = config.read<uint16_t>("maxThreads", 16);
         namespace ServiceId = Protocol::Common::ServiceId;
-        rpcServer->registerService(ServiceId::CONTROL_SERVICE,
-                                   controlService,
-                                   maxThreads);
-        rpcServer->registerService(ServiceId::RAFT_SERVICE,
-                                   raftService,
-                                   maxThreads);
-        rpcServer->registerService(ServiceId::CLIENT_SERVICE,
-                                   clientService,
-                                   maxThreads);
+        typedef RPC::ThreadDispatchService::Priority Priority;
+        rpcServer->registerService(
+            ServiceId::CONTROL_SERVICE,
+            controlService,
+            config.read<uint32_t>("maxControlThreads", maxThreads),
+            Priority::NORMAL);
+        // Raft RPCs are scheduled ahead of client RPCs, so that a flood of
+        // client requests can't delay heartbeats into causing elections.
+        rpcServer->registerService(
+            ServiceId::RAFT_SERVICE,
+            raftService,
+            config.read<uint32_t>("maxRaftThreads", maxThreads),
+            Priority::HIGH);
+        for (auto it = groups.begin() + 1; it != groups.end(); ++it) {
+            rpcServer->registerService(
+                Core::Util::downCast<uint16_t>(
+                    ServiceId::RAFT_GROUP_SERVICE_BASE + it->id),
+                it->raftService,
+                config.read<uint32_t>("maxRaftThreads", maxThreads),
+                Priority::HIGH);
+        }
+        rpcServer->registerService(
+            ServiceId::CLIENT_SERVICE,
+            clientService,
+            config.read<uint32_t>("maxClientThreads", maxThreads),
+            Priority::LOW);
 
         std::string listenAddressesStr =
             config.read<std::string>("listenAddresses");
@@ -172,6 +244,16 @@ Globals::init()
         if (listenAddresses.empty()) {
             EXIT("No server addresses specified to listen on");
         }
+#ifdef IX_TARGET_BUILD
+        {
+            std::string backend = config.read<std::string>("ixBackend", "ix");
+            std::string error = RPC::IX::selectBackend(
+                backend, listenAddresses.front());
+            if (!error.empty())
+                EXIT("Could not use IX backend %s: %s",
+                     backend.c_str(), error.c_str());
+        }
+#endif
         for (auto it = listenAddresses.begin();
              it != listenAddresses.end();
              ++it) {
@@ -193,16 +275,44 @@ Globals::init()
         }
         raft->serverAddresses = listenAddressesStr;
         raft->init();
+        for (auto it = groups.begin() + 1; it != groups.end(); ++it) {
+            NOTICE("Raft group %lu owns %s", it->id, it->path.c_str());
+            it->raft->serverAddresses = listenAddressesStr;
+            it->raft->init();
+        }
     }
 
     if (!stateMachine) {
         stateMachine.reset(new StateMachine(raft, config, *this));
     }
+    groups.front().raft = raft;
+    groups.front().stateMachine = stateMachine;
+    groups.front().raftService = raftService;
+    for (auto it = groups.begin() + 1; it != groups.end(); ++it) {
+        if (!it->stateMachine)
+            it->stateMachine.reset(new StateMachine(it->raft, config, *this));
+    }
 #ifndef IX_TARGET_BUILD
     serverStats.enable();
 #endif
 }
 
+const Globals::RaftGroup&
+Globals::findGroup(const std::string& path) const
+{
+    assert(!groups.empty());
+    const RaftGroup* owner = &groups.front();
+    for (auto it = groups.begin() + 1; it != groups.end(); ++it) {
+        if (it->path.size() > owner->path.size() &&
+            Core::StringUtil::startsWith(path, it->path) &&
+            (path.size() == it->path.size() ||
+             path.at(it->path.size()) == '/')) {
+            owner = &*it;
+        }
+    }
+    return *owner;
+}
+
 void
 Globals::leaveSignalsBlocked()
 {
@@ -15,12 +15,16 @@
  */
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "Client/SessionManager.h"
 #include "Core/Config.h"
 #include "Core/Mutex.h"
 #include "Event/Loop.h"
 #include "Event/Signal.h"
+#include "Server/AdmissionControl.h"
+#include "Server/EntryTracer.h"
 #include "Server/ServerStats.h"
 
 #ifndef LOGCABIN_SERVER_GLOBALS_H
@@ -126,6 +130,16 @@ class Globals {
     Server::ServerStats serverStats;
 #endif
 
+    /**
+     * Timestamps sampled client writes as they move through the server.
+     */
+    Server::EntryTracer entryTracer;
+
+    /**
+     * Decides which client writes to reject when the server is overloaded.
+     */
+    Server::AdmissionControl admissionControl;
+
     /**
      * The event loop that runs the RPC system.
      */
@@ -212,6 +226,56 @@ class Globals {
      */
     std::shared_ptr<Server::StateMachine> stateMachine;
 
+    /**
+     * One of the independent Raft groups hosted by this process. Each group
+     * has its own log, state machine, and leader, and it owns a subtree of
+     * the namespace; the groups share everything else in Globals.
+     */
+    struct RaftGroup {
+        RaftGroup();
+        ~RaftGroup();
+        /**
+         * 0 for the root group, which owns everything not owned by another
+         * group and also handles sessions and membership changes.
+         */
+        uint64_t id;
+        /**
+         * The absolute path of the subtree that this group owns ("/" for the
+         * root group).
+         */
+        std::string path;
+        /**
+         * Consensus module for this group (the same as #raft for the root
+         * group).
+         */
+        std::shared_ptr<Server::RaftConsensus> raft;
+        /**
+         * State machine for this group (the same as #stateMachine for the
+         * root group).
+         */
+        std::shared_ptr<Server::StateMachine> stateMachine;
+        /**
+         * Service over which this group's peers talk to it.
+         */
+        std::shared_ptr<Server::RaftService> raftService;
+    };
+
+    /**
+     * Return the Raft group that owns the given path: the group with the
+     * longest 'path' that is the given path or one of its ancestors.
+     * \param path
+     *      An absolute path in the Tree. Relative paths (which the Tree will
+     *      reject anyway) are owned by the root group.
+     */
+    const RaftGroup& findGroup(const std::string& path) const;
+
+    /**
+     * All Raft groups hosted by this process, indexed by their IDs. The root
+     * group comes first and is always present after init(); the others come
+     * from the 'raftGroups' config option. Empty before init().
+     */
+    std::vector<RaftGroup> groups;
+
   private:
 
     /**
@@ -235,6 +299,9 @@ class Globals {
      */
     std::unique_ptr<RPC::Server> rpcServer;
 
+    // ServerStats reports on the RPC thread pool.
+    friend class ServerStats;
+
     // Globals is non-copyable.
     Globals(const Globals&) = delete;
     Globals& operator=(const Globals&) = delete;
@@ -19,6 +19,7 @@
 #include "RPC/Address.h"
 #include "RPC/Server.h"
 #include "Server/Globals.h"
+#include "Server/RaftConsensus.h"
 
 namespace LogCabin {
 namespace Server {
@@ -36,6 +37,52 @@ TEST(ServerGlobalsTest, basics) {
     globals.run();
 }
 
+TEST(ServerGlobalsTest, initRaftGroups) {
+    Globals globals;
+    globals.config.set("storageModule", "Memory");
+    globals.config.set("uuid", "my-fake-uuid-123");
+    globals.config.set("listenAddresses", "127.0.0.1");
+    globals.config.set("serverId", "1");
+    globals.config.set("use-temporary-storage", "true");
+    globals.config.set("raftGroups", "/a,/a/b,/c");
+    globals.init();
+    ASSERT_EQ(4U, globals.groups.size());
+    EXPECT_EQ(globals.raft, globals.groups.at(0).raft);
+    EXPECT_EQ(globals.stateMachine, globals.groups.at(0).stateMachine);
+    EXPECT_EQ("/a/b", globals.groups.at(2).path);
+    EXPECT_EQ(2U, globals.groups.at(2).raft->groupId);
+    EXPECT_EQ(1U, globals.groups.at(2).raft->serverId);
+    EXPECT_EQ(globals.raft->storageLayout.serverDir.path + "/group2",
+              globals.groups.at(2).raft->storageLayout.serverDir.path);
+
+    EXPECT_EQ(0U, globals.findGroup("/").id);
+    EXPECT_EQ(0U, globals.findGroup("/ab").id);
+    EXPECT_EQ(0U, globals.findGroup("keepalive").id);
+    EXPECT_EQ(1U, globals.findGroup("/a").id);
+    EXPECT_EQ(1U, globals.findGroup("/a/x").id);
+    EXPECT_EQ(2U, globals.findGroup("/a/b").id);
+    EXPECT_EQ(2U, globals.findGroup("/a/b/c").id);
+    EXPECT_EQ(1U, globals.findGroup("/a/bc").id);
+    EXPECT_EQ(3U, globals.findGroup("/c/").id);
+    globals.eventLoop.exit();
+    globals.run();
+}
+
+TEST(ServerGlobalsTest, initRaftGroupsBadPath) {
+    Globals globals;
+    globals.config.set("storageModule", "Memory");
+    globals.config.set("uuid", "my-fake-uuid-123");
+    globals.config.set("listenAddresses", "127.0.0.1");
+    globals.config.set("serverId", "1");
+    globals.config.set("use-temporary-storage", "true");
+    globals.config.set("raftGroups", "/a,/b/");
+    EXPECT_DEATH(globals.init(),
+                 "Bad path for Raft group 2");
+    globals.config.set("raftGroups", "/a,/a");
+    EXPECT_DEATH(globals.init(),
+                 "listed twice");
+}
+
 TEST(ServerGlobalsTest, initNoServers) {
     Globals globals;
     globals.config.set("storageModule", "Memory");
@@ -349,7 +349,11 @@ main(int argc, char** argv)
                    Core::StringUtil::toString(globals.config).c_str());
             globals.init();
             if (options.bootstrap) {
-                globals.raft->bootstrapConfiguration();
+                for (auto it = globals.groups.begin();
+                     it != globals.groups.end();
+                     ++it) {
+                    it->raft->bootstrapConfiguration();
+                }
                 NOTICE("Done bootstrapping configuration. Exiting.");
             } else {
                 globals.leaveSignalsBlocked();
@@ -17,7 +17,9 @@
 
 #include <algorithm>
 #include <fcntl.h>
+#include <google/protobuf/io/coded_stream.h>
 #include <limits>
+#include <set>
 #include <string.h>
 #include <sys/file.h>
 #include <sys/stat.h>
@@ -120,7 +122,8 @@ LocalServer::getMatchIndex() const
 bool
 LocalServer::haveVote() const
 {
-    return (consensus.votedFor == serverId);
+    // A pre-candidate always grants itself a Pre-Vote.
+    return (consensus.preVoting || consensus.votedFor == serverId);
 }
 
 void
@@ -161,6 +164,11 @@ LocalServer::updatePeerStats(Protocol::ServerStats::Raft::Peer& peerStats,
     }
 }
 
+void
+LocalServer::wakeUp()
+{
+}
+
 ////////// Peer //////////
 
 Peer::Peer(uint64_t serverId, RaftConsensus& consensus)
@@ -170,6 +178,8 @@ Peer::Peer(uint64_t serverId, RaftConsensus& consensus)
     , eventLoop(consensus.globals.eventLoop)
 #endif
     , exiting(false)
+    , wakeup()
+    , numWakeups(0)
     , requestVoteDone(false)
     , haveVote_(false)
     , suppressBulkData(true)
@@ -183,6 +193,8 @@ Peer::Peer(uint64_t serverId, RaftConsensus& consensus)
     , lastAckEpoch(0)
     , nextHeartbeatTime(TimePoint::min())
     , backoffUntil(TimePoint::min())
+    , appendEntriesBytesLimit(~0UL)
+    , minAppendEntriesRoundTrip(std::chrono::nanoseconds::max())
     , rpcFailuresSinceLastWarning(0)
     , lastCatchUpIterationMs(~0UL)
     , thisCatchUpIterationStart(Clock::now())
@@ -254,6 +266,7 @@ void
 Peer::interrupt()
 {
     rpc.cancel();
+    wakeup.notify_all();
 }
 
 bool
@@ -266,6 +279,7 @@ void
 Peer::scheduleHeartbeat()
 {
     nextHeartbeatTime = Clock::now();
+    wakeup.notify_all();
 }
 
 Peer::CallStatus
@@ -275,11 +289,31 @@ Peer::callRPC(Protocol::Raft::OpCode opCode,
               std::unique_lock<Mutex>& lockGuard)
 {
     typedef RPC::ClientRPC::Status RPCStatus;
+    if (consensus.deliverRPC) {
+        // Like ClientRPC, serialize the request before releasing the lock,
+        // since it may borrow entries from the log (see packEntries()).
+        Core::Buffer requestBuffer;
+        Core::ProtoBuf::serialize(request, requestBuffer);
+        // release lock for concurrency
+        Core::MutexUnlock<Mutex> unlockGuard(lockGuard);
+        if (consensus.deliverRPC(serverId, opCode, requestBuffer, response))
+            return CallStatus::OK;
+        return CallStatus::FAILED;
+    }
+    uint16_t serviceId = Protocol::Common::ServiceId::RAFT_SERVICE;
+    if (consensus.groupId != 0) {
+        serviceId = Core::Util::downCast<uint16_t>(
+            Protocol::Common::ServiceId::RAFT_GROUP_SERVICE_BASE +
+            consensus.groupId);
+    }
+    // Serialize the request first: getSession() may release the lock to
+    // connect, and the request may borrow entries from the log.
+    Core::Buffer requestBuffer = RPC::ClientRPC::serializeRequest(request);
     rpc = RPC::ClientRPC(getSession(lockGuard),
-                         Protocol::Common::ServiceId::RAFT_SERVICE,
+                         serviceId,
                          /* serviceSpecificErrorVersion = */ 0,
                          opCode,
-                         request);
+                         std::move(requestBuffer));
     // release lock for concurrency
     Core::MutexUnlock<Mutex> unlockGuard(lockGuard);
     switch (rpc.waitForReply(&response, NULL, TimePoint::max())) {
@@ -308,7 +342,17 @@ Peer::callRPC(Protocol::Raft::OpCode opCode,
         case RPCStatus::RPC_CANCELED:
             return CallStatus::FAILED;
         case RPCStatus::INVALID_SERVICE:
-            PANIC("The server isn't running the RaftService");
+            if (consensus.groupId == 0)
+                PANIC("The server isn't running the RaftService");
+            // The peer's raftGroups setting doesn't match ours; keep retrying
+            // in case it's restarted with the right one.
+            ++rpcFailuresSinceLastWarning;
+            if (rpcFailuresSinceLastWarning % 100 == 1) {
+                WARNING("The server isn't running Raft group %lu (check its "
+                        "raftGroups setting)",
+                        consensus.groupId);
+            }
+            return CallStatus::FAILED;
         case RPCStatus::INVALID_REQUEST:
             return CallStatus::INVALID_REQUEST;
     }
@@ -392,6 +436,7 @@ Peer::updatePeerStats(Protocol::ServerStats::Raft::Peer& peerStats,
             peerStats.set_last_agree_index(matchIndex);
             peerStats.set_is_caught_up(isCaughtUp_);
             peerStats.set_next_heartbeat_at(time.unixNanos(nextHeartbeatTime));
+            peerStats.set_append_entries_bytes_limit(appendEntriesBytesLimit);
             break;
     }
 
@@ -405,12 +450,67 @@ Peer::updatePeerStats(Protocol::ServerStats::Raft::Peer& peerStats,
             peerStats.set_backoff_until(time.unixNanos(backoffUntil));
             break;
     }
+    peerStats.set_wakeups(numWakeups);
+}
+
+void
+Peer::wakeUp()
+{
+    wakeup.notify_all();
+}
+
+////////// Configuration::QuorumTracker //////////
+
+Configuration::QuorumTracker::QuorumTracker()
+    : values()
+    , sorted()
+{
+}
+
+Configuration::QuorumTracker::~QuorumTracker()
+{
+}
+
+void
+Configuration::QuorumTracker::reset(const std::vector<ServerRef>& servers,
+                                    const GetValue& getValue)
+{
+    values.clear();
+    sorted.clear();
+    for (auto it = servers.begin(); it != servers.end(); ++it) {
+        uint64_t value = getValue(**it);
+        values[it->get()] = value;
+        sorted.push_back(value);
+    }
+    std::sort(sorted.begin(), sorted.end());
+}
+
+void
+Configuration::QuorumTracker::update(const Server& server, uint64_t value)
+{
+    auto it = values.find(&server);
+    if (it == values.end() || it->second == value)
+        return;
+    sorted.erase(std::lower_bound(sorted.begin(), sorted.end(), it->second));
+    sorted.insert(std::upper_bound(sorted.begin(), sorted.end(), value),
+                  value);
+    it->second = value;
+}
+
+uint64_t
+Configuration::QuorumTracker::quorumMin() const
+{
+    if (sorted.empty())
+        return 0;
+    return sorted[(sorted.size() - 1) / 2];
 }
 
 ////////// Configuration::SimpleConfiguration //////////
 
 Configuration::SimpleConfiguration::SimpleConfiguration()
     : servers()
+    , matchIndexes()
+    , ackEpochs()
 {
 }
 
@@ -492,6 +592,7 @@ Configuration::Configuration(uint64_t serverId, RaftConsensus& consensus)
     , description()
     , oldServers()
     , newServers()
+    , learners()
 {
     localServer.reset(new LocalServer(serverId, consensus));
     knownServers[serverId] = localServer;
@@ -519,6 +620,12 @@ Configuration::hasVote(std::shared_ptr<Server> server) const
     }
 }
 
+bool
+Configuration::isLearner(std::shared_ptr<Server> server) const
+{
+    return learners.contains(server);
+}
+
 std::string
 Configuration::lookupAddress(uint64_t serverId) const
 {
@@ -550,6 +657,52 @@ Configuration::quorumMin(const GetValue& getValue) const
     }
 }
 
+uint64_t
+Configuration::quorumMatchIndex() const
+{
+    if (state == State::TRANSITIONAL) {
+        return std::min(oldServers.matchIndexes.quorumMin(),
+                        newServers.matchIndexes.quorumMin());
+    } else {
+        return oldServers.matchIndexes.quorumMin();
+    }
+}
+
+uint64_t
+Configuration::quorumAckEpoch() const
+{
+    uint64_t epoch;
+    if (state == State::TRANSITIONAL) {
+        epoch = std::min(oldServers.ackEpochs.quorumMin(),
+                         newServers.ackEpochs.quorumMin());
+    } else {
+        epoch = oldServers.ackEpochs.quorumMin();
+    }
+    // The local server is tracked as ~0UL; this turns it into the current
+    // epoch when the quorum's smallest value is the local server's.
+    return std::min(epoch, localServer->getLastAckEpoch());
+}
+
+namespace {
+uint64_t ackEpochOrMax(const Server* localServer, const Server& server)
+{
+    if (&server == localServer)
+        return ~0UL;
+    return server.getLastAckEpoch();
+}
+}
+
+void
+Configuration::resetQuorumTrackers()
+{
+    GetValue getAckEpoch = std::bind(ackEpochOrMax, localServer.get(),
+                                     std::placeholders::_1);
+    oldServers.matchIndexes.reset(oldServers.servers, &Server::getMatchIndex);
+    oldServers.ackEpochs.reset(oldServers.servers, getAckEpoch);
+    newServers.matchIndexes.reset(newServers.servers, &Server::getMatchIndex);
+    newServers.ackEpochs.reset(newServers.servers, getAckEpoch);
+}
+
 void
 Configuration::resetStagingServers()
 {
@@ -576,10 +729,12 @@ Configuration::reset()
     description = {};
     oldServers.servers.clear();
     newServers.servers.clear();
+    learners.servers.clear();
     for (auto it = knownServers.begin(); it != knownServers.end(); ++it)
         it->second->exit();
     knownServers.clear();
     knownServers[localServer->serverId] = localServer;
+    resetQuorumTrackers();
 }
 
 void
@@ -598,6 +753,7 @@ Configuration::setConfiguration(
     description = newDescription;
     oldServers.servers.clear();
     newServers.servers.clear();
+    learners.servers.clear();
 
     // Build up the list of old servers
     for (auto confIt = description.prev_configuration().servers().begin();
@@ -617,10 +773,20 @@ Configuration::setConfiguration(
         newServers.servers.push_back(server);
     }
 
+    // Build up the list of learners
+    for (auto confIt = description.learners().begin();
+         confIt != description.learners().end();
+         ++confIt) {
+        std::shared_ptr<Server> server = getServer(confIt->server_id());
+        server->addresses = confIt->addresses();
+        learners.servers.push_back(server);
+    }
+
     // Servers not in the current configuration need to be told to exit
     setGCFlag(*localServer);
     oldServers.forEach(setGCFlag);
     newServers.forEach(setGCFlag);
+    learners.forEach(setGCFlag);
     auto it = knownServers.begin();
     while (it != knownServers.end()) {
         std::shared_ptr<Server> server = it->second;
@@ -632,6 +798,7 @@ Configuration::setConfiguration(
             ++it;
         }
     }
+    resetQuorumTrackers();
 }
 
 void
@@ -647,6 +814,7 @@ Configuration::setStagingServers(
         server->addresses = it->addresses();
         newServers.servers.push_back(server);
     }
+    resetQuorumTrackers();
 }
 
 bool
@@ -667,6 +835,24 @@ Configuration::stagingMin(const GetValue& getValue) const
         return 0;
 }
 
+void
+Configuration::updateAckEpoch(const Server& server)
+{
+    if (&server == localServer.get())
+        return;
+    uint64_t epoch = server.getLastAckEpoch();
+    oldServers.ackEpochs.update(server, epoch);
+    newServers.ackEpochs.update(server, epoch);
+}
+
+void
+Configuration::updateMatchIndex(const Server& server)
+{
+    uint64_t matchIndex = server.getMatchIndex();
+    oldServers.matchIndexes.update(server, matchIndex);
+    newServers.matchIndexes.update(server, matchIndex);
+}
+
 void
 Configuration::updateServerStats(Protocol::ServerStats& serverStats,
                                  Core::Time::SteadyTimeConverter& time) const
@@ -684,6 +870,7 @@ Configuration::updateServerStats(Protocol::ServerStats& serverStats,
                                  newServers.contains(peer));
         peerStats.set_staging_member(state == State::STAGING &&
                                      newServers.contains(peer));
+        peerStats.set_learner(learners.contains(peer));
         peer->updatePeerStats(peerStats, time);
     }
 }
@@ -953,6 +1140,13 @@ RaftConsensus::RaftConsensus(Globals& globals)
         globals.config.read<uint64_t>(
             "maxLogEntriesPerRequest",
             5000))
+    , APPEND_ENTRIES_TARGET_DURATION(
+        globals.config.keyExists("appendEntriesTargetMilliseconds")
+            ? std::chrono::nanoseconds(
+                std::chrono::milliseconds(
+                    globals.config.read<uint64_t>(
+                        "appendEntriesTargetMilliseconds")))
+            : HEARTBEAT_PERIOD / 2)
     , RPC_FAILURE_BACKOFF(
         globals.config.keyExists("rpcFailureBackoffMilliseconds")
             ? std::chrono::nanoseconds(
@@ -965,9 +1159,12 @@ RaftConsensus::RaftConsensus(Globals& globals)
             globals.config.read<uint64_t>(
                 "stateMachineUpdaterBackoffMilliseconds",
                 10000)))
+    , PRE_VOTE(globals.config.read<bool>("preVote", false))
     , SOFT_RPC_SIZE_LIMIT(Protocol::Common::MAX_MESSAGE_LENGTH - 1024)
     , serverId(0)
     , serverAddresses()
+    , groupId(0)
+    , deliverRPC()
     , globals(globals)
     , storageLayout()
     , sessionManager(
@@ -999,7 +1196,13 @@ RaftConsensus::RaftConsensus(Globals& globals)
     , clusterClock()
     , startElectionAt(TimePoint::max())
     , withholdVotesUntil(TimePoint::min())
+    , lastLeaderContact(TimePoint::min())
+    , preVoting(false)
+    , leadershipTransferElection(false)
+    , leadershipTransferTarget(0)
+    , leadershipTransferSent(false)
     , numEntriesTruncated(0)
+    , commitNanos()
     , leaderDiskThread()
     , timerThread()
     , stateMachineUpdaterThread()
@@ -1048,9 +1251,13 @@ RaftConsensus::init()
 #endif
 
     NOTICE("My server ID is %lu", serverId);
+    if (groupId != 0)
+        NOTICE("Running Raft group %lu", groupId);
 
     if (storageLayout.topDir.fd == -1) {
-        if (globals.config.read("use-temporary-storage", false))
+        if (groupId != 0) // within the root group's locked directory
+            storageLayout.initGroup(globals.raft->storageLayout, groupId);
+        else if (globals.config.read("use-temporary-storage", false))
             storageLayout.initTemporary(serverId); // unit tests
         else
             storageLayout.init(globals.config, serverId);
@@ -1167,6 +1374,7 @@ RaftConsensus::bootstrapConfiguration()
 RaftConsensus::ClientResult
 RaftConsensus::getConfiguration(
         Protocol::Raft::SimpleConfiguration& currentConfiguration,
+        Protocol::Raft::SimpleConfiguration& learners,
         uint64_t& id) const
 {
     std::unique_lock<Mutex> lockGuard(mutex);
@@ -1177,6 +1385,7 @@ RaftConsensus::getConfiguration(
         return ClientResult::RETRY;
     }
     currentConfiguration = configuration->description.prev_configuration();
+    *learners.mutable_servers() = configuration->description.learners();
     id = configuration->id;
     return ClientResult::SUCCESS;
 }
@@ -1191,6 +1400,29 @@ RaftConsensus::getLastCommitIndex() const
         return {ClientResult::SUCCESS, commitIndex};
 }
 
+std::pair<RaftConsensus::ClientResult, uint64_t>
+RaftConsensus::getStaleReadIndex(std::chrono::nanoseconds maxStaleness) const
+{
+    std::unique_lock<Mutex> lockGuard(mutex);
+    if (maxStaleness == std::chrono::nanoseconds::max())
+        return {ClientResult::SUCCESS, commitIndex};
+    if (state == State::LEADER) {
+        // A leader that has lost contact with its followers steps down after
+        // an election timeout (see stepDownThreadMain()), so its commitIndex
+        // can be at most that stale.
+        if (maxStaleness < ELECTION_TIMEOUT && !upToDateLeader(lockGuard))
+            return {ClientResult::NOT_LEADER, 0};
+        return {ClientResult::SUCCESS, commitIndex};
+    }
+    if (state == State::FOLLOWER &&
+        leaderId != 0 &&
+        lastLeaderContact != TimePoint::min() &&
+        Clock::now() - lastLeaderContact <= maxStaleness) {
+        return {ClientResult::SUCCESS, commitIndex};
+    }
+    return {ClientResult::NOT_LEADER, 0};
+}
+
 std::string
 RaftConsensus::getLeaderHint() const
 {
@@ -1198,6 +1430,16 @@ RaftConsensus::getLeaderHint() const
     return configuration->lookupAddress(leaderId);
 }
 
+uint64_t
+RaftConsensus::getNumUncommittedEntries() const
+{
+    std::lock_guard<Mutex> lockGuard(mutex);
+    uint64_t lastLogIndex = log->getLastLogIndex();
+    if (lastLogIndex <= commitIndex)
+        return 0;
+    return lastLogIndex - commitIndex;
+}
+
 RaftConsensus::Entry
 RaftConsensus::getNextEntry(uint64_t lastIndex) const
 {
@@ -1315,6 +1557,7 @@ RaftConsensus::handleAppendEntries(
     stepDown(request.term());
     setElectionTimer();
     withholdVotesUntil = Clock::now() + ELECTION_TIMEOUT;
+    TimePoint received = Clock::now();
 
     // Record the leader ID as a hint for clients.
     if (leaderId == 0) {
@@ -1429,6 +1672,13 @@ RaftConsensus::handleAppendEntries(
         VERBOSE("New commitIndex: %lu", commitIndex);
     }
 
+    // Only a follower that has everything the leader had committed when it
+    // sent this request is as fresh as the leader was at that time.
+    if (request.has_leader_commit_index() &&
+        commitIndex >= request.leader_commit_index()) {
+        lastLeaderContact = received;
+    }
+
     // reset election timer to avoid punishing the leader for our own
     // long disk writes
     setElectionTimer();
@@ -1547,7 +1797,28 @@ RaftConsensus::handleRequestVote(
                      request.last_log_index() >= lastLogIndex));
 
     NOTICE("LOGISOK : %d", (int)logIsOk);
-    if (withholdVotesUntil > Clock::now()) {
+
+    // A Pre-Vote asks whether we would vote for the caller if it started an
+    // election in request.term(). It must not change any of our state: the
+    // caller has not actually incremented its term.
+    if (request.pre_vote()) {
+        bool granted = (withholdVotesUntil <= Clock::now() &&
+                        request.term() > currentTerm &&
+                        logIsOk);
+        NOTICE("%s Pre-Vote for term %lu from server %lu "
+               "(this server's term is %lu)",
+               granted ? "Granting" : "Rejecting",
+               request.term(), request.server_id(), currentTerm);
+        response.set_term(currentTerm);
+        response.set_granted(granted);
+        response.set_log_ok(logIsOk);
+        return;
+    }
+
+    // An election started by a leadership transfer was requested by the
+    // leader itself, so it's not disruptive.
+    if (withholdVotesUntil > Clock::now() &&
+        !request.leadership_transfer()) {
         NOTICE("Rejecting RequestVote for term %lu from server %lu, since "
                "this server (which is in term %lu) recently heard from a "
                "leader (%lu). Should server %lu be shut down?",
@@ -1591,6 +1862,38 @@ RaftConsensus::handleRequestVote(
     response.set_log_ok(logIsOk);
 }
 
+void
+RaftConsensus::handleTimeoutNow(
+                    const Protocol::Raft::TimeoutNow::Request& request,
+                    Protocol::Raft::TimeoutNow::Response& response)
+{
+    std::lock_guard<Mutex> lockGuard(mutex);
+    assert(!exiting);
+
+    response.set_term(currentTerm);
+    if (request.term() < currentTerm) {
+        VERBOSE("Caller(%lu) is stale. Our term is %lu, theirs is %lu",
+                 request.server_id(), currentTerm, request.term());
+        return; // response was set above
+    }
+    if (request.term() > currentTerm) {
+        NOTICE("Received TimeoutNow request from server %lu in term %lu "
+               "(this server's term was %lu)",
+                request.server_id(), request.term(), currentTerm);
+        stepDown(request.term());
+    }
+
+    if (state == State::FOLLOWER) {
+        NOTICE("Server %lu asked this server to take over leadership in "
+               "term %lu", request.server_id(), currentTerm);
+        // Skip the Pre-Vote phase: the leader is stepping aside on purpose.
+        startNewElection();
+        if (state == State::CANDIDATE)
+            leadershipTransferElection = true;
+    }
+    response.set_term(currentTerm);
+}
+
 std::pair<RaftConsensus::ClientResult, uint64_t>
 RaftConsensus::replicate(const Core::Buffer& operation)
 {
@@ -1632,6 +1935,42 @@ RaftConsensus::setConfiguration(
         return ClientResult::FAIL;
     }
 
+    // Work out the learners of the new configuration. A server can't both
+    // vote and be a learner.
+    std::set<uint64_t> newServerIds;
+    for (auto it = request.new_servers().begin();
+         it != request.new_servers().end();
+         ++it) {
+        newServerIds.insert(it->server_id());
+    }
+    Protocol::Raft::SimpleConfiguration newLearners;
+    if (request.replace_learners()) {
+        for (auto it = request.new_learners().begin();
+             it != request.new_learners().end();
+             ++it) {
+            if (newServerIds.count(it->server_id()) > 0) {
+                NOTICE("Rejecting configuration that lists server %lu as "
+                       "both a voter and a learner", it->server_id());
+                *response.mutable_configuration_bad()->add_bad_servers() =
+                    *it;
+            }
+            Protocol::Raft::Server* s = newLearners.add_servers();
+            s->set_server_id(it->server_id());
+            s->set_addresses(it->addresses());
+        }
+        if (response.has_configuration_bad())
+            return ClientResult::FAIL;
+    } else {
+        const Protocol::Raft::Configuration& description =
+            configuration->description;
+        for (auto it = description.learners().begin();
+             it != description.learners().end();
+             ++it) {
+            if (newServerIds.count(it->server_id()) == 0)
+                *newLearners.add_servers() = *it;
+        }
+    }
+
     NOTICE("Attempting to change the configuration from %lu",
            configuration->id);
 
@@ -1690,6 +2029,7 @@ RaftConsensus::setConfiguration(
     *newConfiguration.mutable_prev_configuration() =
         configuration->description.prev_configuration();
     *newConfiguration.mutable_next_configuration() = nextConfiguration;
+    *newConfiguration.mutable_learners() = newLearners.servers();
     Log::Entry entry;
     entry.set_type(Protocol::Raft::EntryType::CONFIGURATION);
     *entry.mutable_configuration() = newConfiguration;
@@ -1752,6 +2092,83 @@ RaftConsensus::setSupportedStateMachineVersions(uint16_t minSupported,
     }
 }
 
+RaftConsensus::ClientResult
+RaftConsensus::transferLeadership(uint64_t targetId)
+{
+    std::unique_lock<Mutex> lockGuard(mutex);
+    if (exiting || state != State::LEADER)
+        return ClientResult::NOT_LEADER;
+    if (leadershipTransferTarget != 0) {
+        NOTICE("Leadership transfer to server %lu already in progress",
+               leadershipTransferTarget);
+        return ClientResult::FAIL;
+    }
+    uint64_t term = currentTerm;
+
+    std::set<uint64_t> voters;
+    for (auto it = configuration->description.prev_configuration()
+                        .servers().begin();
+         it != configuration->description.prev_configuration()
+                        .servers().end();
+         ++it) {
+        voters.insert(it->server_id());
+    }
+    for (auto it = configuration->description.next_configuration()
+                        .servers().begin();
+         it != configuration->description.next_configuration()
+                        .servers().end();
+         ++it) {
+        voters.insert(it->server_id());
+    }
+    voters.erase(serverId);
+
+    if (targetId == 0) {
+        // Pick the voter that will take the least time to catch up.
+        uint64_t bestMatchIndex = 0;
+        configuration->forEach([&](Server& server) {
+            if (voters.count(server.serverId) > 0 &&
+                (targetId == 0 ||
+                 server.getMatchIndex() > bestMatchIndex)) {
+                targetId = server.serverId;
+                bestMatchIndex = server.getMatchIndex();
+            }
+        });
+        if (targetId == 0) {
+            NOTICE("No other voting servers to transfer leadership to");
+            return ClientResult::FAIL;
+        }
+    } else if (voters.count(targetId) == 0) {
+        NOTICE("Can't transfer leadership to server %lu, since it's not "
+               "another voting member of the cluster", targetId);
+        return ClientResult::FAIL;
+    }
+
+    NOTICE("Transferring leadership to server %lu", targetId);
+    leadershipTransferTarget = targetId;
+    leadershipTransferSent = false;
+    configuration->forEach(&Server::wakeUp);
+    stateChanged.notify_all();
+
+    TimePoint giveUpAt = Clock::now() + ELECTION_TIMEOUT;
+    while (!exiting &&
+           currentTerm == term &&
+           leadershipTransferTarget == targetId &&
+           Clock::now() < giveUpAt) {
+        stateChanged.wait_until(lockGuard, giveUpAt);
+    }
+
+    if (currentTerm == term) {
+        NOTICE("Leadership transfer to server %lu did not complete within "
+               "an election timeout", targetId);
+        if (leadershipTransferTarget == targetId) {
+            leadershipTransferTarget = 0;
+            stateChanged.notify_all();
+        }
+        return ClientResult::FAIL;
+    }
+    return ClientResult::SUCCESS;
+}
+
 std::unique_ptr<Storage::SnapshotFile::Writer>
 RaftConsensus::beginSnapshot(uint64_t lastIncludedIndex)
 {
@@ -1905,6 +2322,7 @@ RaftConsensus::updateServerStats(Protocol::ServerStats& serverStats) const
     raftStats.set_last_snapshot_cluster_time(lastSnapshotClusterTime);
     raftStats.set_last_snapshot_bytes(lastSnapshotBytes);
     raftStats.set_num_entries_truncated(numEntriesTruncated);
+    commitNanos.updateProtoBuf(*raftStats.mutable_commit_nanos());
     raftStats.set_log_start_index(log->getLogStartIndex());
     raftStats.set_log_bytes(log->getSizeBytes());
     configuration->updateServerStats(serverStats, time);
@@ -2053,7 +2471,14 @@ RaftConsensus::leaderDiskThreadMain()
                 leaderDiskThreadWorking = false;
             }
             if (state == State::LEADER && currentTerm == term) {
+                if (groupId == 0) {
+                    globals.entryTracer.note(
+                        EntryTracer::SYNCED,
+                        configuration->localServer->lastSyncedIndex + 1,
+                        sync->lastIndex);
+                }
                 configuration->localServer->lastSyncedIndex = sync->lastIndex;
+                configuration->updateMatchIndex(*configuration->localServer);
                 advanceCommitIndex();
             }
             log->syncComplete(std::move(sync));
@@ -2069,8 +2494,12 @@ RaftConsensus::timerThreadMain()
     std::unique_lock<Mutex> lockGuard(mutex);
     Core::ThreadId::setName("startNewElection");
     while (!exiting) {
-        if (Clock::now() >= startElectionAt)
-            startNewElection();
+        if (Clock::now() >= startElectionAt) {
+            if (PRE_VOTE)
+                startPreVote();
+            else
+                startNewElection();
+        }
         stateChanged.wait_until(lockGuard, startElectionAt);
     }
 }
@@ -2083,8 +2512,8 @@ RaftConsensus::peerThreadMain(std::shared_ptr<Peer> peer)
         Core::StringUtil::format("Peer(%lu)", peer->serverId));
     NOTICE("Peer thread for server %lu started", peer->serverId);
 
-    // Each iteration of this loop issues a new RPC or sleeps on the condition
-    // variable.
+    // Each iteration of this loop issues a new RPC or sleeps on the peer's
+    // condition variable.
     while (!peer->exiting) {
         TimePoint now = Clock::now();
         TimePoint waitUntil = TimePoint::min();
@@ -2113,6 +2542,10 @@ RaftConsensus::peerThreadMain(std::shared_ptr<Peer> peer)
                         // appendEntries delegates to installSnapshot if we
                         // need to send a snapshot instead
                         appendEntries(lockGuard, *peer);
+                    } else if (leadershipTransferTarget == peer->serverId &&
+                               !leadershipTransferSent) {
+                        // the target's log is caught up
+                        timeoutNow(lockGuard, *peer);
                     } else {
                         waitUntil = peer->nextHeartbeatTime;
                     }
@@ -2120,7 +2553,8 @@ RaftConsensus::peerThreadMain(std::shared_ptr<Peer> peer)
             }
         }
 
-        stateChanged.wait_until(lockGuard, waitUntil);
+        peer->wakeup.wait_until(lockGuard, waitUntil);
+        ++peer->numWakeups;
     }
 
     // must return immediately after this
@@ -2145,7 +2579,7 @@ RaftConsensus::stepDownThreadMain()
                 // in the configuration), we need to sleep. Without this guard,
                 // this method would not relinquish the CPU.
                 ++currentEpoch;
-                if (configuration->quorumMin(&Server::getLastAckEpoch) <
+                if (configuration->quorumAckEpoch() <
                     currentEpoch) {
                     break;
                 }
@@ -2164,7 +2598,7 @@ RaftConsensus::stepDownThreadMain()
                 return;
             if (currentTerm > term)
                 break;
-            if (configuration->quorumMin(&Server::getLastAckEpoch) >= epoch)
+            if (configuration->quorumAckEpoch() >= epoch)
                 break;
             if (Clock::now() >= stepDownAt) {
                 NOTICE("No broadcast for a timeout, stepping down from leader "
@@ -2192,7 +2626,7 @@ RaftConsensus::advanceCommitIndex()
 
     // calculate the largest entry ID stored on a quorum of servers
     uint64_t newCommitIndex =
-        configuration->quorumMin(&Server::getMatchIndex);
+        configuration->quorumMatchIndex();
     if (commitIndex >= newCommitIndex)
         return;
     // If we have discarded the entry, it's because we already knew it was
@@ -2202,6 +2636,10 @@ RaftConsensus::advanceCommitIndex()
     // guarantee that no server without them can be elected.
     if (log->getEntry(newCommitIndex).term() != currentTerm)
         return;
+    if (groupId == 0) {
+        globals.entryTracer.note(EntryTracer::COMMITTED,
+                                 commitIndex + 1, newCommitIndex);
+    }
     commitIndex = newCommitIndex;
     VERBOSE("New commitIndex: %lu", commitIndex);
     assert(commitIndex <= log->getLastLogIndex());
@@ -2226,6 +2664,8 @@ RaftConsensus::advanceCommitIndex()
             entry.set_cluster_time(clusterClock.leaderStamp());
             *entry.mutable_configuration()->mutable_prev_configuration() =
                 configuration->description.next_configuration();
+            *entry.mutable_configuration()->mutable_learners() =
+                configuration->description.learners();
             append({&entry});
             return;
         }
@@ -2252,6 +2692,8 @@ RaftConsensus::append(const std::vector<const Log::Entry*>& entries)
             configurationManager->add(index, entry.configuration());
         ++index;
     }
+    if (state == State::LEADER)
+        configuration->forEach(&Server::wakeUp);
     stateChanged.notify_all();
 }
 
@@ -2289,9 +2731,13 @@ RaftConsensus::appendEntries(std::unique_lock<Mutex>& lockGuard,
     request.set_term(currentTerm);
     request.set_prev_log_term(prevLogTerm);
     request.set_prev_log_index(prevLogIndex);
+    request.set_leader_commit_index(commitIndex);
     uint64_t numEntries = 0;
+    uint64_t bytesLimit = std::min(SOFT_RPC_SIZE_LIMIT,
+                                   peer.appendEntriesBytesLimit);
     if (!peer.suppressBulkData)
-        numEntries = packEntries(peer.nextIndex, request);
+        numEntries = packEntries(peer.nextIndex, bytesLimit, request);
+    Core::Util::Finally _([&request]() { unpackEntries(request); });
     request.set_commit_index(std::min(commitIndex, prevLogIndex + numEntries));
 
     // Execute RPC
@@ -2331,8 +2777,13 @@ RaftConsensus::appendEntries(std::unique_lock<Mutex>& lockGuard,
     } else {
         assert(response.term() == currentTerm);
         peer.lastAckEpoch = epoch;
+        configuration->updateAckEpoch(peer);
         stateChanged.notify_all();
         peer.nextHeartbeatTime = start + HEARTBEAT_PERIOD;
+        bool full = (numEntries < MAX_LOG_ENTRIES_PER_REQUEST &&
+                     prevLogIndex + numEntries < lastLogIndex);
+        adaptAppendEntriesLimit(peer, bytesLimit, numEntries, full,
+                                Clock::now() - start);
         if (response.success()) {
             if (peer.matchIndex > prevLogIndex + numEntries) {
                 // Revisit this warning if we pipeline AppendEntries RPCs for
@@ -2342,6 +2793,7 @@ RaftConsensus::appendEntries(std::unique_lock<Mutex>& lockGuard,
                         "didn't.");
             } else {
                 peer.matchIndex = prevLogIndex + numEntries;
+                configuration->updateMatchIndex(peer);
                 advanceCommitIndex();
             }
             peer.nextIndex = peer.matchIndex + 1;
@@ -2393,6 +2845,36 @@ RaftConsensus::appendEntries(std::unique_lock<Mutex>& lockGuard,
     }
 }
 
+void
+RaftConsensus::adaptAppendEntriesLimit(Peer& peer,
+                                       uint64_t bytesLimit,
+                                       uint64_t numEntries,
+                                       bool full,
+                                       std::chrono::nanoseconds elapsed) const
+{
+    peer.minAppendEntriesRoundTrip = std::min(peer.minAppendEntriesRoundTrip,
+                                              elapsed);
+    if (numEntries == 0 ||
+        APPEND_ENTRIES_TARGET_DURATION == std::chrono::nanoseconds::zero()) {
+        return;
+    }
+    // Requests that are too slow shrink quickly; requests that only took a
+    // little while grow back, as long as there was more to send. Only the
+    // time beyond the round trip counts, which is roughly the time spent
+    // transferring and writing the entries, so this follows the throughput
+    // of the link and the follower's disk without having to estimate it.
+    const uint64_t minBytesLimit = 4096;
+    std::chrono::nanoseconds transfer =
+        elapsed - peer.minAppendEntriesRoundTrip;
+    if (transfer > APPEND_ENTRIES_TARGET_DURATION) {
+        peer.appendEntriesBytesLimit = std::max(minBytesLimit,
+                                                bytesLimit / 2);
+    } else if (full && transfer < APPEND_ENTRIES_TARGET_DURATION / 2) {
+        peer.appendEntriesBytesLimit = std::min(SOFT_RPC_SIZE_LIMIT,
+                                                bytesLimit * 2);
+    }
+}
+
 void
 RaftConsensus::installSnapshot(std::unique_lock<Mutex>& lockGuard,
                                Peer& peer)
@@ -2470,6 +2952,7 @@ RaftConsensus::installSnapshot(std::unique_lock<Mutex>& lockGuard,
     } else {
         assert(response.term() == currentTerm);
         peer.lastAckEpoch = epoch;
+        configuration->updateAckEpoch(peer);
         stateChanged.notify_all();
         peer.nextHeartbeatTime = start + HEARTBEAT_PERIOD;
         peer.suppressBulkData = false;
@@ -2486,6 +2969,7 @@ RaftConsensus::installSnapshot(std::unique_lock<Mutex>& lockGuard,
             NOTICE("Done sending snapshot through index %lu to follower",
                    peer.lastSnapshotIndex);
             peer.matchIndex = peer.lastSnapshotIndex;
+            configuration->updateMatchIndex(peer);
             peer.nextIndex = peer.lastSnapshotIndex + 1;
             // These entries are already committed if they're in a snapshot, so
             // the commitIndex shouldn't advance, but let's just follow the
@@ -2508,6 +2992,8 @@ RaftConsensus::becomeLeader()
            log->getLastLogIndex() + 1);
     state = State::LEADER;
     leaderId = serverId;
+    leadershipTransferElection = false;
+    leadershipTransferTarget = 0;
     printElectionState();
     startElectionAt = TimePoint::max();
     withholdVotesUntil = TimePoint::max();
@@ -2522,6 +3008,7 @@ RaftConsensus::becomeLeader()
     // matchIndex for ourselves and each follower, then append the no op.
     // Otherwise we'll set our localServer's last agree index too high.
     configuration->forEach(&Server::beginLeadership);
+    configuration->resetQuorumTrackers();
 
     // Append a new entry so that commitment is not delayed indefinitely.
     // Otherwise, if the leader never gets anything to append, it will never
@@ -2580,60 +3067,49 @@ RaftConsensus::interruptAll()
 uint64_t
 RaftConsensus::packEntries(
         uint64_t nextIndex,
+        uint64_t bytesLimit,
         Protocol::Raft::AppendEntries::Request& request) const
 {
-    // Add as many as entries as will fit comfortably in the request. It's
-    // easiest to add one entry at a time until the RPC gets too big, then back
-    // the last one out.
-
-    // Calculating the size of the request ProtoBuf is a bit expensive, so this
-    // estimates high, then if it reaches the size limit, corrects the estimate
-    // and keeps going. This is a dumb algorithm but does well enough. It gets
-    // the number of calls to request.ByteSize() down to about 15 even with
-    // extremely small entries (10 bytes of payload data in each of 50,000
-    // entries filling to a 1MB max).
-
-    // Processing 19000 entries here with 10 bytes of data each (total request
-    // size of 1MB) still takes about 42 milliseconds on an overloaded laptop
-    // when compiling in DEBUG mode. That's a bit slow, in case someone has
-    // aggressive election timeouts. As a result, the total number of entries
-    // in a request is now limited to MAX_LOG_ENTRIES_PER_REQUEST=5000, which
-    // amortizes RPC overhead well enough anyhow. This limit will only kick in
-    // when the entry size drops below 200 bytes, since 1M/5K=200.
+    // Add as many entries as will fit comfortably in the request. The
+    // encoded size of each entry in the request is exactly its own size plus
+    // a tag and a length prefix, so the size of the request is known as it
+    // goes, without serializing anything twice or adding an entry only to
+    // back it out.
+    //
+    // The entries are borrowed from the log rather than copied, since copying
+    // them was most of the cost of building large requests: 19000 entries
+    // with 10 bytes of data each used to take about 42 milliseconds here on
+    // an overloaded laptop in DEBUG mode. The total number of entries in a
+    // request is still limited to MAX_LOG_ENTRIES_PER_REQUEST=5000 to bound
+    // the follower's processing time. This limit will only kick in when the
+    // entry size drops below 200 bytes, since 1M/5K=200.
 
     using Core::Util::downCast;
+    using google::protobuf::io::CodedOutputStream;
     uint64_t lastIndex = std::min(log->getLastLogIndex(),
                                   nextIndex + MAX_LOG_ENTRIES_PER_REQUEST - 1);
     google::protobuf::RepeatedPtrField<Protocol::Raft::Entry>& requestEntries =
         *request.mutable_entries();
+    const uint64_t tagSize = CodedOutputStream::VarintSize32(
+        Protocol::Raft::AppendEntries::Request::kEntriesFieldNumber << 3);
 
     uint64_t numEntries = 0;
     uint64_t currentSize = downCast<uint64_t>(request.ByteSize());
 
     for (uint64_t index = nextIndex; index <= lastIndex; ++index) {
         const Log::Entry& entry = log->getEntry(index);
-        *requestEntries.Add() = entry;
-
-        // Each member of a repeated message field is encoded with a tag
-        // and a length. We conservatively assume the tag and length will
-        // be up to 10 bytes each (2^64), though in practice the tag is
-        // probably one byte and the length is probably two.
-        currentSize += uint64_t(entry.ByteSize()) + 20;
-
-        if (currentSize >= SOFT_RPC_SIZE_LIMIT) {
-            // The message might be too big: calculate more exact but more
-            // expensive size.
-            uint64_t actualSize = downCast<uint64_t>(request.ByteSize());
-            assert(currentSize >= actualSize);
-            currentSize = actualSize;
-            if (currentSize >= SOFT_RPC_SIZE_LIMIT && numEntries > 0) {
-                // This entry doesn't fit and we've already got some
-                // entries to send: discard this one and stop adding more.
-                requestEntries.RemoveLast();
-                break;
-            }
+        uint32_t entrySize = downCast<uint32_t>(entry.ByteSize());
+        currentSize += (tagSize +
+                        CodedOutputStream::VarintSize32(entrySize) +
+                        entrySize);
+        if (currentSize >= bytesLimit && numEntries > 0) {
+            // This entry doesn't fit and we've already got some entries to
+            // send: stop adding more.
+            break;
         }
-        // This entry fit, so we'll send it.
+        // This entry fit (or it's the first), so we'll send it. The request
+        // only reads the entry; see unpackEntries().
+        requestEntries.AddAllocated(const_cast<Log::Entry*>(&entry));
         ++numEntries;
     }
 
@@ -2641,6 +3117,15 @@ RaftConsensus::packEntries(
     return numEntries;
 }
 
+void
+RaftConsensus::unpackEntries(Protocol::Raft::AppendEntries::Request& request)
+{
+    google::protobuf::RepeatedPtrField<Protocol::Raft::Entry>& requestEntries =
+        *request.mutable_entries();
+    while (!requestEntries.empty())
+        requestEntries.ReleaseLast();
+}
+
 void
 RaftConsensus::readSnapshot()
 {
@@ -2753,13 +3238,27 @@ RaftConsensus::replicateEntry(Log::Entry& entry,
                               std::unique_lock<Mutex>& lockGuard)
 {
     if (state == State::LEADER) {
+        // Hold off new entries while leadership is being handed off, so that
+        // the target's log can catch up.
+        uint64_t term = currentTerm;
+        while (!exiting && currentTerm == term &&
+               leadershipTransferTarget != 0) {
+            stateChanged.wait(lockGuard);
+        }
+        if (exiting || currentTerm != term || state != State::LEADER)
+            return {ClientResult::NOT_LEADER, 0};
         entry.set_term(currentTerm);
         entry.set_cluster_time(clusterClock.leaderStamp());
+        TimePoint start = Clock::now();
         append({&entry});
         uint64_t index = log->getLastLogIndex();
+        if (entry.type() == Protocol::Raft::EntryType::DATA && groupId == 0)
+            globals.entryTracer.noteAppended(index);
         while (!exiting && currentTerm == entry.term()) {
             if (commitIndex >= index) {
                 VERBOSE("replicate succeeded");
+                commitNanos.push(uint64_t(std::chrono::nanoseconds(
+                    Clock::now() - start).count()));
                 return {ClientResult::SUCCESS, index};
             }
             stateChanged.wait(lockGuard);
@@ -2773,9 +3272,16 @@ RaftConsensus::requestVote(std::unique_lock<Mutex>& lockGuard, Peer& peer)
 {
     Protocol::Raft::RequestVote::Request request;
     request.set_server_id(serverId);
-    request.set_term(currentTerm);
+    // A Pre-Vote asks about the term this server would run for.
+    bool preVote = preVoting;
+    uint64_t term = currentTerm;
+    request.set_term(preVote ? term + 1 : term);
     request.set_last_log_term(getLastLogTerm());
     request.set_last_log_index(log->getLastLogIndex());
+    if (preVote)
+        request.set_pre_vote(true);
+    if (leadershipTransferElection)
+        request.set_leadership_transfer(true);
 
     Protocol::Raft::RequestVote::Response response;
     VERBOSE("requestVote start");
@@ -2798,8 +3304,8 @@ RaftConsensus::requestVote(std::unique_lock<Mutex>& lockGuard, Peer& peer)
                   "RPC or claims the request is malformed");
     }
 
-    if (currentTerm != request.term() || state != State::CANDIDATE ||
-        peer.exiting) {
+    if (currentTerm != term || state != State::CANDIDATE ||
+        preVoting != preVote || peer.exiting) {
         VERBOSE("ignore RPC result");
         // we don't care about result of RPC
         return;
@@ -2813,21 +3319,79 @@ RaftConsensus::requestVote(std::unique_lock<Mutex>& lockGuard, Peer& peer)
     } else {
         peer.requestVoteDone = true;
         peer.lastAckEpoch = epoch;
+        configuration->updateAckEpoch(peer);
         stateChanged.notify_all();
 
         if (response.granted()) {
             peer.haveVote_ = true;
-            NOTICE("Got vote from server %lu for term %lu",
-                   peer.serverId, currentTerm);
-            if (configuration->quorumAll(&Server::haveVote))
-                becomeLeader();
+            NOTICE("Got %s from server %lu for term %lu",
+                   preVote ? "Pre-Vote" : "vote",
+                   peer.serverId, request.term());
+            if (configuration->quorumAll(&Server::haveVote)) {
+                if (preVote)
+                    startNewElection();
+                else
+                    becomeLeader();
+            }
         } else {
-            NOTICE("Vote denied by server %lu for term %lu",
-                   peer.serverId, currentTerm);
+            NOTICE("%s denied by server %lu for term %lu",
+                   preVote ? "Pre-Vote" : "Vote",
+                   peer.serverId, request.term());
         }
     }
 }
 
+void
+RaftConsensus::timeoutNow(std::unique_lock<Mutex>& lockGuard, Peer& peer)
+{
+    Protocol::Raft::TimeoutNow::Request request;
+    request.set_server_id(serverId);
+    request.set_term(currentTerm);
+
+    Protocol::Raft::TimeoutNow::Response response;
+    VERBOSE("timeoutNow start");
+    TimePoint start = Clock::now();
+    Peer::CallStatus status = peer.callRPC(
+                Protocol::Raft::OpCode::TIMEOUT_NOW,
+                request, response,
+                lockGuard);
+    VERBOSE("timeoutNow done");
+    switch (status) {
+        case Peer::CallStatus::OK:
+            break;
+        case Peer::CallStatus::FAILED:
+            peer.suppressBulkData = true;
+            peer.backoffUntil = start + RPC_FAILURE_BACKOFF;
+            return;
+        case Peer::CallStatus::INVALID_REQUEST:
+            WARNING("Server %lu doesn't support the TimeoutNow RPC; "
+                    "aborting leadership transfer",
+                    peer.serverId);
+            if (leadershipTransferTarget == peer.serverId) {
+                leadershipTransferTarget = 0;
+                stateChanged.notify_all();
+            }
+            return;
+    }
+
+    if (currentTerm != request.term() || peer.exiting) {
+        VERBOSE("ignore RPC result");
+        // we don't care about result of RPC
+        return;
+    }
+
+    if (response.term() > currentTerm) {
+        NOTICE("Received TimeoutNow response from server %lu in "
+               "term %lu (this server's term was %lu)",
+                peer.serverId, response.term(), currentTerm);
+        stepDown(response.term());
+    } else if (leadershipTransferTarget == peer.serverId) {
+        // Keep sending heartbeats until the target's election deposes us.
+        leadershipTransferSent = true;
+        stateChanged.notify_all();
+    }
+}
+
 void
 RaftConsensus::setElectionTimer()
 {
@@ -2873,6 +3437,13 @@ RaftConsensus::startNewElection()
         return;
     }
 
+    if (configuration->isLearner(configuration->localServer)) {
+        // Learners never stand for election: go back to sleep.
+        VERBOSE("Not running for election as a learner");
+        setElectionTimer();
+        return;
+    }
+
     if (leaderId > 0) {
         NOTICE("Running for election in term %lu "
                "(haven't heard from leader %lu lately)",
@@ -2889,6 +3460,8 @@ RaftConsensus::startNewElection()
     }
     ++currentTerm;
     state = State::CANDIDATE;
+    preVoting = false;
+    leadershipTransferElection = false;
     leaderId = 0;
     votedFor = serverId;
     printElectionState();
@@ -2906,6 +3479,46 @@ RaftConsensus::startNewElection()
         becomeLeader();
 }
 
+void
+RaftConsensus::startPreVote()
+{
+    if (configuration->id == 0) {
+        // Don't have a configuration: go back to sleep.
+        setElectionTimer();
+        return;
+    }
+
+    if (configuration->isLearner(configuration->localServer)) {
+        // Learners never stand for election: go back to sleep.
+        VERBOSE("Not polling for Pre-Votes as a learner");
+        setElectionTimer();
+        return;
+    }
+
+    if (leaderId > 0) {
+        NOTICE("Polling for Pre-Votes for term %lu "
+               "(haven't heard from leader %lu lately)",
+               currentTerm + 1,
+               leaderId);
+    } else {
+        NOTICE("Polling for Pre-Votes for term %lu",
+               currentTerm + 1);
+    }
+    // Unlike startNewElection(), this leaves currentTerm, leaderId, and
+    // votedFor alone, so a failed Pre-Vote disturbs no one.
+    state = State::CANDIDATE;
+    preVoting = true;
+    leadershipTransferElection = false;
+    printElectionState();
+    setElectionTimer();
+    configuration->forEach(&Server::beginRequestVote);
+    interruptAll();
+
+    // if we're the only server, go straight to the real election
+    if (configuration->quorumAll(&Server::haveVote))
+        startNewElection();
+}
+
 void
 RaftConsensus::stepDown(uint64_t newTerm)
 {
@@ -2915,6 +3528,7 @@ RaftConsensus::stepDown(uint64_t newTerm)
         currentTerm = newTerm;
         leaderId = 0;
         votedFor = 0;
+        lastLeaderContact = TimePoint::min();
         updateLogMetadata();
         configuration->resetStagingServers();
         if (snapshotWriter) {
@@ -2933,6 +3547,9 @@ RaftConsensus::stepDown(uint64_t newTerm)
         setElectionTimer();
     if (withholdVotesUntil == TimePoint::max()) // was leader
         withholdVotesUntil = TimePoint::min();
+    preVoting = false;
+    leadershipTransferElection = false;
+    leadershipTransferTarget = 0;
     interruptAll();
 
     // If the leader disk thread is currently writing to disk, wait for it to
@@ -2975,7 +3592,7 @@ RaftConsensus::upToDateLeader(std::unique_lock<Mutex>& lockGuard) const
     while (true) {
         if (exiting || state != State::LEADER)
             return false;
-        if (configuration->quorumMin(&Server::getLastAckEpoch) >= epoch) {
+        if (configuration->quorumAckEpoch() >= epoch) {
             // So we know we're the current leader, but do we have an
             // up-to-date commitIndex yet? What we'd like to check is whether
             // the entry's term at commitIndex matches our currentTerm, but
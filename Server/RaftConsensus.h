@@ -26,9 +26,11 @@
 #include "build/Protocol/ServerStats.pb.h"
 #include "build/Server/SnapshotStats.pb.h"
 #include "Client/SessionManager.h"
+#include "Core/Buffer.h"
 #include "Core/CompatAtomic.h"
 #include "Core/ConditionVariable.h"
 #include "Core/Mutex.h"
+#include "Core/RollingStat.h"
 #include "Core/Time.h"
 #include "RPC/ClientRPC.h"
 #include "Storage/Layout.h"
@@ -149,8 +151,9 @@ class Server {
      */
     virtual bool haveVote() const = 0;
     /**
-     * Cancel any outstanding RPCs to this Server.
-     * The condition variable in RaftConsensus will be notified separately.
+     * Cancel any outstanding RPCs to this Server and wake up its peer thread,
+     * if any. The condition variable in RaftConsensus will be notified
+     * separately.
      */
     virtual void interrupt() = 0;
     /**
@@ -162,7 +165,8 @@ class Server {
     virtual bool isCaughtUp() const = 0;
     /**
      * Make the next heartbeat RPC happen soon. Return immediately.
-     * The condition variable in RaftConsensus will be notified separately.
+     * This wakes up the Server's peer thread, if any, but the condition
+     * variable in RaftConsensus will be notified separately.
      */
     virtual void scheduleHeartbeat() = 0;
     /**
@@ -172,6 +176,12 @@ class Server {
     virtual void
     updatePeerStats(Protocol::ServerStats::Raft::Peer& peerStats,
                     Core::Time::SteadyTimeConverter& time) const = 0;
+    /**
+     * Wake up the Server's peer thread, if any, so that it re-evaluates
+     * whether it has an RPC to send. Called when entries are appended to the
+     * leader's log.
+     */
+    virtual void wakeUp() = 0;
 
     /**
      * Print out a Server for debugging purposes.
@@ -237,6 +247,7 @@ class LocalServer : public Server {
     std::ostream& dumpToStream(std::ostream& os) const;
     void updatePeerStats(Protocol::ServerStats::Raft::Peer& peerStats,
                          Core::Time::SteadyTimeConverter& time) const;
+    void wakeUp();
     RaftConsensus& consensus;
     /**
      * The index of the last log entry that has been flushed to disk.
@@ -277,6 +288,7 @@ class Peer : public Server {
     bool isCaughtUp() const;
     void interrupt();
     void scheduleHeartbeat();
+    void wakeUp();
 
     /**
      * Returned by callRPC().
@@ -362,6 +374,26 @@ class Peer : public Server {
      */
     bool exiting;
 
+    /**
+     * The peer thread waits on this, rather than on
+     * RaftConsensus::stateChanged, whenever it has nothing to send. It's
+     * notified only for events that may give this peer something to do (see
+     * interrupt(), scheduleHeartbeat(), and wakeUp()), so that unrelated
+     * state changes, such as another follower's acknowledgment, don't wake up
+     * every peer thread. This only removes idle wakeups: each peer still has
+     * its own thread, which blocks for the duration of every RPC, so the
+     * leader still sends one RPC and switches to one thread per peer for each
+     * batch of new entries.
+     */
+    Core::ConditionVariable wakeup;
+
+    /**
+     * The number of times the peer thread has returned from waiting on
+     * 'wakeup', whether or not it then found work to do. This is reported in
+     * ServerStats so that the cost of waking peer threads can be measured.
+     */
+    uint64_t numWakeups;
+
     /**
      * Set to true if the server has responded to our RequestVote request in
      * the current term, false otherwise.
@@ -423,6 +455,24 @@ class Peer : public Server {
      */
     TimePoint backoffUntil;
 
+    /**
+     * The most bytes the leader will currently pack into an AppendEntries
+     * request to this follower (further capped by SOFT_RPC_SIZE_LIMIT). This
+     * starts out unlimited and adapts to how long requests take
+     * to be acknowledged, so that requests over a slow link or to a slow disk
+     * don't hold up heartbeats. See RaftConsensus::adaptAppendEntriesLimit().
+     * Only used when leader.
+     */
+    uint64_t appendEntriesBytesLimit;
+
+    /**
+     * The shortest time any AppendEntries request to this follower has taken
+     * to be acknowledged. This approximates the round-trip time of the link,
+     * which adaptAppendEntriesLimit() discounts, since sending less data
+     * can't make up for it.
+     */
+    std::chrono::nanoseconds minAppendEntriesRoundTrip;
+
     /**
      * Counts RPC failures to issue fewer warnings.
      * Accessed only from callRPC() without holding the lock.
@@ -489,6 +539,41 @@ class Configuration {
     typedef std::function<void(Server&)> SideEffect;
 
   private:
+    /**
+     * Keeps one value per server (such as its matchIndex) in sorted order, so
+     * that the largest value held by a majority of the servers can be read in
+     * constant time and a single server's value can be changed with a binary
+     * search, rather than sorting every server's value on each query.
+     */
+    class QuorumTracker {
+      public:
+        QuorumTracker();
+        ~QuorumTracker();
+        /**
+         * Start tracking the given servers' values, replacing any others.
+         */
+        void reset(const std::vector<ServerRef>& servers,
+                   const GetValue& getValue);
+        /**
+         * Record a new value for the given server. Does nothing if the server
+         * is not tracked.
+         */
+        void update(const Server& server, uint64_t value);
+        /**
+         * Same as SimpleConfiguration::quorumMin() over the tracked values.
+         */
+        uint64_t quorumMin() const;
+      private:
+        /**
+         * The current value of each tracked server.
+         */
+        std::unordered_map<const Server*, uint64_t> values;
+        /**
+         * The values of #values, in ascending order.
+         */
+        std::vector<uint64_t> sorted;
+    };
+
     /**
      * A list of servers in which a simple majority constitutes a quorum.
      */
@@ -502,6 +587,15 @@ class Configuration {
         bool quorumAll(const Predicate& predicate) const;
         uint64_t quorumMin(const GetValue& getValue) const;
         std::vector<ServerRef> servers;
+        /**
+         * Tracks Server::getMatchIndex() of #servers.
+         */
+        QuorumTracker matchIndexes;
+        /**
+         * Tracks Server::getLastAckEpoch() of #servers, except that the local
+         * server counts as having the largest epoch (see quorumAckEpoch()).
+         */
+        QuorumTracker ackEpochs;
     };
 
   public:
@@ -555,6 +649,12 @@ class Configuration {
      */
     bool hasVote(ServerRef server) const;
 
+    /**
+     * Return true if the given server is a non-voting member (learner) of the
+     * configuration, false otherwise.
+     */
+    bool isLearner(ServerRef server) const;
+
     /**
      * Lookup the network addresses for a particular server
      * (comma-delimited).
@@ -577,6 +677,28 @@ class Configuration {
      */
     uint64_t quorumMin(const GetValue& getValue) const;
 
+    /**
+     * Equivalent to quorumMin(&Server::getMatchIndex), but runs in constant
+     * time. This relies on updateMatchIndex() being called whenever a
+     * server's match index changes.
+     */
+    uint64_t quorumMatchIndex() const;
+
+    /**
+     * Equivalent to quorumMin(&Server::getLastAckEpoch), but runs in constant
+     * time. This relies on updateAckEpoch() being called whenever a peer's
+     * lastAckEpoch changes. The local server's epoch needn't be reported,
+     * since it is always the current epoch, which no peer's exceeds.
+     */
+    uint64_t quorumAckEpoch() const;
+
+    /**
+     * Recompute the values tracked for quorumMatchIndex() and
+     * quorumAckEpoch() from scratch. Called when the servers' values all
+     * change at once, as when becoming leader.
+     */
+    void resetQuorumTrackers();
+
     /**
      * Remove the staging servers, if any. Return to the configuration state
      * prior to a preceding call to setStagingServers.
@@ -625,6 +747,18 @@ class Configuration {
      */
     uint64_t stagingMin(const GetValue& getValue) const;
 
+    /**
+     * Must be called after a server's lastAckEpoch changes (see
+     * quorumAckEpoch()).
+     */
+    void updateAckEpoch(const Server& server);
+
+    /**
+     * Must be called after a server's match index changes (see
+     * quorumMatchIndex()).
+     */
+    void updateMatchIndex(const Server& server);
+
     /**
      * Write the configuration servers' state into the given structure. Used
      * for diagnostics.
@@ -700,6 +834,12 @@ class Configuration {
      */
     SimpleConfiguration newServers;
 
+    /**
+     * Non-voting members, listed in the description's learners. These
+     * receive log entries under every state but never take part in a quorum.
+     */
+    SimpleConfiguration learners;
+
     friend class Invariants;
 };
 
@@ -1014,9 +1154,16 @@ class RaftConsensus {
     /**
      * Get the current leader's active, committed, simple cluster
      * configuration.
+     * \param[out] configuration
+     *      The voting members of the configuration.
+     * \param[out] learners
+     *      The non-voting members of the configuration.
+     * \param[out] id
+     *      Identifies the configuration (the index of its log entry).
      */
     ClientResult getConfiguration(
             Protocol::Raft::SimpleConfiguration& configuration,
+            Protocol::Raft::SimpleConfiguration& learners,
             uint64_t& id) const;
 
     /**
@@ -1026,12 +1173,39 @@ class RaftConsensus {
      */
     std::pair<ClientResult, uint64_t> getLastCommitIndex() const;
 
+    /**
+     * Return the most recent entry ID that this server knows to be committed,
+     * without confirming leadership with a quorum first. This is used to
+     * serve reads that may be stale by a bounded amount of time, which
+     * followers can answer without involving the leader.
+     * \param maxStaleness
+     *      Followers return SUCCESS only if they were caught up with the
+     *      current leader's commit index within this amount of time. Leaders return SUCCESS without
+     *      any communication if maxStaleness is at least an election timeout
+     *      (they would have stepped down otherwise); with tighter bounds they
+     *      behave like getLastCommitIndex(). The special value
+     *      std::chrono::nanoseconds::max() means unbounded: any server returns
+     *      SUCCESS, even if it knows of no leader.
+     * \return
+     *      NOT_LEADER if this server cannot honor the given bound; otherwise,
+     *      SUCCESS and the commit index.
+     */
+    std::pair<ClientResult, uint64_t> getStaleReadIndex(
+            std::chrono::nanoseconds maxStaleness) const;
+
     /**
      * Return the network address for a recent leader, if known,
      * or empty string otherwise.
      */
     std::string getLeaderHint() const;
 
+    /**
+     * Return the number of entries in this server's log that are not known
+     * to be committed. On leaders, this is the amount of work waiting on
+     * followers and the disk.
+     */
+    uint64_t getNumUncommittedEntries() const;
+
     /**
      * This returns the entry following lastIndex in the replicated log. Some
      * entries may be used internally by the consensus module. These will have
@@ -1083,6 +1257,18 @@ class RaftConsensus {
     void handleRequestVote(const Protocol::Raft::RequestVote::Request& request,
                            Protocol::Raft::RequestVote::Response& response);
 
+    /**
+     * Process a TimeoutNow RPC from the leader, which is asking this server to
+     * start an election right away so that it can take over leadership.
+     * Called by RaftService.
+     * \param[in] request
+     *      The request that was received from the other server.
+     * \param[out] response
+     *      Where the reply should be placed.
+     */
+    void handleTimeoutNow(const Protocol::Raft::TimeoutNow::Request& request,
+                          Protocol::Raft::TimeoutNow::Response& response);
+
     /**
      * Submit an operation to the replicated log.
      * \param operation
@@ -1096,7 +1282,9 @@ class RaftConsensus {
     std::pair<ClientResult, uint64_t> replicate(const Core::Buffer& operation);
 
     /**
-     * Change the cluster's configuration.
+     * Change the cluster's configuration, including its set of non-voting
+     * learners. New voters are caught up before the change begins; new
+     * learners are not, since they don't affect availability.
      * Returns successfully once operation completed and old servers are no
      * longer needed.
      * \return
@@ -1122,6 +1310,22 @@ class RaftConsensus {
     setSupportedStateMachineVersions(uint16_t minSupported,
                                      uint16_t maxSupported);
 
+    /**
+     * Hand off leadership to another server, so that the cluster does not sit
+     * through an election timeout when this server goes down for planned
+     * maintenance. New commands are held back while the transfer is in
+     * progress. Once the target's log is caught up, it is sent a TimeoutNow
+     * RPC, and this method returns once a new term has begun.
+     * \param targetId
+     *      The ID of the server that should become leader, or 0 to choose
+     *      the voting server with the most up-to-date log.
+     * \return
+     *      NOT_LEADER if this server is not the leader; FAIL if targetId does
+     *      not name another voting server or if no new term began within an
+     *      election timeout; SUCCESS otherwise.
+     */
+    ClientResult transferLeadership(uint64_t targetId);
+
     /**
      * Start taking a snapshot. Called by the state machine when it wants to
      * take a snapshot.
@@ -1271,6 +1475,32 @@ class RaftConsensus {
      */
     void appendEntries(std::unique_lock<Mutex>& lockGuard, Peer& peer);
 
+    /**
+     * Helper for #appendEntries() to size later requests to a follower based
+     * on how long the last one took, beyond the link's round-trip time: the
+     * limit is halved (down to 4 KB) whenever a request takes longer than
+     * APPEND_ENTRIES_TARGET_DURATION, and doubled (up to SOFT_RPC_SIZE_LIMIT)
+     * whenever a request that was cut short by the limit takes under half of
+     * that.
+     * \param peer
+     *      The follower, whose appendEntriesBytesLimit and
+     *      minAppendEntriesRoundTrip are updated.
+     * \param bytesLimit
+     *      The limit that the request was packed with.
+     * \param numEntries
+     *      The number of entries in the request.
+     * \param full
+     *      True if the request was cut short by 'bytesLimit', false if it
+     *      contained all the entries that were available.
+     * \param elapsed
+     *      The time from sending the request to receiving its response.
+     */
+    void adaptAppendEntriesLimit(Peer& peer,
+                                 uint64_t bytesLimit,
+                                 uint64_t numEntries,
+                                 bool full,
+                                 std::chrono::nanoseconds elapsed) const;
+
     /**
      * Send an InstallSnapshot RPC to the server (containing part of a
      * snapshot file to replicate).
@@ -1311,8 +1541,17 @@ class RaftConsensus {
     /**
      * Helper for #appendEntries() to put the right number of entries into the
      * request.
+     *
+     * The entries are not copied: the request borrows the log's own Entry
+     * objects, which must be handed back with unpackEntries() before the
+     * request is destroyed or cleared. Since the log may discard entries
+     * while the lock is released, the request must be serialized before
+     * then, and its entries must not be read afterwards.
      * \param nextIndex
      *      First entry to send to the follower.
+     * \param bytesLimit
+     *      Keep the request under this many bytes, unless a single entry is
+     *      larger on its own.
      * \param request
      *      AppendEntries request ProtoBuf in which to pack the entries.
      * \return
@@ -1320,8 +1559,16 @@ class RaftConsensus {
      */
     uint64_t
     packEntries(uint64_t nextIndex,
+                uint64_t bytesLimit,
                 Protocol::Raft::AppendEntries::Request& request) const;
 
+    /**
+     * Remove the entries borrowed by packEntries() from the request, without
+     * touching or freeing them.
+     */
+    static void
+    unpackEntries(Protocol::Raft::AppendEntries::Request& request);
+
     /**
      * Try to read the latest good snapshot from disk. Loads the header of the
      * snapshot file, which is used internally by the consensus module. The
@@ -1353,6 +1600,17 @@ class RaftConsensus {
      */
     void requestVote(std::unique_lock<Mutex>& lockGuard, Peer& peer);
 
+    /**
+     * Send a TimeoutNow RPC to the server. This is used by leaders to complete
+     * a leadership transfer once the target's log is caught up.
+     * \param lockGuard
+     *      Used to temporarily release the lock while invoking the RPC, so as
+     *      to allow for some concurrency.
+     * \param peer
+     *      The target of the leadership transfer.
+     */
+    void timeoutNow(std::unique_lock<Mutex>& lockGuard, Peer& peer);
+
     /**
      * Dumps serverId, currentTerm, state, leaderId, and votedFor to the debug
      * log. This is intended to be easy to grep and parse.
@@ -1375,6 +1633,16 @@ class RaftConsensus {
      */
     void startNewElection();
 
+    /**
+     * Begin a Pre-Vote round instead of an election. This is called when a
+     * timeout elapses and #PRE_VOTE is set. The server becomes a candidate
+     * but does not increment its term; it asks the other servers whether they
+     * would vote for it, and calls startNewElection() only once a quorum
+     * says yes. This way, a server that was partitioned away cannot force a
+     * healthy leader to step down when it rejoins.
+     */
+    void startPreVote();
+
     /**
      * Transition to being a follower. This is called when we
      * receive an RPC request with newer term, receive an RPC response
@@ -1432,6 +1700,16 @@ class RaftConsensus {
      */
     uint64_t MAX_LOG_ENTRIES_PER_REQUEST;
 
+    /**
+     * A leader tries to keep each AppendEntries request to a follower from
+     * taking longer than this to be acknowledged, by shrinking the requests
+     * it sends that follower (see #adaptAppendEntriesLimit()). Zero disables
+     * this, so that requests are only bounded by #SOFT_RPC_SIZE_LIMIT and
+     * #MAX_LOG_ENTRIES_PER_REQUEST.
+     * Const except for unit tests.
+     */
+    std::chrono::nanoseconds APPEND_ENTRIES_TARGET_DURATION;
+
     /**
      * A candidate or leader waits this long after an RPC fails before sending
      * another one, so as to not overwhelm the network with retries.
@@ -1448,6 +1726,12 @@ class RaftConsensus {
      */
     const std::chrono::nanoseconds STATE_MACHINE_UPDATER_BACKOFF;
 
+    /**
+     * If true, servers poll for a Pre-Vote before starting an election (see
+     * #startPreVote()).
+     */
+    const bool PRE_VOTE;
+
     /**
      * Prefer to keep RPC requests under this size.
      * Const except for unit tests.
@@ -1466,6 +1750,34 @@ class RaftConsensus {
      */
     std::string serverAddresses;
 
+    /**
+     * Which of the Raft groups hosted by this process this instance runs. The
+     * root group is 0; other groups talk to their peers over
+     * RAFT_GROUP_SERVICE_BASE + groupId instead of RAFT_SERVICE, keep their
+     * files in a subdirectory of the root group's storage, and must be
+     * initialized after the root group. Only the root group feeds the
+     * EntryTracer, since the tracer is keyed by log index.
+     */
+    uint64_t groupId;
+
+    /**
+     * Sends a serialized request to the peer with the given server ID and
+     * fills in its reply. Returns false if either message was lost.
+     */
+    typedef std::function<bool(uint64_t peerId,
+                               Protocol::Raft::OpCode opCode,
+                               const Core::Buffer& request,
+                               google::protobuf::Message& response)>
+            DeliverRPC;
+
+    /**
+     * Used only for unit testing. If set, peers hand their RPCs to this
+     * instead of opening sessions to the other servers, so that
+     * SimulatedCluster can run several servers in one process. Empty
+     * normally.
+     */
+    DeliverRPC deliverRPC;
+
   private:
 
     /**
@@ -1682,6 +1994,42 @@ class RaftConsensus {
      */
     TimePoint withholdVotesUntil;
 
+    /**
+     * When this server received the latest AppendEntries request from the
+     * leader of the current term after which its commitIndex reached the
+     * leader's (see leader_commit_index). Followers use this to bound how
+     * stale their state is for getStaleReadIndex(). TimePoint::min() if that
+     * hasn't happened in this term, for example while catching up.
+     */
+    TimePoint lastLeaderContact;
+
+    /**
+     * True while this server is a candidate in the Pre-Vote phase: it has not
+     * incremented #currentTerm, and votes it collects are only Pre-Votes.
+     * See #startPreVote().
+     */
+    bool preVoting;
+
+    /**
+     * True while this server is a candidate because the previous leader sent
+     * it a TimeoutNow request. Its RequestVote requests then ask other
+     * servers to disregard #withholdVotesUntil.
+     */
+    bool leadershipTransferElection;
+
+    /**
+     * On leaders, the ID of the server to which leadership is being
+     * transferred, or 0 if no transfer is in progress.
+     * See #transferLeadership().
+     */
+    uint64_t leadershipTransferTarget;
+
+    /**
+     * On leaders, set once the TimeoutNow request for the current leadership
+     * transfer has been acknowledged.
+     */
+    bool leadershipTransferSent;
+
     /**
      * The total number of entries ever truncated from the end of the log.
      * This happens only when a new leader tells this server to remove
@@ -1689,6 +2037,12 @@ class RaftConsensus {
      */
     uint64_t numEntriesTruncated;
 
+    /**
+     * How long replicateEntry() takes from appending a client's entry to the
+     * log until the entry is committed, in nanoseconds.
+     */
+    Core::RollingStat commitNanos;
+
     /**
      * The thread that executes leaderDiskThreadMain() to flush log entries to
      * stable storage in the background on leaders.
@@ -193,6 +193,14 @@ Invariants::checkBasic()
                     consensus.currentTerm);
     }
 
+    // The incrementally maintained quorum values agree with recomputing them.
+    if (consensus.state == RaftConsensus::State::LEADER) {
+        expect(consensus.configuration->quorumMatchIndex() ==
+               consensus.configuration->quorumMin(&Server::getMatchIndex));
+        expect(consensus.configuration->quorumAckEpoch() ==
+               consensus.configuration->quorumMin(&Server::getLastAckEpoch));
+    }
+
     // A leader always points its leaderId at itself.
     if (consensus.state == RaftConsensus::State::LEADER)
         expect(consensus.leaderId == consensus.serverId);
@@ -190,6 +190,28 @@ TEST_F(ServerRaftConsensusSimpleConfigurationTest, quorumMin) {
     EXPECT_EQ(1U, cfg.quorumMin(getServerId));
 }
 
+TEST_F(ServerRaftConsensusSimpleConfigurationTest, quorumTracker) {
+    Configuration::QuorumTracker tracker;
+    EXPECT_EQ(0U, tracker.quorumMin());
+    tracker.reset(cfg.servers, getServerId);
+    EXPECT_EQ(2U, tracker.quorumMin());
+    tracker.update(*cfg.servers.at(0), 5);
+    EXPECT_EQ(3U, tracker.quorumMin());
+    tracker.update(*cfg.servers.at(2), 1);
+    EXPECT_EQ(2U, tracker.quorumMin());
+    tracker.update(*cfg.servers.at(1), 7);
+    EXPECT_EQ(5U, tracker.quorumMin());
+    tracker.update(*cfg.servers.at(1), 7);
+    EXPECT_EQ(5U, tracker.quorumMin());
+    tracker.update(*oneCfg.servers.at(0), 0); // not tracked
+    EXPECT_EQ(5U, tracker.quorumMin());
+    EXPECT_EQ((std::vector<uint64_t>{1, 5, 7}), tracker.sorted);
+    tracker.reset(oneCfg.servers, getServerId);
+    EXPECT_EQ(1U, tracker.quorumMin());
+    tracker.reset(emptyCfg.servers, getServerId);
+    EXPECT_EQ(0U, tracker.quorumMin());
+}
+
 class ServerRaftConsensusConfigurationTest
             : public ServerRaftConsensusSimpleConfigurationTest {
     ServerRaftConsensusConfigurationTest()
@@ -258,6 +280,39 @@ const char* d4 =
         "servers { server_id: 2, addresses: '127.0.0.1:5255' }"
     "}";
 
+TEST_F(ServerRaftConsensusConfigurationTest, quorumMatchIndex) {
+    cfg.setConfiguration(1, desc(d4));
+    cfg.localServer->lastSyncedIndex = 4;
+    cfg.updateMatchIndex(*cfg.localServer);
+    EXPECT_EQ(0U, cfg.quorumMatchIndex());
+    Peer& peer2 = *dynamic_cast<Peer*>(cfg.getServer(2).get());
+    peer2.matchIndex = 3;
+    cfg.updateMatchIndex(peer2);
+    EXPECT_EQ(3U, cfg.quorumMatchIndex());
+    EXPECT_EQ(cfg.quorumMin(&Server::getMatchIndex), cfg.quorumMatchIndex());
+    cfg.setConfiguration(2, desc(d3));
+    EXPECT_EQ(3U, cfg.quorumMatchIndex());
+    peer2.matchIndex = 5;
+    cfg.updateMatchIndex(peer2);
+    EXPECT_EQ(4U, cfg.quorumMatchIndex());
+}
+
+TEST_F(ServerRaftConsensusConfigurationTest, quorumAckEpoch) {
+    consensus.currentEpoch = 10;
+    cfg.setConfiguration(1, desc(d));
+    EXPECT_EQ(10U, cfg.quorumAckEpoch());
+    cfg.setConfiguration(2, desc(d3));
+    EXPECT_EQ(0U, cfg.quorumAckEpoch());
+    Peer& peer2 = *dynamic_cast<Peer*>(cfg.getServer(2).get());
+    peer2.lastAckEpoch = 8;
+    cfg.updateAckEpoch(peer2);
+    EXPECT_EQ(8U, cfg.quorumAckEpoch());
+    ++consensus.currentEpoch;
+    cfg.updateAckEpoch(*cfg.localServer); // no effect
+    EXPECT_EQ(8U, cfg.quorumAckEpoch());
+    EXPECT_EQ(cfg.quorumMin(&Server::getLastAckEpoch), cfg.quorumAckEpoch());
+}
+
 TEST_F(ServerRaftConsensusConfigurationTest, reset) {
     std::string expected = Core::StringUtil::toString(cfg);
     cfg.setConfiguration(1, desc(d4));
@@ -290,6 +345,33 @@ TEST_F(ServerRaftConsensusConfigurationTest, setConfiguration) {
     EXPECT_EQ(1U, cfg.knownServers.size());
 }
 
+TEST_F(ServerRaftConsensusConfigurationTest, setConfiguration_learners) {
+    cfg.setConfiguration(1, desc(
+        "prev_configuration {"
+        "    servers { server_id: 1, addresses: '127.0.0.1:5254' }"
+        "}"
+        "learners { server_id: 2, addresses: '127.0.0.1:5255' }"));
+    EXPECT_EQ(Configuration::State::STABLE, cfg.state);
+    EXPECT_EQ(2U, cfg.knownServers.size());
+    std::shared_ptr<Server> s2 = cfg.getServer(2);
+    EXPECT_EQ("127.0.0.1:5255", s2->addresses);
+    EXPECT_TRUE(cfg.isLearner(s2));
+    EXPECT_FALSE(cfg.hasVote(s2));
+    EXPECT_FALSE(cfg.isLearner(cfg.localServer));
+
+    // learners don't count toward a quorum
+    Peer& peer2 = *dynamic_cast<Peer*>(s2.get());
+    peer2.matchIndex = 10;
+    cfg.updateMatchIndex(peer2);
+    EXPECT_EQ(0U, cfg.quorumMatchIndex());
+
+    // removing the learner makes it exit
+    cfg.setConfiguration(2, desc(d));
+    EXPECT_FALSE(cfg.isLearner(s2));
+    EXPECT_TRUE(peer2.exiting);
+    EXPECT_EQ(1U, cfg.knownServers.size());
+}
+
 TEST_F(ServerRaftConsensusConfigurationTest, setStagingServers) {
     cfg.setConfiguration(1, desc(
         "prev_configuration {"
@@ -423,6 +505,8 @@ void drainDiskQueue(RaftConsensus& consensus)
         sync->wait();
         consensus.configuration->localServer->lastSyncedIndex =
                     sync->lastIndex;
+        consensus.configuration->updateMatchIndex(
+                    *consensus.configuration->localServer);
         consensus.advanceCommitIndex();
         consensus.log->syncComplete(std::move(sync));
     }
@@ -683,14 +767,17 @@ TEST_F(ServerRaftConsensusTest, getConfiguration_notleader)
 {
     init();
     Protocol::Raft::SimpleConfiguration c;
+    Protocol::Raft::SimpleConfiguration learners;
     uint64_t id;
-    EXPECT_EQ(ClientResult::NOT_LEADER, consensus->getConfiguration(c, id));
+    EXPECT_EQ(ClientResult::NOT_LEADER,
+              consensus->getConfiguration(c, learners, id));
 }
 
 void
 setLastAckEpoch(Peer* peer)
 {
     peer->lastAckEpoch = peer->consensus.currentEpoch;
+    peer->consensus.configuration->updateAckEpoch(*peer);
 }
 
 TEST_F(ServerRaftConsensusTest, getConfiguration_retry)
@@ -711,8 +798,10 @@ TEST_F(ServerRaftConsensusTest, getConfiguration_retry)
               consensus->configuration->state);
     consensus->stateChanged.callback = std::bind(setLastAckEpoch, getPeer(2));
     Protocol::Raft::SimpleConfiguration c;
+    Protocol::Raft::SimpleConfiguration learners;
     uint64_t id;
-    EXPECT_EQ(ClientResult::RETRY, consensus->getConfiguration(c, id));
+    EXPECT_EQ(ClientResult::RETRY,
+              consensus->getConfiguration(c, learners, id));
 }
 
 TEST_F(ServerRaftConsensusTest, getConfiguration_ok)
@@ -723,14 +812,131 @@ TEST_F(ServerRaftConsensusTest, getConfiguration_ok)
     drainDiskQueue(*consensus);
     EXPECT_EQ(State::LEADER, consensus->state);
     Protocol::Raft::SimpleConfiguration c;
+    Protocol::Raft::SimpleConfiguration learners;
     uint64_t id;
-    EXPECT_EQ(ClientResult::SUCCESS, consensus->getConfiguration(c, id));
+    EXPECT_EQ(ClientResult::SUCCESS,
+              consensus->getConfiguration(c, learners, id));
     EXPECT_EQ("servers { server_id: 1, addresses: '127.0.0.1:5254' }", c);
+    EXPECT_EQ("", learners);
     EXPECT_EQ(1U, id);
 }
 
 // TODO(ongaro): getLastCommitIndex: low-priority test
 
+TEST_F(ServerRaftConsensusTest, getStaleReadIndex)
+{
+    typedef std::pair<ClientResult, uint64_t> R;
+    init();
+    std::chrono::nanoseconds unbounded = std::chrono::nanoseconds::max();
+
+    // no leader
+    EXPECT_EQ(R(ClientResult::NOT_LEADER, 0),
+              consensus->getStaleReadIndex(milliseconds(1000)));
+    EXPECT_EQ(R(ClientResult::SUCCESS, 0),
+              consensus->getStaleReadIndex(unbounded));
+
+    // follower with recent leader contact
+    Protocol::Raft::AppendEntries::Request request;
+    Protocol::Raft::AppendEntries::Response response;
+    request.set_server_id(3);
+    request.set_term(10);
+    request.set_prev_log_term(0);
+    request.set_prev_log_index(0);
+    request.add_entries()->CopyFrom(entry1);
+    request.set_commit_index(1);
+    request.set_leader_commit_index(1);
+    consensus->handleAppendEntries(request, response);
+    EXPECT_TRUE(response.success());
+    EXPECT_EQ(Clock::mockValue, consensus->lastLeaderContact);
+    EXPECT_EQ(R(ClientResult::SUCCESS, 1),
+              consensus->getStaleReadIndex(milliseconds(1000)));
+
+    // follower with stale leader contact
+    Clock::mockValue += milliseconds(1001);
+    EXPECT_EQ(R(ClientResult::NOT_LEADER, 0),
+              consensus->getStaleReadIndex(milliseconds(1000)));
+    EXPECT_EQ(R(ClientResult::SUCCESS, 1),
+              consensus->getStaleReadIndex(unbounded));
+
+    // leader of just self
+    consensus->startNewElection();
+    drainDiskQueue(*consensus);
+    EXPECT_EQ(State::LEADER, consensus->state);
+    R result = consensus->getStaleReadIndex(consensus->ELECTION_TIMEOUT);
+    EXPECT_EQ(ClientResult::SUCCESS, result.first);
+    EXPECT_EQ(consensus->commitIndex, result.second);
+    result = consensus->getStaleReadIndex(milliseconds(1));
+    EXPECT_EQ(ClientResult::SUCCESS, result.first);
+    EXPECT_EQ(consensus->commitIndex, result.second);
+}
+
+TEST_F(ServerRaftConsensusTest, getStaleReadIndex_catchingUp)
+{
+    typedef std::pair<ClientResult, uint64_t> R;
+    init();
+    Protocol::Raft::AppendEntries::Request request;
+    Protocol::Raft::AppendEntries::Response response;
+    request.set_server_id(3);
+    request.set_term(10);
+    request.set_prev_log_term(0);
+    request.set_prev_log_index(0);
+    request.add_entries()->CopyFrom(entry1);
+    request.set_commit_index(1);
+
+    // the leader has committed more than this follower has
+    request.set_leader_commit_index(5);
+    consensus->handleAppendEntries(request, response);
+    EXPECT_TRUE(response.success());
+    EXPECT_EQ(TimePoint::min(), consensus->lastLeaderContact);
+    EXPECT_EQ(R(ClientResult::NOT_LEADER, 0),
+              consensus->getStaleReadIndex(milliseconds(1000)));
+
+    // rejected requests don't count either
+    request.clear_entries();
+    request.set_prev_log_index(2);
+    request.set_prev_log_term(10);
+    request.set_leader_commit_index(1);
+    consensus->handleAppendEntries(request, response);
+    EXPECT_FALSE(response.success());
+    EXPECT_EQ(TimePoint::min(), consensus->lastLeaderContact);
+
+    // nor do requests from a leader that doesn't say how far it has committed
+    request.set_prev_log_index(1);
+    request.set_prev_log_term(1);
+    request.clear_leader_commit_index();
+    consensus->handleAppendEntries(request, response);
+    EXPECT_TRUE(response.success());
+    EXPECT_EQ(TimePoint::min(), consensus->lastLeaderContact);
+
+    // caught up
+    request.set_leader_commit_index(1);
+    consensus->handleAppendEntries(request, response);
+    EXPECT_TRUE(response.success());
+    EXPECT_EQ(Clock::mockValue, consensus->lastLeaderContact);
+    EXPECT_EQ(R(ClientResult::SUCCESS, 1),
+              consensus->getStaleReadIndex(milliseconds(1000)));
+
+    // installing a snapshot means catching up
+    Clock::mockValue += milliseconds(1);
+    Protocol::Raft::InstallSnapshot::Request snapshotRequest;
+    Protocol::Raft::InstallSnapshot::Response snapshotResponse;
+    snapshotRequest.set_server_id(3);
+    snapshotRequest.set_term(10);
+    snapshotRequest.set_last_snapshot_index(1);
+    snapshotRequest.set_byte_offset(0);
+    snapshotRequest.set_data("hello");
+    snapshotRequest.set_done(false);
+    consensus->handleInstallSnapshot(snapshotRequest, snapshotResponse);
+    EXPECT_EQ(Clock::mockValue - milliseconds(1),
+              consensus->lastLeaderContact);
+
+    // a new term forgets the old leader
+    consensus->stepDown(11);
+    EXPECT_EQ(TimePoint::min(), consensus->lastLeaderContact);
+    EXPECT_EQ(R(ClientResult::NOT_LEADER, 0),
+              consensus->getStaleReadIndex(milliseconds(1000)));
+}
+
 TEST_F(ServerRaftConsensusTest, getNextEntry)
 {
     init();
@@ -1358,6 +1564,123 @@ TEST_F(ServerRaftConsensusTest, handleRequestVote_termStale)
     EXPECT_GT(Clock::mockValue, consensus->startElectionAt);
 }
 
+TEST_F(ServerRaftConsensusTest, handleRequestVote_preVote)
+{
+    init();
+    consensus->stepDown(5);
+    consensus->append({&entry5});
+    Protocol::Raft::RequestVote::Request request;
+    Protocol::Raft::RequestVote::Response response;
+    request.set_server_id(2);
+    request.set_term(6);
+    request.set_last_log_term(5);
+    request.set_last_log_index(1);
+    request.set_pre_vote(true);
+
+    // log is ok: grant the Pre-Vote but don't change any state
+    TimePoint oldStartElectionAt = consensus->startElectionAt;
+    Clock::mockValue += milliseconds(2);
+    consensus->handleRequestVote(request, response);
+    EXPECT_EQ("term: 5 "
+              "granted: true "
+              "log_ok: true",
+              response);
+    EXPECT_EQ(5U, consensus->currentTerm);
+    EXPECT_EQ(0U, consensus->votedFor);
+    EXPECT_EQ(oldStartElectionAt, consensus->startElectionAt);
+
+    // term isn't newer than ours
+    request.set_term(5);
+    consensus->handleRequestVote(request, response);
+    EXPECT_EQ("term: 5 "
+              "granted: false "
+              "log_ok: true",
+              response);
+
+    // log is not ok
+    request.set_term(6);
+    request.set_last_log_term(4);
+    consensus->handleRequestVote(request, response);
+    EXPECT_EQ("term: 5 "
+              "granted: false "
+              "log_ok: false",
+              response);
+
+    // recently heard from a leader
+    request.set_last_log_term(5);
+    consensus->withholdVotesUntil = Clock::now() + milliseconds(1);
+    consensus->handleRequestVote(request, response);
+    EXPECT_EQ("term: 5 "
+              "granted: false "
+              "log_ok: true",
+              response);
+    EXPECT_EQ(5U, consensus->currentTerm);
+    EXPECT_EQ(0U, consensus->votedFor);
+}
+
+TEST_F(ServerRaftConsensusTest, handleRequestVote_leadershipTransfer)
+{
+    init();
+    consensus->stepDown(5);
+    consensus->append({&entry5});
+    Protocol::Raft::RequestVote::Request request;
+    Protocol::Raft::RequestVote::Response response;
+    request.set_server_id(2);
+    request.set_term(6);
+    request.set_last_log_term(5);
+    request.set_last_log_index(1);
+
+    consensus->withholdVotesUntil = Clock::now() + milliseconds(1);
+    consensus->handleRequestVote(request, response);
+    EXPECT_EQ("term: 5 "
+              "granted: false "
+              "log_ok: true",
+              response);
+
+    // the leader asked for this election, so disregard withholdVotesUntil
+    request.set_leadership_transfer(true);
+    consensus->handleRequestVote(request, response);
+    EXPECT_EQ("term: 6 "
+              "granted: true "
+              "log_ok: true",
+              response);
+    EXPECT_EQ(2U, consensus->votedFor);
+}
+
+TEST_F(ServerRaftConsensusTest, handleTimeoutNow)
+{
+    init();
+    consensus->stepDown(5);
+    consensus->append({&entry5});
+    Protocol::Raft::TimeoutNow::Request request;
+    Protocol::Raft::TimeoutNow::Response response;
+    request.set_server_id(2);
+
+    // stale term: ignore
+    request.set_term(4);
+    consensus->handleTimeoutNow(request, response);
+    EXPECT_EQ("term: 5", response);
+    EXPECT_EQ(State::FOLLOWER, consensus->state);
+
+    // newer term: catch up, then start an election right away
+    request.set_term(6);
+    consensus->handleTimeoutNow(request, response);
+    EXPECT_EQ("term: 7", response);
+    EXPECT_EQ(State::CANDIDATE, consensus->state);
+    EXPECT_FALSE(consensus->preVoting);
+    EXPECT_TRUE(consensus->leadershipTransferElection);
+
+    // already a candidate: no-op
+    request.set_term(7);
+    consensus->handleTimeoutNow(request, response);
+    EXPECT_EQ("term: 7", response);
+    EXPECT_EQ(7U, consensus->currentTerm);
+
+    // stepping down clears the flag
+    consensus->stepDown(8);
+    EXPECT_FALSE(consensus->leadershipTransferElection);
+}
+
 // TODO(ongardie): low-priority test: replicate
 
 TEST_F(ServerRaftConsensusTest, setConfiguration_notLeader)
@@ -1471,6 +1794,89 @@ TEST_F(ServerRaftConsensusTest, setConfiguration_replicateFail)
               l2.configuration());
 }
 
+TEST_F(ServerRaftConsensusTest, setConfiguration_learnerAlsoVoter)
+{
+    init();
+    consensus->append({&entry1});
+    consensus->startNewElection();
+    drainDiskQueue(*consensus);
+
+    Protocol::Client::SetConfiguration::Request request;
+    Protocol::Client::SetConfiguration::Response response;
+    request = Core::ProtoBuf::fromString<
+        Protocol::Client::SetConfiguration::Request>(
+        "old_id: 1 "
+        "new_servers { server_id: 1, addresses: '127.0.0.1:5254' }"
+        "new_learners { server_id: 1, addresses: '127.0.0.1:5254' }"
+        "replace_learners: true");
+    EXPECT_EQ(ClientResult::FAIL,
+              consensus->setConfiguration(request, response));
+    EXPECT_EQ("configuration_bad { "
+                  "bad_servers { "
+                      "server_id: 1 "
+                      "addresses: '127.0.0.1:5254' "
+                  "}"
+              "}",
+              response);
+    EXPECT_EQ(Configuration::State::STABLE, consensus->configuration->state);
+}
+
+TEST_F(ServerRaftConsensusTest, setConfiguration_learners)
+{
+    init();
+    consensus->append({&entry1});
+    consensus->stepDown(1);
+    consensus->startNewElection();
+    consensus->leaderDiskThread =
+        std::thread(&RaftConsensus::leaderDiskThreadMain, consensus.get());
+    Protocol::Client::SetConfiguration::Request request;
+    Protocol::Client::SetConfiguration::Response response;
+    request = Core::ProtoBuf::fromString<
+        Protocol::Client::SetConfiguration::Request>(
+        "old_id: 1 "
+        "new_servers { server_id: 1, addresses: '127.0.0.1:5254' }"
+        "new_learners { server_id: 2, addresses: '127.0.0.1:5255' }"
+        "replace_learners: true");
+
+    // The learner is never caught up and never acknowledges anything, yet
+    // the change completes with just this server.
+    EXPECT_EQ(ClientResult::SUCCESS,
+              consensus->setConfiguration(request, response));
+
+    // 1: entry1, 2: no-op, 3: transitional, 4: new config
+    EXPECT_EQ(4U, consensus->log->getLastLogIndex());
+    EXPECT_EQ("prev_configuration {"
+                  "servers { server_id: 1, addresses: '127.0.0.1:5254' }"
+              "}"
+              "next_configuration {"
+                  "servers { server_id: 1, addresses: '127.0.0.1:5254' }"
+              "}"
+              "learners { server_id: 2, addresses: '127.0.0.1:5255' }",
+              consensus->log->getEntry(3).configuration());
+    EXPECT_EQ("prev_configuration {"
+                  "servers { server_id: 1, addresses: '127.0.0.1:5254' }"
+              "}"
+              "learners { server_id: 2, addresses: '127.0.0.1:5255' }",
+              consensus->log->getEntry(4).configuration());
+    EXPECT_TRUE(consensus->configuration->isLearner(
+        consensus->configuration->knownServers.at(2)));
+    EXPECT_EQ(4U, consensus->commitIndex);
+
+    // Without replace_learners, the learners are kept.
+    request.set_old_id(4);
+    request.clear_new_learners();
+    request.clear_replace_learners();
+    response.Clear();
+    EXPECT_EQ(ClientResult::SUCCESS,
+              consensus->setConfiguration(request, response));
+    EXPECT_EQ(6U, consensus->log->getLastLogIndex());
+    EXPECT_EQ("prev_configuration {"
+                  "servers { server_id: 1, addresses: '127.0.0.1:5254' }"
+              "}"
+              "learners { server_id: 2, addresses: '127.0.0.1:5255' }",
+              consensus->log->getEntry(6).configuration());
+}
+
 TEST_F(ServerRaftConsensusTest, setConfiguration_replicateOkJustUs)
 {
     init();
@@ -1514,14 +1920,17 @@ class SetConfigurationHelper3 {
         } else if (iter == 2) { // no-op entry
             drainDiskQueue(*consensus);
             peer->matchIndex = 2;
+            consensus->configuration->updateMatchIndex(*peer);
             consensus->advanceCommitIndex();
         } else if (iter == 3) { // transitional entry
             drainDiskQueue(*consensus);
             peer->matchIndex = 3;
+            consensus->configuration->updateMatchIndex(*peer);
             consensus->advanceCommitIndex();
         } else if (iter == 4) { // new configuration entry
             drainDiskQueue(*consensus);
             peer->matchIndex = 4;
+            consensus->configuration->updateMatchIndex(*peer);
             consensus->advanceCommitIndex();
         } else {
             FAIL();
@@ -1589,6 +1998,56 @@ TEST_F(ServerRaftConsensusTest, setSupportedStateMachineVersions)
     EXPECT_EQ(3U, consensus->stateChanged.notificationCount);
 }
 
+TEST_F(ServerRaftConsensusTest, transferLeadership)
+{
+    init();
+    EXPECT_EQ(ClientResult::NOT_LEADER, consensus->transferLeadership(0));
+
+    // no other voters to hand off to
+    consensus->stepDown(5);
+    consensus->append({&entry1});
+    consensus->startNewElection();
+    EXPECT_EQ(State::LEADER, consensus->state);
+    EXPECT_EQ(ClientResult::FAIL, consensus->transferLeadership(0));
+    EXPECT_EQ(ClientResult::FAIL, consensus->transferLeadership(1));
+    EXPECT_EQ(ClientResult::FAIL, consensus->transferLeadership(2));
+    EXPECT_EQ(0U, consensus->leadershipTransferTarget);
+}
+
+TEST_F(ServerRaftConsensusTest, transferLeadership_timeout)
+{
+    init();
+    consensus->stepDown(5);
+    consensus->append({&entry5});
+    consensus->startNewElection();
+    consensus->becomeLeader();
+    uint64_t target = 0;
+    consensus->stateChanged.callback = [&]() {
+        target = consensus->leadershipTransferTarget;
+        Clock::mockValue += consensus->ELECTION_TIMEOUT;
+    };
+    EXPECT_EQ(ClientResult::FAIL, consensus->transferLeadership(0));
+    EXPECT_EQ(2U, target);
+    EXPECT_EQ(0U, consensus->leadershipTransferTarget);
+    EXPECT_EQ(State::LEADER, consensus->state);
+}
+
+TEST_F(ServerRaftConsensusTest, transferLeadership_newTerm)
+{
+    init();
+    consensus->stepDown(5);
+    consensus->append({&entry5});
+    consensus->startNewElection();
+    consensus->becomeLeader();
+    consensus->stateChanged.callback = [&]() {
+        std::lock_guard<Mutex> lockGuard(consensus->mutex);
+        consensus->stepDown(consensus->currentTerm + 1);
+    };
+    EXPECT_EQ(ClientResult::SUCCESS, consensus->transferLeadership(2));
+    EXPECT_EQ(State::FOLLOWER, consensus->state);
+    EXPECT_EQ(0U, consensus->leadershipTransferTarget);
+}
+
 TEST_F(ServerRaftConsensusTest, beginSnapshot)
 {
     // Log:
@@ -1753,6 +2212,7 @@ class StateMachineUpdaterThreadMainHelper {
                       "  requested_version: 4 "
                       "}", command);
             peer.matchIndex = 5;
+            consensus.configuration->updateMatchIndex(peer);
             consensus.commitIndex = 5;
             consensus.stateChanged.notify_all(); // to satisfy RaftInvariants
         // leader and all info and servers overlap on current version: go to
@@ -1916,7 +2376,7 @@ class FollowerThreadMainHelper {
     {
     }
     void operator()() {
-        TimePoint waitUntil(consensus.stateChanged.lastWaitUntil);
+        TimePoint waitUntil(peer.wakeup.lastWaitUntil);
 
         if (iter == 1) {
             // expect to block forever as a follower
@@ -1990,8 +2450,7 @@ TEST_F(ServerRaftConsensusPTest, peerThreadMain)
         "}");
     consensus->append({&entry5});
     std::shared_ptr<Peer> peer = getPeerRef(2);
-    consensus->stateChanged.callback = FollowerThreadMainHelper(*consensus,
-                                                                *peer);
+    peer->wakeup.callback = FollowerThreadMainHelper(*consensus, *peer);
     ++consensus->numPeerThreads;
 
     // first requestVote RPC succeeds
@@ -2013,6 +2472,7 @@ TEST_F(ServerRaftConsensusPTest, peerThreadMain)
     arequest.set_prev_log_term(6);
     arequest.set_prev_log_index(2);
     arequest.set_commit_index(0);
+    arequest.set_leader_commit_index(0);
     Protocol::Raft::AppendEntries::Response aresponse;
     aresponse.set_term(6);
     aresponse.set_success(true);
@@ -2024,6 +2484,7 @@ TEST_F(ServerRaftConsensusPTest, peerThreadMain)
                        arequest, aresponse);
 
     consensus->peerThreadMain(peer);
+    EXPECT_EQ(8U, peer->numWakeups);
 }
 
 class StepDownThreadMainHelper {
@@ -2071,6 +2532,7 @@ class StepDownThreadMainHelper2 {
         } else if (iter == 2) {
             EXPECT_EQ(2U, consensus.currentEpoch);
             peer.lastAckEpoch = 2;
+            consensus.configuration->updateAckEpoch(peer);
         } else if (iter == 3) {
             EXPECT_EQ(3U, consensus.currentEpoch);
             Clock::mockValue += consensus.ELECTION_TIMEOUT;
@@ -2126,10 +2588,12 @@ TEST_F(ServerRaftConsensusTest,
     consensus->becomeLeader();
     drainDiskQueue(*consensus);
     getPeer(2)->matchIndex = 2;
+    consensus->configuration->updateMatchIndex(*getPeer(2));
     consensus->advanceCommitIndex();
     EXPECT_EQ(State::LEADER, consensus->state);
     EXPECT_EQ(0U, consensus->commitIndex);
     getPeer(2)->matchIndex = 3;
+    consensus->configuration->updateMatchIndex(*getPeer(2));
     consensus->advanceCommitIndex();
     EXPECT_EQ(3U, consensus->commitIndex);
 }
@@ -2156,12 +2620,14 @@ TEST_F(ServerRaftConsensusTest, advanceCommitIndex_commitCfgWithoutSelf)
     consensus->append({&entry1});
     drainDiskQueue(*consensus);
     getPeer(2)->matchIndex = 3;
+    consensus->configuration->updateMatchIndex(*getPeer(2));
     consensus->advanceCommitIndex();
     EXPECT_EQ(3U, consensus->commitIndex);
     EXPECT_EQ(4U, consensus->log->getLastLogIndex());
     EXPECT_EQ(State::LEADER, consensus->state);
 
     getPeer(2)->matchIndex = 4;
+    consensus->configuration->updateMatchIndex(*getPeer(2));
     consensus->advanceCommitIndex();
     EXPECT_EQ(4U, consensus->commitIndex);
     EXPECT_EQ(State::FOLLOWER, consensus->state);
@@ -2216,6 +2682,35 @@ TEST_F(ServerRaftConsensusTest, append)
     EXPECT_TRUE(consensus->logSyncQueued);
 }
 
+TEST_F(ServerRaftConsensusTest, append_wakesPeersOnlyAsLeader)
+{
+    init();
+    consensus->stepDown(5);
+    consensus->append({&entry1});
+    consensus->append({&entry5});
+    Peer& peer = *getPeer(2);
+    Log::Entry entry;
+    entry.set_term(5);
+    entry.set_type(Protocol::Raft::EntryType::NOOP);
+    entry.set_cluster_time(entry5.cluster_time());
+    peer.wakeup.notificationCount = 0;
+    consensus->append({&entry});
+    EXPECT_EQ(0U, peer.wakeup.notificationCount);
+
+    consensus->startNewElection();
+    consensus->becomeLeader();
+    drainDiskQueue(*consensus);
+    peer.wakeup.notificationCount = 0;
+    consensus->stateChanged.notificationCount = 0;
+    consensus->advanceCommitIndex();
+    EXPECT_EQ(0U, peer.wakeup.notificationCount);
+    entry.set_term(consensus->currentTerm);
+    entry.set_cluster_time(consensus->clusterClock.leaderStamp());
+    consensus->append({&entry});
+    EXPECT_EQ(1U, peer.wakeup.notificationCount);
+    EXPECT_EQ(1U, consensus->stateChanged.notificationCount);
+}
+
 // used in AppendEntries tests
 class ServerRaftConsensusPATest : public ServerRaftConsensusPTest {
     ServerRaftConsensusPATest()
@@ -2253,6 +2748,7 @@ class ServerRaftConsensusPATest : public ServerRaftConsensusPTest {
         request.set_prev_log_term(0);
         request.set_prev_log_index(0);
         request.set_commit_index(3);
+        request.set_leader_commit_index(3);
         Protocol::Raft::Entry* e1 = request.add_entries();
         e1->set_term(1);
         e1->set_cluster_time(0);
@@ -2716,6 +3212,7 @@ TEST_F(ServerRaftConsensusTest, interruptAll)
     Peer& peer = *getPeer(2);
     EXPECT_EQ("RPC canceled by user", peer.rpc.getErrorMessage());
     EXPECT_EQ(1U, consensus->stateChanged.notificationCount);
+    EXPECT_LT(0U, peer.wakeup.notificationCount);
 }
 
 // packEntries used to be part of appendEntries. The tests
@@ -2726,40 +3223,93 @@ TEST_F(ServerRaftConsensusTest, packEntries)
 {
     init();
     consensus->stepDown(5);
+    uint64_t limit = consensus->SOFT_RPC_SIZE_LIMIT;
 
     // limit by log length (of 0)
     Protocol::Raft::AppendEntries::Request request;
-    EXPECT_EQ(0U, consensus->packEntries(1U, request));
-    request.clear_entries();
+    EXPECT_EQ(0U, consensus->packEntries(1U, limit, request));
+    RaftConsensus::unpackEntries(request);
 
     // limit by log length (of 2)
     consensus->append({&entry1});
     consensus->append({&entry2});
-    EXPECT_EQ(2U, consensus->packEntries(1U, request));
-    request.clear_entries();
+    EXPECT_EQ(2U, consensus->packEntries(1U, limit, request));
+    // entries are borrowed from the log, not copied
+    EXPECT_EQ(&consensus->log->getEntry(2), &request.entries(1));
+    RaftConsensus::unpackEntries(request);
+    EXPECT_EQ(0, request.entries_size());
 
     // limit by number of log entries
     for (uint64_t i = 0; i < 128; ++i)
         consensus->append({&entry2});
-    consensus->SOFT_RPC_SIZE_LIMIT = 1024 * 1024;
     consensus->MAX_LOG_ENTRIES_PER_REQUEST = 32;
-    EXPECT_EQ(32U, consensus->packEntries(3U, request));
-    request.clear_entries();
+    EXPECT_EQ(32U, consensus->packEntries(3U, 1024 * 1024, request));
+    RaftConsensus::unpackEntries(request);
     consensus->MAX_LOG_ENTRIES_PER_REQUEST = 5000;
 
     // limit by number of bytes
-    consensus->SOFT_RPC_SIZE_LIMIT = 1024;
-    uint64_t n = consensus->packEntries(3U, request);
+    uint64_t n = consensus->packEntries(3U, 1024, request);
     EXPECT_GT(5000U, n);
     EXPECT_LT(0U, n);
-    EXPECT_GE(1024, request.ByteSize());
+    EXPECT_GT(1024, request.ByteSize());
     *request.add_entries() = consensus->log->getEntry(3);
     EXPECT_LE(1024, request.ByteSize());
-    request.clear_entries();
+    request.mutable_entries()->RemoveLast();
+    RaftConsensus::unpackEntries(request);
 
     // one entry is allowed even if it's too big
-    consensus->SOFT_RPC_SIZE_LIMIT = 1;
-    EXPECT_EQ(1U, consensus->packEntries(3U, request));
+    EXPECT_EQ(1U, consensus->packEntries(3U, 1, request));
+    RaftConsensus::unpackEntries(request);
+}
+
+TEST_F(ServerRaftConsensusPATest, adaptAppendEntriesLimit)
+{
+    using std::chrono::milliseconds;
+    consensus->SOFT_RPC_SIZE_LIMIT = 1024 * 1024;
+    consensus->APPEND_ENTRIES_TARGET_DURATION = milliseconds(100);
+    Peer& p = *peer;
+    EXPECT_EQ(~0UL, p.appendEntriesBytesLimit);
+
+    // heartbeats only establish the round-trip time
+    consensus->adaptAppendEntriesLimit(p, 1024 * 1024, 0, false,
+                                       milliseconds(10));
+    EXPECT_EQ(milliseconds(10), p.minAppendEntriesRoundTrip);
+    EXPECT_EQ(~0UL, p.appendEntriesBytesLimit);
+
+    // slow requests shrink the limit
+    consensus->adaptAppendEntriesLimit(p, 1024 * 1024, 10, true,
+                                       milliseconds(150));
+    EXPECT_EQ(512U * 1024, p.appendEntriesBytesLimit);
+
+    // the round-trip time doesn't count towards the target
+    consensus->adaptAppendEntriesLimit(p, 512 * 1024, 10, true,
+                                       milliseconds(105));
+    EXPECT_EQ(512U * 1024, p.appendEntriesBytesLimit);
+
+    // but never below 4 KB
+    consensus->adaptAppendEntriesLimit(p, 5000, 10, true,
+                                       milliseconds(500));
+    EXPECT_EQ(4096U, p.appendEntriesBytesLimit);
+
+    // fast requests grow it only if they were cut short
+    consensus->adaptAppendEntriesLimit(p, 4096, 10, false,
+                                       milliseconds(20));
+    EXPECT_EQ(4096U, p.appendEntriesBytesLimit);
+    consensus->adaptAppendEntriesLimit(p, 4096, 10, true,
+                                       milliseconds(20));
+    EXPECT_EQ(8192U, p.appendEntriesBytesLimit);
+
+    // but never above SOFT_RPC_SIZE_LIMIT
+    consensus->adaptAppendEntriesLimit(p, 1024 * 1024, 10, true,
+                                       milliseconds(20));
+    EXPECT_EQ(1024U * 1024, p.appendEntriesBytesLimit);
+
+    // a target of 0 disables this
+    consensus->APPEND_ENTRIES_TARGET_DURATION =
+        std::chrono::nanoseconds::zero();
+    consensus->adaptAppendEntriesLimit(p, 1024 * 1024, 10, true,
+                                       milliseconds(500));
+    EXPECT_EQ(1024U * 1024, p.appendEntriesBytesLimit);
 }
 
 TEST_F(ServerRaftConsensusTest, readSnapshot)
@@ -2830,6 +3380,8 @@ TEST_F(ServerRaftConsensusTest, readSnapshot)
     consensus->log.reset(log2.release());
     consensus->commitIndex = 0;
     consensus->configuration->localServer->lastSyncedIndex = 0;
+    consensus->configuration->updateMatchIndex(
+        *consensus->configuration->localServer);
     consensus->clusterClock.newEpoch(20);
     consensus->lastSnapshotIndex = 0;
     EXPECT_EQ(1U, consensus->log->getLogStartIndex());
@@ -3065,6 +3617,73 @@ TEST_F(ServerRaftConsensusPTest, requestVote_termOkAsLeader)
     EXPECT_EQ(State::LEADER, consensus->state);
 }
 
+TEST_F(ServerRaftConsensusPTest, requestVote_preVote)
+{
+    init();
+    consensus->stepDown(5);
+    consensus->append({&entry5});
+    consensus->startPreVote();
+    EXPECT_EQ(State::CANDIDATE, consensus->state);
+    Peer& peer = *getPeer(2);
+
+    Protocol::Raft::RequestVote::Request request;
+    request.set_server_id(1);
+    request.set_term(6);
+    request.set_last_log_term(5);
+    request.set_last_log_index(1);
+    request.set_pre_vote(true);
+
+    Protocol::Raft::RequestVote::Response response;
+    response.set_term(5);
+    response.set_granted(true);
+
+    peerService->reply(Protocol::Raft::OpCode::REQUEST_VOTE,
+                       request, response);
+    std::unique_lock<Mutex> lockGuard(consensus->mutex);
+    consensus->requestVote(lockGuard, peer);
+    // got a quorum of Pre-Votes: now a real candidate in the next term
+    EXPECT_EQ(State::CANDIDATE, consensus->state);
+    EXPECT_FALSE(consensus->preVoting);
+    EXPECT_EQ(6U, consensus->currentTerm);
+    EXPECT_EQ(1U, consensus->votedFor);
+    EXPECT_FALSE(peer.requestVoteDone);
+}
+
+TEST_F(ServerRaftConsensusPTest, timeoutNow)
+{
+    init();
+    consensus->stepDown(5);
+    consensus->append({&entry5});
+    consensus->startNewElection();
+    consensus->becomeLeader();
+    consensus->leadershipTransferTarget = 2;
+    Peer& peer = *getPeer(2);
+
+    Protocol::Raft::TimeoutNow::Request request;
+    request.set_server_id(1);
+    request.set_term(6);
+
+    Protocol::Raft::TimeoutNow::Response response;
+    response.set_term(6);
+
+    peerService->reply(Protocol::Raft::OpCode::TIMEOUT_NOW,
+                       request, response);
+    std::unique_lock<Mutex> lockGuard(consensus->mutex);
+    consensus->timeoutNow(lockGuard, peer);
+    EXPECT_TRUE(consensus->leadershipTransferSent);
+    EXPECT_EQ(State::LEADER, consensus->state);
+
+    // target is already in a newer term
+    consensus->leadershipTransferSent = false;
+    response.set_term(7);
+    peerService->reply(Protocol::Raft::OpCode::TIMEOUT_NOW,
+                       request, response);
+    consensus->timeoutNow(lockGuard, peer);
+    EXPECT_EQ(State::FOLLOWER, consensus->state);
+    EXPECT_EQ(7U, consensus->currentTerm);
+    EXPECT_EQ(0U, consensus->leadershipTransferTarget);
+}
+
 TEST_F(ServerRaftConsensusTest, setElectionTimer)
 {
     // TODO(ongaro): seed the random number generator and make sure the values
@@ -3125,6 +3744,58 @@ TEST_F(ServerRaftConsensusTest, startNewElection)
     consensus->append({&entry1});
     consensus->startNewElection();
     EXPECT_EQ(State::CANDIDATE, consensus->state);
+
+    // learners don't run
+    consensus->stepDown(11);
+    entry1.set_term(11);
+    *entry1.mutable_configuration() = desc(
+        "prev_configuration {"
+            "servers { server_id: 2, addresses: '127.0.0.1:5256' }"
+        "}"
+        "learners { server_id: 1, addresses: '127.0.0.1:5254' }");
+    consensus->append({&entry1});
+    consensus->startNewElection();
+    EXPECT_EQ(State::FOLLOWER, consensus->state);
+    EXPECT_EQ(11U, consensus->currentTerm);
+    EXPECT_LT(Clock::now(), consensus->startElectionAt);
+    consensus->startPreVote();
+    EXPECT_EQ(State::FOLLOWER, consensus->state);
+}
+
+TEST_F(ServerRaftConsensusTest, startPreVote)
+{
+    init();
+
+    // no configuration yet -> no op
+    consensus->startPreVote();
+    EXPECT_EQ(State::FOLLOWER, consensus->state);
+    EXPECT_FALSE(consensus->preVoting);
+
+    // need other Pre-Votes to run for real: term and vote are unchanged
+    consensus->stepDown(5);
+    consensus->append({&entry1});
+    consensus->append({&entry5});
+    consensus->startPreVote();
+    EXPECT_EQ(State::CANDIDATE, consensus->state);
+    EXPECT_TRUE(consensus->preVoting);
+    EXPECT_EQ(5U, consensus->currentTerm);
+    EXPECT_EQ(0U, consensus->votedFor);
+    EXPECT_LT(Clock::now(), consensus->startElectionAt);
+    EXPECT_GT(Clock::now() + consensus->ELECTION_TIMEOUT * 2,
+              consensus->startElectionAt);
+
+    // stepping down ends the Pre-Vote
+    consensus->stepDown(5);
+    EXPECT_FALSE(consensus->preVoting);
+
+    // already won: runs the real election, which it also wins
+    consensus->stepDown(7);
+    entry1.set_term(7);
+    consensus->append({&entry1});
+    consensus->startPreVote();
+    EXPECT_EQ(State::LEADER, consensus->state);
+    EXPECT_EQ(8U, consensus->currentTerm);
+    EXPECT_FALSE(consensus->preVoting);
 }
 
 TEST_F(ServerRaftConsensusTest, stepDown)
@@ -3196,8 +3867,10 @@ class UpToDateLeaderHelper {
         Peer* peer = dynamic_cast<Peer*>(server);
         if (iter == 1) {
             peer->lastAckEpoch = consensus->currentEpoch;
+            consensus->configuration->updateAckEpoch(*peer);
         } else if (iter == 2) {
             peer->matchIndex = 4;
+            consensus->configuration->updateMatchIndex(*peer);
             consensus->advanceCommitIndex();
         } else {
             FAIL();
@@ -15,7 +15,9 @@
 
 #include "build/Protocol/Raft.pb.h"
 #include "Core/Debug.h"
+#include "Core/Time.h"
 #include "Core/ProtoBuf.h"
+#include "Protocol/Common.h"
 #include "RPC/ServerRPC.h"
 #include "Server/RaftConsensus.h"
 #include "Server/RaftService.h"
@@ -24,8 +26,10 @@
 namespace LogCabin {
 namespace Server {
 
-RaftService::RaftService(Globals& globals)
+RaftService::RaftService(Globals& globals,
+                         std::shared_ptr<RaftConsensus> raft)
     : globals(globals)
+    , raft(raft)
 {
 }
 
@@ -38,7 +42,10 @@ RaftService::handleRPC(RPC::ServerRPC rpc)
 {
     using Protocol::Raft::OpCode;
     // Call the appropriate RPC handler based on the request's opCode.
-    switch (rpc.getOpCode()) {
+    Core::Time::SteadyClock::time_point start =
+        Core::Time::SteadyClock::now();
+    uint16_t opCode = rpc.getOpCode();
+    switch (opCode) {
         case OpCode::APPEND_ENTRIES:
             appendEntries(std::move(rpc));
             break;
@@ -48,11 +55,20 @@ RaftService::handleRPC(RPC::ServerRPC rpc)
         case OpCode::REQUEST_VOTE:
             requestVote(std::move(rpc));
             break;
+        case OpCode::TIMEOUT_NOW:
+            timeoutNow(std::move(rpc));
+            break;
         default:
             WARNING("Client sent request with bad op code (%u) to RaftService",
                     rpc.getOpCode());
             rpc.rejectInvalidRequest();
     }
+#ifndef IX_TARGET_BUILD
+    globals.serverStats.noteRPCNanos(
+        Protocol::Common::ServiceId::RAFT_SERVICE, opCode,
+        uint64_t(std::chrono::nanoseconds(
+            Core::Time::SteadyClock::now() - start).count()));
+#endif
 }
 
 std::string
@@ -80,7 +96,7 @@ RaftService::appendEntries(RPC::ServerRPC rpc)
     PRELUDE(AppendEntries);
     //VERBOSE("AppendEntries:\n%s",
     //        Core::ProtoBuf::dumpString(request).c_str());
-    globals.raft->handleAppendEntries(request, response);
+    raft->handleAppendEntries(request, response);
     rpc.reply(response);
 }
 
@@ -90,7 +106,7 @@ RaftService::installSnapshot(RPC::ServerRPC rpc)
     PRELUDE(InstallSnapshot);
     //VERBOSE("InstallSnapshot:\n%s",
     //        Core::ProtoBuf::dumpString(request).c_str());
-    globals.raft->handleInstallSnapshot(request, response);
+    raft->handleInstallSnapshot(request, response);
     rpc.reply(response);
 }
 
@@ -100,7 +116,15 @@ RaftService::requestVote(RPC::ServerRPC rpc)
     PRELUDE(RequestVote);
     //VERBOSE("RequestVote:\n%s",
     //        Core::ProtoBuf::dumpString(request).c_str());
-    globals.raft->handleRequestVote(request, response);
+    raft->handleRequestVote(request, response);
+    rpc.reply(response);
+}
+
+void
+RaftService::timeoutNow(RPC::ServerRPC rpc)
+{
+    PRELUDE(TimeoutNow);
+    raft->handleTimeoutNow(request, response);
     rpc.reply(response);
 }
 
@@ -13,6 +13,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <memory>
+
 #include "RPC/Service.h"
 
 #ifndef LOGCABIN_SERVER_RAFTSERVICE_H
@@ -23,12 +25,19 @@ namespace Server {
 
 // forward declaration
 class Globals;
+class RaftConsensus;
 
 // TODO(ongaro): doc
 class RaftService : public RPC::Service {
   public:
-    /// Constructor.
-    explicit RaftService(Globals& globals);
+    /**
+     * Constructor.
+     * \param globals
+     *      The LogCabin daemon's top-level objects.
+     * \param raft
+     *      The Raft group that incoming RPCs are handed to.
+     */
+    RaftService(Globals& globals, std::shared_ptr<RaftConsensus> raft);
 
     /// Destructor.
     ~RaftService();
@@ -43,12 +52,18 @@ class RaftService : public RPC::Service {
     void requestVote(RPC::ServerRPC rpc);
     void appendEntries(RPC::ServerRPC rpc);
     void installSnapshot(RPC::ServerRPC rpc);
+    void timeoutNow(RPC::ServerRPC rpc);
 
     /**
      * The LogCabin daemon's top-level objects.
      */
     Globals& globals;
 
+    /**
+     * The Raft group this service runs the consensus protocol for.
+     */
+    std::shared_ptr<RaftConsensus> raft;
+
   public:
 
     // RaftService is non-copyable.
@@ -19,6 +19,7 @@
 #include "Core/ThreadId.h"
 #include "Core/Time.h"
 #include "Event/Signal.h"
+#include "RPC/Server.h"
 #include "Server/Globals.h"
 #include "Server/RaftConsensus.h"
 #include "Server/StateMachine.h"
@@ -93,11 +94,20 @@ ServerStats::ServerStats(Globals& globals)
     , lastDumped(SteadyClock::now())
     , stats()
     , deferred()
+    , rpcNanos()
 {
+    for (uint16_t i = 0; i < MAX_SERVICE_ID; ++i) {
+        for (uint16_t j = 0; j < MAX_OP_CODE; ++j)
+            rpcNanos[i][j] = NULL;
+    }
 }
 
 ServerStats::~ServerStats()
 {
+    for (uint16_t i = 0; i < MAX_SERVICE_ID; ++i) {
+        for (uint16_t j = 0; j < MAX_OP_CODE; ++j)
+            delete rpcNanos[i][j].load();
+    }
 }
 
 void
@@ -138,6 +148,26 @@ ServerStats::getCurrent() const
     return getCurrent(lockGuard);
 }
 
+void
+ServerStats::noteRPCNanos(uint16_t serviceId, uint16_t opCode, uint64_t nanos)
+{
+    if (serviceId >= MAX_SERVICE_ID || opCode >= MAX_OP_CODE)
+        return;
+    std::atomic<Core::Histogram*>& slot = rpcNanos[serviceId][opCode];
+    Core::Histogram* histogram = slot.load(std::memory_order_acquire);
+    if (histogram == NULL) {
+        // Another thread may race to allocate this one; the loser frees its
+        // copy and uses the winner's.
+        Core::Histogram* fresh = new Core::Histogram();
+        if (slot.compare_exchange_strong(histogram, fresh)) {
+            histogram = fresh;
+        } else {
+            delete fresh;
+        }
+    }
+    histogram->push(nanos);
+}
+
 ////////// ServerStats private //////////
 
 void
@@ -159,11 +189,40 @@ ServerStats::getCurrent(std::unique_lock<Core::Mutex>& lockGuard) const
         Core::Time::SystemClock::now().time_since_epoch()).count();
     Protocol::ServerStats copy = stats;
     copy.set_start_at(startTime);
+    for (uint16_t i = 0; i < MAX_SERVICE_ID; ++i) {
+        for (uint16_t j = 0; j < MAX_OP_CODE; ++j) {
+            const Core::Histogram* histogram =
+                rpcNanos[i][j].load(std::memory_order_acquire);
+            if (histogram == NULL)
+                continue;
+            Protocol::ServerStats::RPC& rpc = *copy.add_rpc();
+            rpc.set_service_id(i);
+            rpc.set_op_code(j);
+            histogram->updateProtoBuf(*rpc.mutable_nanos());
+        }
+    }
     if (deferred.get() != NULL) { // enabled
         // release lock to avoid deadlock and for concurrency
         Core::MutexUnlock<Core::Mutex> unlockGuard(lockGuard);
         globals.raft->updateServerStats(copy);
+        globals.entryTracer.updateServerStats(copy);
+        globals.admissionControl.updateServerStats(copy);
+        if (globals.rpcServer)
+            globals.rpcServer->updateServerStats(copy);
         globals.stateMachine->updateServerStats(copy);
+        for (size_t i = 1; i < globals.groups.size(); ++i) {
+            const Globals::RaftGroup& group = globals.groups.at(i);
+            Protocol::ServerStats groupStats;
+            group.raft->updateServerStats(groupStats);
+            group.stateMachine->updateServerStats(groupStats);
+            Protocol::ServerStats::RaftGroup& stats = *copy.add_raft_group();
+            stats.set_group_id(group.id);
+            stats.set_path(group.path);
+            stats.mutable_raft()->Swap(groupStats.mutable_raft());
+            stats.mutable_storage()->Swap(groupStats.mutable_storage());
+            stats.mutable_state_machine()->Swap(
+                groupStats.mutable_state_machine());
+        }
     }
     copy.set_end_at(std::chrono::nanoseconds(
         Core::Time::SystemClock::now().time_since_epoch()).count());
@@ -21,6 +21,8 @@
 
 #include "build/Protocol/ServerStats.pb.h"
 
+#include "Core/CompatAtomic.h"
+#include "Core/Histogram.h"
 #include "Core/Mutex.h"
 #include "Core/Time.h"
 #include "Event/Signal.h"
@@ -40,7 +42,8 @@ class Globals;
  * directly. This #stats structure is copied every time stats are requested.
  * Second, when stats are requested, #getCurrent() will ask certain modules
  * (such as RaftConsensus) to fill in the current information into a copy of
- * the stats structure.
+ * the stats structure. Frequent measurements such as RPC latencies are an
+ * exception: noteRPCNanos() records them into lock-free histograms.
  */
 class ServerStats {
   public:
@@ -76,6 +79,18 @@ class ServerStats {
      */
     Protocol::ServerStats getCurrent() const;
 
+    /**
+     * Record how long a service took to handle an RPC. This is cheap and
+     * may be called from any thread without a Lock.
+     * \param serviceId
+     *      See Protocol::Common::ServiceId.
+     * \param opCode
+     *      The RPC's opcode within the service.
+     * \param nanos
+     *      The time spent handling the RPC.
+     */
+    void noteRPCNanos(uint16_t serviceId, uint16_t opCode, uint64_t nanos);
+
     /**
      * Provides read/write access to #stats, protected against concurrent
      * access.
@@ -103,6 +118,12 @@ class ServerStats {
      */
     typedef Core::Time::SteadyClock SteadyClock;
 
+    /**
+     * Bounds on the service IDs and opcodes for which noteRPCNanos() keeps
+     * histograms. RPCs outside these bounds are not recorded.
+     */
+    enum { MAX_SERVICE_ID = 4, MAX_OP_CODE = 32 };
+
     /**
      * Used to include wall time in stats.
      */
@@ -225,6 +246,14 @@ class ServerStats {
      * modules should be queried for stats during getCurrent().
      */
     std::unique_ptr<Deferred> deferred;
+
+    /**
+     * Service latencies recorded by noteRPCNanos(), indexed by service ID
+     * and opcode. Each histogram is allocated the first time an RPC of its
+     * type is recorded, and freed in the destructor. These are not protected
+     * by #mutex.
+     */
+    std::atomic<Core::Histogram*> rpcNanos[MAX_SERVICE_ID][MAX_OP_CODE];
 };
 
 } // namespace LogCabin::Server
@@ -131,6 +131,25 @@ TEST_F(ServerServerStatsTest, getCurrent)
     EXPECT_TRUE(stat.has_raft());
 }
 
+TEST_F(ServerServerStatsTest, noteRPCNanos)
+{
+    globals.serverStats.noteRPCNanos(2, 1, 1000);
+    globals.serverStats.noteRPCNanos(2, 1, 3000);
+    globals.serverStats.noteRPCNanos(1, 7, 10);
+    // out of range: ignored
+    globals.serverStats.noteRPCNanos(1, ServerStats::MAX_OP_CODE, 10);
+    globals.serverStats.noteRPCNanos(ServerStats::MAX_SERVICE_ID, 1, 10);
+    Protocol::ServerStats stat = globals.serverStats.getCurrent();
+    ASSERT_EQ(2, stat.rpc_size());
+    EXPECT_EQ(1U, stat.rpc(0).service_id());
+    EXPECT_EQ(7U, stat.rpc(0).op_code());
+    EXPECT_EQ(1U, stat.rpc(0).nanos().count());
+    EXPECT_EQ(2U, stat.rpc(1).service_id());
+    EXPECT_EQ(1U, stat.rpc(1).op_code());
+    EXPECT_EQ(2U, stat.rpc(1).nanos().count());
+    EXPECT_NEAR(3000, double(stat.rpc(1).nanos().p99()), 3000 / 8);
+}
+
 
 struct StatsDumperMainHelper {
     explicit StatsDumperMainHelper(ServerStats& serverStats)
@@ -0,0 +1,575 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <functional>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "build/Protocol/Client.pb.h"
+#include "build/Protocol/ServerStats.pb.h"
+#include "Core/Buffer.h"
+#include "Core/CompatAtomic.h"
+#include "Core/Debug.h"
+#include "Core/ProtoBuf.h"
+#include "Core/StringUtil.h"
+#include "Server/Globals.h"
+#include "Server/RaftConsensus.h"
+#include "Server/SimulatedCluster.h"
+#include "Server/StateMachine.h"
+#include "Storage/FilesystemUtil.h"
+
+namespace LogCabin {
+namespace Server {
+
+namespace {
+
+/**
+ * Parse a request, invoke a RaftConsensus handler on it, and serialize the
+ * response.
+ * \tparam RPC
+ *      A message type from Raft.proto with nested Request and Response
+ *      types, such as Protocol::Raft::AppendEntries.
+ * \return
+ *      False if the request could not be parsed.
+ */
+template<typename RPC>
+bool
+invoke(RaftConsensus& consensus,
+       void (RaftConsensus::*handler)(const typename RPC::Request&,
+                                      typename RPC::Response&),
+       const Core::Buffer& requestBuffer,
+       Core::Buffer& responseBuffer)
+{
+    typename RPC::Request request;
+    typename RPC::Response response;
+    if (!Core::ProtoBuf::parse(requestBuffer, request))
+        return false;
+    (consensus.*handler)(request, response);
+    Core::ProtoBuf::serialize(response, responseBuffer);
+    return true;
+}
+
+/**
+ * Return the given server's view of its Raft state.
+ */
+Protocol::ServerStats::Raft
+getRaftStats(const RaftConsensus& consensus)
+{
+    Protocol::ServerStats stats;
+    consensus.updateServerStats(stats);
+    return stats.raft();
+}
+
+/**
+ * Return the total number of times the given server's peer threads have
+ * woken up.
+ */
+uint64_t
+getPeerWakeups(const RaftConsensus& consensus)
+{
+    Protocol::ServerStats::Raft stats = getRaftStats(consensus);
+    uint64_t wakeups = 0;
+    for (auto it = stats.peer().begin(); it != stats.peer().end(); ++it)
+        wakeups += it->wakeups();
+    return wakeups;
+}
+
+} // anonymous namespace
+
+//// class SimulatedNetwork ////
+
+SimulatedNetwork::Options::Options()
+    : latency(0)
+    , jitter(0)
+    , bytesPerSecond(0)
+    , lossProbability(0)
+    , seed(0)
+{
+}
+
+SimulatedNetwork::SimulatedNetwork(const Options& options)
+    : options(options)
+    , mutex()
+    , callsDone()
+    , random(options.seed)
+    , servers()
+    , isolated()
+    , linkBusyUntil()
+    , exiting(false)
+    , numActiveCalls(0)
+    , numMessages(0)
+    , numLost(0)
+{
+}
+
+SimulatedNetwork::~SimulatedNetwork()
+{
+    shutdown();
+}
+
+void
+SimulatedNetwork::addServer(uint64_t serverId, RaftConsensus& consensus)
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    servers[serverId] = &consensus;
+}
+
+void
+SimulatedNetwork::setIsolated(uint64_t serverId, bool isolate)
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    if (isolate)
+        isolated.insert(serverId);
+    else
+        isolated.erase(serverId);
+}
+
+void
+SimulatedNetwork::shutdown()
+{
+    std::unique_lock<Core::Mutex> lockGuard(mutex);
+    exiting = true;
+    while (numActiveCalls > 0)
+        callsDone.wait(lockGuard);
+}
+
+bool
+SimulatedNetwork::call(uint64_t from,
+                       uint64_t to,
+                       Protocol::Raft::OpCode opCode,
+                       const Core::Buffer& request,
+                       google::protobuf::Message& response)
+{
+    RaftConsensus* target = NULL;
+    {
+        std::lock_guard<Core::Mutex> lockGuard(mutex);
+        if (exiting)
+            return false;
+        auto it = servers.find(to);
+        if (it == servers.end())
+            return false;
+        target = it->second;
+        ++numActiveCalls;
+    }
+
+    bool ok = false;
+    TimePoint arrival;
+    bool delivered = transmit(from, to, request.getLength(), arrival);
+    Core::Time::sleep(arrival);
+    if (delivered) {
+        Core::Buffer responseBuffer;
+        if (dispatch(*target, opCode, request, responseBuffer)) {
+            delivered = transmit(to, from, responseBuffer.getLength(),
+                                 arrival);
+            Core::Time::sleep(arrival);
+            if (delivered)
+                ok = Core::ProtoBuf::parse(responseBuffer, response);
+        }
+    }
+
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    --numActiveCalls;
+    if (numActiveCalls == 0)
+        callsDone.notify_all();
+    return ok;
+}
+
+uint64_t
+SimulatedNetwork::getNumMessages() const
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    return numMessages;
+}
+
+uint64_t
+SimulatedNetwork::getNumLost() const
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    return numLost;
+}
+
+bool
+SimulatedNetwork::transmit(uint64_t from, uint64_t to, uint64_t bytes,
+                           TimePoint& arrival)
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    ++numMessages;
+    TimePoint now = Clock::now();
+    TimePoint& busyUntil = linkBusyUntil[{from, to}];
+    TimePoint start = std::max(now, busyUntil);
+    if (options.bytesPerSecond > 0) {
+        busyUntil = start + std::chrono::nanoseconds(
+            bytes * 1000UL * 1000 * 1000 / options.bytesPerSecond);
+    } else {
+        busyUntil = start;
+    }
+    arrival = busyUntil + options.latency;
+    if (options.jitter.count() > 0) {
+        std::uniform_int_distribution<int64_t> jitter(
+            0, options.jitter.count());
+        arrival += std::chrono::nanoseconds(jitter(random));
+    }
+    bool lost = (isolated.find(from) != isolated.end() ||
+                 isolated.find(to) != isolated.end());
+    if (!lost && options.lossProbability > 0) {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        lost = uniform(random) < options.lossProbability;
+    }
+    if (lost)
+        ++numLost;
+    return !lost;
+}
+
+bool
+SimulatedNetwork::dispatch(RaftConsensus& consensus,
+                           Protocol::Raft::OpCode opCode,
+                           const Core::Buffer& request,
+                           Core::Buffer& response)
+{
+    using namespace Protocol::Raft; // NOLINT
+    switch (opCode) {
+        case REQUEST_VOTE:
+            return invoke<RequestVote>(
+                consensus, &RaftConsensus::handleRequestVote,
+                request, response);
+        case APPEND_ENTRIES:
+            return invoke<AppendEntries>(
+                consensus, &RaftConsensus::handleAppendEntries,
+                request, response);
+        case INSTALL_SNAPSHOT:
+            return invoke<InstallSnapshot>(
+                consensus, &RaftConsensus::handleInstallSnapshot,
+                request, response);
+        case TIMEOUT_NOW:
+            return invoke<TimeoutNow>(
+                consensus, &RaftConsensus::handleTimeoutNow,
+                request, response);
+    }
+    WARNING("Unknown Raft opcode %d", int(opCode));
+    return false;
+}
+
+//// class SimulatedCluster ////
+
+SimulatedCluster::Options::Options()
+    : numServers(3)
+    , numLearners(0)
+    , network()
+    , storageModule("Memory")
+    , storagePath("/tmp")
+    , electionTimeoutMilliseconds(100)
+    , heartbeatPeriodMilliseconds(25)
+    , config()
+{
+}
+
+SimulatedCluster::ReplicationResult::ReplicationResult()
+    : entries(0)
+    , failures(0)
+    , elapsed(0)
+    , commitNanos()
+    , peerWakeups(0)
+{
+}
+
+double
+SimulatedCluster::ReplicationResult::entriesPerSecond() const
+{
+    if (elapsed.count() == 0)
+        return 0;
+    return double(entries) * 1e9 / double(elapsed.count());
+}
+
+SimulatedCluster::Node::Node()
+    : globals()
+    , raft()
+    , stateMachine()
+{
+}
+
+SimulatedCluster::Node::~Node()
+{
+    // The state machine's destructor tells the consensus module to exit and
+    // joins with its threads, which hold references to raft.
+    stateMachine.reset();
+    raft.reset();
+    globals.reset();
+}
+
+SimulatedCluster::SimulatedCluster(const Options& options)
+    : options(options)
+    , storageDir()
+    , network(options.network)
+    , nodes()
+{
+    using Core::StringUtil::format;
+    if (options.storageModule != "Memory") {
+        std::string pattern = options.storagePath + "/logcabinXXXXXX";
+        std::vector<char> path(pattern.begin(), pattern.end());
+        path.push_back('\0');
+        if (::mkdtemp(path.data()) == NULL) {
+            PANIC("Couldn't create temporary directory in %s: %s",
+                  options.storagePath.c_str(), strerror(errno));
+        }
+        storageDir = path.data();
+    }
+
+    uint64_t numNodes = options.numServers + options.numLearners;
+    for (uint64_t serverId = 1; serverId <= numNodes; ++serverId) {
+        std::unique_ptr<Node> node(new Node());
+        node->globals.reset(new Globals());
+        Core::Config& config = node->globals->config;
+        for (auto it = options.config.begin();
+             it != options.config.end();
+             ++it) {
+            config.set(it->first, it->second);
+        }
+        config.set("serverId", serverId);
+        config.set("storageModule", options.storageModule);
+        if (storageDir.empty())
+            config.set("use-temporary-storage", "true");
+        else
+            config.set("storagePath", storageDir);
+        config.set("electionTimeoutMilliseconds",
+                   options.electionTimeoutMilliseconds);
+        config.set("heartbeatPeriodMilliseconds",
+                   options.heartbeatPeriodMilliseconds);
+        node->globals->serverId = serverId;
+
+        node->raft.reset(new RaftConsensus(*node->globals));
+        node->raft->serverId = serverId;
+        node->raft->serverAddresses = format("simulated:%lu", serverId);
+        node->raft->deliverRPC =
+            std::bind(&SimulatedNetwork::call, &network, serverId,
+                      std::placeholders::_1, std::placeholders::_2,
+                      std::placeholders::_3, std::placeholders::_4);
+        network.addServer(serverId, *node->raft);
+        node->raft->init();
+        if (serverId == 1)
+            node->raft->bootstrapConfiguration();
+        node->stateMachine.reset(
+            new StateMachine(node->raft, config, *node->globals));
+        nodes.push_back(std::move(node));
+    }
+
+    TimePoint timeout = Clock::now() + std::chrono::minutes(1);
+    uint64_t leaderId = waitForLeader(timeout);
+    if (leaderId == 0)
+        PANIC("Simulated cluster failed to elect a leader");
+    if (numNodes == 1)
+        return;
+
+    RaftConsensus& leader = getRaft(leaderId);
+    Protocol::Raft::SimpleConfiguration configuration;
+    Protocol::Raft::SimpleConfiguration learners;
+    uint64_t id = 0;
+    while (leader.getConfiguration(configuration, learners, id) !=
+           RaftConsensus::ClientResult::SUCCESS) {
+        if (Clock::now() > timeout)
+            PANIC("Couldn't get the simulated cluster's configuration");
+        Core::Time::sleep(std::chrono::milliseconds(1));
+    }
+    Protocol::Client::SetConfiguration::Request request;
+    Protocol::Client::SetConfiguration::Response response;
+    request.set_old_id(id);
+    request.set_replace_learners(true);
+    for (uint64_t serverId = 1; serverId <= options.numServers; ++serverId) {
+        Protocol::Client::Server& server = *request.add_new_servers();
+        server.set_server_id(serverId);
+        server.set_addresses(format("simulated:%lu", serverId));
+    }
+    for (uint64_t serverId = options.numServers + 1;
+         serverId <= numNodes;
+         ++serverId) {
+        Protocol::Client::Server& server = *request.add_new_learners();
+        server.set_server_id(serverId);
+        server.set_addresses(format("simulated:%lu", serverId));
+    }
+    if (leader.setConfiguration(request, response) !=
+            RaftConsensus::ClientResult::SUCCESS ||
+        !response.has_ok()) {
+        PANIC("Couldn't add servers to the simulated cluster: %s",
+              Core::ProtoBuf::dumpString(response).c_str());
+    }
+}
+
+SimulatedCluster::~SimulatedCluster()
+{
+    // Stop delivering messages first so that no handler runs on a server
+    // that is being destroyed.
+    network.shutdown();
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+        (*it)->raft->exit();
+    nodes.clear();
+    if (!storageDir.empty())
+        Storage::FilesystemUtil::remove(storageDir);
+}
+
+uint64_t
+SimulatedCluster::getLeader() const
+{
+    uint64_t leaderId = 0;
+    uint64_t leaderTerm = 0;
+    for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+        Protocol::ServerStats::Raft stats = getRaftStats(*(*it)->raft);
+        if (stats.state() == Protocol::ServerStats::Raft::LEADER &&
+            stats.current_term() >= leaderTerm) {
+            leaderId = (*it)->raft->serverId;
+            leaderTerm = stats.current_term();
+        }
+    }
+    return leaderId;
+}
+
+uint64_t
+SimulatedCluster::waitForLeader(TimePoint timeout) const
+{
+    while (true) {
+        uint64_t leaderId = getLeader();
+        if (leaderId != 0 || Clock::now() > timeout)
+            return leaderId;
+        Core::Time::sleep(std::chrono::milliseconds(1));
+    }
+}
+
+RaftConsensus&
+SimulatedCluster::getRaft(uint64_t serverId)
+{
+    return *nodes.at(serverId - 1)->raft;
+}
+
+SimulatedNetwork&
+SimulatedCluster::getNetwork()
+{
+    return network;
+}
+
+SimulatedCluster::ReplicationResult
+SimulatedCluster::measureReplication(uint64_t numWriters,
+                                     uint64_t numEntries,
+                                     uint64_t valueSize)
+{
+    ReplicationResult result;
+    uint64_t leaderId = waitForLeader(Clock::now() + std::chrono::minutes(1));
+    if (leaderId == 0) {
+        WARNING("No leader in simulated cluster");
+        return result;
+    }
+    RaftConsensus& leader = getRaft(leaderId);
+    std::vector<uint64_t> clientIds;
+    for (uint64_t i = 0; i < numWriters; ++i) {
+        uint64_t clientId = openSession(leader);
+        if (clientId == 0) {
+            WARNING("Lost leadership while opening sessions");
+            return result;
+        }
+        clientIds.push_back(clientId);
+    }
+
+    const std::string value(valueSize, 'v');
+    std::atomic<uint64_t> submitted(0);
+    std::atomic<uint64_t> committed(0);
+    std::atomic<uint64_t> failures(0);
+    std::vector<std::thread> writers;
+    uint64_t startWakeups = getPeerWakeups(leader);
+    TimePoint start = Clock::now();
+    for (uint64_t i = 0; i < numWriters; ++i) {
+        writers.emplace_back([&, i] () {
+            StateMachine::Command::Request command;
+            Protocol::Client::ReadWriteTree::Request& tree =
+                *command.mutable_tree();
+            tree.mutable_exactly_once()->set_client_id(clientIds.at(i));
+            tree.mutable_write()->set_path(
+                Core::StringUtil::format("/writer%lu", i));
+            tree.mutable_write()->set_contents(value);
+            for (uint64_t rpcNumber = 1;
+                 submitted.fetch_add(1) < numEntries;
+                 ++rpcNumber) {
+                tree.mutable_exactly_once()->set_first_outstanding_rpc(
+                    rpcNumber);
+                tree.mutable_exactly_once()->set_rpc_number(rpcNumber);
+                Core::Buffer buffer;
+                Core::ProtoBuf::serialize(command, buffer);
+                TimePoint sent = Clock::now();
+                if (leader.replicate(buffer).first !=
+                    RaftConsensus::ClientResult::SUCCESS) {
+                    ++failures;
+                    continue;
+                }
+                result.commitNanos.push(uint64_t(
+                    std::chrono::nanoseconds(Clock::now() - sent).count()));
+                ++committed;
+            }
+        });
+    }
+    for (auto it = writers.begin(); it != writers.end(); ++it)
+        it->join();
+    result.elapsed = Clock::now() - start;
+    result.peerWakeups = getPeerWakeups(leader) - startWakeups;
+    result.entries = committed;
+    result.failures = failures;
+    return result;
+}
+
+std::chrono::nanoseconds
+SimulatedCluster::measureElection()
+{
+    uint64_t oldLeaderId = waitForLeader(
+        Clock::now() + std::chrono::minutes(1));
+    if (oldLeaderId == 0)
+        return std::chrono::nanoseconds::max();
+    TimePoint start = Clock::now();
+    TimePoint timeout = start + std::chrono::minutes(1);
+    network.setIsolated(oldLeaderId, true);
+    std::chrono::nanoseconds elapsed = std::chrono::nanoseconds::max();
+    while (Clock::now() < timeout) {
+        bool found = false;
+        for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+            RaftConsensus& raft = *(*it)->raft;
+            if (raft.serverId != oldLeaderId &&
+                getRaftStats(raft).state() ==
+                    Protocol::ServerStats::Raft::LEADER) {
+                found = true;
+            }
+        }
+        if (found) {
+            elapsed = Clock::now() - start;
+            break;
+        }
+        Core::Time::sleep(std::chrono::microseconds(100));
+    }
+    network.setIsolated(oldLeaderId, false);
+    return elapsed;
+}
+
+uint64_t
+SimulatedCluster::openSession(RaftConsensus& leader)
+{
+    StateMachine::Command::Request command;
+    command.mutable_open_session();
+    Core::Buffer buffer;
+    Core::ProtoBuf::serialize(command, buffer);
+    std::pair<RaftConsensus::ClientResult, uint64_t> result =
+        leader.replicate(buffer);
+    if (result.first != RaftConsensus::ClientResult::SUCCESS)
+        return 0;
+    // The session's client ID is the index of the entry that opened it.
+    return result.second;
+}
+
+} // namespace LogCabin::Server
+} // namespace LogCabin
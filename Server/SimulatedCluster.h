@@ -0,0 +1,456 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "build/Protocol/Raft.pb.h"
+#include "Core/Buffer.h"
+#include "Core/ConditionVariable.h"
+#include "Core/Histogram.h"
+#include "Core/Mutex.h"
+#include "Core/Time.h"
+
+#ifndef LOGCABIN_SERVER_SIMULATEDCLUSTER_H
+#define LOGCABIN_SERVER_SIMULATEDCLUSTER_H
+
+namespace LogCabin {
+namespace Server {
+
+// forward declarations
+class Globals;
+class RaftConsensus;
+class StateMachine;
+
+/**
+ * An in-process stand-in for the network between RaftConsensus instances.
+ * Peers hand their serialized RPCs to call(), which holds the request for
+ * the configured delay, and invokes the target's handler directly from the
+ * calling peer thread.
+ *
+ * Each directed link between two servers transmits one message at a time at
+ * the configured bandwidth, so large AppendEntries requests queue up behind
+ * each other as they would on a real link. A lost message makes the RPC fail,
+ * which the caller handles like a dropped connection.
+ *
+ * This class is thread-safe.
+ */
+class SimulatedNetwork {
+  public:
+    typedef Core::Time::SteadyClock Clock;
+    typedef Clock::time_point TimePoint;
+
+    /**
+     * Characteristics of every link in the network.
+     */
+    struct Options {
+        /// Constructor: an instant, lossless network.
+        Options();
+        /**
+         * One-way propagation delay added to every message.
+         */
+        std::chrono::nanoseconds latency;
+        /**
+         * Each message is further delayed by a random amount up to this.
+         */
+        std::chrono::nanoseconds jitter;
+        /**
+         * Bytes per second each directed link can carry, or 0 for unlimited.
+         */
+        uint64_t bytesPerSecond;
+        /**
+         * Probability from 0 to 1 that any given message is dropped.
+         */
+        double lossProbability;
+        /**
+         * Seeds the generator used for jitter and loss, so that runs with the
+         * same seed make the same sequence of random choices.
+         */
+        uint64_t seed;
+    };
+
+    /**
+     * Constructor.
+     */
+    explicit SimulatedNetwork(const Options& options);
+
+    /**
+     * Destructor. Calls shutdown().
+     */
+    ~SimulatedNetwork();
+
+    /**
+     * Make a server reachable through call().
+     * \param serverId
+     *      The server's ID, as used in the Raft configuration.
+     * \param consensus
+     *      The server's consensus module, which must outlive this object or
+     *      shutdown().
+     */
+    void addServer(uint64_t serverId, RaftConsensus& consensus);
+
+    /**
+     * Partition a server away from all others, or reconnect it.
+     * \param serverId
+     *      The server to affect.
+     * \param isolate
+     *      If true, all messages to and from the server are dropped.
+     */
+    void setIsolated(uint64_t serverId, bool isolate);
+
+    /**
+     * Fail all future calls, and wait for calls that are already delivering
+     * messages to return. After this, no handlers will be invoked.
+     */
+    void shutdown();
+
+    /**
+     * Deliver an RPC from one server to another. Called by peer threads with
+     * no locks held; this blocks for the simulated round-trip time.
+     * \param from
+     *      The ID of the sending server.
+     * \param to
+     *      The ID of the receiving server.
+     * \param opCode
+     *      Which RaftService handler to invoke.
+     * \param request
+     *      The serialized request, of the type that matches opCode.
+     * \param[out] response
+     *      Filled in with the reply if this returns true.
+     * \return
+     *      True if the reply was received; false if either message was lost
+     *      or the target is unknown or isolated.
+     */
+    bool call(uint64_t from,
+              uint64_t to,
+              Protocol::Raft::OpCode opCode,
+              const Core::Buffer& request,
+              google::protobuf::Message& response);
+
+    /**
+     * Return the number of messages sent through the network, including
+     * those that were lost.
+     */
+    uint64_t getNumMessages() const;
+
+    /**
+     * Return the number of messages that were lost.
+     */
+    uint64_t getNumLost() const;
+
+  private:
+    /**
+     * Schedule a message on the link from 'from' to 'to'.
+     * \param from
+     *      The ID of the sending server.
+     * \param to
+     *      The ID of the receiving server.
+     * \param bytes
+     *      The size of the message, which determines how long it occupies
+     *      the link.
+     * \param[out] arrival
+     *      When the message will arrive, if it's not lost.
+     * \return
+     *      False if the message is lost.
+     */
+    bool transmit(uint64_t from, uint64_t to, uint64_t bytes,
+                  TimePoint& arrival);
+
+    /**
+     * Invoke the handler for 'opCode' on the given server.
+     * \param consensus
+     *      The receiving server.
+     * \param opCode
+     *      Which RaftService handler to invoke.
+     * \param request
+     *      The serialized request.
+     * \param[out] response
+     *      The serialized response.
+     * \return
+     *      False if the opcode or request was invalid.
+     */
+    static bool dispatch(RaftConsensus& consensus,
+                         Protocol::Raft::OpCode opCode,
+                         const Core::Buffer& request,
+                         Core::Buffer& response);
+
+    /**
+     * See Options.
+     */
+    const Options options;
+
+    /**
+     * Protects all of the following members.
+     */
+    mutable Core::Mutex mutex;
+
+    /**
+     * Notified when numActiveCalls drops to 0.
+     */
+    Core::ConditionVariable callsDone;
+
+    /**
+     * Source of jitter and loss.
+     */
+    std::mt19937_64 random;
+
+    /**
+     * Reachable servers, keyed by server ID.
+     */
+    std::unordered_map<uint64_t, RaftConsensus*> servers;
+
+    /**
+     * See setIsolated().
+     */
+    std::set<uint64_t> isolated;
+
+    /**
+     * For each (from, to) link, when it will have finished transmitting the
+     * last message scheduled on it.
+     */
+    std::map<std::pair<uint64_t, uint64_t>, TimePoint> linkBusyUntil;
+
+    /**
+     * Set by shutdown().
+     */
+    bool exiting;
+
+    /**
+     * The number of calls that have been admitted and not yet returned.
+     */
+    uint64_t numActiveCalls;
+
+    /**
+     * See getNumMessages().
+     */
+    uint64_t numMessages;
+
+    /**
+     * See getNumLost().
+     */
+    uint64_t numLost;
+};
+
+/**
+ * Runs a whole cluster of RaftConsensus and StateMachine instances in one
+ * process, connected by a SimulatedNetwork, so that replication throughput,
+ * commit latency, and election time can be measured on a single machine
+ * without any sockets. Each server has its own Globals and keeps its log in
+ * memory or in a temporary directory (which may be on tmpfs).
+ *
+ * The constructor bootstraps server 1, waits for it to become leader, and
+ * then adds the other servers to the configuration, so the cluster is ready
+ * for use once it returns. The measurements follow real time, so they are
+ * taken by SimulatedClusterBenchmark; the unit tests only check that the
+ * cluster works.
+ */
+class SimulatedCluster {
+  public:
+    typedef Core::Time::SteadyClock Clock;
+    typedef Clock::time_point TimePoint;
+
+    /**
+     * Describes the cluster to build.
+     */
+    struct Options {
+        /// Constructor: three servers on an instant network, with logs in
+        /// memory.
+        Options();
+        /**
+         * The number of servers, with IDs 1 through numServers.
+         */
+        uint64_t numServers;
+        /**
+         * The number of non-voting learners, with IDs following the voters'.
+         */
+        uint64_t numLearners;
+        /**
+         * Characteristics of the network between the servers.
+         */
+        SimulatedNetwork::Options network;
+        /**
+         * "Memory" for a MemoryLog, or "Segmented" for a SegmentedLog.
+         */
+        std::string storageModule;
+        /**
+         * For SegmentedLog, the directory in which a temporary directory is
+         * created for the servers' files, such as a tmpfs mount like
+         * /dev/shm.
+         */
+        std::string storagePath;
+        /**
+         * Passed to every server as electionTimeoutMilliseconds.
+         */
+        uint64_t electionTimeoutMilliseconds;
+        /**
+         * Passed to every server as heartbeatPeriodMilliseconds.
+         */
+        uint64_t heartbeatPeriodMilliseconds;
+        /**
+         * Other settings passed to every server's config.
+         */
+        std::map<std::string, std::string> config;
+    };
+
+    /**
+     * The results of measureReplication().
+     */
+    struct ReplicationResult {
+        /// Constructor.
+        ReplicationResult();
+        /**
+         * The number of entries that were committed.
+         */
+        uint64_t entries;
+        /**
+         * The number of entries that were rejected because leadership was
+         * lost.
+         */
+        uint64_t failures;
+        /**
+         * Time from the first entry being submitted to the last one
+         * committing.
+         */
+        std::chrono::nanoseconds elapsed;
+        /**
+         * Nanoseconds from submitting each entry to the leader until it
+         * committed.
+         */
+        Core::Histogram commitNanos;
+        /**
+         * The number of times the leader's peer threads woke up to look for
+         * work during the run (see Peer::numWakeups).
+         */
+        uint64_t peerWakeups;
+        /**
+         * Committed entries per second.
+         */
+        double entriesPerSecond() const;
+    };
+
+    /**
+     * Constructor. Builds the cluster and waits until it has a leader and all
+     * servers are in its configuration; PANICs if that takes over a minute.
+     */
+    explicit SimulatedCluster(const Options& options);
+
+    /**
+     * Destructor. Shuts down every server and removes their files.
+     */
+    ~SimulatedCluster();
+
+    /**
+     * Return the ID of the server that currently considers itself leader in
+     * the highest term, or 0 if there is none.
+     */
+    uint64_t getLeader() const;
+
+    /**
+     * Wait for some server to be leader.
+     * \param timeout
+     *      Give up at this time.
+     * \return
+     *      The leader's ID, or 0 on timeout.
+     */
+    uint64_t waitForLeader(TimePoint timeout) const;
+
+    /**
+     * Return the consensus module of the given server (from 1 to
+     * numServers + numLearners).
+     */
+    RaftConsensus& getRaft(uint64_t serverId);
+
+    /**
+     * Return the network connecting the servers.
+     */
+    SimulatedNetwork& getNetwork();
+
+    /**
+     * Commit a batch of tree writes through the current leader and measure
+     * how long they take.
+     * \param numWriters
+     *      The number of threads submitting entries concurrently; each waits
+     *      for its previous entry to commit before submitting the next.
+     * \param numEntries
+     *      The total number of entries to submit.
+     * \param valueSize
+     *      The size in bytes of the value each entry writes.
+     */
+    ReplicationResult measureReplication(uint64_t numWriters,
+                                         uint64_t numEntries,
+                                         uint64_t valueSize);
+
+    /**
+     * Isolate the current leader and measure how long the remaining servers
+     * take to elect a new one; then reconnect the old leader.
+     * \return
+     *      Time from isolating the leader until another server became
+     *      leader, or nanoseconds::max() if that didn't happen within a
+     *      minute.
+     */
+    std::chrono::nanoseconds measureElection();
+
+  private:
+    /**
+     * The objects making up one server.
+     */
+    struct Node {
+        /// Constructor.
+        Node();
+        /// Destructor.
+        ~Node();
+        std::unique_ptr<Globals> globals;
+        std::shared_ptr<RaftConsensus> raft;
+        std::shared_ptr<StateMachine> stateMachine;
+    };
+
+    /**
+     * Open a client session through the leader, for use in exactly-once
+     * tree writes.
+     * \return
+     *      The session's client ID, or 0 if leadership was lost.
+     */
+    uint64_t openSession(RaftConsensus& leader);
+
+    /**
+     * See Options.
+     */
+    const Options options;
+
+    /**
+     * Temporary directory holding every server's files, if any.
+     */
+    std::string storageDir;
+
+    /**
+     * Connects the servers.
+     */
+    SimulatedNetwork network;
+
+    /**
+     * Indexed by server ID minus 1.
+     */
+    std::vector<std::unique_ptr<Node>> nodes;
+};
+
+} // namespace LogCabin::Server
+} // namespace LogCabin
+
+#endif /* LOGCABIN_SERVER_SIMULATEDCLUSTER_H */
@@ -0,0 +1,378 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <getopt.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <iostream>
+#include <string>
+
+#include "Core/Debug.h"
+#include "Core/Histogram.h"
+#include "Core/StringUtil.h"
+#include "Core/ThreadId.h"
+#include "Core/Util.h"
+#include "Server/SimulatedCluster.h"
+
+/**
+ * \file
+ * Measures replication throughput, commit latency, and election time on a
+ * SimulatedCluster: a whole cluster running in this process over a
+ * simulated network. The results depend on real time and thread
+ * scheduling, which is why these measurements live here rather than in the
+ * unit tests.
+ */
+
+namespace {
+
+using namespace LogCabin;
+using Core::StringUtil::format;
+using Server::SimulatedCluster;
+
+/**
+ * Parses argv for the main function.
+ */
+class OptionParser {
+  public:
+    OptionParser(int& argc, char**& argv)
+        : argc(argc)
+        , argv(argv)
+        , cluster()
+        , writers(4)
+        , entries(10000)
+        , size(100)
+        , elections(10)
+        , logPolicy("WARNING")
+    {
+        while (true) {
+            static struct option longOptions[] = {
+               {"bandwidth",  required_argument, NULL, 'b'},
+               {"elections",  required_argument, NULL, 'e'},
+               {"entries",  required_argument, NULL, 'n'},
+               {"help",  no_argument, NULL, 'h'},
+               {"latency",  required_argument, NULL, 'l'},
+               {"learners",  required_argument, NULL, 'L'},
+               {"loss",  required_argument, NULL, 'x'},
+               {"path",  required_argument, NULL, 'p'},
+               {"seed",  required_argument, NULL, 'r'},
+               {"servers",  required_argument, NULL, 'c'},
+               {"set",  required_argument, NULL, 'o'},
+               {"size",  required_argument, NULL, 's'},
+               {"storage",  required_argument, NULL, 'm'},
+               {"verbosity",  required_argument, NULL, 'v'},
+               {"writers",  required_argument, NULL, 'w'},
+               {0, 0, 0, 0}
+            };
+            int c = getopt_long(argc, argv, "b:c:e:hl:L:m:n:o:p:r:s:v:w:x:",
+                                longOptions, NULL);
+
+            // Detect the end of the options.
+            if (c == -1)
+                break;
+
+            switch (c) {
+                case 'b':
+                    cluster.network.bytesPerSecond = uint64_t(atol(optarg));
+                    break;
+                case 'c':
+                    cluster.numServers = std::max(1UL,
+                                                  uint64_t(atol(optarg)));
+                    break;
+                case 'e':
+                    elections = uint64_t(atol(optarg));
+                    break;
+                case 'h':
+                    usage();
+                    exit(0);
+                case 'l':
+                    cluster.network.latency =
+                        std::chrono::microseconds(atol(optarg));
+                    break;
+                case 'L':
+                    cluster.numLearners = uint64_t(atol(optarg));
+                    break;
+                case 'm':
+                    cluster.storageModule = optarg;
+                    break;
+                case 'n':
+                    entries = uint64_t(atol(optarg));
+                    break;
+                case 'o': {
+                    std::string setting = optarg;
+                    size_t equals = setting.find('=');
+                    if (equals == std::string::npos) {
+                        std::cerr << "--set expects key=value, got "
+                                  << setting << std::endl;
+                        usage();
+                        exit(1);
+                    }
+                    cluster.config[setting.substr(0, equals)] =
+                        setting.substr(equals + 1);
+                    break;
+                }
+                case 'p':
+                    cluster.storagePath = optarg;
+                    break;
+                case 'r':
+                    cluster.network.seed = uint64_t(atol(optarg));
+                    break;
+                case 's':
+                    size = uint64_t(atol(optarg));
+                    break;
+                case 'v':
+                    logPolicy = optarg;
+                    break;
+                case 'w':
+                    writers = std::max(1UL, uint64_t(atol(optarg)));
+                    break;
+                case 'x':
+                    cluster.network.lossProbability = atof(optarg);
+                    break;
+                case '?':
+                default:
+                    // getopt_long already printed an error message.
+                    usage();
+                    exit(1);
+            }
+        }
+
+        // We don't expect any additional command line arguments (not options).
+        if (optind != argc) {
+            usage();
+            exit(1);
+        }
+    }
+
+    void usage() {
+        std::cout
+            << "Measures replication and elections on a cluster of LogCabin "
+            << "servers running"
+            << std::endl
+            << "in this process, connected by a simulated network."
+            << std::endl
+            << std::endl
+            << "This program is subject to change (it is not part of "
+            << "LogCabin's stable API)."
+            << std::endl
+            << std::endl
+
+            << "Usage: " << argv[0] << " [options]"
+            << std::endl
+            << std::endl
+
+            << "Options:"
+            << std::endl
+
+            << "  -b <bytes>, --bandwidth=<bytes>  "
+            << "Bytes per second on each link, or 0 for"
+            << std::endl
+            << "                               "
+            << "unlimited [default: 0]"
+            << std::endl
+
+            << "  -c <num>, --servers=<num>    "
+            << "Number of voting servers [default: 3]"
+            << std::endl
+
+            << "  -e <num>, --elections=<num>  "
+            << "Number of elections to measure [default: 10]"
+            << std::endl
+
+            << "  -h, --help                   "
+            << "Print this usage information"
+            << std::endl
+
+            << "  -l <us>, --latency=<us>      "
+            << "One-way network latency in microseconds"
+            << std::endl
+            << "                               "
+            << "[default: 0]"
+            << std::endl
+
+            << "  -L <num>, --learners=<num>   "
+            << "Number of non-voting learners [default: 0]"
+            << std::endl
+
+            << "  -m <name>, --storage=<name>  "
+            << "Storage module: Memory or Segmented"
+            << std::endl
+            << "                               "
+            << "[default: Memory]"
+            << std::endl
+
+            << "  -n <num>, --entries=<num>    "
+            << "Number of entries to replicate [default: 10000]"
+            << std::endl
+
+            << "  -o <key=value>, --set=<key=value>  "
+            << "Set another config option on every server"
+            << std::endl
+            << "                               "
+            << "(may be repeated)"
+            << std::endl
+
+            << "  -p <dir>, --path=<dir>       "
+            << "Directory in which Segmented logs are placed,"
+            << std::endl
+            << "                               "
+            << "such as /dev/shm [default: /tmp]"
+            << std::endl
+
+            << "  -r <num>, --seed=<num>       "
+            << "Seed for the network's loss and jitter"
+            << std::endl
+            << "                               "
+            << "[default: 0]"
+            << std::endl
+
+            << "  -s <bytes>, --size=<bytes>   "
+            << "Size of each entry's value [default: 100]"
+            << std::endl
+
+            << "  -v <policy>, --verbosity=<policy>  "
+            << "Set which log messages are shown"
+            << std::endl
+            << "                               "
+            << "[default: WARNING]"
+            << std::endl
+
+            << "  -w <num>, --writers=<num>    "
+            << "Number of concurrent writers [default: 4]"
+            << std::endl
+
+            << "  -x <prob>, --loss=<prob>     "
+            << "Probability that a message is dropped"
+            << std::endl
+            << "                               "
+            << "[default: 0]"
+            << std::endl;
+    }
+
+    int& argc;
+    char**& argv;
+    SimulatedCluster::Options cluster;
+    uint64_t writers;
+    uint64_t entries;
+    uint64_t size;
+    uint64_t elections;
+    std::string logPolicy;
+};
+
+/**
+ * Return the number of context switches this process has made so far.
+ */
+uint64_t
+getContextSwitches()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        PANIC("getrusage failed: %s", strerror(errno));
+    return uint64_t(usage.ru_nvcsw + usage.ru_nivcsw);
+}
+
+/**
+ * Print the given latency percentiles in microseconds.
+ */
+void
+printLatency(const std::string& name, const Core::Histogram& nanos)
+{
+    std::cout << format("%-12s %8lu %9.1f %9.1f %9.1f %9.1f",
+                        name.c_str(),
+                        nanos.getCount(),
+                        double(nanos.getPercentile(50)) / 1e3,
+                        double(nanos.getPercentile(99)) / 1e3,
+                        double(nanos.getPercentile(99.9)) / 1e3,
+                        double(nanos.getPercentile(100)) / 1e3)
+              << std::endl;
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char** argv)
+{
+    Core::Util::Finally _(google::protobuf::ShutdownProtobufLibrary);
+    Core::ThreadId::setName("main");
+
+    // Parse command line args.
+    OptionParser options(argc, argv);
+    Core::Debug::setLogPolicy(
+        Core::Debug::logPolicyFromString(options.logPolicy));
+
+    std::cout << format("%lu servers and %lu learners (%s logs), "
+                        "%lu us latency, %.3f loss",
+                        options.cluster.numServers,
+                        options.cluster.numLearners,
+                        options.cluster.storageModule.c_str(),
+                        uint64_t(std::chrono::duration_cast<
+                            std::chrono::microseconds>(
+                                options.cluster.network.latency).count()),
+                        options.cluster.network.lossProbability)
+              << std::endl;
+    SimulatedCluster cluster(options.cluster);
+
+    uint64_t startSwitches = getContextSwitches();
+    SimulatedCluster::ReplicationResult result =
+        cluster.measureReplication(options.writers,
+                                   options.entries,
+                                   options.size);
+    uint64_t switches = getContextSwitches() - startSwitches;
+    std::cout << format("Replicated %lu entries of %lu bytes with %lu "
+                        "writers in %.3f s: %.0f entries/s, %lu failed",
+                        result.entries,
+                        options.size,
+                        options.writers,
+                        double(result.elapsed.count()) / 1e9,
+                        result.entriesPerSecond(),
+                        result.failures)
+              << std::endl;
+    if (result.entries > 0) {
+        std::cout << format("Per entry: %.2f leader peer thread wakeups, "
+                            "%.2f context switches (all servers)",
+                            double(result.peerWakeups) /
+                                double(result.entries),
+                            double(switches) / double(result.entries))
+                  << std::endl;
+    }
+
+    Core::Histogram electionNanos;
+    uint64_t failedElections = 0;
+    for (uint64_t i = 0; i < options.elections; ++i) {
+        std::chrono::nanoseconds elapsed = cluster.measureElection();
+        if (elapsed == std::chrono::nanoseconds::max())
+            ++failedElections;
+        else
+            electionNanos.push(uint64_t(elapsed.count()));
+    }
+    if (failedElections > 0) {
+        std::cout << format("%lu elections found no new leader within a "
+                            "minute", failedElections)
+                  << std::endl;
+    }
+
+    std::cout << format("%-12s %8s %9s %9s %9s %9s",
+                        "latency", "count", "p50-us", "p99-us", "p999-us",
+                        "max-us")
+              << std::endl;
+    printLatency("commit", result.commitNanos);
+    if (electionNanos.getCount() > 0)
+        printLatency("election", electionNanos);
+    std::cout << format("%lu messages sent, %lu lost",
+                        cluster.getNetwork().getNumMessages(),
+                        cluster.getNetwork().getNumLost())
+              << std::endl;
+    return 0;
+}
@@ -0,0 +1,146 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "Server/RaftConsensus.h"
+#include "Server/SimulatedCluster.h"
+
+/**
+ * \file
+ * Short functional tests of the simulated cluster. Throughput, latency, and
+ * election measurements depend on real time and scheduling, so they are
+ * made by SimulatedClusterBenchmark instead.
+ */
+
+namespace LogCabin {
+namespace Server {
+namespace {
+
+typedef SimulatedCluster::Clock Clock;
+typedef SimulatedCluster::TimePoint TimePoint;
+
+/**
+ * Wait until every server's log is as long as the leader's.
+ */
+void
+waitForLogs(SimulatedCluster& cluster, uint64_t numServers)
+{
+    TimePoint timeout = Clock::now() + std::chrono::seconds(10);
+    uint64_t leaderId = cluster.getLeader();
+    ASSERT_NE(0U, leaderId);
+    uint64_t lastIndex = cluster.getRaft(leaderId).log->getLastLogIndex();
+    for (uint64_t id = 1; id <= numServers; ++id) {
+        while (cluster.getRaft(id).log->getLastLogIndex() < lastIndex &&
+               Clock::now() < timeout) {
+            Core::Time::sleep(std::chrono::milliseconds(1));
+        }
+        EXPECT_LE(lastIndex, cluster.getRaft(id).log->getLastLogIndex())
+            << "server " << id;
+    }
+}
+
+TEST(ServerSimulatedNetworkTest, transmit_bandwidth) {
+    SimulatedNetwork::Options options;
+    options.latency = std::chrono::milliseconds(5);
+    options.bytesPerSecond = 1000;
+    SimulatedNetwork network(options);
+    TimePoint start = Clock::now();
+    TimePoint arrival1;
+    TimePoint arrival2;
+    TimePoint arrival3;
+    EXPECT_TRUE(network.transmit(1, 2, 100, arrival1));
+    EXPECT_TRUE(network.transmit(1, 2, 100, arrival2));
+    EXPECT_TRUE(network.transmit(2, 1, 100, arrival3)); // separate link
+    EXPECT_LE(start + std::chrono::milliseconds(105), arrival1);
+    EXPECT_EQ(std::chrono::milliseconds(100), arrival2 - arrival1);
+    EXPECT_GT(arrival2, arrival3);
+    EXPECT_EQ(3U, network.getNumMessages());
+    EXPECT_EQ(0U, network.getNumLost());
+}
+
+TEST(ServerSimulatedNetworkTest, transmit_isolated) {
+    SimulatedNetwork network((SimulatedNetwork::Options()));
+    TimePoint arrival;
+    network.setIsolated(2, true);
+    EXPECT_FALSE(network.transmit(1, 2, 10, arrival));
+    EXPECT_FALSE(network.transmit(2, 3, 10, arrival));
+    EXPECT_TRUE(network.transmit(1, 3, 10, arrival));
+    network.setIsolated(2, false);
+    EXPECT_TRUE(network.transmit(1, 2, 10, arrival));
+    EXPECT_EQ(2U, network.getNumLost());
+}
+
+TEST(ServerSimulatedNetworkTest, call_unknownServer) {
+    SimulatedNetwork network((SimulatedNetwork::Options()));
+    Core::Buffer request;
+    Protocol::Raft::RequestVote::Response response;
+    EXPECT_FALSE(network.call(1, 2, Protocol::Raft::REQUEST_VOTE,
+                              request, response));
+    EXPECT_EQ(0U, network.getNumMessages());
+}
+
+TEST(ServerSimulatedClusterTest, measureReplication) {
+    SimulatedCluster::Options options;
+    SimulatedCluster cluster(options);
+    SimulatedCluster::ReplicationResult result =
+        cluster.measureReplication(4, 40, 100);
+    EXPECT_EQ(40U, result.entries);
+    EXPECT_EQ(0U, result.failures);
+    EXPECT_EQ(40U, result.commitNanos.getCount());
+    EXPECT_LT(0, result.entriesPerSecond());
+    waitForLogs(cluster, options.numServers);
+}
+
+TEST(ServerSimulatedClusterTest, measureReplication_segmentedLog) {
+    SimulatedCluster::Options options;
+    options.storageModule = "Segmented";
+    std::string storageDir;
+    {
+        SimulatedCluster cluster(options);
+        storageDir = cluster.storageDir;
+        EXPECT_EQ(0U, storageDir.find("/tmp/logcabin"));
+        SimulatedCluster::ReplicationResult result =
+            cluster.measureReplication(2, 20, 1000);
+        EXPECT_EQ(20U, result.entries);
+        waitForLogs(cluster, options.numServers);
+    }
+    EXPECT_NE(0, access(storageDir.c_str(), F_OK));
+}
+
+TEST(ServerSimulatedClusterTest, learners) {
+    SimulatedCluster::Options options;
+    options.numLearners = 2;
+    SimulatedCluster cluster(options);
+    uint64_t numNodes = options.numServers + options.numLearners;
+    SimulatedCluster::ReplicationResult result =
+        cluster.measureReplication(2, 20, 10);
+    EXPECT_EQ(20U, result.entries);
+    waitForLogs(cluster, numNodes);
+
+    // cut off the learners: commits don't depend on them
+    cluster.getNetwork().setIsolated(4, true);
+    cluster.getNetwork().setIsolated(5, true);
+    result = cluster.measureReplication(1, 10, 10);
+    EXPECT_EQ(10U, result.entries);
+    cluster.getNetwork().setIsolated(4, false);
+    cluster.getNetwork().setIsolated(5, false);
+    waitForLogs(cluster, numNodes);
+}
+
+} // namespace LogCabin::Server::<anonymous>
+} // namespace LogCabin::Server
+} // namespace LogCabin
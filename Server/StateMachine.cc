@@ -14,10 +14,13 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <algorithm>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unordered_set>
 
+#include "Core/Compression.h"
 #include "Core/Debug.h"
 #include "Core/Mutex.h"
 #include "Core/ProtoBuf.h"
@@ -55,6 +58,13 @@ StateMachine::StateMachine(std::shared_ptr<RaftConsensus> consensus,
             config.read<uint64_t>("snapshotRatio", 4))
     , snapshotWatchdogInterval(std::chrono::milliseconds(
             config.read<uint64_t>("snapshotWatchdogMilliseconds", 10000)))
+    , snapshotFormatVersion(Core::Util::downCast<uint8_t>(
+            config.read<uint64_t>("snapshotFormatVersion", 1)))
+    , snapshotLoadThreads(
+            config.read<uint32_t>("snapshotLoadThreads",
+                std::max(1U, std::thread::hardware_concurrency())))
+    , snapshotFullInterval(
+            std::max(1UL, config.read<uint64_t>("snapshotFullInterval", 8)))
       // TODO(ongaro): This should be configurable, but it must be the same for
       // every server, so it's dangerous to put it in the config file. Need to
       // use the Raft log to agree on this value. Also need to inform clients
@@ -85,13 +95,23 @@ StateMachine::StateMachine(std::shared_ptr<RaftConsensus> consensus,
     , isSnapshotRequested(false)
     , maySnapshotAt(TimePoint::min())
     , sessions()
+    , sessionsByLastModified()
+    , lastSessionCopy(0)
     , tree()
     , versionHistory()
     , writer()
+    , previousSnapshot()
+    , previousSnapshotSections()
+    , numSnapshotsSinceFull(0)
     , applyThread()
     , snapshotThread()
     , snapshotWatchdogThread()
 {
+    if (snapshotFormatVersion < 1 || snapshotFormatVersion > 3) {
+        PANIC("snapshotFormatVersion is %u, but this code can only write "
+              "versions 1 through 3",
+              snapshotFormatVersion);
+    }
     versionHistory.insert({0, 1});
     consensus->setSupportedStateMachineVersions(MIN_SUPPORTED_VERSION,
                                                 MAX_SUPPORTED_VERSION);
@@ -129,6 +149,7 @@ StateMachine::query(const Query::Request& request,
         Tree::ProtoBuf::readOnlyTreeRPC(tree,
                                         request.tree(),
                                         *response.mutable_tree());
+        response.set_applied_index(lastApplied);
         return true;
     }
     warnUnknownRequest(request, "does not understand the given request");
@@ -209,11 +230,19 @@ StateMachine::waitForResponse(uint64_t logIndex,
                 set_status(PC::Status::SESSION_EXPIRED);
             return true;
         }
-        response = responseIt->second;
+        const CachedResponse& cached = responseIt->second;
+        PC::ReadWriteTree::Response& treeResponse = *response.mutable_tree();
+        treeResponse.set_status(cached.status);
+        if (!cached.error.empty())
+            treeResponse.set_error(cached.error);
         return true;
     } else if (command.has_open_session()) {
-        response.mutable_open_session()->
-            set_client_id(logIndex);
+        if (consensus->groupId == 0) {
+            response.mutable_open_session()->
+                set_client_id(logIndex);
+        } else {
+            response.mutable_open_session()->set_client_id(0);
+        }
         return true;
     } else if (versionThen >= 2 && command.has_close_session()) {
         response.mutable_close_session(); // no fields to set
@@ -297,6 +326,30 @@ StateMachine::setInhibit(std::chrono::nanoseconds duration)
     snapshotSuggested.notify_all();
 }
 
+uint16_t
+StateMachine::getRunningVersion() const
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    return getVersion(lastApplied);
+}
+
+bool
+StateMachine::hasSession(uint64_t clientId) const
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    return sessions.find(clientId) != sessions.end();
+}
+
+uint64_t
+StateMachine::getOpenSessions(std::vector<uint64_t>& clientIds) const
+{
+    std::lock_guard<Core::Mutex> lockGuard(mutex);
+    clientIds.clear();
+    for (auto it = sessions.begin(); it != sessions.end(); ++it)
+        clientIds.push_back(it->first);
+    return lastApplied;
+}
+
 
 ////////// StateMachine private methods //////////
 
@@ -325,23 +378,44 @@ StateMachine::apply(const RaftConsensus::Entry& entry)
                                                 {rpcInfo.rpc_number(), {}});
                 if (inserted.second) {
                     // response not found, apply and save it
-                    Tree::ProtoBuf::readWriteTreeRPC(
-                        tree,
-                        command.tree(),
-                        *inserted.first->second.mutable_tree());
-                    session.lastModified = entry.clusterTime;
+                    PC::ReadWriteTree::Response treeResponse;
+                    if (runningVersion < 3 &&
+                        command.tree().has_import_directory()) {
+                        // Rejected in version < 3. ClientService turns
+                        // these away before replicating them, but the
+                        // version may have been lowered since.
+                        treeResponse.set_status(PC::Status::INVALID_ARGUMENT);
+                        treeResponse.set_error(
+                            "Importing directories requires state machine "
+                            "version 3");
+                    } else {
+                        Tree::ProtoBuf::readWriteTreeRPC(
+                            tree,
+                            command.tree(),
+                            treeResponse);
+                    }
+                    CachedResponse& cached = inserted.first->second;
+                    cached.status = treeResponse.status();
+                    if (treeResponse.has_error())
+                        cached.error = treeResponse.error();
+                    touchSession(session, entry.clusterTime);
                 } else {
                     // response exists, do not re-apply
                 }
             }
         }
     } else if (command.has_open_session()) {
-        uint64_t clientId = entry.index;
-        Session& session = sessions.insert({clientId, {}}).first->second;
-        session.lastModified = entry.clusterTime;
+        if (consensus->groupId == 0) {
+            addSession(entry.index, entry.clusterTime);
+        } else if (command.open_session().has_root_index()) {
+            copySessions(command.open_session(), entry.clusterTime);
+        } else {
+            warnUnknownRequest(command, "does not open sessions outside the "
+                               "root Raft group");
+        }
     } else if (command.has_close_session()) {
         if (runningVersion >= 2) {
-            sessions.erase(command.close_session().client_id());
+            removeSession(command.close_session().client_id());
         } else {
             // Command is ignored in version < 2.
             warnUnknownRequest(command, "may not process the given request, "
@@ -398,6 +472,10 @@ StateMachine::applyThreadMain()
                     break;
                 case RaftConsensus::Entry::DATA:
                     apply(entry);
+                    if (consensus->groupId == 0) {
+                        globals.entryTracer.note(EntryTracer::APPLIED,
+                                                 entry.index, entry.index);
+                    }
                     break;
                 case RaftConsensus::Entry::SNAPSHOT:
                     NOTICE("Loading snapshot through entry %lu into state "
@@ -406,7 +484,11 @@ StateMachine::applyThreadMain()
                     NOTICE("Done loading snapshot");
                     break;
             }
-            expireSessions(entry.clusterTime);
+            // Other groups remove sessions only when the root group does
+            // (see copySessions()): clients may use a session in one group
+            // for much longer than the timeout without touching the others.
+            if (consensus->groupId == 0)
+                expireSessions(entry.clusterTime);
             lastApplied = entry.index;
             entriesApplied.notify_all();
             if (shouldTakeSnapshot(lastApplied) &&
@@ -429,6 +511,8 @@ StateMachine::applyThreadMain()
 void
 StateMachine::serializeSessions(SnapshotStateMachine::Header& header) const
 {
+    if (lastSessionCopy > 0)
+        header.set_last_session_copy(lastSessionCopy);
     for (auto it = sessions.begin(); it != sessions.end(); ++it) {
         SnapshotStateMachine::Session& session = *header.add_session();
         session.set_client_id(it->first);
@@ -440,9 +524,87 @@ StateMachine::serializeSessions(SnapshotStateMachine::Header& header) const
             SnapshotStateMachine::Response& response =
                 *session.add_rpc_response();
             response.set_rpc_number(it2->first);
-            *response.mutable_response() = it2->second;
+            PC::ReadWriteTree::Response& treeResponse =
+                *response.mutable_response()->mutable_tree();
+            treeResponse.set_status(it2->second.status);
+            if (!it2->second.error.empty())
+                treeResponse.set_error(it2->second.error);
+        }
+    }
+}
+
+StateMachine::Session&
+StateMachine::addSession(uint64_t clientId, uint64_t clusterTime)
+{
+    auto inserted = sessions.insert({clientId, {}});
+    Session& session = inserted.first->second;
+    if (inserted.second) {
+        session.clientId = clientId;
+        session.expiryPosition = sessionsByLastModified.insert(
+                                        sessionsByLastModified.end(),
+                                        &session);
+    }
+    touchSession(session, clusterTime);
+    return session;
+}
+
+void
+StateMachine::copySessions(
+        const Protocol::Client::OpenSession::Request& request,
+        uint64_t clusterTime)
+{
+    // Reopening a session that the root group has removed would let a client
+    // retrying a command have it applied twice, so older lists are ignored.
+    if (request.root_index() <= lastSessionCopy) {
+        NOTICE("Ignoring copy of the root group's sessions as of index %lu, "
+               "which is older than the last one applied (%lu)",
+               request.root_index(), lastSessionCopy);
+        return;
+    }
+    std::unordered_set<uint64_t> open(request.client_ids().begin(),
+                                      request.client_ids().end());
+    std::vector<uint64_t> closed;
+    for (auto it = sessions.begin(); it != sessions.end(); ++it) {
+        if (open.find(it->first) == open.end())
+            closed.push_back(it->first);
+    }
+    for (auto it = closed.begin(); it != closed.end(); ++it)
+        removeSession(*it);
+    for (auto it = open.begin(); it != open.end(); ++it) {
+        if (sessions.find(*it) == sessions.end())
+            addSession(*it, clusterTime);
+    }
+    lastSessionCopy = request.root_index();
+}
+
+void
+StateMachine::touchSession(Session& session, uint64_t clusterTime)
+{
+    session.lastModified = clusterTime;
+    // Move the session to the back, stepping in front of any sessions that
+    // were modified later (if cluster time ever went backwards).
+    auto position = sessionsByLastModified.end();
+    while (position != sessionsByLastModified.begin()) {
+        auto previous = std::prev(position);
+        if (previous != session.expiryPosition &&
+            (*previous)->lastModified <= clusterTime) {
+            break;
         }
+        position = previous;
     }
+    sessionsByLastModified.splice(position,
+                                  sessionsByLastModified,
+                                  session.expiryPosition);
+}
+
+void
+StateMachine::removeSession(uint64_t clientId)
+{
+    auto it = sessions.find(clientId);
+    if (it == sessions.end())
+        return;
+    sessionsByLastModified.erase(it->second.expiryPosition);
+    sessions.erase(it);
 }
 
 void
@@ -451,33 +613,26 @@ StateMachine::expireResponses(Session& session, uint64_t firstOutstandingRPC)
     if (session.firstOutstandingRPC >= firstOutstandingRPC)
         return;
     session.firstOutstandingRPC = firstOutstandingRPC;
-    auto it = session.responses.begin();
-    while (it != session.responses.end()) {
-        if (it->first < session.firstOutstandingRPC)
-            it = session.responses.erase(it);
-        else
-            ++it;
-    }
+    session.responses.erase(
+        session.responses.begin(),
+        session.responses.lower_bound(session.firstOutstandingRPC));
 }
 
 void
 StateMachine::expireSessions(uint64_t clusterTime)
 {
-    auto it = sessions.begin();
-    while (it != sessions.end()) {
-        Session& session = it->second;
+    while (!sessionsByLastModified.empty()) {
+        Session& session = *sessionsByLastModified.front();
         uint64_t expireTime = session.lastModified + sessionTimeoutNanos;
-        if (expireTime < clusterTime) {
-            uint64_t diffNanos = clusterTime - session.lastModified;
-            NOTICE("Expiring client %lu's session after %lu.%09lu seconds "
-                   "of cluster time due to inactivity",
-                   it->first,
-                   diffNanos / (1000 * 1000 * 1000UL),
-                   diffNanos % (1000 * 1000 * 1000UL));
-            it = sessions.erase(it);
-        } else {
-            ++it;
-        }
+        if (expireTime >= clusterTime)
+            break;
+        uint64_t diffNanos = clusterTime - session.lastModified;
+        NOTICE("Expiring client %lu's session after %lu.%09lu seconds "
+               "of cluster time due to inactivity",
+               session.clientId,
+               diffNanos / (1000 * 1000 * 1000UL),
+               diffNanos % (1000 * 1000 * 1000UL));
+        removeSession(session.clientId);
     }
 }
 
@@ -508,17 +663,35 @@ void
 StateMachine::loadSessions(const SnapshotStateMachine::Header& header)
 {
     sessions.clear();
+    sessionsByLastModified.clear();
+    lastSessionCopy = header.last_session_copy();
+    // Add the sessions oldest first, so that each one goes straight to the
+    // back of sessionsByLastModified.
+    std::vector<const SnapshotStateMachine::Session*> byLastModified;
     for (auto it = header.session().begin();
          it != header.session().end();
          ++it) {
-        Session& session = sessions.insert({it->client_id(), {}})
-                                                        .first->second;
-        session.lastModified = it->last_modified();
-        session.firstOutstandingRPC = it->first_outstanding_rpc();
-        for (auto it2 = it->rpc_response().begin();
-             it2 != it->rpc_response().end();
+        byLastModified.push_back(&*it);
+    }
+    std::stable_sort(byLastModified.begin(), byLastModified.end(),
+                     [](const SnapshotStateMachine::Session* a,
+                        const SnapshotStateMachine::Session* b) {
+                         return a->last_modified() < b->last_modified();
+                     });
+    for (auto it = byLastModified.begin(); it != byLastModified.end(); ++it) {
+        const SnapshotStateMachine::Session& saved = **it;
+        Session& session = addSession(saved.client_id(),
+                                      saved.last_modified());
+        session.firstOutstandingRPC = saved.first_outstanding_rpc();
+        for (auto it2 = saved.rpc_response().begin();
+             it2 != saved.rpc_response().end();
              ++it2) {
-            session.responses.insert({it2->rpc_number(), it2->response()});
+            const PC::ReadWriteTree::Response& treeResponse =
+                it2->response().tree();
+            CachedResponse& cached = session.responses[it2->rpc_number()];
+            cached.status = treeResponse.status();
+            if (treeResponse.has_error())
+                cached.error = treeResponse.error();
         }
     }
 }
@@ -526,22 +699,36 @@ StateMachine::loadSessions(const SnapshotStateMachine::Header& header)
 void
 StateMachine::loadSnapshot(Core::ProtoBuf::InputStream& stream)
 {
-    // Check that this snapshot uses format version 1
+    // Check that this snapshot uses format version 1, 2, or 3
     uint8_t formatVersion = 0;
     uint64_t bytesRead = stream.readRaw(&formatVersion, sizeof(formatVersion));
     if (bytesRead < sizeof(formatVersion)) {
         PANIC("Snapshot contents are empty (no format version field)");
     }
-    if (formatVersion != 1) {
+    if (formatVersion < 1 || formatVersion > 3) {
         PANIC("Snapshot contents format version read was %u, but this "
-              "code can only read version 1",
+              "code can only read versions 1 through 3",
               formatVersion);
     }
 
+    // The sections of an earlier snapshot are of no use with a new tree.
+    previousSnapshot.reset();
+    previousSnapshotSections = Tree::Internal::SnapshotSections();
+    numSnapshotsSinceFull = 0;
+
+    // Version 3 is version 2 wrapped in a compressed container.
+    Core::ProtoBuf::InputStream* contents = &stream;
+    std::unique_ptr<Core::Compression::CompressedInputStream> decompressor;
+    if (formatVersion == 3) {
+        decompressor.reset(
+            new Core::Compression::CompressedInputStream(stream));
+        contents = decompressor.get();
+    }
+
     // Load snapshot header
     {
         SnapshotStateMachine::Header header;
-        std::string error = stream.readMessage(header);
+        std::string error = contents->readMessage(header);
         if (!error.empty()) {
             PANIC("Couldn't read state machine header from snapshot: %s",
                   error.c_str());
@@ -551,7 +738,10 @@ StateMachine::loadSnapshot(Core::ProtoBuf::InputStream& stream)
     }
 
     // Load the tree's state
-    tree.loadSnapshot(stream);
+    if (formatVersion == 1)
+        tree.loadSnapshot(*contents);
+    else
+        tree.loadSnapshotSections(*contents, snapshotLoadThreads);
 }
 
 void
@@ -719,6 +909,27 @@ StateMachine::snapshotWatchdogThreadMain()
 }
 
 
+void
+StateMachine::indexSnapshot(uint64_t contentsOffset,
+                            uint64_t modificationCount)
+{
+    previousSnapshot = writer->mapContents();
+    uint64_t length = previousSnapshot->getFileLength() - contentsOffset;
+    Core::ProtoBuf::MemoryInputStream stream(
+        previousSnapshot->get<char>(contentsOffset, length), length);
+    stream.skip(sizeof(snapshotFormatVersion));
+    SnapshotStateMachine::Header header;
+    std::string error = stream.readMessage(header);
+    if (!error.empty()) {
+        PANIC("Couldn't read back snapshot header: %s", error.c_str());
+    }
+    previousSnapshotSections = Tree::Tree::indexSnapshotSections(
+        previousSnapshot->get<char>(contentsOffset + stream.getBytesRead(),
+                                    stream.getBytesRemaining()),
+        stream.getBytesRemaining(),
+        modificationCount);
+}
+
 void
 StateMachine::takeSnapshot(uint64_t lastIncludedIndex,
                            std::unique_lock<Core::Mutex>& lockGuard)
@@ -731,6 +942,17 @@ StateMachine::takeSnapshot(uint64_t lastIncludedIndex,
     // aren't somehow double-flushed later.
     writer->flushToOS();
 
+    // Decide whether the child may copy unchanged sections of the tree from
+    // the previous snapshot, and note what's needed to index this one. The
+    // copied sections are still written into the new file in full, which
+    // must stand alone: it replaces the previous snapshot and is sent whole
+    // to followers through InstallSnapshot.
+    uint64_t contentsOffset = writer->getBytesWritten();
+    uint64_t modificationCount = tree.getModificationCount();
+    bool incremental = (snapshotFormatVersion == 2 &&
+                        previousSnapshot &&
+                        numSnapshotsSinceFull + 1 < snapshotFullInterval);
+
     ++numSnapshotsAttempted;
     snapshotStarted.notify_all();
 
@@ -751,18 +973,37 @@ StateMachine::takeSnapshot(uint64_t lastIncludedIndex,
             }
         }
 
-        // Format version of snapshot contents is 1.
-        uint8_t formatVersion = 1;
-        writer->writeRaw(&formatVersion, sizeof(formatVersion));
+        // Format version of snapshot contents comes first.
+        writer->writeRaw(&snapshotFormatVersion,
+                         sizeof(snapshotFormatVersion));
+        // Everything else passes through the compressor for version 3.
+        Core::ProtoBuf::OutputStream* contents = writer.get();
+        std::unique_ptr<Core::Compression::CompressedOutputStream> compressor;
+        if (snapshotFormatVersion == 3) {
+            compressor.reset(
+                new Core::Compression::CompressedOutputStream(*writer));
+            contents = compressor.get();
+        }
         // StateMachine state comes next
         {
             SnapshotStateMachine::Header header;
             serializeVersionHistory(header);
             serializeSessions(header);
-            writer->writeMessage(header);
+            contents->writeMessage(header);
         }
         // Then the Tree itself (this one is potentially large)
-        tree.dumpSnapshot(*writer);
+        if (snapshotFormatVersion == 1) {
+            tree.dumpSnapshot(*contents);
+        } else if (incremental) {
+            uint64_t numCopied = tree.dumpSnapshotSections(
+                *contents, &previousSnapshotSections);
+            NOTICE("Copied %lu unchanged sections of the tree from the "
+                   "previous snapshot", numCopied);
+        } else {
+            tree.dumpSnapshotSections(*contents);
+        }
+        if (compressor)
+            compressor->finish();
 
         // Flush the changes to the snapshot file before exiting.
         writer->flushToOS();
@@ -784,6 +1025,13 @@ StateMachine::takeSnapshot(uint64_t lastIncludedIndex,
             NOTICE("Child completed writing state machine contents to "
                    "snapshot staging file");
             writer->seekToEnd();
+            if (snapshotFormatVersion == 2) {
+                indexSnapshot(contentsOffset, modificationCount);
+                if (incremental)
+                    ++numSnapshotsSinceFull;
+                else
+                    numSnapshotsSinceFull = 0;
+            }
             consensus->snapshotDone(lastIncludedIndex, std::move(writer));
         } else if (exiting &&
                    WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM) {
@@ -14,6 +14,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
@@ -25,6 +27,7 @@
 #include "Core/Config.h"
 #include "Core/Mutex.h"
 #include "Core/Time.h"
+#include "Storage/FilesystemUtil.h"
 #include "Tree/Tree.h"
 
 #ifndef LOGCABIN_SERVER_STATEMACHINE_H
@@ -61,7 +64,7 @@ class StateMachine {
          * This state machine code can behave like all versions between
          * MIN_SUPPORTED_VERSION and MAX_SUPPORTED_VERSION, inclusive.
          */
-        MAX_SUPPORTED_VERSION = 2,
+        MAX_SUPPORTED_VERSION = 3,
     };
 
 
@@ -143,6 +146,30 @@ class StateMachine {
      */
     void setInhibit(std::chrono::nanoseconds duration);
 
+    /**
+     * Return the version of the state machine as of the last entry applied.
+     * Called by ClientService to reject commands that this version can't
+     * apply before replicating them.
+     */
+    uint16_t getRunningVersion() const;
+
+    /**
+     * Return whether a session is open, as of the last entry applied.
+     * ClientService uses this in Raft groups other than the root group to
+     * find sessions that haven't been copied into them yet.
+     */
+    bool hasSession(uint64_t clientId) const;
+
+    /**
+     * List the sessions that are open as of the last entry applied.
+     * ClientService uses this in the root Raft group to copy its sessions
+     * into the other groups.
+     * \param[out] clientIds
+     *      Set to the client IDs of the open sessions.
+     * \return
+     *      The index of the last entry applied.
+     */
+    uint64_t getOpenSessions(std::vector<uint64_t>& clientIds) const;
 
   private:
     // forward declaration
@@ -169,6 +196,40 @@ class StateMachine {
      */
     void serializeSessions(SnapshotStateMachine::Header& header) const;
 
+    /**
+     * Create a new session, or return the existing one, and mark it as
+     * modified at the given time.
+     * \param clientId
+     *      Identifies the session.
+     * \param clusterTime
+     *      The session's new #Session::lastModified time.
+     */
+    Session& addSession(uint64_t clientId, uint64_t clusterTime);
+
+    /**
+     * In a Raft group other than the root group, apply a list of the root
+     * group's open sessions: open the listed sessions that this group lacks
+     * and close the ones it has that aren't listed. Does nothing if the list
+     * is older than #lastSessionCopy.
+     * \param request
+     *      The list, as sent by ClientService.
+     * \param clusterTime
+     *      The #Session::lastModified time for newly opened sessions.
+     */
+    void copySessions(const Protocol::Client::OpenSession::Request& request,
+                      uint64_t clusterTime);
+
+    /**
+     * Set a session's #Session::lastModified time, keeping
+     * #sessionsByLastModified in order.
+     */
+    void touchSession(Session& session, uint64_t clusterTime);
+
+    /**
+     * Remove a session, if it exists.
+     */
+    void removeSession(uint64_t clientId);
+
     /**
      * Update the session and clean up unnecessary responses.
      * \param session
@@ -179,7 +240,8 @@ class StateMachine {
     void expireResponses(Session& session, uint64_t firstOutstandingRPC);
 
     /**
-     * Remove old sessions.
+     * Remove old sessions. This only looks at the sessions it removes (plus
+     * one), so it's cheap to call after every entry.
      * \param clusterTime
      *      Sessions are kept if they have been modified during the last
      *      timeout period going backwards from the given time.
@@ -241,6 +303,17 @@ class StateMachine {
      */
     void snapshotWatchdogThreadMain();
 
+    /**
+     * Called by takeSnapshot after the child has written a version 2
+     * snapshot, to set #previousSnapshot and #previousSnapshotSections.
+     * \param contentsOffset
+     *      The offset in the snapshot file at which the state machine's
+     *      contents begin.
+     * \param modificationCount
+     *      The value of Tree::getModificationCount() when the child forked.
+     */
+    void indexSnapshot(uint64_t contentsOffset, uint64_t modificationCount);
+
     /**
      * Called by snapshotThreadMain to actually take the snapshot.
      */
@@ -297,6 +370,31 @@ class StateMachine {
      */
     std::chrono::nanoseconds snapshotWatchdogInterval;
 
+    /**
+     * The format version of the snapshot contents written by takeSnapshot().
+     * Version 1 is a single recursive dump of the tree; version 2 splits the
+     * tree into sections that can be decoded in parallel; version 3 is
+     * version 2 passed through a Core::Compression::CompressedOutputStream.
+     * Servers running older code can only read version 1, so that is the
+     * default.
+     */
+    uint8_t snapshotFormatVersion;
+
+    /**
+     * The maximum number of threads loadSnapshot() uses to decode the tree
+     * from a version 2 or 3 snapshot.
+     */
+    uint32_t snapshotLoadThreads;
+
+    /**
+     * When writing version 2 snapshots, every this many snapshots serializes
+     * the entire tree; the ones in between copy the encoded sections of
+     * unchanged directories from the previous snapshot. That saves encoding
+     * work only: each snapshot is still written out in full. A value of 1
+     * disables copying sections. Ignored for format versions 1 and 3.
+     */
+    uint64_t snapshotFullInterval;
+
     /**
      * The time interval after which to remove an inactive client session, in
      * nanoseconds of cluster time.
@@ -444,17 +542,40 @@ class StateMachine {
      */
     TimePoint maySnapshotAt;
 
+    /**
+     * The response to a read-write tree RPC, as cached in a Session. This is
+     * much smaller than a Protocol::Client::StateMachineCommand::Response:
+     * these responses carry only a status and, rarely, an error message.
+     */
+    struct CachedResponse {
+        CachedResponse()
+            : status(Protocol::Client::Status::OK)
+            , error()
+        {
+        }
+        /// See Protocol::Client::ReadWriteTree::Response::status.
+        Protocol::Client::Status status;
+        /// See Protocol::Client::ReadWriteTree::Response::error.
+        std::string error;
+    };
+
     /**
      * Tracks state for a particular client.
      * Used to prevent duplicate processing of duplicate RPCs.
      */
     struct Session {
         Session()
-            : lastModified(0)
+            : clientId(0)
+            , lastModified(0)
             , firstOutstandingRPC(0)
             , responses()
+            , expiryPosition()
         {
         }
+        /**
+         * The key for this session in #sessions.
+         */
+        uint64_t clientId;
         /**
          * When the session was last active, measured in cluster time
          * (roughly the number of nanoseconds that the cluster has maintained a
@@ -470,16 +591,36 @@ class StateMachine {
          * Responses for RPCs numbered less that firstOutstandingRPC are
          * discarded from this map.
          */
-        std::unordered_map<uint64_t,
-                           Protocol::Client::StateMachineCommand::Response>
-            responses;
+        std::map<uint64_t, CachedResponse> responses;
+        /**
+         * This session's entry in #sessionsByLastModified.
+         */
+        std::list<Session*>::iterator expiryPosition;
     };
 
     /**
-     * Client ID to Session map.
+     * Client ID to Session map. Sessions must be added with addSession() and
+     * removed with removeSession().
      */
     std::unordered_map<uint64_t, Session> sessions;
 
+    /**
+     * Every session in #sessions, ordered by lastModified (oldest first), so
+     * that expireSessions() only needs to look at the front. Since cluster
+     * time does not go backwards, a touched session almost always moves to
+     * the back in constant time.
+     */
+    std::list<Session*> sessionsByLastModified;
+
+    /**
+     * In a Raft group other than the root group, the root group's log index
+     * as of which this group's sessions were last copied from it (see
+     * copySessions()). Only the root group closes and expires sessions, so
+     * copies older than this are ignored rather than bringing back a session
+     * that the root group has since removed.
+     */
+    uint64_t lastSessionCopy;
+
     /**
      * The hierarchical key-value store. Used in readOnlyTreeRPC and
      * readWriteTreeRPC.
@@ -507,6 +648,26 @@ class StateMachine {
      */
     std::unique_ptr<Storage::SnapshotFile::Writer> writer;
 
+    /**
+     * The contents of the last snapshot this server wrote in format version
+     * 2, mapped into memory so that the next snapshot can copy sections from
+     * it. Empty if there is no such snapshot or if a snapshot has been loaded
+     * since. This keeps the file's storage allocated even after the file is
+     * replaced by a newer snapshot.
+     */
+    std::unique_ptr<Storage::FilesystemUtil::FileContents> previousSnapshot;
+
+    /**
+     * Where the tree's sections are found in #previousSnapshot.
+     */
+    Tree::Internal::SnapshotSections previousSnapshotSections;
+
+    /**
+     * The number of incremental snapshots written since the last snapshot
+     * that serialized the entire tree. See #snapshotFullInterval.
+     */
+    uint64_t numSnapshotsSinceFull;
+
     /**
      * Repeatedly calls into the consensus module to get commands to process
      * and applies them.
@@ -64,6 +64,8 @@ class ServerStateMachineTest : public ::testing::Test {
         consensus->startNewElection();
         consensus->configuration->localServer->lastSyncedIndex =
             consensus->log->getLastLogIndex();
+        consensus->configuration->updateMatchIndex(
+            *consensus->configuration->localServer);
         consensus->advanceCommitIndex();
 
         stateMachineSuppressThreads = true;
@@ -151,12 +153,14 @@ TEST_F(ServerStateMachineTest, waitForResponse_wait)
 TEST_F(ServerStateMachineTest, waitForResponse_tree)
 {
     Core::Debug::setLogPolicy({{"Server/StateMachine.cc", "ERROR"}});
-    stateMachine->sessions.insert({1, {}});
+    stateMachine->addSession(1, 0);
     StateMachine::Session& session = stateMachine->sessions.at(1);
     StateMachine::Command::Response r1;
     StateMachine::Command::Response r2;
     r1.mutable_tree()->set_status(Protocol::Client::Status::LOOKUP_ERROR);
-    session.responses.insert({1, r1});
+    r1.mutable_tree()->set_error("no such file");
+    session.responses[1].status = Protocol::Client::Status::LOOKUP_ERROR;
+    session.responses[1].error = "no such file";
 
     StateMachine::Command::Request request;
     auto& exactlyOnce = *request.mutable_tree()->mutable_exactly_once();
@@ -194,6 +198,22 @@ TEST_F(ServerStateMachineTest, waitForResponse_openSession)
               response);
 }
 
+TEST_F(ServerStateMachineTest, waitForResponse_openSession_copy)
+{
+    consensus->groupId = 2;
+    StateMachine::Command::Request request;
+    request.mutable_open_session()->set_raft_group(2);
+    request.mutable_open_session()->set_root_index(39);
+    request.mutable_open_session()->add_client_ids(39);
+    StateMachine::Command::Response response;
+    stateMachine->lastApplied = 3;
+    EXPECT_TRUE(stateMachine->waitForResponse(3, request, response));
+    EXPECT_EQ("open_session { "
+              "  client_id: 0 "
+              "}",
+              response);
+}
+
 TEST_F(ServerStateMachineTest, waitForResponse_closeSession)
 {
     stateMachine->lastApplied = 3;
@@ -382,6 +402,15 @@ TEST_F(ServerStateMachineTest, setInhibit)
     EXPECT_LT(0U, stateMachine->snapshotSuggested.notificationCount);
 }
 
+TEST_F(ServerStateMachineTest, getRunningVersion)
+{
+    stateMachine->versionHistory.insert({5, 3});
+    stateMachine->lastApplied = 4;
+    EXPECT_EQ(1U, stateMachine->getRunningVersion());
+    stateMachine->lastApplied = 5;
+    EXPECT_EQ(3U, stateMachine->getRunningVersion());
+}
+
 TEST_F(ServerStateMachineTest, apply_tree)
 {
     stateMachine->sessionTimeoutNanos = 1;
@@ -405,7 +434,7 @@ TEST_F(ServerStateMachineTest, apply_tree)
     std::vector<std::string> children;
 
     // session does not exist
-    stateMachine->sessions.insert({1, {}});
+    stateMachine->addSession(1, 0);
     stateMachine->apply(entry);
     stateMachine->expireSessions(entry.clusterTime);
     stateMachine->tree.listDirectory("/", children);
@@ -413,8 +442,8 @@ TEST_F(ServerStateMachineTest, apply_tree)
     ASSERT_EQ(0U, stateMachine->sessions.size());
 
     // session exists and need to apply
-    stateMachine->sessions.insert({1, {}});
-    stateMachine->sessions.insert({39, {}});
+    stateMachine->addSession(1, 0);
+    stateMachine->addSession(39, 0);
     stateMachine->apply(entry);
     stateMachine->expireSessions(entry.clusterTime);
     stateMachine->tree.listDirectory("/", children);
@@ -423,7 +452,7 @@ TEST_F(ServerStateMachineTest, apply_tree)
     EXPECT_EQ(2U, stateMachine->sessions.at(39).lastModified);
 
     // session exists and response exists
-    stateMachine->sessions.insert({1, {}});
+    stateMachine->addSession(1, 0);
     stateMachine->tree.removeDirectory("/a");
     stateMachine->apply(entry);
     stateMachine->expireSessions(entry.clusterTime);
@@ -433,7 +462,7 @@ TEST_F(ServerStateMachineTest, apply_tree)
     EXPECT_EQ(2U, stateMachine->sessions.at(39).lastModified);
 
     // session exists but response discarded
-    stateMachine->sessions.insert({1, {}});
+    stateMachine->addSession(1, 0);
     stateMachine->expireResponses(stateMachine->sessions.at(39), 4);
     stateMachine->apply(entry);
     stateMachine->expireSessions(entry.clusterTime);
@@ -443,10 +472,154 @@ TEST_F(ServerStateMachineTest, apply_tree)
     EXPECT_EQ(2U, stateMachine->sessions.at(39).lastModified);
 }
 
+TEST_F(ServerStateMachineTest, apply_tree_importDirectory)
+{
+    Tree::Tree source;
+    source.write("/b", "bb");
+    std::string contents;
+    source.exportDirectory("/", contents);
+    RaftConsensus::Entry entry;
+    entry.index = 6;
+    entry.type = RaftConsensus::Entry::DATA;
+    entry.clusterTime = 2;
+    StateMachine::Command::Request command =
+        Core::ProtoBuf::fromString<StateMachine::Command::Request>(
+            "tree: { "
+            " exactly_once: { "
+            "  client_id: 39 "
+            "  first_outstanding_rpc: 2 "
+            "  rpc_number: 3 "
+            " } "
+            " import_directory { "
+            "  path: '/a' "
+            "  contents: '' "
+            " } "
+            "}");
+    command.mutable_tree()->mutable_import_directory()->
+        set_contents(contents);
+    entry.command = serialize(command);
+    stateMachine->addSession(39, 0);
+    std::vector<std::string> children;
+
+    // rejected before version 3
+    stateMachine->apply(entry);
+    const StateMachine::CachedResponse& rejected =
+        stateMachine->sessions.at(39).responses.at(3);
+    EXPECT_EQ(Protocol::Client::Status::INVALID_ARGUMENT, rejected.status);
+    EXPECT_EQ("Importing directories requires state machine version 3",
+              rejected.error);
+    stateMachine->tree.listDirectory("/", children);
+    EXPECT_EQ((std::vector<std::string> {}), children);
+
+    // applied from version 3 on
+    stateMachine->versionHistory.insert({5, 3});
+    command.mutable_tree()->mutable_exactly_once()->set_rpc_number(4);
+    entry.command = serialize(command);
+    stateMachine->apply(entry);
+    EXPECT_EQ(Protocol::Client::Status::OK,
+              stateMachine->sessions.at(39).responses.at(4).status);
+    stateMachine->tree.listDirectory("/a", children);
+    EXPECT_EQ((std::vector<std::string> {"b"}), children);
+}
+
+TEST_F(ServerStateMachineTest, apply_tree_unknownSession)
+{
+    Core::Debug::setLogPolicy({{"Server/StateMachine.cc", "ERROR"}});
+    consensus->groupId = 2;
+    RaftConsensus::Entry entry;
+    entry.index = 6;
+    entry.type = RaftConsensus::Entry::DATA;
+    entry.clusterTime = 2;
+    StateMachine::Command::Request command =
+        Core::ProtoBuf::fromString<StateMachine::Command::Request>(
+            "tree: { "
+            " exactly_once: { "
+            "  client_id: 39 "
+            "  first_outstanding_rpc: 2 "
+            "  rpc_number: 3 "
+            " } "
+            " make_directory { "
+            "  path: '/a' "
+            " } "
+            "}");
+    entry.command = serialize(command);
+    stateMachine->apply(entry);
+    std::vector<std::string> children;
+    stateMachine->tree.listDirectory("/", children);
+    EXPECT_EQ((std::vector<std::string> {}), children);
+    EXPECT_EQ(0U, stateMachine->sessions.size());
+    StateMachine::Command::Response response;
+    EXPECT_TRUE(stateMachine->waitForResponse(0, command, response));
+    EXPECT_EQ("tree { "
+              "  status: SESSION_EXPIRED "
+              "}", response);
+}
+
+TEST_F(ServerStateMachineTest, apply_tree_retryAfterExpiry)
+{
+    Core::Debug::setLogPolicy({{"Server/StateMachine.cc", "ERROR"}});
+    consensus->groupId = 2;
+    RaftConsensus::Entry entry;
+    entry.type = RaftConsensus::Entry::DATA;
+    entry.clusterTime = 2;
+    StateMachine::Command::Request openSession =
+        Core::ProtoBuf::fromString<StateMachine::Command::Request>(
+            "open_session: { raft_group: 2 root_index: 39 client_ids: 39 }");
+    StateMachine::Command::Request command =
+        Core::ProtoBuf::fromString<StateMachine::Command::Request>(
+            "tree: { "
+            " exactly_once: { "
+            "  client_id: 39 "
+            "  first_outstanding_rpc: 2 "
+            "  rpc_number: 3 "
+            " } "
+            " make_directory { "
+            "  path: '/a' "
+            " } "
+            "}");
+
+    entry.index = 6;
+    entry.command = serialize(openSession);
+    stateMachine->apply(entry);
+    entry.index = 7;
+    entry.command = serialize(command);
+    stateMachine->apply(entry);
+    ASSERT_EQ(1U, stateMachine->sessions.at(39).responses.count(3));
+
+    // the root group expires the session
+    entry.index = 8;
+    entry.command = serialize(
+        Core::ProtoBuf::fromString<StateMachine::Command::Request>(
+            "open_session: { raft_group: 2 root_index: 50 }"));
+    stateMachine->apply(entry);
+    EXPECT_EQ(0U, stateMachine->sessions.size());
+    stateMachine->tree.removeDirectory("/a");
+
+    // The client's retry must not be applied a second time.
+    entry.index = 9;
+    entry.clusterTime = 10;
+    entry.command = serialize(command);
+    stateMachine->apply(entry);
+    std::vector<std::string> children;
+    stateMachine->tree.listDirectory("/", children);
+    EXPECT_EQ((std::vector<std::string> {}), children);
+    StateMachine::Command::Response response;
+    EXPECT_TRUE(stateMachine->waitForResponse(0, command, response));
+    EXPECT_EQ("tree { "
+              "  status: SESSION_EXPIRED "
+              "}", response);
+
+    // Nor may a late copy of the session bring it back.
+    entry.index = 10;
+    entry.command = serialize(openSession);
+    stateMachine->apply(entry);
+    EXPECT_EQ(0U, stateMachine->sessions.size());
+}
+
 TEST_F(ServerStateMachineTest, apply_openSession)
 {
     stateMachine->sessionTimeoutNanos = 1;
-    stateMachine->sessions.insert({1, {}});
+    stateMachine->addSession(1, 0);
     StateMachine::Command::Request command =
         Core::ProtoBuf::fromString<StateMachine::Command::Request>(
             "open_session: {}");
@@ -467,11 +640,65 @@ TEST_F(ServerStateMachineTest, apply_openSession)
     EXPECT_EQ(0U, session.responses.size());
 }
 
+TEST_F(ServerStateMachineTest, apply_openSession_copy)
+{
+    consensus->groupId = 2;
+    RaftConsensus::Entry entry;
+    entry.type = RaftConsensus::Entry::DATA;
+    entry.clusterTime = 2;
+
+    entry.index = 6;
+    entry.command = serialize(
+        Core::ProtoBuf::fromString<StateMachine::Command::Request>(
+            "open_session: { raft_group: 2 root_index: 39 "
+            "                client_ids: [38, 39] }"));
+    stateMachine->apply(entry);
+    EXPECT_EQ((std::vector<uint64_t>{38U, 39U}),
+              Core::STLUtil::sorted(
+                  Core::STLUtil::getKeys(stateMachine->sessions)));
+    EXPECT_EQ(39U, stateMachine->lastSessionCopy);
+    stateMachine->sessions.at(39).firstOutstandingRPC = 5;
+
+    // sessions missing from newer copies are closed, existing ones are kept
+    entry.index = 7;
+    entry.command = serialize(
+        Core::ProtoBuf::fromString<StateMachine::Command::Request>(
+            "open_session: { raft_group: 2 root_index: 41 "
+            "                client_ids: [39, 41] }"));
+    stateMachine->apply(entry);
+    EXPECT_EQ((std::vector<uint64_t>{39U, 41U}),
+              Core::STLUtil::sorted(
+                  Core::STLUtil::getKeys(stateMachine->sessions)));
+    EXPECT_EQ(5U, stateMachine->sessions.at(39).firstOutstandingRPC);
+    EXPECT_EQ(41U, stateMachine->lastSessionCopy);
+
+    // older copies are ignored
+    entry.index = 8;
+    entry.command = serialize(
+        Core::ProtoBuf::fromString<StateMachine::Command::Request>(
+            "open_session: { raft_group: 2 root_index: 40 "
+            "                client_ids: [38, 39] }"));
+    stateMachine->apply(entry);
+    EXPECT_EQ((std::vector<uint64_t>{39U, 41U}),
+              Core::STLUtil::sorted(
+                  Core::STLUtil::getKeys(stateMachine->sessions)));
+    EXPECT_EQ(41U, stateMachine->lastSessionCopy);
+
+    // sessions are only opened in the root group
+    Core::Debug::setLogPolicy({{"Server/StateMachine.cc", "ERROR"}});
+    entry.index = 9;
+    entry.command = serialize(
+        Core::ProtoBuf::fromString<StateMachine::Command::Request>(
+            "open_session: {}"));
+    stateMachine->apply(entry);
+    EXPECT_EQ(2U, stateMachine->sessions.size());
+}
+
 TEST_F(ServerStateMachineTest, apply_closeSession)
 {
-    stateMachine->sessions.insert({2, {}});
-    stateMachine->sessions.insert({3, {}});
-    stateMachine->sessions.insert({4, {}});
+    stateMachine->addSession(2, 0);
+    stateMachine->addSession(3, 0);
+    stateMachine->addSession(4, 0);
     StateMachine::Command::Request command;
     command.mutable_close_session()->set_client_id(3);
 
@@ -593,6 +820,58 @@ TEST_F(ServerStateMachineTest, applyThreadMain_exiting_TimingSensitive)
     EXPECT_EQ(0U, consensus->lastSnapshotIndex);
 }
 
+// Only the root group expires sessions, so a client that idles past the
+// session timeout can still write to another group.
+TEST_F(ServerStateMachineTest, applyThreadMain_idleSessionInOtherGroup)
+{
+    consensus->groupId = 2;
+    stateMachine->sessionTimeoutNanos = 1000;
+    std::vector<std::string> commands = {
+        "open_session: { raft_group: 2 root_index: 40 "
+        "                client_ids: [39, 40] }",
+        "tree: { exactly_once: { client_id: 40 first_outstanding_rpc: 1 "
+        "                       rpc_number: 1 } "
+        "        make_directory { path: '/a' } }",
+        "tree: { exactly_once: { client_id: 40 first_outstanding_rpc: 1 "
+        "                       rpc_number: 2 } "
+        "        make_directory { path: '/b' } }",
+        "tree: { exactly_once: { client_id: 39 first_outstanding_rpc: 1 "
+        "                       rpc_number: 1 } "
+        "        make_directory { path: '/c' } }",
+    };
+    std::vector<uint64_t> clusterTimes = {10, 20, 5000, 6000};
+    for (size_t i = 0; i < commands.size(); ++i) {
+        Storage::Log::Entry entry;
+        entry.set_term(1);
+        entry.set_type(Protocol::Raft::EntryType::DATA);
+        entry.set_cluster_time(clusterTimes.at(i));
+        entry.set_data(
+            Core::ProtoBuf::fromString<StateMachine::Command::Request>(
+                commands.at(i)).SerializeAsString());
+        consensus->append({&entry});
+    }
+    uint64_t lastIndex = consensus->log->getLastLogIndex();
+    consensus->configuration->localServer->lastSyncedIndex = lastIndex;
+    consensus->configuration->updateMatchIndex(
+        *consensus->configuration->localServer);
+    consensus->advanceCommitIndex();
+
+    stateMachine->applyThread = std::thread(&StateMachine::applyThreadMain,
+                                            stateMachine.get());
+    stateMachine->wait(lastIndex);
+    consensus->exit();
+    stateMachine->applyThread.join();
+
+    EXPECT_EQ((std::vector<uint64_t>{39U, 40U}),
+              Core::STLUtil::sorted(
+                  Core::STLUtil::getKeys(stateMachine->sessions)));
+    EXPECT_EQ(Protocol::Client::Status::OK,
+              stateMachine->sessions.at(39).responses.at(1).status);
+    std::vector<std::string> children;
+    stateMachine->tree.listDirectory("/", children);
+    EXPECT_EQ((std::vector<std::string> {"a/", "b/", "c/"}), children);
+}
+
 TEST_F(ServerStateMachineTest, serializeSessions)
 {
     StateMachine::Command::Response r1;
@@ -601,31 +880,37 @@ TEST_F(ServerStateMachineTest, serializeSessions)
     StateMachine::Command::Response r2;
     r2.mutable_tree()->set_status(Protocol::Client::Status::TYPE_ERROR);
 
-    StateMachine::Session s1;
-    s1.lastModified = 6;
+    StateMachine::CachedResponse c1;
+    c1.status = Protocol::Client::Status::LOOKUP_ERROR;
+    StateMachine::CachedResponse c2;
+    c2.status = Protocol::Client::Status::TYPE_ERROR;
+
+    StateMachine::Session& s1 = stateMachine->addSession(4, 6);
     s1.firstOutstandingRPC = 5;
-    s1.responses.insert({5, r1});
-    s1.responses.insert({7, r2});
-    stateMachine->sessions.insert({4, s1});
+    s1.responses.insert({5, c1});
+    s1.responses.insert({7, c2});
 
-    StateMachine::Session s2;
+    StateMachine::Session& s2 = stateMachine->addSession(80, 0);
     s2.firstOutstandingRPC = 9;
-    s2.responses.insert({10, r2});
-    s2.responses.insert({11, r1});
-    stateMachine->sessions.insert({80, s2});
+    s2.responses.insert({10, c2});
+    s2.responses.insert({11, c1});
 
-    StateMachine::Session s3;
+    StateMachine::Session& s3 = stateMachine->addSession(91, 3);
     s3.firstOutstandingRPC = 6;
-    stateMachine->sessions.insert({91, s3});
+
+    stateMachine->lastSessionCopy = 91;
 
     SnapshotStateMachine::Header header;
     stateMachine->serializeSessions(header);
 
-    stateMachine->sessions.at(80).responses.at(10) = r1;
+    stateMachine->sessions.at(80).responses.at(10) = c1;
     stateMachine->sessions.at(80).firstOutstandingRPC = 10;
+    stateMachine->lastSessionCopy = 0;
 
     stateMachine->loadSessions(header);
 
+    EXPECT_EQ(91U, stateMachine->lastSessionCopy);
+
     EXPECT_EQ((std::vector<std::uint64_t>{4, 80, 91}),
               Core::STLUtil::sorted(
                 Core::STLUtil::getKeys(stateMachine->sessions)));
@@ -637,14 +922,18 @@ TEST_F(ServerStateMachineTest, serializeSessions)
               Core::STLUtil::sorted(
                 Core::STLUtil::getKeys(
                     stateMachine->sessions.at(4).responses)));
-    EXPECT_EQ(r1, stateMachine->sessions.at(4).responses.at(5));
-    EXPECT_EQ(r2, stateMachine->sessions.at(4).responses.at(7));
+    EXPECT_EQ(c1.status,
+              stateMachine->sessions.at(4).responses.at(5).status);
+    EXPECT_EQ(c2.status,
+              stateMachine->sessions.at(4).responses.at(7).status);
     EXPECT_EQ((std::vector<std::uint64_t>{10, 11}),
               Core::STLUtil::sorted(
                 Core::STLUtil::getKeys(
                     stateMachine->sessions.at(80).responses)));
-    EXPECT_EQ(r2, stateMachine->sessions.at(80).responses.at(10));
-    EXPECT_EQ(r1, stateMachine->sessions.at(80).responses.at(11));
+    EXPECT_EQ(c2.status,
+              stateMachine->sessions.at(80).responses.at(10).status);
+    EXPECT_EQ(c1.status,
+              stateMachine->sessions.at(80).responses.at(11).status);
     EXPECT_EQ((std::vector<std::uint64_t>{}),
               Core::STLUtil::sorted(
                 Core::STLUtil::getKeys(
@@ -671,7 +960,7 @@ TEST_F(ServerStateMachineTest, serializeVersionHistory)
 
 TEST_F(ServerStateMachineTest, expireResponses)
 {
-    stateMachine->sessions.insert({1, {}});
+    stateMachine->addSession(1, 0);
     StateMachine::Session& session = stateMachine->sessions.at(1);
     session.responses.insert({1, {}});
     session.responses.insert({2, {}});
@@ -688,19 +977,35 @@ TEST_F(ServerStateMachineTest, expireResponses)
 TEST_F(ServerStateMachineTest, expireSessions)
 {
     stateMachine->sessionTimeoutNanos = 1;
-    stateMachine->sessions.insert({1, {}});
-    stateMachine->sessions.at(1).lastModified = 100;
-    stateMachine->sessions.insert({2, {}});
-    stateMachine->sessions.at(2).lastModified = 400;
-    stateMachine->sessions.insert({3, {}});
-    stateMachine->sessions.at(3).lastModified = 200;
-    stateMachine->sessions.insert({4, {}});
-    stateMachine->sessions.at(4).lastModified = 201;
-    stateMachine->sessions.insert({5, {}});
+    stateMachine->addSession(1, 100);
+    stateMachine->addSession(2, 400);
+    stateMachine->addSession(3, 200);
+    stateMachine->addSession(4, 201);
+    stateMachine->addSession(5, 0);
     stateMachine->expireSessions(202);
     EXPECT_EQ((std::vector<uint64_t>{2U, 4U}),
               Core::STLUtil::sorted(
                   Core::STLUtil::getKeys(stateMachine->sessions)));
+    EXPECT_EQ(2U, stateMachine->sessionsByLastModified.size());
+}
+
+TEST_F(ServerStateMachineTest, touchSession)
+{
+    StateMachine::Session& s1 = stateMachine->addSession(1, 100);
+    StateMachine::Session& s2 = stateMachine->addSession(2, 200);
+    StateMachine::Session& s3 = stateMachine->addSession(3, 50);
+    EXPECT_EQ((std::list<StateMachine::Session*>{&s3, &s1, &s2}),
+              stateMachine->sessionsByLastModified);
+    stateMachine->touchSession(s1, 300);
+    EXPECT_EQ((std::list<StateMachine::Session*>{&s3, &s2, &s1}),
+              stateMachine->sessionsByLastModified);
+    stateMachine->touchSession(s1, 150);
+    EXPECT_EQ((std::list<StateMachine::Session*>{&s3, &s1, &s2}),
+              stateMachine->sessionsByLastModified);
+    stateMachine->removeSession(1);
+    stateMachine->removeSession(1);
+    EXPECT_EQ((std::list<StateMachine::Session*>{&s3, &s2}),
+              stateMachine->sessionsByLastModified);
 }
 
 TEST_F(ServerStateMachineTest, getVersion)
@@ -741,13 +1046,13 @@ TEST_F(ServerStateMachineTest, loadSnapshot_unknownFormatVersion)
 {
     std::unique_ptr<Storage::SnapshotFile::Writer> writer =
         consensus->beginSnapshot(1);
-    uint8_t formatVersion = 2;
+    uint8_t formatVersion = 4;
     writer->writeRaw(&formatVersion, sizeof(formatVersion));
     writer->save();
     consensus->readSnapshot();
     EXPECT_DEATH(stateMachine->loadSnapshot(*consensus->snapshotReader),
-                 "Snapshot contents format version read was 2, but this code "
-                 "can only read version 1");
+                 "Snapshot contents format version read was 4, but this code "
+                 "can only read versions 1 through 3");
 }
 
 // loadVersionHistory normal path tested along with serializeVersionHistory
@@ -755,12 +1060,12 @@ TEST_F(ServerStateMachineTest, loadSnapshot_unknownFormatVersion)
 
 TEST_F(ServerStateMachineTest, loadVersionHistory_unknownVersion)
 {
-    stateMachine->versionHistory.insert({1, 3});
+    stateMachine->versionHistory.insert({1, 4});
     SnapshotStateMachine::Header header;
     stateMachine->serializeVersionHistory(header);
     EXPECT_DEATH(stateMachine->loadVersionHistory(header),
-                 "State machine version read from snapshot was 3, but this "
-                 "code only supports 1 through 2");
+                 "State machine version read from snapshot was 4, but this "
+                 "code only supports 1 through 3");
 }
 
 struct SnapshotThreadMainHelper {
@@ -928,7 +1233,7 @@ TEST_F(ServerStateMachineTest, takeSnapshot)
 {
     EXPECT_EQ(0U, consensus->lastSnapshotIndex);
     stateMachine->tree.makeDirectory("/foo");
-    stateMachine->sessions.insert({4, {}});
+    stateMachine->addSession(4, 0);
     {
         std::unique_lock<Core::Mutex> lockGuard(stateMachine->mutex);
         stateMachine->takeSnapshot(1, lockGuard);
@@ -947,6 +1252,89 @@ TEST_F(ServerStateMachineTest, takeSnapshot)
                   Core::STLUtil::getKeys(stateMachine->sessions)));
 }
 
+TEST_F(ServerStateMachineTest, takeSnapshot_formatVersion1)
+{
+    stateMachine->snapshotFormatVersion = 1;
+    stateMachine->tree.makeDirectory("/foo");
+    {
+        std::unique_lock<Core::Mutex> lockGuard(stateMachine->mutex);
+        stateMachine->takeSnapshot(1, lockGuard);
+    }
+    stateMachine->tree.removeDirectory("/foo");
+    consensus->discardUnneededEntries();
+    consensus->readSnapshot();
+    uint8_t formatVersion = 0;
+    consensus->snapshotReader->readRaw(&formatVersion, 1);
+    EXPECT_EQ(1U, formatVersion);
+    consensus->readSnapshot();
+    stateMachine->loadSnapshot(*consensus->snapshotReader);
+    std::vector<std::string> children;
+    stateMachine->tree.listDirectory("/", children);
+    EXPECT_EQ((std::vector<std::string>{"foo/"}), children);
+}
+
+TEST_F(ServerStateMachineTest, takeSnapshot_incremental)
+{
+    stateMachine->snapshotFormatVersion = 2;
+    stateMachine->snapshotFullInterval = 3;
+    stateMachine->tree.makeDirectory("/a");
+    stateMachine->tree.makeDirectory("/b");
+    stateMachine->tree.write("/b/y", "unchanged");
+    std::vector<uint64_t> sinceFull;
+    for (uint64_t i = 0; i < 4; ++i) {
+        Storage::Log::Entry entry;
+        entry.set_term(1);
+        entry.set_type(Protocol::Raft::EntryType::NOOP);
+        consensus->append({&entry});
+        consensus->commitIndex = consensus->log->getLastLogIndex();
+        stateMachine->tree.write("/a/x", Core::StringUtil::toString(i));
+        {
+            std::unique_lock<Core::Mutex> lockGuard(stateMachine->mutex);
+            stateMachine->takeSnapshot(consensus->commitIndex, lockGuard);
+        }
+        sinceFull.push_back(stateMachine->numSnapshotsSinceFull);
+        EXPECT_EQ(2U, stateMachine->previousSnapshotSections.sections.size());
+    }
+    EXPECT_EQ((std::vector<uint64_t>{0, 1, 2, 0}), sinceFull);
+
+    stateMachine->tree.removeDirectory("/");
+    consensus->readSnapshot();
+    stateMachine->loadSnapshot(*consensus->snapshotReader);
+    EXPECT_FALSE(stateMachine->previousSnapshot);
+    std::string contents;
+    stateMachine->tree.read("/a/x", contents);
+    EXPECT_EQ("3", contents);
+    stateMachine->tree.read("/b/y", contents);
+    EXPECT_EQ("unchanged", contents);
+}
+
+TEST_F(ServerStateMachineTest, takeSnapshot_formatVersion3)
+{
+    stateMachine->snapshotFormatVersion = 3;
+    stateMachine->tree.makeDirectory("/foo");
+    stateMachine->tree.write("/bar", std::string(100000, 'x'));
+    {
+        std::unique_lock<Core::Mutex> lockGuard(stateMachine->mutex);
+        stateMachine->takeSnapshot(1, lockGuard);
+    }
+    stateMachine->tree.removeDirectory("/foo");
+    stateMachine->tree.removeFile("/bar");
+    consensus->discardUnneededEntries();
+    consensus->readSnapshot();
+    uint8_t formatVersion = 0;
+    consensus->snapshotReader->readRaw(&formatVersion, 1);
+    EXPECT_EQ(3U, formatVersion);
+    EXPECT_GT(10000U, consensus->snapshotReader->getSizeBytes());
+    consensus->readSnapshot();
+    stateMachine->loadSnapshot(*consensus->snapshotReader);
+    std::vector<std::string> children;
+    stateMachine->tree.listDirectory("/", children);
+    EXPECT_EQ((std::vector<std::string>{"foo/", "bar"}), children);
+    std::string contents;
+    stateMachine->tree.read("/bar", contents);
+    EXPECT_EQ(std::string(100000, 'x'), contents);
+}
+
 } // namespace LogCabin::Server::<anonymous>
 } // namespace LogCabin::Server
 } // namespace LogCabin
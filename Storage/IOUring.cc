@@ -0,0 +1,231 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Core/Debug.h"
+#include "Core/StringUtil.h"
+#include "Storage/IOUring.h"
+
+namespace LogCabin {
+namespace Storage {
+
+namespace {
+
+int
+sysSetup(uint32_t entries, struct io_uring_params* params)
+{
+    return int(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int
+sysEnter(int fd, uint32_t toSubmit, uint32_t minComplete, uint32_t flags)
+{
+    return int(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+                         flags, NULL, 0));
+}
+
+int
+sysRegister(int fd, uint32_t opcode, void* arg, uint32_t nrArgs)
+{
+    return int(::syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+/// Return a pointer 'offset' bytes into 'base'.
+template<typename T>
+T*
+at(void* base, uint32_t offset)
+{
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+} // anonymous namespace
+
+IOUring::IOUring()
+    : mutex()
+    , fd(-1)
+    , params()
+    , sqRing(MAP_FAILED)
+    , sqRingSize(0)
+    , cqRing(MAP_FAILED)
+    , cqRingSize(0)
+    , sqes(NULL)
+    , sqesSize(0)
+    , sqHead(NULL)
+    , sqTail(NULL)
+    , sqMask(NULL)
+    , sqArray(NULL)
+    , cqHead(NULL)
+    , cqTail(NULL)
+    , cqMask(NULL)
+    , cqes(NULL)
+    , sqEntries(0)
+    , localSQTail(0)
+    , toSubmit(0)
+    , supportedOps()
+{
+}
+
+std::unique_ptr<IOUring>
+IOUring::create(uint32_t entries, std::string& error)
+{
+    std::unique_ptr<IOUring> ring(new IOUring());
+    memset(&ring->params, 0, sizeof(ring->params));
+    ring->fd = sysSetup(entries, &ring->params);
+    if (ring->fd < 0) {
+        error = Core::StringUtil::format("io_uring_setup failed: %s",
+                                         strerror(errno));
+        return NULL;
+    }
+    const struct io_uring_params& p = ring->params;
+    // Writes are appended at each file's current offset, and the rings must
+    // be mappable in one piece; both are available since Linux 5.6.
+    if (!(p.features & IORING_FEAT_RW_CUR_POS) ||
+        !(p.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(p.features & IORING_FEAT_NODROP)) {
+        error = Core::StringUtil::format(
+            "io_uring lacks required features (have 0x%x)", p.features);
+        return NULL;
+    }
+
+    // Ask which operations this kernel implements, since the features above
+    // say nothing about opcodes added later (such as RENAMEAT in 5.11).
+    const uint32_t maxOps = 256;
+    std::vector<uint64_t> probeBuffer(
+        (sizeof(struct io_uring_probe) +
+         maxOps * sizeof(struct io_uring_probe_op) +
+         sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    struct io_uring_probe* probe =
+        reinterpret_cast<struct io_uring_probe*>(probeBuffer.data());
+    if (sysRegister(ring->fd, IORING_REGISTER_PROBE, probe, maxOps) < 0) {
+        error = Core::StringUtil::format("io_uring probe failed: %s",
+                                         strerror(errno));
+        return NULL;
+    }
+    for (uint32_t i = 0; i < probe->ops_len; ++i) {
+        if (probe->ops[i].flags & IO_URING_OP_SUPPORTED)
+            ring->supportedOps.set(probe->ops[i].op);
+    }
+    if (!ring->isSupported(IORING_OP_WRITE) ||
+        !ring->isSupported(IORING_OP_FSYNC) ||
+        !ring->isSupported(IORING_OP_CLOSE)) {
+        error = "io_uring lacks the write, fsync, or close operation";
+        return NULL;
+    }
+
+    ring->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring->cqRingSize = p.cq_off.cqes +
+                       p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqRingSize = std::max(ring->sqRingSize, ring->cqRingSize);
+    ring->sqRing = mmap(NULL, ring->sqRingSize,
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        error = Core::StringUtil::format("mmap of io_uring failed: %s",
+                                         strerror(errno));
+        return NULL;
+    }
+    ring->cqRing = ring->sqRing;
+    ring->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, ring->sqesSize,
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        error = Core::StringUtil::format("mmap of io_uring failed: %s",
+                                         strerror(errno));
+        return NULL;
+    }
+    ring->sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+    ring->sqHead = at<uint32_t>(ring->sqRing, p.sq_off.head);
+    ring->sqTail = at<uint32_t>(ring->sqRing, p.sq_off.tail);
+    ring->sqMask = at<uint32_t>(ring->sqRing, p.sq_off.ring_mask);
+    ring->sqArray = at<uint32_t>(ring->sqRing, p.sq_off.array);
+    ring->cqHead = at<uint32_t>(ring->cqRing, p.cq_off.head);
+    ring->cqTail = at<uint32_t>(ring->cqRing, p.cq_off.tail);
+    ring->cqMask = at<uint32_t>(ring->cqRing, p.cq_off.ring_mask);
+    ring->cqes = at<struct io_uring_cqe>(ring->cqRing, p.cq_off.cqes);
+    ring->sqEntries = p.sq_entries;
+    ring->localSQTail = *ring->sqTail;
+    return ring;
+}
+
+IOUring::~IOUring()
+{
+    if (sqes != NULL)
+        munmap(sqes, sqesSize);
+    if (sqRing != MAP_FAILED)
+        munmap(sqRing, sqRingSize);
+    if (fd >= 0)
+        ::close(fd);
+}
+
+struct io_uring_sqe*
+IOUring::getSQE()
+{
+    uint32_t head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (localSQTail - head >= sqEntries)
+        return NULL;
+    uint32_t index = localSQTail & *sqMask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    ++localSQTail;
+    ++toSubmit;
+    return sqe;
+}
+
+void
+IOUring::submitAndWait(uint32_t waitFor)
+{
+    // Publish the new entries to the kernel.
+    __atomic_store_n(sqTail, localSQTail, __ATOMIC_RELEASE);
+    while (toSubmit > 0 || waitFor > 0) {
+        int r = sysEnter(fd, toSubmit, waitFor,
+                         waitFor > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            PANIC("io_uring_enter failed: %s", strerror(errno));
+        }
+        toSubmit -= std::min(toSubmit, uint32_t(r));
+        uint32_t ready = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) -
+                         *cqHead;
+        if (ready >= waitFor)
+            waitFor = 0;
+    }
+}
+
+bool
+IOUring::popCompletion(uint64_t& userData, int32_t& result)
+{
+    uint32_t head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+        return false;
+    const struct io_uring_cqe& cqe = cqes[head & *cqMask];
+    userData = cqe.user_data;
+    result = cqe.res;
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+} // namespace LogCabin::Storage
+} // namespace LogCabin
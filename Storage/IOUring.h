@@ -0,0 +1,162 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <bitset>
+#include <cinttypes>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <linux/io_uring.h>
+
+#ifndef LOGCABIN_STORAGE_IOURING_H
+#define LOGCABIN_STORAGE_IOURING_H
+
+namespace LogCabin {
+namespace Storage {
+
+/**
+ * A minimal wrapper around a Linux io_uring instance: a submission queue
+ * shared with the kernel where requests are placed, and a completion queue
+ * where their results come back. This lets a batch of filesystem operations
+ * be handed to the kernel with a single system call (and, using
+ * IOSQE_IO_LINK, be executed strictly in order).
+ *
+ * This talks to the kernel directly (it does not depend on liburing). It is
+ * not thread-safe; callers must hold #mutex from preparing a batch until all
+ * of its completions have been reaped.
+ */
+class IOUring {
+  public:
+    /**
+     * Set up a new io_uring.
+     * \param entries
+     *      The minimum size of the submission queue (the kernel rounds this
+     *      up to a power of two). This bounds the number of operations in
+     *      a single batch.
+     * \param[out] error
+     *      If this returns NULL, set to a description of why.
+     * \return
+     *      The new io_uring, or NULL if the kernel does not support io_uring
+     *      (or lacks features this class needs, including the write, fsync,
+     *      and close operations).
+     */
+    static std::unique_ptr<IOUring> create(uint32_t entries,
+                                           std::string& error);
+
+    /**
+     * Destructor. Any operations that were submitted but not yet reaped are
+     * left to complete in the kernel.
+     */
+    ~IOUring();
+
+    /**
+     * Return the number of operations that fit in the submission queue.
+     */
+    uint32_t getCapacity() const { return sqEntries; }
+
+    /**
+     * Return true if the kernel implements the given operation (one of the
+     * IORING_OP_ constants). Operations were added over several kernel
+     * releases: RENAMEAT and UNLINKAT, for example, need Linux 5.11.
+     */
+    bool isSupported(uint8_t opcode) const { return supportedOps[opcode]; }
+
+    /**
+     * Return a zeroed submission queue entry for the caller to fill in, or
+     * NULL if the submission queue is full. The entry is handed to the
+     * kernel on the next call to submitAndWait().
+     */
+    struct io_uring_sqe* getSQE();
+
+    /**
+     * Submit all entries returned by getSQE() since the last call, then
+     * wait until at least the given number of completions are available.
+     * PANICs on errors.
+     * \param waitFor
+     *      The number of completions to wait for (may be 0).
+     */
+    void submitAndWait(uint32_t waitFor);
+
+    /**
+     * Remove one completion from the completion queue, if one is available.
+     * \param[out] userData
+     *      The user_data field of the corresponding submission queue entry.
+     * \param[out] result
+     *      The operation's result: what the equivalent system call would
+     *      have returned, or the negated errno on failure.
+     * \return
+     *      True if a completion was returned; false if there was none.
+     */
+    bool popCompletion(uint64_t& userData, int32_t& result);
+
+    /**
+     * Serializes users of this io_uring; see class comment.
+     */
+    std::mutex mutex;
+
+  private:
+    /// Use create() instead.
+    IOUring();
+
+    /// The file descriptor returned by io_uring_setup.
+    int fd;
+    /// Parameters filled in by the kernel in io_uring_setup.
+    struct io_uring_params params;
+
+    /// The mapping holding the submission queue ring.
+    void* sqRing;
+    /// The size of #sqRing.
+    size_t sqRingSize;
+    /// The mapping holding the completion queue ring, which may be the same
+    /// as #sqRing.
+    void* cqRing;
+    /// The size of #cqRing.
+    size_t cqRingSize;
+    /// The mapping holding the submission queue entries.
+    struct io_uring_sqe* sqes;
+    /// The size of #sqes in bytes.
+    size_t sqesSize;
+
+    /// Pointers into #sqRing.
+    uint32_t* sqHead;
+    uint32_t* sqTail;
+    uint32_t* sqMask;
+    uint32_t* sqArray;
+    /// Pointers into #cqRing.
+    uint32_t* cqHead;
+    uint32_t* cqTail;
+    uint32_t* cqMask;
+    struct io_uring_cqe* cqes;
+
+    /// The number of entries in the submission queue.
+    uint32_t sqEntries;
+    /// The tail of the submission queue as seen by this process, including
+    /// entries returned by getSQE() but not yet submitted.
+    uint32_t localSQTail;
+    /// The number of entries returned by getSQE() since the last submit.
+    uint32_t toSubmit;
+    /// Which operations the kernel implements, indexed by opcode.
+    std::bitset<256> supportedOps;
+
+    // IOUring is non-copyable.
+    IOUring(const IOUring&) = delete;
+    IOUring& operator=(const IOUring&) = delete;
+};
+
+} // namespace LogCabin::Storage
+} // namespace LogCabin
+
+#endif /* LOGCABIN_STORAGE_IOURING_H */
@@ -0,0 +1,112 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+
+#include "Core/Debug.h"
+#include "Storage/FilesystemUtil.h"
+#include "Storage/IOUring.h"
+
+namespace LogCabin {
+namespace Storage {
+namespace {
+
+namespace FS = FilesystemUtil;
+
+class StorageIOUringTest : public ::testing::Test {
+    StorageIOUringTest()
+        : tmpdir()
+        , ring()
+    {
+        std::string path = FS::mkdtemp();
+        tmpdir = FS::openDir(path);
+        std::string error;
+        ring = IOUring::create(4, error);
+        if (!ring)
+            WARNING("io_uring is not available: %s", error.c_str());
+    }
+    ~StorageIOUringTest()
+    {
+        FS::remove(tmpdir.path);
+    }
+    FS::File tmpdir;
+    std::unique_ptr<IOUring> ring;
+};
+
+TEST_F(StorageIOUringTest, getSQE_full) {
+    if (!ring)
+        return;
+    EXPECT_EQ(4U, ring->getCapacity());
+    for (uint32_t i = 0; i < 4; ++i)
+        ASSERT_TRUE(ring->getSQE() != NULL);
+    EXPECT_TRUE(ring->getSQE() == NULL);
+    ring->submitAndWait(4);
+    uint64_t userData;
+    int32_t result;
+    for (uint32_t i = 0; i < 4; ++i) {
+        ASSERT_TRUE(ring->popCompletion(userData, result));
+        EXPECT_EQ(0, result); // NOPs
+    }
+    EXPECT_FALSE(ring->popCompletion(userData, result));
+    EXPECT_TRUE(ring->getSQE() != NULL);
+}
+
+TEST_F(StorageIOUringTest, isSupported) {
+    if (!ring)
+        return;
+    EXPECT_TRUE(ring->isSupported(IORING_OP_NOP));
+    EXPECT_TRUE(ring->isSupported(IORING_OP_WRITE));
+    EXPECT_FALSE(ring->isSupported(255));
+}
+
+TEST_F(StorageIOUringTest, linkedWrites) {
+    if (!ring)
+        return;
+    FS::File file = FS::openFile(tmpdir, "f", O_CREAT|O_WRONLY);
+    const char* data[] = {"hello ", "world"};
+    struct io_uring_sqe* prev = NULL;
+    for (uint64_t i = 0; i < 2; ++i) {
+        struct io_uring_sqe* sqe = ring->getSQE();
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = file.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(data[i]);
+        sqe->len = uint32_t(strlen(data[i]));
+        sqe->off = uint64_t(-1);
+        sqe->user_data = i;
+        if (prev != NULL)
+            prev->flags |= IOSQE_IO_LINK;
+        prev = sqe;
+    }
+    ring->submitAndWait(2);
+    uint64_t userData;
+    int32_t result;
+    ASSERT_TRUE(ring->popCompletion(userData, result));
+    EXPECT_EQ(0U, userData);
+    EXPECT_EQ(6, result);
+    ASSERT_TRUE(ring->popCompletion(userData, result));
+    EXPECT_EQ(1U, userData);
+    EXPECT_EQ(5, result);
+
+    FS::File readFile = FS::openFile(tmpdir, "f", O_RDONLY);
+    FS::FileContents contents(readFile);
+    EXPECT_EQ(11U, contents.getFileLength());
+    EXPECT_EQ("hello world",
+              std::string(contents.get<char>(0, 11), 11));
+}
+
+} // namespace LogCabin::Storage::<anonymous>
+} // namespace LogCabin::Storage
+} // namespace LogCabin
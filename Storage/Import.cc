@@ -0,0 +1,397 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <getopt.h>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "build/Protocol/Raft.pb.h"
+#include "build/Server/SnapshotMetadata.pb.h"
+#include "build/Server/SnapshotStateMachine.pb.h"
+#include "Core/Compression.h"
+#include "Core/Config.h"
+#include "Core/Debug.h"
+#include "Core/ProtoBuf.h"
+#include "Core/StringUtil.h"
+#include "Core/ThreadId.h"
+#include "Core/Util.h"
+#include "Storage/Layout.h"
+#include "Storage/Log.h"
+#include "Storage/LogFactory.h"
+#include "Storage/SnapshotFile.h"
+#include "Tree/Tree.h"
+
+namespace {
+
+using namespace LogCabin;
+
+/**
+ * Parses argv for the main function.
+ */
+class OptionParser {
+  public:
+    OptionParser(int& argc, char**& argv)
+        : argc(argc)
+        , argv(argv)
+        , configFilename("logcabin.conf")
+        , inputFilename("-")
+        , outputFilename()
+    {
+        while (true) {
+            static struct option longOptions[] = {
+               {"config",  required_argument, NULL, 'c'},
+               {"help",  no_argument, NULL, 'h'},
+               {"input",  required_argument, NULL, 'i'},
+               {"output",  required_argument, NULL, 'o'},
+               {0, 0, 0, 0}
+            };
+            int c = getopt_long(argc, argv, "c:hi:o:", longOptions, NULL);
+
+            // Detect the end of the options.
+            if (c == -1)
+                break;
+
+            switch (c) {
+                case 'h':
+                    usage();
+                    exit(0);
+                case 'c':
+                    configFilename = optarg;
+                    break;
+                case 'i':
+                    inputFilename = optarg;
+                    break;
+                case 'o':
+                    outputFilename = optarg;
+                    break;
+                case '?':
+                default:
+                    // getopt_long already printed an error message.
+                    usage();
+                    exit(1);
+            }
+        }
+
+        // We don't expect any additional command line arguments (not options).
+        if (optind != argc) {
+            usage();
+            exit(1);
+        }
+    }
+
+    void usage() {
+        std::cout
+            << "Builds a LogCabin tree from a stream of keys and values, "
+            << "without going"
+            << std::endl
+            << "through Raft one write at a time."
+            << std::endl
+            << std::endl
+            << "By default, this writes a snapshot containing the tree into "
+            << "the storage"
+            << std::endl
+            << "directory of the server given by the configuration file, "
+            << "which must be"
+            << std::endl
+            << "empty. This takes the place of bootstrapping the server: "
+            << "afterwards, start"
+            << std::endl
+            << "it normally and add the other servers with "
+            << "logcabin-reconfigure, and they"
+            << std::endl
+            << "will receive the snapshot. This will refuse to run while "
+            << "LogCabin is"
+            << std::endl
+            << "running."
+            << std::endl
+            << std::endl
+            << "With --output, this instead writes just the encoded tree to "
+            << "a file, which"
+            << std::endl
+            << "can be installed into a running cluster with 'logcabin "
+            << "import <path>'."
+            << std::endl
+            << std::endl
+            << "Each line of input is a key, a tab, and a value. Keys are "
+            << "absolute paths;"
+            << std::endl
+            << "their parent directories are created as needed. Values may "
+            << "contain the"
+            << std::endl
+            << "escapes \\n, \\t, and \\\\."
+            << std::endl
+            << std::endl
+            << "This program is subject to change (it is not part of "
+            << "LogCabin's stable API)."
+            << std::endl
+            << std::endl
+
+            << "Usage: " << argv[0] << " [options]"
+            << std::endl
+            << std::endl
+
+            << "Options:"
+            << std::endl
+
+            << "  -h, --help                   "
+            << "Print this usage information"
+            << std::endl
+
+            << "  -c <file>, --config=<file>   "
+            << "Set the path to the configuration file"
+            << std::endl
+            << "                               "
+            << "[default: logcabin.conf]"
+            << std::endl
+
+            << "  -i <file>, --input=<file>    "
+            << "Read keys and values from <file>"
+            << std::endl
+            << "                               "
+            << "[default: - for stdin]"
+            << std::endl
+
+            << "  -o <file>, --output=<file>   "
+            << "Write the encoded tree to <file> instead"
+            << std::endl
+            << "                               "
+            << "of a snapshot"
+            << std::endl;
+    }
+
+    int& argc;
+    char**& argv;
+    std::string configFilename;
+    std::string inputFilename;
+    std::string outputFilename;
+};
+
+/**
+ * Undo the escapes allowed in input values.
+ */
+std::string
+unescape(const std::string& value, uint64_t lineNumber)
+{
+    std::string ret;
+    ret.reserve(value.size());
+    for (auto it = value.begin(); it != value.end(); ++it) {
+        if (*it != '\\') {
+            ret += *it;
+            continue;
+        }
+        ++it;
+        if (it == value.end())
+            EXIT("Line %lu ends with a lone backslash", lineNumber);
+        switch (*it) {
+            case 'n':
+                ret += '\n';
+                break;
+            case 't':
+                ret += '\t';
+                break;
+            case '\\':
+                ret += '\\';
+                break;
+            default:
+                EXIT("Line %lu has unknown escape \\%c", lineNumber, *it);
+        }
+    }
+    return ret;
+}
+
+/**
+ * Read keys and values from the stream into the tree.
+ * \return
+ *      The number of keys read.
+ */
+uint64_t
+readInput(std::istream& input, Tree::Tree& tree)
+{
+    uint64_t lineNumber = 0;
+    std::string line;
+    while (std::getline(input, line)) {
+        ++lineNumber;
+        if (line.empty())
+            continue;
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos)
+            EXIT("Line %lu has no tab separating key and value", lineNumber);
+        std::string path = line.substr(0, tab);
+        std::string value = unescape(line.substr(tab + 1), lineNumber);
+        Tree::Result result = tree.write(path, value);
+        if (result.status == Tree::Status::LOOKUP_ERROR) {
+            result = tree.makeDirectory(path.substr(0, path.rfind('/') + 1));
+            if (result.status == Tree::Status::OK)
+                result = tree.write(path, value);
+        }
+        if (result.status != Tree::Status::OK)
+            EXIT("Line %lu: %s", lineNumber, result.error.c_str());
+        if (lineNumber % 1000000 == 0)
+            NOTICE("Read %lu lines", lineNumber);
+    }
+    return lineNumber;
+}
+
+/**
+ * Write a snapshot containing the tree into an empty storage directory, along
+ * with the log metadata a freshly bootstrapped server would have.
+ */
+void
+writeSnapshot(const Core::Config& config, const Tree::Tree& tree)
+{
+    if (!config.read<std::string>("raftGroups", "").empty()) {
+        EXIT("Importing into servers with several Raft groups is not "
+             "supported; bootstrap them normally and use 'logcabin import' "
+             "for each group's subtree instead");
+    }
+    uint64_t serverId = config.read<uint64_t>("serverId");
+    std::string addresses = config.read<std::string>("listenAddresses");
+    uint8_t formatVersion = Core::Util::downCast<uint8_t>(
+            config.read<uint64_t>("snapshotFormatVersion", 1));
+    if (formatVersion < 1 || formatVersion > 3) {
+        EXIT("snapshotFormatVersion is %u, but this code can only write "
+             "versions 1 through 3", formatVersion);
+    }
+
+    Storage::Layout storageLayout;
+    storageLayout.init(config, serverId);
+    NOTICE("Opening log at %s", storageLayout.serverDir.path.c_str());
+    std::unique_ptr<Storage::Log> log =
+        Storage::LogFactory::makeLog(config, storageLayout);
+    bool haveSnapshot = true;
+    try {
+        Storage::SnapshotFile::Reader reader(storageLayout);
+    } catch (const std::runtime_error& e) { // file not found
+        haveSnapshot = false;
+    }
+    if (log->metadata.current_term() != 0 ||
+        log->getLogStartIndex() != 1 ||
+        log->getLastLogIndex() != 0 ||
+        haveSnapshot) {
+        EXIT("Refusing to import: it looks like a log or snapshot already "
+             "exists.");
+    }
+
+    Storage::SnapshotFile::Writer writer(storageLayout);
+
+    // The snapshot stands in for the configuration entry that
+    // RaftConsensus::bootstrapConfiguration() would have appended at index 1.
+    uint8_t version = 1;
+    writer.writeRaw(&version, sizeof(version));
+    Server::SnapshotMetadata::Header header;
+    header.set_last_included_index(1);
+    header.set_last_included_term(1);
+    header.set_last_cluster_time(0);
+    Protocol::Raft::Server& server =
+        *header.mutable_configuration()->mutable_prev_configuration()->
+            add_servers();
+    server.set_server_id(serverId);
+    server.set_addresses(addresses);
+    header.set_configuration_index(1);
+    writer.writeMessage(header);
+
+    // The state machine part is laid out as in StateMachine::takeSnapshot(),
+    // for a state machine with no sessions.
+    writer.writeRaw(&formatVersion, sizeof(formatVersion));
+    Core::ProtoBuf::OutputStream* contents = &writer;
+    std::unique_ptr<Core::Compression::CompressedOutputStream> compressor;
+    if (formatVersion == 3) {
+        compressor.reset(
+            new Core::Compression::CompressedOutputStream(writer));
+        contents = compressor.get();
+    }
+    Server::SnapshotStateMachine::Header smHeader;
+    Server::SnapshotStateMachine::VersionUpdate& update =
+        *smHeader.add_version_update();
+    update.set_log_index(0);
+    update.set_version(1);
+    contents->writeMessage(smHeader);
+    if (formatVersion == 1)
+        tree.dumpSnapshot(*contents);
+    else
+        tree.dumpSnapshotSections(*contents);
+    if (compressor)
+        compressor->finish();
+    uint64_t bytes = writer.save();
+    NOTICE("Wrote %lu-byte snapshot", bytes);
+
+    // Like RaftConsensus::bootstrapConfiguration(), start in term 1.
+    log->metadata.set_current_term(1);
+    log->metadata.set_voted_for(0);
+    log->updateMetadata();
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char** argv)
+{
+    using namespace LogCabin;
+
+    try {
+
+        Core::Util::Finally _(google::protobuf::ShutdownProtobufLibrary);
+        Core::ThreadId::setName("main");
+
+        // Parse command line args.
+        OptionParser options(argc, argv);
+
+        Core::Config config;
+        if (options.outputFilename.empty()) {
+            NOTICE("Using config file %s", options.configFilename.c_str());
+            config.readFile(options.configFilename.c_str());
+            Core::Debug::setLogPolicy(
+                Core::Debug::logPolicyFromString(
+                    config.read<std::string>("logPolicy", "NOTICE")));
+        }
+
+        Tree::Tree tree;
+        uint64_t numLines;
+        if (options.inputFilename == "-") {
+            numLines = readInput(std::cin, tree);
+        } else {
+            std::ifstream input(options.inputFilename);
+            if (!input)
+                EXIT("Could not open %s", options.inputFilename.c_str());
+            numLines = readInput(input, tree);
+        }
+        NOTICE("Read %lu lines of input", numLines);
+
+        if (options.outputFilename.empty()) {
+            writeSnapshot(config, tree);
+        } else {
+            std::string contents;
+            tree.exportDirectory("/", contents);
+            std::ofstream output(options.outputFilename,
+                                 std::ios::binary | std::ios::trunc);
+            output.write(contents.data(),
+                         static_cast<std::streamsize>(contents.size()));
+            output.close();
+            if (!output)
+                EXIT("Could not write %s", options.outputFilename.c_str());
+            NOTICE("Wrote %lu bytes to %s",
+                   contents.size(), options.outputFilename.c_str());
+        }
+        return 0;
+
+    } catch (const Core::Config::Exception& e) {
+        ERROR("Fatal exception from config file: %s",
+              e.what());
+    }
+}
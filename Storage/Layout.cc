@@ -113,5 +113,21 @@ Layout::initTemporary(uint64_t serverId)
     removeAllFiles = true;
 }
 
+void
+Layout::initGroup(const Layout& server, uint64_t groupId)
+{
+    if (removeAllFiles) {
+        Storage::FilesystemUtil::remove(topDir.path);
+        removeAllFiles = false;
+    }
+    topDir = FS::openDir(server.topDir.path);
+    serverDir = FS::openDir(
+        server.serverDir,
+        Core::StringUtil::format("group%lu", groupId));
+    lockFile = FS::File();
+    logDir = FS::openDir(serverDir, "log");
+    snapshotDir = FS::openDir(serverDir, "snapshot");
+}
+
 } // namespace LogCabin::Storage
 } // namespace LogCabin
@@ -40,6 +40,9 @@ namespace Storage {
  *             snapshot - latest complete snapshot
  *             "partial.%010lu.%06lu" % (seconds, micro) - in progress
  *         lock - lockFile, ensures only 1 process accesses serverDir a time
+ *         "group%lu" % groupId/ - serverDir of each extra Raft group
+ *             log/ - logDir of the group
+ *             snapshot/ - snapshotDir of the group
  */
 class Layout {
   public:
@@ -83,6 +86,19 @@ class Layout {
      */
     void initTemporary(uint64_t serverId = 1);
 
+    /**
+     * Initialize for one of the extra Raft groups hosted by a server. The
+     * group's files are kept in a subdirectory of the server's directory,
+     * which is already locked by 'server', so this layout's lockFile is left
+     * closed.
+     * \param server
+     *      The layout of the server (group 0), already initialized. This must
+     *      outlive the new layout if it was created with initTemporary().
+     * \param groupId
+     *      The ID of the Raft group, greater than 0.
+     */
+    void initGroup(const Layout& server, uint64_t groupId);
+
     /**
      * Contains all files.
      * Defined by config option 'storagePath'.
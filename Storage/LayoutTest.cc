@@ -32,6 +32,20 @@ TEST(StorageLayoutTest, basics)
         "Could not lock storage directory");
 }
 
+TEST(StorageLayoutTest, initGroup)
+{
+    Layout layout;
+    layout.initTemporary(3);
+    Layout group;
+    group.initGroup(layout, 2);
+    EXPECT_EQ(layout.topDir.path, group.topDir.path);
+    EXPECT_EQ(layout.topDir.path + "/server3/group2", group.serverDir.path);
+    EXPECT_EQ(-1, group.lockFile.fd);
+    EXPECT_EQ(layout.topDir.path + "/server3/group2/log", group.logDir.path);
+    EXPECT_EQ(layout.topDir.path + "/server3/group2/snapshot",
+              group.snapshotDir.path);
+}
+
 } // namespace LogCabin::Storage::<anonymous>
 } // namespace LogCabin::Storage
 } // namespace LogCabin
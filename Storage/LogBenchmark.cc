@@ -0,0 +1,495 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Core/Config.h"
+#include "Core/Debug.h"
+#include "Core/Histogram.h"
+#include "Core/StringUtil.h"
+#include "Core/ThreadId.h"
+#include "Core/Time.h"
+#include "Core/Util.h"
+#include "Storage/Layout.h"
+#include "Storage/Log.h"
+#include "Storage/LogFactory.h"
+
+/**
+ * \file
+ * Measures the Storage::Log implementations directly, without the rest of
+ * LogCabin. It appends a log of the given size in batches, waiting for each
+ * batch to become durable, then reads the entries back, reopens the log (as
+ * a server does on startup), and finally truncates it away.
+ */
+
+namespace {
+
+using namespace LogCabin;
+using Core::StringUtil::format;
+typedef Core::Time::SteadyClock Clock;
+typedef Clock::time_point TimePoint;
+
+/**
+ * Parses argv for the main function.
+ */
+class OptionParser {
+  public:
+    OptionParser(int& argc, char**& argv)
+        : argc(argc)
+        , argv(argv)
+        , storageModule("Segmented")
+        , checksum("CRC32")
+        , entries(100000)
+        , size(1024)
+        , batch(1)
+        , path()
+        , settings()
+        , logPolicy("WARNING")
+    {
+        while (true) {
+            static struct option longOptions[] = {
+               {"batch",  required_argument, NULL, 'b'},
+               {"checksum",  required_argument, NULL, 'c'},
+               {"entries",  required_argument, NULL, 'n'},
+               {"help",  no_argument, NULL, 'h'},
+               {"path",  required_argument, NULL, 'p'},
+               {"set",  required_argument, NULL, 'o'},
+               {"size",  required_argument, NULL, 's'},
+               {"storage",  required_argument, NULL, 'm'},
+               {"verbosity",  required_argument, NULL, 'v'},
+               {0, 0, 0, 0}
+            };
+            int c = getopt_long(argc, argv, "b:c:hm:n:o:p:s:v:",
+                                longOptions, NULL);
+
+            // Detect the end of the options.
+            if (c == -1)
+                break;
+
+            switch (c) {
+                case 'b':
+                    batch = std::max(1UL, uint64_t(atol(optarg)));
+                    break;
+                case 'c':
+                    checksum = optarg;
+                    break;
+                case 'h':
+                    usage();
+                    exit(0);
+                case 'm':
+                    storageModule = optarg;
+                    break;
+                case 'n':
+                    entries = uint64_t(atol(optarg));
+                    break;
+                case 'o': {
+                    std::string setting = optarg;
+                    size_t equals = setting.find('=');
+                    if (equals == std::string::npos) {
+                        std::cerr << "--set expects key=value, got "
+                                  << setting << std::endl;
+                        usage();
+                        exit(1);
+                    }
+                    settings.push_back({setting.substr(0, equals),
+                                        setting.substr(equals + 1)});
+                    break;
+                }
+                case 'p':
+                    path = optarg;
+                    break;
+                case 's':
+                    size = uint64_t(atol(optarg));
+                    break;
+                case 'v':
+                    logPolicy = optarg;
+                    break;
+                case '?':
+                default:
+                    // getopt_long already printed an error message.
+                    usage();
+                    exit(1);
+            }
+        }
+
+        // We don't expect any additional command line arguments (not options).
+        if (optind != argc) {
+            usage();
+            exit(1);
+        }
+    }
+
+    void usage() {
+        std::cout
+            << "Measures the performance of LogCabin's log storage modules."
+            << std::endl
+            << "Appends the given number of entries in batches, syncing "
+            << "after each batch,"
+            << std::endl
+            << "then reads them back, reopens the log, and truncates it."
+            << std::endl
+            << std::endl
+            << "This program is subject to change (it is not part of "
+            << "LogCabin's stable API)."
+            << std::endl
+            << std::endl
+
+            << "Usage: " << argv[0] << " [options]"
+            << std::endl
+            << std::endl
+
+            << "Options:"
+            << std::endl
+
+            << "  -b <num>, --batch=<num>      "
+            << "Number of entries appended per sync [default: 1]"
+            << std::endl
+
+            << "  -c <name>, --checksum=<name> "
+            << "Checksum algorithm (storageChecksum)"
+            << std::endl
+            << "                               "
+            << "[default: CRC32]"
+            << std::endl
+
+            << "  -h, --help                   "
+            << "Print this usage information"
+            << std::endl
+
+            << "  -m <name>, --storage=<name>  "
+            << "Storage module: Segmented, SimpleFile, or Memory"
+            << std::endl
+            << "                               "
+            << "[default: Segmented]"
+            << std::endl
+
+            << "  -n <num>, --entries=<num>    "
+            << "Number of entries to append [default: 100000]"
+            << std::endl
+
+            << "  -o <key=value>, --set=<key=value>  "
+            << "Set another config option, such as"
+            << std::endl
+            << "                               "
+            << "storageIOEngine=uring (may be repeated)"
+            << std::endl
+
+            << "  -p <dir>, --path=<dir>       "
+            << "Directory in which to place the log, which must"
+            << std::endl
+            << "                               "
+            << "not already contain one [default: a new"
+            << std::endl
+            << "                               "
+            << "temporary directory, removed on exit]"
+            << std::endl
+
+            << "  -s <bytes>, --size=<bytes>   "
+            << "Size of each entry's data [default: 1024]"
+            << std::endl
+
+            << "  -v <policy>, --verbosity=<policy>  "
+            << "Set which log messages are shown"
+            << std::endl
+            << "                               "
+            << "[default: WARNING]"
+            << std::endl;
+    }
+
+    int& argc;
+    char**& argv;
+    std::string storageModule;
+    std::string checksum;
+    uint64_t entries;
+    uint64_t size;
+    uint64_t batch;
+    std::string path;
+    std::vector<std::pair<std::string, std::string>> settings;
+    std::string logPolicy;
+};
+
+/**
+ * Counts of read and write system calls made by this process so far, as
+ * reported by the kernel in /proc/self/io. fsync and friends aren't
+ * included.
+ */
+struct Syscalls {
+    Syscalls()
+        : valid(false)
+        , reads(0)
+        , writes(0)
+    {
+        std::ifstream io("/proc/self/io");
+        std::string key;
+        uint64_t value;
+        while (io >> key >> value) {
+            if (key == "syscr:") {
+                reads = value;
+                valid = true;
+            } else if (key == "syscw:") {
+                writes = value;
+            }
+        }
+    }
+    bool valid;
+    uint64_t reads;
+    uint64_t writes;
+};
+
+/**
+ * Collects and prints the results of one phase of the benchmark.
+ */
+class Phase {
+  public:
+    explicit Phase(const std::string& name)
+        : name(name)
+        , start(Clock::now())
+        , startSyscalls()
+        , latency()
+    {
+    }
+
+    /**
+     * Print a line of results.
+     * \param ops
+     *      The number of entries the phase operated on.
+     * \param bytes
+     *      The number of bytes of entry data the phase operated on.
+     */
+    void report(uint64_t ops, uint64_t bytes) {
+        double seconds = std::chrono::duration<double>(
+            Clock::now() - start).count();
+        Syscalls endSyscalls;
+        std::string syscallsPerOp = "n/a";
+        if (startSyscalls.valid && endSyscalls.valid && ops > 0) {
+            syscallsPerOp = format(
+                "%.3f",
+                double(endSyscalls.reads - startSyscalls.reads +
+                       endSyscalls.writes - startSyscalls.writes) /
+                double(ops));
+        }
+        std::cout << format("%-16s %10lu %9.3f %12.0f %9.2f %10s",
+                            name.c_str(),
+                            ops,
+                            seconds,
+                            double(ops) / seconds,
+                            double(bytes) / seconds / 1024 / 1024,
+                            syscallsPerOp.c_str());
+        if (latency.getCount() > 0) {
+            std::cout << format(" %9.1f %9.1f %9.1f %9.1f",
+                                double(latency.getPercentile(50)) / 1e3,
+                                double(latency.getPercentile(99)) / 1e3,
+                                double(latency.getPercentile(99.9)) / 1e3,
+                                double(latency.getPercentile(100)) / 1e3);
+        }
+        std::cout << std::endl;
+    }
+
+    static void printHeader() {
+        std::cout << format("%-16s %10s %9s %12s %9s %10s"
+                            " %9s %9s %9s %9s",
+                            "phase", "ops", "seconds", "ops/s", "MB/s",
+                            "sysc/op", "p50-us", "p99-us", "p999-us",
+                            "max-us")
+                  << std::endl;
+    }
+
+    /**
+     * Time how long 'f' takes and add it to the latency histogram.
+     */
+    template<typename F>
+    void time(F f) {
+        TimePoint opStart = Clock::now();
+        f();
+        latency.push(uint64_t(std::chrono::nanoseconds(
+            Clock::now() - opStart).count()));
+    }
+
+    const std::string name;
+    const TimePoint start;
+    const Syscalls startSyscalls;
+    Core::Histogram latency;
+};
+
+/**
+ * Wait for all appended entries to be durable.
+ */
+void
+sync(Storage::Log& log)
+{
+    std::unique_ptr<Storage::Log::Sync> sync = log.takeSync();
+    sync->wait();
+    log.syncComplete(std::move(sync));
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char** argv)
+{
+    try {
+
+        Core::Util::Finally _(google::protobuf::ShutdownProtobufLibrary);
+        Core::ThreadId::setName("main");
+
+        // Parse command line args.
+        OptionParser options(argc, argv);
+        Core::Debug::setLogPolicy(
+            Core::Debug::logPolicyFromString(options.logPolicy));
+
+        Core::Config config;
+        config.set("storageModule", options.storageModule);
+        config.set("storageChecksum", options.checksum);
+        for (auto it = options.settings.begin();
+             it != options.settings.end();
+             ++it) {
+            config.set(it->first, it->second);
+        }
+
+        Storage::Layout layout;
+        if (options.path.empty())
+            layout.initTemporary();
+        else
+            layout.init(options.path, 1);
+
+        std::cout << format("%s log, %lu entries of %lu bytes, %lu per "
+                            "batch, %s checksums",
+                            options.storageModule.c_str(),
+                            options.entries,
+                            options.size,
+                            options.batch,
+                            options.checksum.c_str())
+                  << std::endl
+                  << "Latencies are per batch for append, per entry for "
+                  << "reads, and per call for"
+                  << std::endl
+                  << "truncatePrefix."
+                  << std::endl;
+        Phase::printHeader();
+
+        std::unique_ptr<Storage::Log> log =
+            Storage::LogFactory::makeLog(config, layout);
+        if (log->getLastLogIndex() != 0) {
+            EXIT("The log at %s is not empty",
+                 layout.serverDir.path.c_str());
+        }
+
+        // Build one batch of entries up front, so that constructing them isn't
+        // part of the measurement.
+        const std::string data(options.size, 'd');
+        std::vector<Storage::Log::Entry> batchEntries(options.batch);
+        std::vector<const Storage::Log::Entry*> batch;
+        for (auto it = batchEntries.begin(); it != batchEntries.end(); ++it) {
+            it->set_term(1);
+            it->set_type(Protocol::Raft::EntryType::DATA);
+            it->set_data(data);
+            it->set_cluster_time(0);
+            batch.push_back(&*it);
+        }
+
+        { // append and sync
+            Phase phase("append+sync");
+            uint64_t appended = 0;
+            while (appended < options.entries) {
+                if (options.entries - appended < batch.size())
+                    batch.resize(options.entries - appended);
+                phase.time([&] () {
+                    log->append(batch);
+                    sync(*log);
+                });
+                appended += batch.size();
+            }
+            phase.report(appended, appended * options.size);
+        }
+
+        uint64_t lastIndex = log->getLastLogIndex();
+        uint64_t checksum = 0; // keeps the reads from being optimized out
+        { // read entries in order
+            Phase phase("read-sequential");
+            for (uint64_t index = 1; index <= lastIndex; ++index) {
+                phase.time([&] () {
+                    checksum += log->getEntry(index).data().size();
+                });
+            }
+            phase.report(lastIndex, lastIndex * options.size);
+        }
+
+        if (lastIndex > 0) { // read entries in random order
+            std::mt19937_64 random(1);
+            std::uniform_int_distribution<uint64_t> indexes(1, lastIndex);
+            Phase phase("read-random");
+            for (uint64_t i = 0; i < lastIndex; ++i) {
+                uint64_t index = indexes(random);
+                phase.time([&] () {
+                    checksum += log->getEntry(index).data().size();
+                });
+            }
+            phase.report(lastIndex, lastIndex * options.size);
+        }
+
+        if (options.storageModule != "Memory") { // startup replay
+            log.reset();
+            Phase phase("reopen");
+            phase.time([&] () {
+                log = Storage::LogFactory::makeLog(config, layout);
+            });
+            phase.report(log->getLastLogIndex(),
+                         log->getLastLogIndex() * options.size);
+            if (log->getLastLogIndex() != lastIndex) {
+                PANIC("Reopened log has %lu entries, expected %lu",
+                      log->getLastLogIndex(), lastIndex);
+            }
+        }
+
+        { // discard the log from the front in 100 steps
+            Phase phase("truncatePrefix");
+            uint64_t step = std::max(1UL, lastIndex / 100);
+            for (uint64_t index = 1 + step;
+                 index <= lastIndex + 1;
+                 index += step) {
+                phase.time([&] () {
+                    log->truncatePrefix(index);
+                    sync(*log);
+                });
+            }
+            // The steps stop short of the end unless they divide it evenly.
+            if (log->getLogStartIndex() <= lastIndex) {
+                phase.time([&] () {
+                    log->truncatePrefix(lastIndex + 1);
+                    sync(*log);
+                });
+            }
+            phase.report(lastIndex, lastIndex * options.size);
+        }
+
+        log.reset();
+        if (checksum != lastIndex * 2 * options.size)
+            PANIC("Read back the wrong amount of data");
+        return 0;
+
+    } catch (const Core::Config::Exception& e) {
+        ERROR("Fatal exception from config: %s",
+              e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,371 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _BSD_SOURCE
+#include <endian.h>
+#include <fcntl.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "build/Protocol/Raft.pb.h"
+#include "Core/Checksum.h"
+#include "Core/ProtoBuf.h"
+#include "Core/StringUtil.h"
+#include "Storage/SegmentScanner.h"
+
+namespace LogCabin {
+namespace Storage {
+namespace SegmentScanner {
+
+namespace FS = FilesystemUtil;
+using Core::StringUtil::format;
+using google::protobuf::internal::WireFormatLite;
+
+namespace {
+
+/**
+ * The fields of a log entry that scanSegment() looks at.
+ */
+struct EntryHeader {
+    EntryHeader()
+        : term(0)
+        , index(0)
+        , type(Protocol::Raft::EntryType::UNKNOWN)
+    {
+    }
+    uint64_t term;
+    uint64_t index;
+    int type;
+};
+
+/**
+ * Decode the term, index, and type of a binary-encoded entry, skipping over
+ * its configuration and data rather than copying them out.
+ * \return
+ *      True if the entry was well-formed, false otherwise.
+ */
+bool
+decodeBinary(const void* data, uint64_t length, EntryHeader& header)
+{
+    if (length > INT_MAX)
+        return false;
+    google::protobuf::io::CodedInputStream input(
+        static_cast<const uint8_t*>(data), int(length));
+    bool haveTerm = false;
+    while (true) {
+        uint32_t tag = input.ReadTag();
+        if (tag == 0)
+            break;
+        uint32_t value;
+        switch (WireFormatLite::GetTagFieldNumber(tag)) {
+            case Protocol::Raft::Entry::kTermFieldNumber:
+                if (!input.ReadVarint64(&header.term))
+                    return false;
+                haveTerm = true;
+                break;
+            case Protocol::Raft::Entry::kIndexFieldNumber:
+                if (!input.ReadVarint64(&header.index))
+                    return false;
+                break;
+            case Protocol::Raft::Entry::kTypeFieldNumber:
+                if (!input.ReadVarint32(&value))
+                    return false;
+                header.type = int(value);
+                break;
+            default:
+                if (!WireFormatLite::SkipField(&input, tag))
+                    return false;
+        }
+    }
+    return haveTerm && uint64_t(input.CurrentPosition()) == length;
+}
+
+/**
+ * Decode the term, index, and type of a text-encoded entry.
+ * \return
+ *      True if the entry was well-formed, false otherwise.
+ */
+bool
+decodeText(const void* data, uint64_t length, EntryHeader& header)
+{
+    Protocol::Raft::Entry entry;
+    Core::ProtoBuf::Internal::fromString(
+        std::string(static_cast<const char*>(data), length),
+        entry);
+    if (!entry.IsInitialized())
+        return false;
+    header.term = entry.term();
+    header.index = entry.index();
+    header.type = entry.type();
+    return true;
+}
+
+/**
+ * Return true if all the bytes in range [start, start + length) are zero.
+ */
+bool
+isAllZeros(const void* _start, uint64_t length)
+{
+    const uint8_t* start = static_cast<const uint8_t*>(_start);
+    for (uint64_t offset = 0; offset < length; ++offset) {
+        if (start[offset] != 0)
+            return false;
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+////////// struct SegmentSummary //////////
+
+SegmentSummary::SegmentSummary()
+    : filename()
+    , isOpen(false)
+    , expectedStartIndex(0)
+    , expectedEndIndex(0)
+    , fileBytes(0)
+    , validBytes(0)
+    , numEntries(0)
+    , firstIndex(0)
+    , lastIndex(0)
+    , minTerm(0)
+    , maxTerm(0)
+    , numConfigurations(0)
+    , numIndexGaps(0)
+    , numChecksumFailures(0)
+    , numParseFailures(0)
+    , zeroBytes(0)
+    , error()
+    , entryBytes()
+{
+}
+
+std::ostream&
+operator<<(std::ostream& os, const SegmentSummary& summary)
+{
+    os << summary.filename << ": "
+       << summary.numEntries << " entries";
+    if (summary.numEntries > 0) {
+        os << " [" << summary.firstIndex << ", " << summary.lastIndex << "]"
+           << " terms " << summary.minTerm << "-" << summary.maxTerm
+           << ", " << summary.numConfigurations << " configs"
+           << ", entry bytes p50 " << summary.entryBytes.getPercentile(50)
+           << " p99 " << summary.entryBytes.getPercentile(99)
+           << " max " << summary.entryBytes.getPercentile(100);
+    }
+    os << ", " << summary.fileBytes << " bytes";
+    if (summary.numChecksumFailures > 0)
+        os << ", " << summary.numChecksumFailures << " CHECKSUM FAILURES";
+    if (summary.numParseFailures > 0)
+        os << ", " << summary.numParseFailures << " PARSE FAILURES";
+    if (summary.numIndexGaps > 0)
+        os << ", " << summary.numIndexGaps << " INDEX GAPS";
+    if (!summary.isOpen &&
+        (summary.firstIndex != summary.expectedStartIndex ||
+         summary.lastIndex < summary.expectedEndIndex)) {
+        os << ", MISSING ENTRIES";
+    }
+    if (summary.zeroBytes > 0)
+        os << ", " << summary.zeroBytes << " zero bytes at end";
+    if (!summary.error.empty())
+        os << ", ERROR at offset " << summary.validBytes
+           << ": " << summary.error;
+    return os;
+}
+
+bool
+isSegmentFilename(const std::string& filename)
+{
+    uint64_t a;
+    uint64_t b;
+    unsigned bytesConsumed;
+    if (sscanf(filename.c_str(), "%020lu-%020lu%n",
+               &a, &b, &bytesConsumed) == 2 &&
+        bytesConsumed == filename.length()) {
+        return true;
+    }
+    if (sscanf(filename.c_str(), "open-%lu%n",
+               &a, &bytesConsumed) == 1 &&
+        bytesConsumed == filename.length()) {
+        return true;
+    }
+    return false;
+}
+
+SegmentSummary
+scanSegment(const FS::File& dir,
+            const std::string& filename,
+            SegmentedLog::Encoding encoding)
+{
+    SegmentSummary summary;
+    summary.filename = filename;
+    {
+        unsigned bytesConsumed;
+        summary.isOpen = !(sscanf(filename.c_str(), "%020lu-%020lu%n",
+                                  &summary.expectedStartIndex,
+                                  &summary.expectedEndIndex,
+                                  &bytesConsumed) == 2 &&
+                           bytesConsumed == filename.length());
+    }
+
+    FS::File file = FS::tryOpenFile(dir, filename, O_RDONLY);
+    if (file.fd < 0) {
+        summary.error = format("Could not open: %s", strerror(errno));
+        return summary;
+    }
+    FS::FileContents reader(file);
+    summary.fileBytes = reader.getFileLength();
+    if (summary.fileBytes < 1) {
+        summary.error = "Empty file (no version field)";
+        return summary;
+    }
+    const char* begin = reader.get<char>(0, summary.fileBytes);
+    uint8_t version = uint8_t(begin[0]);
+    if (version != 1 && version != 2) {
+        summary.error = format("Unknown segment version %u", version);
+        return summary;
+    }
+
+    uint64_t offset = 1;
+    while (offset < summary.fileBytes) {
+        // Same as SegmentedLog::skipPadding(): in version 2, a zero byte
+        // after a record means the rest of its block is padding.
+        const uint64_t BLOCK = SegmentedLog::DIRECT_IO_BLOCK_SIZE;
+        if (version >= 2 && offset % BLOCK != 0 && begin[offset] == 0) {
+            offset = std::min((offset / BLOCK + 1) * BLOCK,
+                              summary.fileBytes);
+            if (offset == summary.fileBytes)
+                break;
+        }
+        summary.validBytes = offset;
+        uint64_t remaining = summary.fileBytes - offset;
+        if (summary.isOpen && isAllZeros(begin + offset, remaining)) {
+            summary.zeroBytes = remaining;
+            break;
+        }
+
+        const char* checksum = begin + offset;
+        uint32_t checksumBytes = Core::Checksum::length(
+            checksum,
+            uint32_t(std::min(remaining,
+                              uint64_t(Core::Checksum::MAX_LENGTH))));
+        if (checksumBytes == 0) {
+            summary.error = "Missing checksum";
+            break;
+        }
+        uint64_t dataLen;
+        if (remaining < checksumBytes + sizeof(dataLen)) {
+            summary.error = "Record length truncated";
+            break;
+        }
+        memcpy(&dataLen, checksum + checksumBytes, sizeof(dataLen));
+        dataLen = be64toh(dataLen);
+        if (remaining - checksumBytes - sizeof(dataLen) < dataLen) {
+            summary.error = "Record truncated";
+            break;
+        }
+        const char* lengthField = checksum + checksumBytes;
+        const char* data = lengthField + sizeof(dataLen);
+        offset += checksumBytes + sizeof(dataLen) + dataLen;
+
+        if (!Core::Checksum::verify(checksum, lengthField,
+                                    sizeof(dataLen) + dataLen).empty()) {
+            // The length itself may be corrupt, in which case the next
+            // record won't have a valid checksum and scanning will stop.
+            ++summary.numChecksumFailures;
+            continue;
+        }
+
+        EntryHeader header;
+        bool ok;
+        switch (encoding) {
+            case SegmentedLog::Encoding::BINARY:
+                ok = decodeBinary(data, dataLen, header);
+                break;
+            case SegmentedLog::Encoding::TEXT:
+                ok = decodeText(data, dataLen, header);
+                break;
+            default:
+                ok = false;
+        }
+        if (!ok) {
+            ++summary.numParseFailures;
+            continue;
+        }
+
+        if (summary.numEntries == 0) {
+            summary.firstIndex = header.index;
+            summary.minTerm = header.term;
+        } else if (header.index != summary.lastIndex + 1) {
+            ++summary.numIndexGaps;
+        }
+        ++summary.numEntries;
+        summary.lastIndex = header.index;
+        summary.minTerm = std::min(summary.minTerm, header.term);
+        summary.maxTerm = std::max(summary.maxTerm, header.term);
+        if (header.type == Protocol::Raft::EntryType::CONFIGURATION)
+            ++summary.numConfigurations;
+        summary.entryBytes.push(dataLen);
+    }
+    if (summary.error.empty() && summary.zeroBytes == 0)
+        summary.validBytes = offset;
+    return summary;
+}
+
+std::vector<SegmentSummary>
+scanSegments(const FS::File& dir,
+             SegmentedLog::Encoding encoding,
+             uint32_t numThreads)
+{
+    std::vector<std::string> filenames = FS::ls(dir);
+    filenames.erase(std::remove_if(filenames.begin(), filenames.end(),
+                                   [](const std::string& filename) {
+                                       return !isSegmentFilename(filename);
+                                   }),
+                    filenames.end());
+    // Closed segment names sort in log order, ahead of the open segments.
+    std::sort(filenames.begin(), filenames.end());
+
+    // Each thread repeatedly claims the next unscanned file. The files are
+    // independent, so this needs no other coordination.
+    std::vector<SegmentSummary> summaries(filenames.size());
+    std::atomic<uint64_t> next(0);
+    auto scan = [&]() {
+        while (true) {
+            uint64_t i = next.fetch_add(1);
+            if (i >= filenames.size())
+                return;
+            summaries.at(i) = scanSegment(dir, filenames.at(i), encoding);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (uint64_t i = 1; i < numThreads && i < filenames.size(); ++i)
+        threads.emplace_back(scan);
+    scan();
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+        it->join();
+    return summaries;
+}
+
+} // namespace LogCabin::Storage::SegmentScanner
+} // namespace LogCabin::Storage
+} // namespace LogCabin
@@ -0,0 +1,173 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Core/Histogram.h"
+#include "Storage/FilesystemUtil.h"
+#include "Storage/SegmentedLog.h"
+
+#ifndef LOGCABIN_STORAGE_SEGMENTSCANNER_H
+#define LOGCABIN_STORAGE_SEGMENTSCANNER_H
+
+namespace LogCabin {
+namespace Storage {
+
+/**
+ * Reads the segment files of a SegmentedLog directory for inspection, without
+ * opening the log. Unlike loading a SegmentedLog, this never modifies the
+ * files, keeps none of the entries in memory, and reads each segment through
+ * its own mapping, so that several segments can be checked in parallel. The
+ * entries are only partially decoded: enough to find their index, term, and
+ * type.
+ *
+ * Errors in the files are reported in the results rather than causing a
+ * PANIC, since the point is to look at storage that may be damaged.
+ */
+namespace SegmentScanner {
+
+/**
+ * What scanSegment() found in one segment file.
+ */
+struct SegmentSummary {
+    /// Constructor.
+    SegmentSummary();
+    /**
+     * Print a one-line description of the segment.
+     */
+    friend std::ostream& operator<<(std::ostream& os,
+                                    const SegmentSummary& summary);
+    /**
+     * The name of the file within the log directory.
+     */
+    std::string filename;
+    /**
+     * True for open segments ("open-N"), false for closed segments.
+     */
+    bool isOpen;
+    /**
+     * For closed segments, the first and last indexes given by the
+     * filename.
+     */
+    uint64_t expectedStartIndex;
+    /// See expectedStartIndex.
+    uint64_t expectedEndIndex;
+    /**
+     * The size of the file in bytes.
+     */
+    uint64_t fileBytes;
+    /**
+     * The number of bytes into the file just past the last record that
+     * could be read.
+     */
+    uint64_t validBytes;
+    /**
+     * The number of records whose checksum matched and that decoded as
+     * entries.
+     */
+    uint64_t numEntries;
+    /**
+     * The index of the first entry read, or 0 if none.
+     */
+    uint64_t firstIndex;
+    /**
+     * The index of the last entry read, or 0 if none.
+     */
+    uint64_t lastIndex;
+    /**
+     * The smallest term of any entry read, or 0 if none.
+     */
+    uint64_t minTerm;
+    /**
+     * The largest term of any entry read, or 0 if none.
+     */
+    uint64_t maxTerm;
+    /**
+     * The number of entries of type CONFIGURATION.
+     */
+    uint64_t numConfigurations;
+    /**
+     * The number of entries whose index didn't follow the previous entry's.
+     */
+    uint64_t numIndexGaps;
+    /**
+     * The number of records whose checksum didn't match. These are skipped
+     * if their length is plausible.
+     */
+    uint64_t numChecksumFailures;
+    /**
+     * The number of records with a good checksum that couldn't be decoded.
+     */
+    uint64_t numParseFailures;
+    /**
+     * For open segments, the number of zero bytes following the last record
+     * (preallocated space that was never written).
+     */
+    uint64_t zeroBytes;
+    /**
+     * Why scanning stopped before the end of the file, or empty if it
+     * didn't.
+     */
+    std::string error;
+    /**
+     * The size in bytes of each entry's encoding.
+     */
+    Core::Histogram entryBytes;
+};
+
+/**
+ * Return true if the filename is that of an open or closed segment.
+ */
+bool isSegmentFilename(const std::string& filename);
+
+/**
+ * Read through a single segment file.
+ * \param dir
+ *      The log directory, such as "Segmented-Binary".
+ * \param filename
+ *      The name of the segment file within 'dir'.
+ * \param encoding
+ *      How entries in the log are encoded.
+ */
+SegmentSummary
+scanSegment(const FilesystemUtil::File& dir,
+            const std::string& filename,
+            SegmentedLog::Encoding encoding);
+
+/**
+ * Read through all the segment files in a log directory.
+ * \param dir
+ *      The log directory, such as "Segmented-Binary".
+ * \param encoding
+ *      How entries in the log are encoded.
+ * \param numThreads
+ *      The maximum number of segments to read at once, including on the
+ *      calling thread.
+ * \return
+ *      One summary per segment file, in the order of their filenames
+ *      (closed segments in log order, followed by open segments).
+ */
+std::vector<SegmentSummary>
+scanSegments(const FilesystemUtil::File& dir,
+             SegmentedLog::Encoding encoding,
+             uint32_t numThreads);
+
+} // namespace LogCabin::Storage::SegmentScanner
+} // namespace LogCabin::Storage
+} // namespace LogCabin
+
+#endif /* LOGCABIN_STORAGE_SEGMENTSCANNER_H */
@@ -0,0 +1,226 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "build/Protocol/Raft.pb.h"
+#include "Core/Config.h"
+#include "Storage/Layout.h"
+#include "Storage/SegmentScanner.h"
+
+namespace LogCabin {
+namespace Storage {
+namespace {
+
+namespace FS = FilesystemUtil;
+using namespace SegmentScanner; // NOLINT
+
+class StorageSegmentScannerTest : public ::testing::Test {
+    StorageSegmentScannerTest()
+        : config()
+        , layout()
+    {
+        config.set<uint64_t>("storageSegmentBytes", 1024);
+        config.set<uint64_t>("storageOpenSegments", 1);
+        layout.initTemporary();
+    }
+
+    /**
+     * Write entries 1 through 'numEntries' to a new log and shut it down.
+     * Entry 1 is a configuration; the rest are 300 bytes of data, in terms
+     * that increase every 4 entries.
+     */
+    void writeLog(SegmentedLog::Encoding encoding, uint64_t numEntries) {
+        SegmentedLog log(layout.logDir, encoding, config);
+        for (uint64_t i = 1; i <= numEntries; ++i) {
+            Protocol::Raft::Entry entry;
+            entry.set_term(i / 4 + 1);
+            entry.set_cluster_time(i);
+            if (i == 1) {
+                entry.set_type(Protocol::Raft::EntryType::CONFIGURATION);
+                Protocol::Raft::Server& server =
+                    *entry.mutable_configuration()->
+                        mutable_prev_configuration()->add_servers();
+                server.set_server_id(1);
+                server.set_addresses("127.0.0.1:5254");
+            } else {
+                entry.set_type(Protocol::Raft::EntryType::DATA);
+                entry.set_data(std::string(300, 'x'));
+            }
+            log.append({&entry});
+            std::unique_ptr<Log::Sync> sync = log.takeSync();
+            sync->wait();
+            log.syncComplete(std::move(sync));
+        }
+    }
+
+    Core::Config config;
+    Layout layout;
+};
+
+TEST_F(StorageSegmentScannerTest, isSegmentFilename) {
+    EXPECT_TRUE(isSegmentFilename(
+        "00000000000000000003-00000000000000000004"));
+    EXPECT_TRUE(isSegmentFilename("open-3"));
+    EXPECT_FALSE(isSegmentFilename("metadata1"));
+    EXPECT_FALSE(isSegmentFilename("open-3x"));
+    EXPECT_FALSE(isSegmentFilename("00000000000000000003"));
+}
+
+TEST_F(StorageSegmentScannerTest, scanSegments) {
+    writeLog(SegmentedLog::Encoding::BINARY, 10);
+    FS::File dir = FS::openDir(layout.logDir, "Segmented-Binary");
+    std::vector<SegmentSummary> summaries =
+        scanSegments(dir, SegmentedLog::Encoding::BINARY, 4);
+    ASSERT_LT(1U, summaries.size());
+
+    uint64_t numEntries = 0;
+    uint64_t numConfigurations = 0;
+    uint64_t nextIndex = 1;
+    for (auto it = summaries.begin(); it != summaries.end(); ++it) {
+        EXPECT_EQ("", it->error) << it->filename;
+        EXPECT_EQ(0U, it->numChecksumFailures);
+        EXPECT_EQ(0U, it->numParseFailures);
+        EXPECT_EQ(0U, it->numIndexGaps);
+        EXPECT_EQ(it->numEntries, it->entryBytes.getCount());
+        if (it->numEntries == 0)
+            continue;
+        EXPECT_EQ(nextIndex, it->firstIndex) << it->filename;
+        if (!it->isOpen) {
+            EXPECT_EQ(it->expectedStartIndex, it->firstIndex);
+            EXPECT_EQ(it->expectedEndIndex, it->lastIndex);
+            EXPECT_EQ(it->fileBytes, it->validBytes);
+        }
+        nextIndex = it->lastIndex + 1;
+        numEntries += it->numEntries;
+        numConfigurations += it->numConfigurations;
+    }
+    EXPECT_EQ(10U, numEntries);
+    EXPECT_EQ(1U, numConfigurations);
+    EXPECT_EQ(1U, summaries.front().minTerm);
+    EXPECT_EQ(1U, summaries.front().firstIndex);
+    EXPECT_LE(300U, summaries.front().entryBytes.getPercentile(99));
+}
+
+TEST_F(StorageSegmentScannerTest, scanSegment_padding) {
+    const uint64_t BLOCK = SegmentedLog::DIRECT_IO_BLOCK_SIZE;
+    config.set("storageDirectIO", true);
+    config.set<uint64_t>("storageSegmentBytes", 3 * BLOCK);
+    writeLog(SegmentedLog::Encoding::BINARY, 7);
+    FS::File dir = FS::openDir(layout.logDir, "Segmented-Binary");
+    std::vector<SegmentSummary> summaries =
+        scanSegments(dir, SegmentedLog::Encoding::BINARY, 1);
+    ASSERT_LT(1U, summaries.size());
+
+    // each record starts its own block, so segments are version 2
+    const SegmentSummary& first = summaries.front();
+    ASSERT_FALSE(first.isOpen);
+    FS::File file = FS::openFile(dir, first.filename, O_RDONLY);
+    FS::FileContents contents(file);
+    EXPECT_EQ(2U, *contents.get<uint8_t>(0, 1));
+    EXPECT_EQ(3 * BLOCK, first.fileBytes);
+
+    uint64_t numEntries = 0;
+    uint64_t nextIndex = 1;
+    for (auto it = summaries.begin(); it != summaries.end(); ++it) {
+        EXPECT_EQ("", it->error) << it->filename;
+        EXPECT_EQ(0U, it->numChecksumFailures);
+        EXPECT_EQ(0U, it->numParseFailures);
+        EXPECT_EQ(0U, it->numIndexGaps);
+        if (it->numEntries == 0)
+            continue;
+        EXPECT_EQ(nextIndex, it->firstIndex) << it->filename;
+        if (!it->isOpen) {
+            EXPECT_EQ(it->fileBytes, it->validBytes);
+        }
+        nextIndex = it->lastIndex + 1;
+        numEntries += it->numEntries;
+    }
+    EXPECT_EQ(7U, numEntries);
+    EXPECT_EQ(3U, first.numEntries);
+}
+
+TEST_F(StorageSegmentScannerTest, scanSegment_text) {
+    writeLog(SegmentedLog::Encoding::TEXT, 3);
+    FS::File dir = FS::openDir(layout.logDir, "Segmented-Text");
+    std::vector<SegmentSummary> summaries =
+        scanSegments(dir, SegmentedLog::Encoding::TEXT, 1);
+    uint64_t numEntries = 0;
+    uint64_t maxTerm = 0;
+    for (auto it = summaries.begin(); it != summaries.end(); ++it) {
+        EXPECT_EQ("", it->error) << it->filename;
+        EXPECT_EQ(0U, it->numParseFailures);
+        numEntries += it->numEntries;
+        maxTerm = std::max(maxTerm, it->maxTerm);
+    }
+    EXPECT_EQ(3U, numEntries);
+    EXPECT_EQ(1U, maxTerm);
+}
+
+TEST_F(StorageSegmentScannerTest, scanSegment_checksumFailure) {
+    writeLog(SegmentedLog::Encoding::BINARY, 10);
+    FS::File dir = FS::openDir(layout.logDir, "Segmented-Binary");
+    std::vector<SegmentSummary> before =
+        scanSegments(dir, SegmentedLog::Encoding::BINARY, 1);
+    ASSERT_FALSE(before.front().isOpen);
+    ASSERT_LT(1U, before.front().numEntries);
+
+    // flip a byte in the last entry's data
+    FS::File file = FS::openFile(dir, before.front().filename, O_RDWR);
+    char c = 0;
+    off_t offset = off_t(before.front().fileBytes - 2);
+    ASSERT_EQ(1, pread(file.fd, &c, 1, offset));
+    c = char(~c);
+    ASSERT_EQ(1, pwrite(file.fd, &c, 1, offset));
+
+    SegmentSummary after = scanSegment(dir, before.front().filename,
+                                       SegmentedLog::Encoding::BINARY);
+    EXPECT_EQ(1U, after.numChecksumFailures);
+    EXPECT_EQ(before.front().numEntries - 1, after.numEntries);
+    EXPECT_EQ("", after.error);
+}
+
+TEST_F(StorageSegmentScannerTest, scanSegment_truncated) {
+    writeLog(SegmentedLog::Encoding::BINARY, 10);
+    FS::File dir = FS::openDir(layout.logDir, "Segmented-Binary");
+    std::vector<SegmentSummary> before =
+        scanSegments(dir, SegmentedLog::Encoding::BINARY, 1);
+    ASSERT_FALSE(before.front().isOpen);
+    FS::File file = FS::openFile(dir, before.front().filename, O_RDWR);
+    FS::truncate(file, before.front().fileBytes - 10);
+
+    SegmentSummary after = scanSegment(dir, before.front().filename,
+                                       SegmentedLog::Encoding::BINARY);
+    EXPECT_EQ("Record truncated", after.error);
+    EXPECT_EQ(before.front().numEntries - 1, after.numEntries);
+    EXPECT_GT(before.front().fileBytes, after.validBytes);
+}
+
+TEST_F(StorageSegmentScannerTest, scanSegment_badFiles) {
+    FS::File dir = FS::openDir(layout.logDir, "Segmented-Binary");
+    FS::openFile(dir, "open-1", O_CREAT);
+    EXPECT_EQ("Empty file (no version field)",
+              scanSegment(dir, "open-1",
+                          SegmentedLog::Encoding::BINARY).error);
+    EXPECT_EQ(0U, scanSegment(dir, "open-2",
+                              SegmentedLog::Encoding::BINARY).error.find(
+                                  "Could not open"));
+}
+
+} // namespace LogCabin::Storage::<anonymous>
+} // namespace LogCabin::Storage
+} // namespace LogCabin
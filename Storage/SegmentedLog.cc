@@ -19,6 +19,7 @@
 
 #include <algorithm>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -69,6 +70,32 @@ isAllZeros(const void* _start, size_t length)
     return true;
 }
 
+/**
+ * Create the io_uring used to execute filesystem operations, if the
+ * "storageIOEngine" config option asks for one.
+ * \return
+ *      The new io_uring, or NULL to execute operations with blocking system
+ *      calls.
+ */
+std::unique_ptr<IOUring>
+openIOUring(const Core::Config& config)
+{
+    std::string engine = config.read<std::string>("storageIOEngine", "sync");
+    if (engine == "sync")
+        return NULL;
+    if (engine != "io_uring") {
+        PANIC("Unknown storageIOEngine: '%s' (expected 'sync' or "
+              "'io_uring')", engine.c_str());
+    }
+    std::string error;
+    std::unique_ptr<IOUring> ring = IOUring::create(64, error);
+    if (!ring) {
+        WARNING("Falling back to storageIOEngine 'sync', since io_uring is "
+                "not usable: %s", error.c_str());
+    }
+    return ring;
+}
+
 } // anonymous namespace
 
 
@@ -176,9 +203,14 @@ SegmentedLog::PreparedSegments::waitForOpenSegment()
 
 
 SegmentedLog::Sync::Sync(uint64_t lastIndex,
-                         std::chrono::nanoseconds diskWriteDurationThreshold)
+                         std::chrono::nanoseconds diskWriteDurationThreshold,
+                         IOUring* ioUring)
     : Log::Sync(lastIndex)
     , diskWriteDurationThreshold(diskWriteDurationThreshold)
+    , ioUring(ioUring)
+    , opCounts()
+    , bytesWritten(0)
+    , ioUringBatches(0)
     , ops()
     , waitStart(TimePoint::max())
     , waitEnd(TimePoint::max())
@@ -217,20 +249,42 @@ SegmentedLog::Sync::wait()
     optimize();
 
     waitStart = Clock::now();
-    uint64_t writes = 0;
-    uint64_t totalBytesWritten = 0;
-    uint64_t truncates = 0;
-    uint64_t renames = 0;
-    uint64_t fdatasyncs = 0;
-    uint64_t fsyncs = 0;
-    uint64_t closes = 0;
-    uint64_t unlinks = 0;
+    if (ioUring != NULL) {
+        executeWithIOUring();
+    } else {
+        while (!ops.empty()) {
+            execute(ops.front());
+            ops.pop_front();
+        }
+    }
 
-    while (!ops.empty()) {
-        Op& op = ops.front();
-        FS::File f(op.fd, "-unknown-");
-        switch (op.opCode) {
-            case Op::WRITE: {
+    waitEnd = Clock::now();
+    std::chrono::nanoseconds elapsed = waitEnd - waitStart;
+    if (elapsed > diskWriteDurationThreshold) {
+        WARNING("Executing filesystem operations took longer than expected "
+                "(%s for %lu writes totaling %lu bytes, %lu truncates, "
+                "%lu renames, %lu fdatasyncs, %lu fsyncs, %lu closes, and "
+                "%lu unlinks in %lu io_uring batches)",
+                Core::StringUtil::toString(elapsed).c_str(),
+                opCounts[Op::WRITE],
+                bytesWritten,
+                opCounts[Op::TRUNCATE],
+                opCounts[Op::RENAME],
+                opCounts[Op::FDATASYNC],
+                opCounts[Op::FSYNC],
+                opCounts[Op::CLOSE],
+                opCounts[Op::UNLINKAT],
+                ioUringBatches);
+    }
+}
+
+void
+SegmentedLog::Sync::execute(Op& op)
+{
+    FS::File f(op.fd, "-unknown-");
+    switch (op.opCode) {
+        case Op::WRITE: {
+            if (op.offset < 0) {
                 ssize_t written = FS::write(op.fd,
                         op.writeData.getData(),
                         op.writeData.getLength());
@@ -239,66 +293,212 @@ SegmentedLog::Sync::wait()
                           op.fd,
                           strerror(errno));
                 }
-                ++writes;
-                totalBytesWritten += op.writeData.getLength();
-                break;
-            }
-            case Op::TRUNCATE: {
-                FS::truncate(f, op.size);
-                ++truncates;
-                break;
-            }
-            case Op::RENAME: {
-                FS::rename(f, op.filename1,
-                           f, op.filename2);
-                ++renames;
-                break;
-            }
-            case Op::FDATASYNC: {
-                FS::fdatasync(f);
-                ++fdatasyncs;
-                break;
+            } else {
+                const char* data = static_cast<const char*>(
+                                        op.writeData.getData());
+                uint64_t length = op.writeData.getLength();
+                uint64_t done = 0;
+                while (done < length) {
+                    ssize_t written = ::pwrite(op.fd,
+                                               data + done,
+                                               length - done,
+                                               op.offset + int64_t(done));
+                    if (written < 0) {
+                        if (errno == EINTR)
+                            continue;
+                        PANIC("Failed to write to fd %d at offset %lu: %s",
+                              op.fd,
+                              uint64_t(op.offset) + done,
+                              strerror(errno));
+                    }
+                    done += uint64_t(written);
+                }
             }
-            case Op::FSYNC: {
-                FS::fsync(f);
-                ++fsyncs;
+            bytesWritten += op.writeData.getLength();
+            break;
+        }
+        case Op::TRUNCATE: {
+            FS::truncate(f, op.size);
+            break;
+        }
+        case Op::RENAME: {
+            FS::rename(f, op.filename1,
+                       f, op.filename2);
+            break;
+        }
+        case Op::FDATASYNC: {
+            FS::fdatasync(f);
+            break;
+        }
+        case Op::FSYNC: {
+            FS::fsync(f);
+            break;
+        }
+        case Op::CLOSE: {
+            f.close();
+            break;
+        }
+        case Op::UNLINKAT: {
+            FS::removeFile(f, op.filename1);
+            break;
+        }
+        case Op::NOOP: {
+            break;
+        }
+    }
+    f.release();
+    ++opCounts[op.opCode];
+}
+
+void
+SegmentedLog::Sync::executeWithIOUring()
+{
+    std::lock_guard<std::mutex> lockGuard(ioUring->mutex);
+    while (!ops.empty()) {
+        if (!ioUringCanExecute(ops.front())) {
+            execute(ops.front());
+            ops.pop_front();
+            continue;
+        }
+
+        // Prepare a chain of linked entries for the longest run of ops that
+        // io_uring can execute (up to the size of the ring). user_data is
+        // the op's position in #ops.
+        struct io_uring_sqe* prev = NULL;
+        uint32_t chainLength = 0;
+        for (auto it = ops.begin(); it != ops.end(); ++it) {
+            Op& op = *it;
+            if (!ioUringCanExecute(op))
                 break;
-            }
-            case Op::CLOSE: {
-                f.close();
-                ++closes;
+            struct io_uring_sqe* sqe = ioUring->getSQE();
+            if (sqe == NULL)
                 break;
+            sqe->fd = op.fd;
+            sqe->user_data = chainLength;
+            switch (op.opCode) {
+                case Op::WRITE:
+                    sqe->opcode = IORING_OP_WRITE;
+                    sqe->addr = reinterpret_cast<uint64_t>(
+                                    op.writeData.getData());
+                    sqe->len = Core::Util::downCast<uint32_t>(
+                                    op.writeData.getLength());
+                    // -1 means at the current file offset
+                    sqe->off = uint64_t(op.offset);
+                    break;
+                case Op::RENAME:
+                    sqe->opcode = IORING_OP_RENAMEAT;
+                    sqe->addr = reinterpret_cast<uint64_t>(
+                                    op.filename1.c_str());
+                    sqe->len = uint32_t(op.fd); // new directory
+                    sqe->addr2 = reinterpret_cast<uint64_t>(
+                                    op.filename2.c_str());
+                    break;
+                case Op::FDATASYNC:
+                case Op::FSYNC:
+                    if (FS::skipFsync) {
+                        sqe->opcode = IORING_OP_NOP;
+                        break;
+                    }
+                    sqe->opcode = IORING_OP_FSYNC;
+                    if (op.opCode == Op::FDATASYNC)
+                        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+                    break;
+                case Op::CLOSE:
+                    sqe->opcode = IORING_OP_CLOSE;
+                    break;
+                case Op::UNLINKAT:
+                    sqe->opcode = IORING_OP_UNLINKAT;
+                    sqe->addr = reinterpret_cast<uint64_t>(
+                                    op.filename1.c_str());
+                    break;
+                case Op::TRUNCATE:
+                case Op::NOOP:
+                    break;
             }
-            case Op::UNLINKAT: {
-                FS::removeFile(f, op.filename1);
-                ++unlinks;
-                break;
+            if (prev != NULL)
+                prev->flags |= IOSQE_IO_LINK;
+            prev = sqe;
+            ++chainLength;
+        }
+        ioUring->submitAndWait(chainLength);
+        ++ioUringBatches;
+
+        std::vector<int32_t> results(chainLength, -ECANCELED);
+        uint32_t reaped = 0;
+        while (reaped < chainLength) {
+            uint64_t userData;
+            int32_t result;
+            if (!ioUring->popCompletion(userData, result)) {
+                ioUring->submitAndWait(chainLength - reaped);
+                continue;
             }
-            case Op::NOOP: {
-                break;
+            results.at(userData) = result;
+            ++reaped;
+        }
+
+        for (uint32_t i = 0; i < chainLength; ++i) {
+            Op& op = ops.front();
+            int32_t result = results.at(i);
+            if (result == -ECANCELED) {
+                // An earlier link in the chain ended early; its remaining
+                // ops were never started, so run them the slow way.
+                execute(op);
+            } else if (op.opCode == Op::UNLINKAT && result == -ENOENT) {
+                ++opCounts[op.opCode];
+            } else if (result < 0) {
+                PANIC("Failed to execute filesystem op %d on fd %d: %s",
+                      int(op.opCode), op.fd, strerror(-result));
+            } else if (op.opCode == Op::WRITE &&
+                       uint64_t(result) < op.writeData.getLength() &&
+                       op.offset >= 0) {
+                // Short positioned write: just write it all again (the
+                // remainder alone may not be suitably aligned for O_DIRECT).
+                // The rest of the chain was canceled and is handled above.
+                execute(op);
+            } else if (op.opCode == Op::WRITE &&
+                       uint64_t(result) < op.writeData.getLength()) {
+                // Short write: finish it synchronously. The rest of the
+                // chain was canceled and is handled above.
+                uint64_t rest = op.writeData.getLength() - uint64_t(result);
+                if (FS::write(op.fd,
+                              static_cast<const char*>(
+                                    op.writeData.getData()) + result,
+                              rest) < 0) {
+                    PANIC("Failed to write to fd %d: %s",
+                          op.fd,
+                          strerror(errno));
+                }
+                bytesWritten += op.writeData.getLength();
+                ++opCounts[op.opCode];
+            } else {
+                if (op.opCode == Op::WRITE)
+                    bytesWritten += op.writeData.getLength();
+                ++opCounts[op.opCode];
             }
+            ops.pop_front();
         }
-        f.release();
-        ops.pop_front();
     }
+}
 
-    waitEnd = Clock::now();
-    std::chrono::nanoseconds elapsed = waitEnd - waitStart;
-    if (elapsed > diskWriteDurationThreshold) {
-        WARNING("Executing filesystem operations took longer than expected "
-                "(%s for %lu writes totaling %lu bytes, %lu truncates, "
-                "%lu renames, %lu fdatasyncs, %lu fsyncs, %lu closes, and "
-                "%lu unlinks)",
-                Core::StringUtil::toString(elapsed).c_str(),
-                writes,
-                totalBytesWritten,
-                truncates,
-                renames,
-                fdatasyncs,
-                fsyncs,
-                closes,
-                unlinks);
+bool
+SegmentedLog::Sync::ioUringCanExecute(const Op& op) const
+{
+    switch (op.opCode) {
+        case Op::WRITE:
+        case Op::FDATASYNC:
+        case Op::FSYNC:
+        case Op::CLOSE:
+            // IOUring::create() checks for these.
+            return true;
+        case Op::RENAME:
+            return ioUring->isSupported(IORING_OP_RENAMEAT);
+        case Op::UNLINKAT:
+            return ioUring->isSupported(IORING_OP_UNLINKAT);
+        case Op::TRUNCATE: // io_uring has no ftruncate on the kernels we target
+        case Op::NOOP:
+            return false;
     }
+    return false;
 }
 
 void
@@ -353,6 +553,10 @@ SegmentedLog::SegmentedLog(const FS::File& parentDir,
     , shouldCheckInvariants(config.read<bool>("storageDebug", false))
     , diskWriteDurationThreshold(config.read<uint64_t>(
         "electionTimeoutMilliseconds", 500) / 4)
+    , ioUring(openIOUring(config))
+    , directIO(config.read<bool>("storageDirectIO", false))
+    , directIOOffset(0)
+    , directIOPending()
     , metadata()
     , dir(FS::openDir(parentDir,
                       (encoding == Encoding::BINARY
@@ -365,7 +569,8 @@ SegmentedLog::SegmentedLog(const FS::File& parentDir,
     , preparedSegments(
         std::max(config.read<uint64_t>("storageOpenSegments", 3),
                  1UL))
-    , currentSync(new SegmentedLog::Sync(0, diskWriteDurationThreshold))
+    , currentSync(new SegmentedLog::Sync(0, diskWriteDurationThreshold,
+                                         ioUring.get()))
     , metadataWriteNanos()
     , filesystemOpsNanos()
     , segmentPreparer()
@@ -519,6 +724,7 @@ SegmentedLog::append(const std::vector<const Entry*>& entries)
 
             // Truncate away any extra 0 bytes at the end from when
             // MAX_SEGMENT_SIZE was allocated.
+            flushDirectIO();
             currentSync->ops.emplace_back(openSegmentFile.fd,
                                           Sync::Op::TRUNCATE);
             currentSync->ops.back().size = openSegment->bytes;
@@ -559,12 +765,20 @@ SegmentedLog::append(const std::vector<const Entry*>& entries)
 
         openSegment->entries.emplace_back(std::move(record));
         openSegment->bytes += buf.getLength();
-        currentSync->ops.emplace_back(openSegmentFile.fd, Sync::Op::WRITE);
-        currentSync->ops.back().writeData = std::move(buf);
+        if (directIO) {
+            const char* data = static_cast<const char*>(buf.getData());
+            directIOPending.insert(directIOPending.end(),
+                                   data, data + buf.getLength());
+        } else {
+            currentSync->ops.emplace_back(openSegmentFile.fd,
+                                          Sync::Op::WRITE);
+            currentSync->ops.back().writeData = std::move(buf);
+        }
         ++openSegment->endIndex;
         ++index;
     }
 
+    flushDirectIO();
     currentSync->ops.emplace_back(openSegmentFile.fd, Sync::Op::FDATASYNC);
     currentSync->lastIndex = getLastLogIndex();
     checkInvariants();
@@ -626,7 +840,8 @@ SegmentedLog::takeSync()
 {
     std::unique_ptr<SegmentedLog::Sync> other(
             new SegmentedLog::Sync(getLastLogIndex(),
-                                   diskWriteDurationThreshold));
+                                   diskWriteDurationThreshold,
+                                   ioUring.get()));
     std::swap(other, currentSync);
     return std::move(other);
 }
@@ -913,17 +1128,18 @@ SegmentedLog::loadClosedSegment(Segment& segment, uint64_t logStartIndex)
     FS::File file = FS::openFile(dir, segment.filename, O_RDWR);
     FS::FileContents reader(file);
     uint64_t offset = 0;
+    uint8_t version = 0;
 
     if (reader.getFileLength() < 1) {
         PANIC("Found completely empty segment file %s (it doesn't even have "
               "a version field)",
               segment.filename.c_str());
     } else {
-        uint8_t version = *reader.get<uint8_t>(0, 1);
+        version = *reader.get<uint8_t>(0, 1);
         offset += 1;
-        if (version != 1) {
+        if (version != 1 && version != 2) {
             PANIC("Segment version read from %s was %u, but this code can "
-                  "only read version 1",
+                  "only read versions 1 and 2",
                   segment.filename.c_str(),
                   version);
         }
@@ -944,6 +1160,7 @@ SegmentedLog::loadClosedSegment(Segment& segment, uint64_t logStartIndex)
          index <= segment.endIndex;
          ++index) {
         std::string error;
+        offset = skipPadding(reader, version, offset);
         if (offset >= reader.getFileLength()) {
             error = "File too short";
         } else {
@@ -961,6 +1178,7 @@ SegmentedLog::loadClosedSegment(Segment& segment, uint64_t logStartIndex)
                   error.c_str());
         }
     }
+    offset = skipPadding(reader, version, offset);
     if (offset < reader.getFileLength()) {
         WARNING("Found an extra %lu bytes at the end of closed segment "
                 "%s. This can happen if the server crashed while "
@@ -983,17 +1201,18 @@ SegmentedLog::loadOpenSegment(Segment& segment, uint64_t logStartIndex)
     FS::File file = FS::openFile(dir, segment.filename, O_RDWR);
     FS::FileContents reader(file);
     uint64_t offset = 0;
+    uint8_t version = 0;
 
     if (reader.getFileLength() < 1) {
         WARNING("Found completely empty segment file %s (it doesn't even have "
                 "a version field)",
                 segment.filename.c_str());
     } else {
-        uint8_t version = *reader.get<uint8_t>(0, 1);
+        version = *reader.get<uint8_t>(0, 1);
         offset += 1;
-        if (version != 1) {
+        if (version != 1 && version != 2) {
             PANIC("Segment version read from %s was %u, but this code can "
-                  "only read version 1",
+                  "only read versions 1 and 2",
                   segment.filename.c_str(),
                   version);
         }
@@ -1001,6 +1220,9 @@ SegmentedLog::loadOpenSegment(Segment& segment, uint64_t logStartIndex)
 
     uint64_t lastIndex = 0;
     while (offset < reader.getFileLength()) {
+        offset = skipPadding(reader, version, offset);
+        if (offset >= reader.getFileLength())
+            break;
         segment.entries.emplace_back(offset);
         std::string error = readProtoFromFile(
                 file,
@@ -1199,6 +1421,71 @@ SegmentedLog::openNewSegment()
     newSegment.filename = s.first;
     openSegmentFile = std::move(s.second);
     segmentsByStartIndex.insert({newSegment.startIndex, newSegment});
+
+    if (directIO) {
+        directIOOffset = sizeof(SegmentHeader);
+        directIOPending.clear();
+    }
+}
+
+void
+SegmentedLog::flushDirectIO()
+{
+    if (directIOPending.empty())
+        return;
+    // A new segment's first write must also cover the segment header, which
+    // prepareNewSegment() wrote (and synced) with the same contents. All
+    // later writes start at a block boundary, so no record that may already
+    // be durable is ever written again.
+    SegmentHeader header;
+    header.version = 2;
+    uint64_t start = directIOOffset / DIRECT_IO_BLOCK_SIZE *
+                     DIRECT_IO_BLOCK_SIZE;
+    uint64_t prefixLength = directIOOffset - start;
+    assert(prefixLength == 0 ||
+           (start == 0 && prefixLength == sizeof(header)));
+    uint64_t length = prefixLength + directIOPending.size();
+    uint64_t paddedLength = ((length + DIRECT_IO_BLOCK_SIZE - 1) /
+                             DIRECT_IO_BLOCK_SIZE * DIRECT_IO_BLOCK_SIZE);
+    void* data = NULL;
+    int errnum = posix_memalign(&data, DIRECT_IO_BLOCK_SIZE, paddedLength);
+    if (errnum != 0) {
+        PANIC("Could not allocate %lu bytes for aligned write: %s",
+              paddedLength, strerror(errnum));
+    }
+    char* buf = static_cast<char*>(data);
+    Core::Util::memcpy(buf, {
+        {&header, prefixLength},
+        {directIOPending.data(), directIOPending.size()},
+    });
+    memset(buf + length, 0, paddedLength - length);
+
+    currentSync->ops.emplace_back(openSegmentFile.fd, Sync::Op::WRITE);
+    currentSync->ops.back().writeData = Core::Buffer(buf, paddedLength, free);
+    currentSync->ops.back().offset = int64_t(start);
+
+    // The padding becomes part of the segment, so that the next record
+    // starts in a fresh block.
+    Segment& openSegment = getOpenSegment();
+    assert(directIOOffset + directIOPending.size() == openSegment.bytes);
+    directIOOffset = start + paddedLength;
+    directIOPending.clear();
+    openSegment.bytes = directIOOffset;
+}
+
+uint64_t
+SegmentedLog::skipPadding(FS::FileContents& reader,
+                          uint8_t version,
+                          uint64_t offset) const
+{
+    if (version < 2 ||
+        offset % DIRECT_IO_BLOCK_SIZE == 0 ||
+        offset >= reader.getFileLength() ||
+        *reader.get<uint8_t>(offset, 1) != 0) {
+        return offset;
+    }
+    uint64_t next = (offset / DIRECT_IO_BLOCK_SIZE + 1) * DIRECT_IO_BLOCK_SIZE;
+    return std::min(next, reader.getFileLength());
 }
 
 std::string
@@ -1318,7 +1605,7 @@ SegmentedLog::prepareNewSegment(uint64_t id)
                                  O_CREAT|O_EXCL|O_RDWR);
     FS::allocate(file, 0, MAX_SEGMENT_SIZE);
     SegmentHeader header;
-    header.version = 1;
+    header.version = directIO ? 2 : 1;
     ssize_t written = FS::write(file.fd,
                                 &header,
                                 sizeof(header));
@@ -1328,6 +1615,17 @@ SegmentedLog::prepareNewSegment(uint64_t id)
     }
     FS::fsync(file);
     FS::fsync(dir);
+    if (directIO) {
+        // Only writes from now on need to bypass the page cache. If the
+        // filesystem doesn't support O_DIRECT, the aligned writes still
+        // work, just through the page cache.
+        int flags = fcntl(file.fd, F_GETFL);
+        if (flags < 0 || fcntl(file.fd, F_SETFL, flags | O_DIRECT) != 0) {
+            WARNING("Could not enable O_DIRECT on %s (continuing with "
+                    "buffered writes): %s",
+                    file.path.c_str(), strerror(errno));
+        }
+    }
 
     TimePoint end = Clock::now();
     std::chrono::nanoseconds elapsed = end - start;
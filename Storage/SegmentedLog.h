@@ -24,6 +24,7 @@
 #include "Core/Mutex.h"
 #include "Core/RollingStat.h"
 #include "Storage/FilesystemUtil.h"
+#include "Storage/IOUring.h"
 #include "Storage/Log.h"
 
 #ifndef LOGCABIN_STORAGE_SEGMENTEDLOG_H
@@ -83,8 +84,11 @@ namespace Storage {
  * start at entry 15, that entire segment will be retained.
  *
  * Each segment file starts with a segment header, which currently contains
- * just a one-byte version number for the format of that segment. The current
- * format (version 1) is just a concatenation of serialized entry records.
+ * just a one-byte version number for the format of that segment. Version 1
+ * is just a concatenation of serialized entry records. Version 2, written in
+ * direct I/O mode, is the same except that a record may be followed by zeros
+ * up to the next DIRECT_IO_BLOCK_SIZE boundary (records never start with a
+ * zero byte, so readers can tell padding from the next record).
  */
 class SegmentedLog : public Log {
     /**
@@ -108,6 +112,13 @@ class SegmentedLog : public Log {
       BINARY,
     };
 
+    /**
+     * Writes to open segments in direct I/O mode must be aligned to this many
+     * bytes, in offset and length. Segments of version 2 may therefore have
+     * zero padding after any record, up to the next multiple of this size.
+     */
+    enum { DIRECT_IO_BLOCK_SIZE = 4096 };
+
     /**
      * Constructor.
      * \param parentDir
@@ -280,6 +291,7 @@ class SegmentedLog : public Log {
                 , filename1()
                 , filename2()
                 , size(0)
+                , offset(-1)
             {
             }
             int fd;
@@ -288,10 +300,25 @@ class SegmentedLog : public Log {
             std::string filename1;
             std::string filename2;
             uint64_t size;
+            /// For WRITE: the file offset to write at, or -1 to write at
+            /// (and advance) the file's current offset.
+            int64_t offset;
         };
 
+        /**
+         * Constructor.
+         * \param lastIndex
+         *      See Log::Sync::lastIndex.
+         * \param diskWriteDurationThreshold
+         *      See #diskWriteDurationThreshold.
+         * \param ioUring
+         *      If not NULL, wait() submits ops through this io_uring in
+         *      linked batches; otherwise it executes them one system call
+         *      at a time.
+         */
         explicit Sync(uint64_t lastIndex,
-                      std::chrono::nanoseconds diskWriteDurationThreshold);
+                      std::chrono::nanoseconds diskWriteDurationThreshold,
+                      IOUring* ioUring = NULL);
         ~Sync();
         /**
          * Add how long the filesystem ops took to 'nanos'. This is invoked
@@ -305,14 +332,43 @@ class SegmentedLog : public Log {
          */
         void optimize();
         void wait();
+        /**
+         * Execute a single op with blocking system calls, and count it in
+         * #opCounts.
+         */
+        void execute(Op& op);
+        /**
+         * Execute all of #ops using #ioUring. Runs of ops that io_uring
+         * supports are submitted as chains of linked entries, so that the
+         * kernel executes them in order; the rest (and any op whose chain was
+         * cut short by a short write) fall back to execute().
+         */
+        void executeWithIOUring();
+        /**
+         * Return true if executeWithIOUring() can submit the given op to
+         * #ioUring; the others are executed with blocking system calls.
+         */
+        bool ioUringCanExecute(const Op& op) const;
         /// If a wait() exceeds this time, log a warning.
         const std::chrono::nanoseconds diskWriteDurationThreshold;
+        /// See constructor. Not owned.
+        IOUring* ioUring;
+        /// The number of ops of each type executed, indexed by OpCode.
+        uint64_t opCounts[Op::NOOP + 1];
+        /// The total number of bytes written by WRITE ops.
+        uint64_t bytesWritten;
+        /// The number of batches submitted to #ioUring.
+        uint64_t ioUringBatches;
         /// List of operations to perform during wait().
         std::deque<Op> ops;
         /// Time at start of wait() call.
         TimePoint waitStart;
         /// Time at end of wait() call.
         TimePoint waitEnd;
+
+        // Sync is non-copyable.
+        Sync(const Sync&) = delete;
+        Sync& operator=(const Sync&) = delete;
     };
 
     /**
@@ -386,7 +442,7 @@ class SegmentedLog : public Log {
      */
     struct SegmentHeader {
         /**
-         * Always set to 1 for now.
+         * 1, or 2 if records may be followed by padding (see class comment).
          */
         uint8_t version;
     } __attribute__((packed));
@@ -481,6 +537,15 @@ class SegmentedLog : public Log {
      */
     void closeSegment();
 
+    /**
+     * In direct I/O mode, queue a single block-aligned WRITE for the records
+     * buffered in #directIOPending, padded with zeros to a whole number of
+     * blocks, and advance the open segment to the end of that padding so
+     * that the next write starts in a fresh block. Does nothing if no
+     * records are buffered.
+     */
+    void flushDirectIO();
+
     /**
      * Return a reference to the current open segment (the one that new writes
      * should go into). Crashes if there is no open segment (but it's an
@@ -498,6 +563,15 @@ class SegmentedLog : public Log {
      */
     void openNewSegment();
 
+    /**
+     * In segments of version 2, return the offset of the next record given
+     * the end of the previous one: if a zero byte follows it, the rest of
+     * the block is padding and is skipped. Otherwise, return 'offset'.
+     */
+    uint64_t skipPadding(FilesystemUtil::FileContents& reader,
+                         uint8_t version,
+                         uint64_t offset) const;
+
     /**
      * Read the next ProtoBuf record out of 'file'.
      * \param file
@@ -587,6 +661,38 @@ class SegmentedLog : public Log {
      */
     const std::chrono::milliseconds diskWriteDurationThreshold;
 
+    /**
+     * Used by Sync objects to execute filesystem operations if the
+     * "storageIOEngine" config option is "io_uring" and the kernel supports
+     * it; otherwise NULL.
+     */
+    std::unique_ptr<IOUring> ioUring;
+
+    /**
+     * Set to true if the "storageDirectIO" config option is set. Open
+     * segments are then opened with O_DIRECT, bypassing the page cache, and
+     * each append() is written as one block-aligned write that starts in a
+     * fresh block and is padded with zeros to a block boundary. Blocks that
+     * hold synced records are never written again, so a torn write can only
+     * damage records that were not yet durable. The segments use version 2
+     * of the format (see class comment).
+     */
+    const bool directIO;
+
+    /**
+     * In direct I/O mode, the offset in the open segment at which
+     * #directIOPending begins. This is a multiple of DIRECT_IO_BLOCK_SIZE,
+     * except for a new segment's first write, which begins just after the
+     * segment header.
+     */
+    uint64_t directIOOffset;
+
+    /**
+     * In direct I/O mode, serialized records appended to the open segment
+     * that have not been queued as a write yet (the write-combining buffer).
+     */
+    std::vector<char> directIOPending;
+
     /**
      * The metadata this class mintains. This should be combined with the
      * superclass's metadata when being written out to disk.
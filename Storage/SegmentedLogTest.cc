@@ -625,6 +625,119 @@ TEST_F(StorageSegmentedLogTest, append_rollover)
     construct(); // extra sanity checks
 }
 
+TEST_F(StorageSegmentedLogTest, append_rollover_ioUring)
+{
+    config.set("storageIOEngine", "io_uring");
+    construct();
+    if (!log->ioUring) {
+        WARNING("io_uring is not available; skipping test");
+        return;
+    }
+    log->truncatePrefix(3);
+    std::vector<const Log::Entry*> entries;
+    for (uint64_t i = 3; i <= 19; ++i)
+        entries.push_back(&sampleEntry);
+    log->append(entries);
+    std::unique_ptr<Log::Sync> sync = log->takeSync();
+    sync->wait();
+    EXPECT_LT(0U, static_cast<SegmentedLog::Sync*>(sync.get())->
+                    ioUringBatches);
+    log->syncComplete(std::move(sync));
+    log->truncateSuffix(18); // TRUNCATE goes through the synchronous path
+    log->append({&sampleEntry});
+    this->sync();
+    FS::File logDir = FS::dup(log->dir);
+    log.reset();
+    EXPECT_EQ((std::vector<std::string> {
+                    "00000000000000000003-00000000000000000016",
+                    "00000000000000000017-00000000000000000018",
+                    "00000000000000000019-00000000000000000019",
+                    "metadata1",
+                    "metadata2",
+               }),
+              sorted(FS::ls(logDir)));
+    construct();
+    EXPECT_EQ(3U, log->getLogStartIndex());
+    EXPECT_EQ(19U, log->getLastLogIndex());
+    EXPECT_EQ("foo", log->getEntry(19).data());
+}
+
+TEST_F(StorageSegmentedLogTest, append_rollover_ioUringWithoutRename)
+{
+    config.set("storageIOEngine", "io_uring");
+    construct();
+    if (!log->ioUring) {
+        WARNING("io_uring is not available; skipping test");
+        return;
+    }
+    // as on kernels before 5.11
+    log->ioUring->supportedOps.reset(IORING_OP_RENAMEAT);
+    log->ioUring->supportedOps.reset(IORING_OP_UNLINKAT);
+    log->truncatePrefix(3);
+    std::vector<const Log::Entry*> entries;
+    for (uint64_t i = 3; i <= 19; ++i)
+        entries.push_back(&sampleEntry);
+    log->append(entries);
+    std::unique_ptr<Log::Sync> sync = log->takeSync();
+    sync->wait();
+    SegmentedLog::Sync* s = static_cast<SegmentedLog::Sync*>(sync.get());
+    EXPECT_LT(0U, s->ioUringBatches);
+    EXPECT_LT(0U, s->opCounts[SegmentedLog::Sync::Op::RENAME]);
+    log->syncComplete(std::move(sync));
+    FS::File logDir = FS::dup(log->dir);
+    log.reset();
+    EXPECT_EQ((std::vector<std::string> {
+                    "00000000000000000003-00000000000000000016",
+                    "00000000000000000017-00000000000000000019",
+                    "metadata1",
+                    "metadata2",
+               }),
+              sorted(FS::ls(logDir)));
+}
+
+TEST_F(StorageSegmentedLogTest, append_directIO)
+{
+    const uint64_t BLOCK = SegmentedLog::DIRECT_IO_BLOCK_SIZE;
+    config.set("storageDirectIO", true);
+    config.set<uint64_t>("storageSegmentBytes", 3 * BLOCK);
+    construct();
+    log->truncatePrefix(3);
+    for (uint64_t i = 3; i <= 9; ++i) {
+        log->append({&sampleEntry});
+        // each append is padded out to a block boundary...
+        EXPECT_EQ(log->directIOOffset, log->getOpenSegment().bytes);
+        EXPECT_EQ(0U, log->directIOOffset % BLOCK);
+        // ...so the next one never rewrites it
+        const SegmentedLog::Sync::Op& write =
+            log->currentSync->ops.at(log->currentSync->ops.size() - 2);
+        EXPECT_EQ(SegmentedLog::Sync::Op::WRITE, write.opCode);
+        EXPECT_EQ(int64_t((i - 3) % 3 * BLOCK), write.offset);
+        if (i % 2 == 0)
+            sync();
+    }
+    sync();
+    EXPECT_EQ(BLOCK, log->segmentsByStartIndex.at(3).entries.at(1).offset);
+    FS::File logDir = FS::dup(log->dir);
+    log.reset();
+    EXPECT_EQ((std::vector<std::string> {
+                    "00000000000000000003-00000000000000000005",
+                    "00000000000000000006-00000000000000000008",
+                    "00000000000000000009-00000000000000000009",
+                    "metadata1",
+                    "metadata2",
+               }),
+              sorted(FS::ls(logDir)));
+    EXPECT_EQ(3 * BLOCK, getSize(FS::openFile(
+                                logDir,
+                                "00000000000000000003-00000000000000000005",
+                                O_RDONLY)));
+    construct();
+    EXPECT_EQ(9U, log->getLastLogIndex());
+    EXPECT_EQ(BLOCK, log->segmentsByStartIndex.at(6).entries.at(1).offset);
+    EXPECT_EQ("foo", log->getEntry(5).data());
+    EXPECT_EQ("foo", log->getEntry(8).data());
+}
+
 TEST_F(StorageSegmentedLogTest, append_largerThanMaxSegmentSize)
 {
     SegmentedLog::Entry bigEntry = sampleEntry;
@@ -939,9 +1052,10 @@ TEST_F(StorageSegmentedLogTest, loadClosedSegment_unknownVersion)
     FS::File file = FS::openFile(log->dir,
                                  closedSegment.filename,
                                  O_CREAT|O_WRONLY);
-    writeSegmentHeader(file, /*version=*/2);
+    writeSegmentHeader(file, /*version=*/3);
     EXPECT_DEATH(log->loadClosedSegment(closedSegment, 5000),
-                 "version.*was 2, but this code can only read version 1");
+                 "version.*was 3, but this code can only read versions 1 "
+                 "and 2");
 }
 
 TEST_F(StorageSegmentedLogTest, loadClosedSegment_removeUnneeded)
@@ -1050,9 +1164,10 @@ TEST_F(StorageSegmentedLogTest, loadOpenSegment_unknownVersion)
     FS::File file = FS::openFile(log->dir,
                                  openSegment.filename,
                                  O_CREAT|O_WRONLY);
-    writeSegmentHeader(file, /*version=*/2);
+    writeSegmentHeader(file, /*version=*/3);
     EXPECT_DEATH(log->loadOpenSegment(openSegment, 1),
-                 "version.*was 2, but this code can only read version 1");
+                 "version.*was 3, but this code can only read versions 1 "
+                 "and 2");
 }
 
 TEST_F(StorageSegmentedLogTest, loadOpenSegment_removeUnneeded)
@@ -1127,6 +1242,45 @@ TEST_F(StorageSegmentedLogTest, loadOpenSegment_truncateZeroAndOk)
     EXPECT_EQ(4U, openSegment.endIndex);
 }
 
+TEST_F(StorageSegmentedLogTest, loadOpenSegment_padding)
+{
+    const uint64_t BLOCK = SegmentedLog::DIRECT_IO_BLOCK_SIZE;
+    config.set("storageDirectIO", true);
+    config.set<uint64_t>("storageSegmentBytes", 3 * BLOCK);
+    construct();
+    log->truncatePrefix(3);
+    log->append({&sampleEntry}); // index 3
+    log->append({&sampleEntry}); // index 4, in the next block
+    sync();
+    {
+        FS::File oldFile =
+            FS::openFile(log->dir,
+                         log->getOpenSegment().filename,
+                         O_RDONLY);
+        FS::FileContents contents(oldFile);
+        FS::File newFile =
+            FS::openFile(log->dir,
+                         openSegment.filename,
+                         O_CREAT|O_RDWR);
+        EXPECT_LT(0, FS::write(newFile.fd,
+                               contents.get(0, contents.getFileLength()),
+                               contents.getFileLength()));
+    }
+    LogCabin::Core::Debug::setLogPolicy({ // expect warnings
+        {"Storage/SegmentedLog", "ERROR"}
+    });
+    EXPECT_TRUE(log->loadOpenSegment(openSegment, 3));
+    LogCabin::Core::Debug::setLogPolicy({
+        {"", "WARNING"}
+    });
+    EXPECT_EQ(2U, openSegment.entries.size());
+    EXPECT_EQ(sizeof(SegmentedLog::SegmentHeader),
+              openSegment.entries.at(0).offset);
+    EXPECT_EQ(BLOCK, openSegment.entries.at(1).offset);
+    EXPECT_EQ(2 * BLOCK, openSegment.bytes);
+    EXPECT_EQ(4U, openSegment.endIndex);
+}
+
 TEST_F(StorageSegmentedLogTest, closeSegment_empty)
 {
     std::string filename = log->getOpenSegment().filename;
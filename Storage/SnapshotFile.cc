@@ -171,8 +171,9 @@ Writer::Writer(const Storage::Layout& storageLayout)
         Core::Time::makeTimeSpec(Core::Time::SystemClock::now());
     stagingName = format("partial.%010lu.%06lu",
                          now.tv_sec, now.tv_nsec / 1000);
+    // Opened for reading too, so that mapContents() works.
     file = FilesystemUtil::openFile(parentDir, stagingName,
-                                    O_WRONLY|O_CREAT|O_EXCL);
+                                    O_RDWR|O_CREAT|O_EXCL);
 }
 
 Writer::~Writer()
@@ -221,6 +222,15 @@ Writer::save()
     return fileSize;
 }
 
+std::unique_ptr<FilesystemUtil::FileContents>
+Writer::mapContents() const
+{
+    if (file.fd < 0)
+        PANIC("File already closed");
+    return std::unique_ptr<FilesystemUtil::FileContents>(
+        new FilesystemUtil::FileContents(file));
+}
+
 uint64_t
 Writer::getBytesWritten() const
 {
@@ -140,6 +140,12 @@ class Writer : public Core::ProtoBuf::OutputStream {
      *      Size in bytes of the file
      */
     uint64_t save();
+    /**
+     * Map the file's current contents into memory for reading. The mapping
+     * remains valid after the file is saved or discarded.
+     * If you call this after the file has been closed, it will PANIC.
+     */
+    std::unique_ptr<FilesystemUtil::FileContents> mapContents() const;
     // See Core::ProtoBuf::OutputStream.
     uint64_t getBytesWritten() const;
     // See Core::ProtoBuf::OutputStream.
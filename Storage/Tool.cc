@@ -18,14 +18,19 @@
 #include <sys/file.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
 
 #include "build/Server/SnapshotMetadata.pb.h"
 #include "build/Server/SnapshotStateMachine.pb.h"
+#include "Core/Compression.h"
 #include "Core/Config.h"
 #include "Core/Debug.h"
+#include "Core/Histogram.h"
 #include "Core/ProtoBuf.h"
 #include "Core/StringUtil.h"
 #include "Core/ThreadId.h"
@@ -33,6 +38,7 @@
 #include "Storage/Layout.h"
 #include "Storage/Log.h"
 #include "Storage/LogFactory.h"
+#include "Storage/SegmentScanner.h"
 #include "Storage/SnapshotFile.h"
 #include "Tree/Tree.h"
 
@@ -49,14 +55,18 @@ class OptionParser {
         : argc(argc)
         , argv(argv)
         , configFilename("logcabin.conf")
+        , scan(false)
+        , numThreads(std::max(1U, std::thread::hardware_concurrency()))
     {
         while (true) {
             static struct option longOptions[] = {
                {"config",  required_argument, NULL, 'c'},
                {"help",  no_argument, NULL, 'h'},
+               {"scan",  no_argument, NULL, 's'},
+               {"threads",  required_argument, NULL, 't'},
                {0, 0, 0, 0}
             };
-            int c = getopt_long(argc, argv, "c:hi:", longOptions, NULL);
+            int c = getopt_long(argc, argv, "c:hst:", longOptions, NULL);
 
             // Detect the end of the options.
             if (c == -1)
@@ -69,6 +79,16 @@ class OptionParser {
                 case 'c':
                     configFilename = optarg;
                     break;
+                case 's':
+                    scan = true;
+                    break;
+                case 't':
+                    numThreads = uint32_t(atoi(optarg));
+                    if (numThreads < 1) {
+                        usage();
+                        exit(1);
+                    }
+                    break;
                 case '?':
                 default:
                     // getopt_long already printed an error message.
@@ -95,6 +115,22 @@ class OptionParser {
             << "equivalent of a fsck for the log."
             << std::endl
             << std::endl
+            << "With --scan, this instead summarizes the storage directory "
+            << "without loading"
+            << std::endl
+            << "it: each log segment is checked and described on one line "
+            << "(entry counts,"
+            << std::endl
+            << "indexes, terms, configurations, entry sizes, and checksum "
+            << "failures), and the"
+            << std::endl
+            << "snapshot's files and directories are counted without "
+            << "building the tree."
+            << std::endl
+            << "This never modifies the log, and it reads several segments "
+            << "at once."
+            << std::endl
+            << std::endl
             << "This program is subject to change (it is not part of "
             << "LogCabin's stable API)."
             << std::endl
@@ -116,12 +152,28 @@ class OptionParser {
             << std::endl
             << "                               "
             << "[default: logcabin.conf]"
+            << std::endl
+
+            << "  -s, --scan                   "
+            << "Summarize the log and snapshot instead of"
+            << std::endl
+            << "                               "
+            << "dumping them"
+            << std::endl
+
+            << "  -t <num>, --threads=<num>    "
+            << "Scan up to <num> log segments at once"
+            << std::endl
+            << "                               "
+            << "[default: the number of CPUs]"
             << std::endl;
     }
 
     int& argc;
     char**& argv;
     std::string configFilename;
+    bool scan;
+    uint32_t numThreads;
 };
 
 void
@@ -143,8 +195,92 @@ dumpTree(const Tree::Tree& tree, const std::string& path = "/")
     }
 }
 
+/**
+ * Check every segment of the log without loading it, and print what was
+ * found.
+ */
+void
+scanLog(const Core::Config& config,
+        Storage::Layout& storageLayout,
+        uint32_t numThreads)
+{
+    using Storage::SegmentedLog;
+    namespace SegmentScanner = Storage::SegmentScanner;
+    std::string module =
+        config.read<std::string>("storageModule", "Segmented");
+    SegmentedLog::Encoding encoding;
+    std::string dirName;
+    if (module == "Segmented" || module == "Segmented-Binary") {
+        encoding = SegmentedLog::Encoding::BINARY;
+        dirName = "Segmented-Binary";
+    } else if (module == "Segmented-Text") {
+        encoding = SegmentedLog::Encoding::TEXT;
+        dirName = "Segmented-Text";
+    } else {
+        NOTICE("Scanning is only supported for segmented logs, not %s",
+               module.c_str());
+        return;
+    }
+    Storage::FilesystemUtil::File dir =
+        Storage::FilesystemUtil::openDir(storageLayout.logDir, dirName);
+
+    std::vector<SegmentScanner::SegmentSummary> summaries =
+        SegmentScanner::scanSegments(dir, encoding, numThreads);
+    NOTICE("Log segments start");
+    uint64_t numEntries = 0;
+    uint64_t numConfigurations = 0;
+    uint64_t numChecksumFailures = 0;
+    uint64_t numParseFailures = 0;
+    uint64_t numErrors = 0;
+    uint64_t numDiscontinuities = 0;
+    uint64_t bytes = 0;
+    uint64_t lastIndex = 0;
+    uint64_t maxTerm = 0;
+    Core::Histogram entryBytes;
+    for (auto it = summaries.begin(); it != summaries.end(); ++it) {
+        std::cout << *it << std::endl;
+        if (it->numEntries > 0) {
+            if (lastIndex > 0 && it->firstIndex != lastIndex + 1)
+                ++numDiscontinuities;
+            lastIndex = it->lastIndex;
+            maxTerm = std::max(maxTerm, it->maxTerm);
+        }
+        numEntries += it->numEntries;
+        numConfigurations += it->numConfigurations;
+        numChecksumFailures += it->numChecksumFailures;
+        numParseFailures += it->numParseFailures;
+        if (!it->error.empty())
+            ++numErrors;
+        bytes += it->fileBytes;
+        entryBytes.merge(it->entryBytes);
+    }
+    NOTICE("Log segments end");
+    std::cout << summaries.size() << " segments, "
+              << bytes << " bytes, "
+              << numEntries << " entries, "
+              << "last index " << lastIndex << ", "
+              << "max term " << maxTerm << ", "
+              << numConfigurations << " configurations" << std::endl
+              << numChecksumFailures << " checksum failures, "
+              << numParseFailures << " parse failures, "
+              << numErrors << " unreadable segments, "
+              << numDiscontinuities << " gaps between segments" << std::endl
+              << "Entry sizes in bytes:" << std::endl
+              << entryBytes
+              << "max: " << entryBytes.getPercentile(100) << std::endl;
+}
+
+/**
+ * Read the snapshot and print its headers.
+ * \param storageLayout
+ *      Where to find the snapshot.
+ * \param summarize
+ *      If false, load the tree and print its contents. If true, just count
+ *      the files and directories, which doesn't need to hold the tree in
+ *      memory.
+ */
 void
-readSnapshot(Storage::Layout& storageLayout)
+readSnapshot(Storage::Layout& storageLayout, bool summarize)
 {
     std::unique_ptr<Storage::SnapshotFile::Reader> reader;
     try {
@@ -181,25 +317,35 @@ readSnapshot(Storage::Layout& storageLayout)
         NOTICE("Snapshot header end");
     }
 
-    { // Check that the state machine part of the snapshot uses format
-      // version 1
-        uint8_t version = 0;
+    // Check that the state machine part of the snapshot uses format
+    // version 1, 2, or 3
+    uint8_t version = 0;
+    {
         uint64_t bytesRead = reader->readRaw(&version, sizeof(version));
         if (bytesRead < 1) {
             PANIC("Snapshot file too short (no state machine version "
                   "field)");
         } else {
-            if (version != 1) {
+            if (version < 1 || version > 3) {
                 PANIC("State machine format version in snapshot read was "
-                      "%u, but this code can only read version 1",
-                      version);
+                      "%u, but this code can only read versions 1 through "
+                      "3", version);
             }
         }
     }
 
+    // Version 3 is version 2 wrapped in a compressed container.
+    Core::ProtoBuf::InputStream* contents = reader.get();
+    std::unique_ptr<Core::Compression::CompressedInputStream> decompressor;
+    if (version == 3) {
+        decompressor.reset(
+            new Core::Compression::CompressedInputStream(*reader));
+        contents = decompressor.get();
+    }
+
     { // Load snapshot header
         Server::SnapshotStateMachine::Header header;
-        std::string error = reader->readMessage(header);
+        std::string error = contents->readMessage(header);
         if (!error.empty()) {
             PANIC("Couldn't read state machine header from snapshot: %s",
                   error.c_str());
@@ -210,9 +356,38 @@ readSnapshot(Storage::Layout& storageLayout)
 
     }
 
+    if (summarize) {
+        Tree::Internal::SnapshotSummary summary;
+        std::string error;
+        if (version == 1)
+            error = Tree::Tree::summarizeSnapshot(*contents, summary);
+        else
+            error = Tree::Tree::summarizeSnapshotSections(*contents, summary);
+        std::cout << summary.numDirectories << " directories, "
+                  << summary.numFiles << " files, "
+                  << summary.fileBytes << " bytes in files, "
+                  << "max depth " << summary.maxDepth;
+        if (version > 1)
+            std::cout << ", " << summary.numSections << " sections";
+        std::cout << std::endl
+                  << "File sizes in bytes:" << std::endl
+                  << summary.fileSizes
+                  << "max: " << summary.fileSizes.getPercentile(100)
+                  << std::endl;
+        if (!error.empty())
+            std::cout << "ERROR: " << error << std::endl;
+        return;
+    }
+
     { // read Tree from stream
         Tree::Tree tree;
-        tree.loadSnapshot(*reader);
+        if (version == 1) {
+            tree.loadSnapshot(*contents);
+        } else {
+            tree.loadSnapshotSections(
+                *contents,
+                std::max(1U, std::thread::hardware_concurrency()));
+        }
         NOTICE("Snapshot tree start");
         dumpTree(tree);
         NOTICE("Snapshot tree end");
@@ -248,6 +423,16 @@ main(int argc, char** argv)
         Storage::Layout storageLayout;
         storageLayout.init(config, serverId);
 
+        if (options.scan) {
+            NOTICE("Scanning log at %s",
+                   storageLayout.serverDir.path.c_str());
+            scanLog(config, storageLayout, options.numThreads);
+            NOTICE("Scanning snapshot at %s",
+                   storageLayout.serverDir.path.c_str());
+            readSnapshot(storageLayout, true);
+            return 0;
+        }
+
         NOTICE("Opening log at %s", storageLayout.serverDir.path.c_str());
         {
             std::unique_ptr<Storage::Log> log =
@@ -258,7 +443,7 @@ main(int argc, char** argv)
         }
 
         NOTICE("Reading snapshot at %s", storageLayout.serverDir.path.c_str());
-        readSnapshot(storageLayout);
+        readSnapshot(storageLayout, false);
 
         return 0;
 
@@ -75,6 +75,9 @@ readWriteTreeRPC(Tree& tree,
                             request.write().contents());
     } else if (request.has_remove_file()) {
         result = tree.removeFile(request.remove_file().path());
+    } else if (request.has_import_directory()) {
+        result = tree.importDirectory(request.import_directory().path(),
+                                      request.import_directory().contents());
     } else {
         PANIC("Unexpected request: %s",
               Core::ProtoBuf::dumpString(request).c_str());
@@ -14,7 +14,12 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <google/protobuf/io/coded_stream.h>
+#include <limits>
+#include <mutex>
+#include <thread>
 
 #include "build/Protocol/ServerStats.pb.h"
 #include "build/Tree/Snapshot.pb.h"
@@ -63,6 +68,29 @@ Result::Result()
 
 namespace Internal {
 
+namespace {
+
+/**
+ * The number of bytes that precede each message in a stream to give its
+ * length (see Core::ProtoBuf::OutputStream).
+ */
+const uint64_t MESSAGE_LENGTH_BYTES = sizeof(uint32_t);
+
+/**
+ * Return the number of bytes a string or bytes field with the given length
+ * takes up in an encoded message. This assumes the field number is at most
+ * 15, so that its tag fits in one byte, as is the case for every field of
+ * Snapshot::File and Snapshot::Directory.
+ */
+uint64_t
+stringFieldBytes(uint64_t length)
+{
+    using google::protobuf::io::CodedOutputStream;
+    return 1 + CodedOutputStream::VarintSize64(length) + length;
+}
+
+} // anonymous namespace
+
 ////////// class File //////////
 
 File::File()
@@ -78,21 +106,37 @@ File::dumpSnapshot(Core::ProtoBuf::OutputStream& stream) const
     stream.writeMessage(file);
 }
 
+uint64_t
+File::getSnapshotBytes() const
+{
+    return MESSAGE_LENGTH_BYTES + stringFieldBytes(contents.size());
+}
+
 void
 File::loadSnapshot(Core::ProtoBuf::InputStream& stream)
 {
-    Snapshot::File node;
-    std::string error = stream.readMessage(node);
+    std::string error = tryLoadSnapshot(stream);
     if (!error.empty()) {
         PANIC("Couldn't read snapshot: %s", error.c_str());
     }
+}
+
+std::string
+File::tryLoadSnapshot(Core::ProtoBuf::InputStream& stream)
+{
+    Snapshot::File node;
+    std::string error = stream.readMessage(node);
+    if (!error.empty())
+        return error;
     contents = node.contents();
+    return "";
 }
 
 ////////// class Directory //////////
 
 Directory::Directory()
-    : directories()
+    : lastModified(0)
+    , directories()
     , files()
 {
 }
@@ -201,24 +245,119 @@ Directory::dumpSnapshot(Core::ProtoBuf::OutputStream& stream) const
         it->second.dumpSnapshot(stream);
 }
 
+uint64_t
+Directory::getSnapshotBytes() const
+{
+    // the Snapshot::Directory message listing the children, as in
+    // dumpSnapshot()
+    uint64_t bytes = MESSAGE_LENGTH_BYTES;
+    for (auto it = directories.begin(); it != directories.end(); ++it)
+        bytes += stringFieldBytes(it->first.size());
+    for (auto it = files.begin(); it != files.end(); ++it)
+        bytes += stringFieldBytes(it->first.size());
+
+    // then the children themselves
+    for (auto it = directories.begin(); it != directories.end(); ++it)
+        bytes += it->second.getSnapshotBytes();
+    for (auto it = files.begin(); it != files.end(); ++it)
+        bytes += it->second.getSnapshotBytes();
+    return bytes;
+}
+
 void
 Directory::loadSnapshot(Core::ProtoBuf::InputStream& stream)
 {
-    Snapshot::Directory dir;
-    std::string error = stream.readMessage(dir);
+    std::string error = tryLoadSnapshot(stream,
+                                        std::numeric_limits<uint64_t>::max());
     if (!error.empty()) {
         PANIC("Couldn't read snapshot: %s", error.c_str());
     }
+}
+
+std::string
+Directory::tryLoadSnapshot(Core::ProtoBuf::InputStream& stream,
+                           uint64_t maxDepth)
+{
+    Snapshot::Directory dir;
+    std::string error = stream.readMessage(dir);
+    if (!error.empty())
+        return error;
+    if (dir.directories_size() > 0 && maxDepth == 0)
+        return "Directories are nested too deeply";
     for (auto it = dir.directories().begin();
          it != dir.directories().end();
          ++it) {
-        directories[*it].loadSnapshot(stream);
+        if (it->empty() || it->find('/') != std::string::npos ||
+            files.find(*it) != files.end()) {
+            return format("Invalid directory name '%s'", it->c_str());
+        }
+        error = directories[*it].tryLoadSnapshot(stream, maxDepth - 1);
+        if (!error.empty())
+            return error;
     }
     for (auto it = dir.files().begin();
          it != dir.files().end();
          ++it) {
-        files[*it].loadSnapshot(stream);
+        if (it->empty() || it->find('/') != std::string::npos ||
+            directories.find(*it) != directories.end()) {
+            return format("Invalid file name '%s'", it->c_str());
+        }
+        error = files[*it].tryLoadSnapshot(stream);
+        if (!error.empty())
+            return error;
+    }
+    return "";
+}
+
+////////// struct SnapshotSections //////////
+
+SnapshotSections::SnapshotSections()
+    : modificationCount(0)
+    , sections()
+{
+}
+
+////////// struct SnapshotSummary //////////
+
+SnapshotSummary::SnapshotSummary()
+    : numDirectories(0)
+    , numFiles(0)
+    , fileBytes(0)
+    , maxDepth(0)
+    , numSections(0)
+    , fileSizes()
+{
+}
+
+std::string
+SnapshotSummary::scanDirectory(Core::ProtoBuf::InputStream& stream,
+                               uint64_t depth)
+{
+    Snapshot::Directory dir;
+    std::string error = stream.readMessage(dir);
+    if (!error.empty())
+        return error;
+    ++numDirectories;
+    maxDepth = std::max(maxDepth, depth);
+    for (auto it = dir.directories().begin();
+         it != dir.directories().end();
+         ++it) {
+        error = scanDirectory(stream, depth + 1);
+        if (!error.empty())
+            return format("%s (under %s)", error.c_str(), it->c_str());
+    }
+    if (dir.files_size() > 0)
+        maxDepth = std::max(maxDepth, depth + 1);
+    for (auto it = dir.files().begin(); it != dir.files().end(); ++it) {
+        Snapshot::File file;
+        error = stream.readMessage(file);
+        if (!error.empty())
+            return format("%s (reading file %s)", error.c_str(), it->c_str());
+        ++numFiles;
+        fileBytes += file.contents().size();
+        fileSizes.push(file.contents().size());
     }
+    return "";
 }
 
 ////////// class Path //////////
@@ -226,7 +365,7 @@ Directory::loadSnapshot(Core::ProtoBuf::InputStream& stream)
 Path::Path(const std::string& symbolic)
     : result()
     , symbolic(symbolic)
-    , parents()
+    , parentsLength(0)
     , target()
 {
     if (!Core::StringUtil::startsWith(symbolic, "/")) {
@@ -236,49 +375,133 @@ Path::Path(const std::string& symbolic)
         return;
     }
 
-    // Add /root prefix (see docs for Tree::superRoot)
-    parents.push_back("root");
-
-    // Split the path into a list of parent components and a target.
-    std::string word;
-    for (auto it = symbolic.begin(); it != symbolic.end(); ++it) {
-        if (*it == '/') {
-            if (!word.empty()) {
-                parents.push_back(word);
-                word.clear();
-            }
-        } else {
-            word += *it;
-        }
+    // The target is the last non-empty component, and everything before it
+    // leads to the parent.
+    size_t end = symbolic.find_last_not_of('/');
+    if (end == std::string::npos) {
+        // Target the root directory from the super root (see docs for
+        // Tree::superRoot).
+        target = "root";
+        return;
     }
-    if (!word.empty())
-        parents.push_back(word);
-    target = parents.back();
-    parents.pop_back();
+    size_t start = symbolic.find_last_of('/', end) + 1;
+    target.assign(symbolic, start, end + 1 - start);
+    parentsLength = start;
+}
+
+bool
+Path::nextParent(size_t& offset, std::string& name) const
+{
+    while (offset < parentsLength && symbolic[offset] == '/')
+        ++offset;
+    if (offset == parentsLength)
+        return false;
+    size_t start = offset;
+    while (symbolic[offset] != '/')
+        ++offset;
+    name.assign(symbolic, start, offset - start);
+    return true;
 }
 
 std::string
-Path::parentsThrough(std::vector<std::string>::const_iterator end) const
+Path::parentsThrough(size_t end) const
 {
-    auto it = parents.begin();
-    ++it; // skip "root"
-    ++end; // end was inclusive, now exclusive
-    if (it == end)
-        return "/";
     std::string ret;
-    do {
-        ret += "/" + *it;
-        ++it;
-    } while (it != end);
+    size_t offset = 0;
+    std::string name;
+    while (offset < end && nextParent(offset, name))
+        ret += "/" + name;
+    if (ret.empty())
+        return "/";
     return ret;
 }
 
+////////// class ParentCache //////////
+
+ParentCache::Slot::Slot()
+    : valid(false)
+    , prefix()
+    , directories()
+{
+}
+
+ParentCache::ParentCache()
+    : slots(NUM_SLOTS)
+{
+}
+
+ParentCache::ParentCache(const ParentCache&)
+    : slots(NUM_SLOTS)
+{
+}
+
+ParentCache&
+ParentCache::operator=(const ParentCache&)
+{
+    clear();
+    return *this;
+}
+
+const std::vector<Directory*>*
+ParentCache::find(const Path& path) const
+{
+    const Slot& slot = slots.at(slotIndex(path));
+    if (slot.valid &&
+        slot.prefix.compare(0, std::string::npos,
+                            path.symbolic, 0, path.parentsLength) == 0) {
+        return &slot.directories;
+    }
+    return NULL;
+}
+
+std::vector<Directory*>&
+ParentCache::insert(const Path& path)
+{
+    Slot& slot = slots.at(slotIndex(path));
+    slot.valid = true;
+    slot.prefix.assign(path.symbolic, 0, path.parentsLength);
+    slot.directories.clear();
+    return slot.directories;
+}
+
+void
+ParentCache::erase(const Path& path)
+{
+    Slot& slot = slots.at(slotIndex(path));
+    if (slot.valid &&
+        slot.prefix.compare(0, std::string::npos,
+                            path.symbolic, 0, path.parentsLength) == 0) {
+        slot.valid = false;
+    }
+}
+
+void
+ParentCache::clear()
+{
+    for (auto it = slots.begin(); it != slots.end(); ++it)
+        it->valid = false;
+}
+
+size_t
+ParentCache::slotIndex(const Path& path)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037UL;
+    for (size_t i = 0; i < path.parentsLength; ++i) {
+        hash ^= uint8_t(path.symbolic[i]);
+        hash *= 1099511628211UL;
+    }
+    return size_t(hash & (NUM_SLOTS - 1));
+}
+
 } // LogCabin::Tree::Internal
 
 ////////// class Tree //////////
 
 Tree::Tree()
     : superRoot()
+    , parentCache()
+    , modificationCount(0)
     , numConditionsChecked(0)
     , numConditionsFailed(0)
     , numMakeDirectoryAttempted(0)
@@ -299,6 +522,8 @@ Tree::Tree()
     , numRemoveFileTargetNotFound(0)
     , numRemoveFileDone(0)
     , numRemoveFileSuccess(0)
+    , numImportDirectoryAttempted(0)
+    , numImportDirectorySuccess(0)
 {
     // Create the root directory so that users don't have to explicitly
     // call makeDirectory("/").
@@ -316,27 +541,26 @@ Result
 Tree::normalLookup(const Path& path, const Directory** parent) const
 {
     *parent = NULL;
-    Result result;
-    const Directory* current = &superRoot;
-    for (auto it = path.parents.begin(); it != path.parents.end(); ++it) {
-        const Directory* next = current->lookupDirectory(*it);
-        if (next == NULL) {
-            if (current->lookupFile(*it) == NULL) {
-                result.status = Status::LOOKUP_ERROR;
-                result.error = format("Parent %s of %s does not exist",
-                                      path.parentsThrough(it).c_str(),
-                                      path.symbolic.c_str());
-            } else {
-                result.status = Status::TYPE_ERROR;
-                result.error = format("Parent %s of %s is a file",
-                                      path.parentsThrough(it).c_str(),
-                                      path.symbolic.c_str());
-            }
-            return result;
-        }
-        current = next;
-    }
-    *parent = current;
+    const std::vector<Directory*>* directories;
+    Result result = lookupParents(path, &directories);
+    if (result.status != Status::OK)
+        return result;
+    *parent = directories->back();
+    return result;
+}
+
+Result
+Tree::modifyLookup(const Path& path, Directory** parent)
+{
+    *parent = NULL;
+    ++modificationCount;
+    const std::vector<Directory*>* directories;
+    Result result = lookupParents(path, &directories);
+    if (result.status != Status::OK)
+        return result;
+    for (auto it = directories->begin(); it != directories->end(); ++it)
+        (*it)->lastModified = modificationCount;
+    *parent = directories->back();
     return result;
 }
 
@@ -345,22 +569,86 @@ Tree::mkdirLookup(const Path& path, Directory** parent)
 {
     *parent = NULL;
     Result result;
+    ++modificationCount;
+    const std::vector<Directory*>* cached = parentCache.find(path);
+    if (cached != NULL) {
+        for (auto it = cached->begin(); it != cached->end(); ++it)
+            (*it)->lastModified = modificationCount;
+        *parent = cached->back();
+        return result;
+    }
+    std::vector<Directory*>& directories = parentCache.insert(path);
     Directory* current = &superRoot;
-    for (auto it = path.parents.begin(); it != path.parents.end(); ++it) {
-        Directory* next = current->makeDirectory(*it);
+    current->lastModified = modificationCount;
+    directories.push_back(current);
+    if (path.parentsLength > 0) {
+        current = superRoot.lookupDirectory("root");
+        current->lastModified = modificationCount;
+        directories.push_back(current);
+    }
+    size_t offset = 0;
+    std::string name;
+    while (path.nextParent(offset, name)) {
+        Directory* next = current->makeDirectory(name);
         if (next == NULL) {
+            parentCache.erase(path);
             result.status = Status::TYPE_ERROR;
             result.error = format("Parent %s of %s is a file",
-                                  path.parentsThrough(it).c_str(),
+                                  path.parentsThrough(offset).c_str(),
                                   path.symbolic.c_str());
             return result;
         }
+        next->lastModified = modificationCount;
+        directories.push_back(next);
         current = next;
     }
     *parent = current;
     return result;
 }
 
+Result
+Tree::lookupParents(const Path& path,
+                    const std::vector<Directory*>** directories) const
+{
+    *directories = parentCache.find(path);
+    Result result;
+    if (*directories != NULL)
+        return result;
+    // Directories are only modified through the non-const lookups, so
+    // casting away const to cache them is safe.
+    std::vector<Directory*>& chain = parentCache.insert(path);
+    const Directory* current = &superRoot;
+    chain.push_back(const_cast<Directory*>(current));
+    if (path.parentsLength > 0) {
+        current = superRoot.lookupDirectory("root");
+        chain.push_back(const_cast<Directory*>(current));
+    }
+    size_t offset = 0;
+    std::string name;
+    while (path.nextParent(offset, name)) {
+        const Directory* next = current->lookupDirectory(name);
+        if (next == NULL) {
+            parentCache.erase(path);
+            if (current->lookupFile(name) == NULL) {
+                result.status = Status::LOOKUP_ERROR;
+                result.error = format("Parent %s of %s does not exist",
+                                      path.parentsThrough(offset).c_str(),
+                                      path.symbolic.c_str());
+            } else {
+                result.status = Status::TYPE_ERROR;
+                result.error = format("Parent %s of %s is a file",
+                                      path.parentsThrough(offset).c_str(),
+                                      path.symbolic.c_str());
+            }
+            return result;
+        }
+        chain.push_back(const_cast<Directory*>(next));
+        current = next;
+    }
+    *directories = &chain;
+    return result;
+}
+
 void
 Tree::dumpSnapshot(Core::ProtoBuf::OutputStream& stream) const
 {
@@ -374,7 +662,265 @@ void
 Tree::loadSnapshot(Core::ProtoBuf::InputStream& stream)
 {
     superRoot = Directory();
+    parentCache.clear();
     superRoot.loadSnapshot(stream);
+    stampRootChildren();
+}
+
+uint64_t
+Tree::dumpSnapshotSections(Core::ProtoBuf::OutputStream& stream,
+                           const SnapshotSections* previous) const
+{
+    const Directory* root = superRoot.lookupDirectory("root");
+    assert(root != NULL);
+
+    // write out the header, listing the root directory's children
+    Snapshot::SectionedHeader header;
+    std::vector<std::string> children = root->getChildren();
+    for (auto it = children.begin(); it != children.end(); ++it) {
+        if (Core::StringUtil::endsWith(*it, "/"))
+            header.add_directories(it->substr(0, it->size() - 1));
+        else
+            header.add_files(*it);
+    }
+    stream.writeMessage(header);
+
+    // files in the root directory are written inline
+    for (auto it = header.files().begin(); it != header.files().end(); ++it)
+        root->lookupFile(*it)->dumpSnapshot(stream);
+
+    // each child directory becomes its own section, which is copied from the
+    // previous snapshot if nothing in it has changed since
+    uint64_t numCopied = 0;
+    for (auto it = header.directories().begin();
+         it != header.directories().end();
+         ++it) {
+        const Directory* dir = root->lookupDirectory(*it);
+        if (previous != NULL &&
+            dir->lastModified <= previous->modificationCount) {
+            auto prev = previous->sections.find(*it);
+            if (prev != previous->sections.end()) {
+                Snapshot::Section section;
+                section.set_length(prev->second.second);
+                stream.writeMessage(section);
+                stream.writeRaw(prev->second.first, prev->second.second);
+                ++numCopied;
+                continue;
+            }
+        }
+        // Size the section first so that the subtree can be streamed out
+        // without staging it in memory.
+        Snapshot::Section section;
+        section.set_length(dir->getSnapshotBytes());
+        stream.writeMessage(section);
+        uint64_t start = stream.getBytesWritten();
+        dir->dumpSnapshot(stream);
+        uint64_t written = stream.getBytesWritten() - start;
+        if (written != section.length()) {
+            PANIC("Snapshot section for %s was %lu bytes, expected %lu",
+                  it->c_str(), written, section.length());
+        }
+    }
+    return numCopied;
+}
+
+SnapshotSections
+Tree::indexSnapshotSections(const void* data, uint64_t length,
+                            uint64_t modificationCount)
+{
+    SnapshotSections index;
+    index.modificationCount = modificationCount;
+    Core::ProtoBuf::MemoryInputStream stream(data, length);
+
+    Snapshot::SectionedHeader header;
+    std::string error = stream.readMessage(header);
+    if (!error.empty()) {
+        PANIC("Couldn't read snapshot: %s", error.c_str());
+    }
+    for (auto it = header.files().begin(); it != header.files().end(); ++it) {
+        Snapshot::File file;
+        error = stream.readMessage(file);
+        if (!error.empty()) {
+            PANIC("Couldn't read snapshot: %s", error.c_str());
+        }
+    }
+    for (auto it = header.directories().begin();
+         it != header.directories().end();
+         ++it) {
+        Snapshot::Section section;
+        error = stream.readMessage(section);
+        if (!error.empty()) {
+            PANIC("Couldn't read snapshot section for %s: %s",
+                  it->c_str(), error.c_str());
+        }
+        if (stream.getBytesRemaining() < section.length()) {
+            PANIC("Couldn't read snapshot section for %s: only %lu of %lu "
+                  "bytes present",
+                  it->c_str(), stream.getBytesRemaining(), section.length());
+        }
+        const char* start = (static_cast<const char*>(data) +
+                             stream.getBytesRead());
+        index.sections[*it] = {start, section.length()};
+        stream.skip(section.length());
+    }
+    return index;
+}
+
+uint64_t
+Tree::getModificationCount() const
+{
+    return modificationCount;
+}
+
+void
+Tree::stampRootChildren()
+{
+    ++modificationCount;
+    Directory* root = superRoot.lookupDirectory("root");
+    superRoot.lastModified = modificationCount;
+    root->lastModified = modificationCount;
+    std::vector<std::string> children = root->getChildren();
+    for (auto it = children.begin(); it != children.end(); ++it) {
+        if (Core::StringUtil::endsWith(*it, "/")) {
+            root->lookupDirectory(it->substr(0, it->size() - 1))->
+                lastModified = modificationCount;
+        }
+    }
+}
+
+void
+Tree::loadSnapshotSections(Core::ProtoBuf::InputStream& stream,
+                           uint32_t numThreads)
+{
+    superRoot = Directory();
+    parentCache.clear();
+    Directory& root = *superRoot.makeDirectory("root");
+
+    Snapshot::SectionedHeader header;
+    std::string error = stream.readMessage(header);
+    if (!error.empty()) {
+        PANIC("Couldn't read snapshot: %s", error.c_str());
+    }
+    for (auto it = header.files().begin(); it != header.files().end(); ++it)
+        root.makeFile(*it)->loadSnapshot(stream);
+
+    // Each thread repeatedly takes the next section off the stream (which
+    // must be read sequentially), then decodes it into its own Directory.
+    uint64_t numSections = uint64_t(header.directories_size());
+    std::vector<Directory> sections(numSections);
+    std::mutex streamMutex;
+    uint64_t nextSection = 0;
+    auto decodeSections = [&]() {
+        std::string encoded;
+        while (true) {
+            uint64_t i;
+            {
+                std::lock_guard<std::mutex> lockGuard(streamMutex);
+                if (nextSection == numSections)
+                    return;
+                i = nextSection;
+                ++nextSection;
+                Snapshot::Section section;
+                std::string error = stream.readMessage(section);
+                if (!error.empty()) {
+                    PANIC("Couldn't read snapshot section %lu: %s",
+                          i, error.c_str());
+                }
+                encoded.resize(section.length());
+                uint64_t bytesRead = stream.readRaw(&encoded[0],
+                                                    section.length());
+                if (bytesRead != section.length()) {
+                    PANIC("Couldn't read snapshot section %lu: only %lu of "
+                          "%lu bytes present",
+                          i, bytesRead, section.length());
+                }
+            }
+            Core::ProtoBuf::MemoryInputStream sectionStream(encoded.data(),
+                                                            encoded.size());
+            sections.at(i).loadSnapshot(sectionStream);
+            if (sectionStream.getBytesRemaining() != 0) {
+                PANIC("Snapshot section %lu has %lu bytes of trailing "
+                      "garbage", i, sectionStream.getBytesRemaining());
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint64_t i = 1; i < numThreads && i < numSections; ++i)
+        threads.emplace_back(decodeSections);
+    decodeSections();
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+        it->join();
+
+    // stitch the sections into the root directory
+    for (uint64_t i = 0; i < numSections; ++i)
+        *root.makeDirectory(header.directories(int(i))) =
+            std::move(sections.at(i));
+    stampRootChildren();
+}
+
+std::string
+Tree::summarizeSnapshot(Core::ProtoBuf::InputStream& stream,
+                        SnapshotSummary& summary)
+{
+    // The stream starts with the super root, which contains only the root
+    // directory.
+    Snapshot::Directory superRoot;
+    std::string error = stream.readMessage(superRoot);
+    if (!error.empty())
+        return error;
+    if (superRoot.directories_size() != 1 ||
+        superRoot.directories(0) != "root" ||
+        superRoot.files_size() != 0) {
+        return "Super root should contain just the root directory";
+    }
+    return summary.scanDirectory(stream, 0);
+}
+
+std::string
+Tree::summarizeSnapshotSections(Core::ProtoBuf::InputStream& stream,
+                                SnapshotSummary& summary)
+{
+    Snapshot::SectionedHeader header;
+    std::string error = stream.readMessage(header);
+    if (!error.empty())
+        return error;
+    ++summary.numDirectories;
+    if (header.directories_size() > 0 || header.files_size() > 0)
+        summary.maxDepth = std::max(summary.maxDepth, 1UL);
+    for (auto it = header.files().begin(); it != header.files().end(); ++it) {
+        Snapshot::File file;
+        error = stream.readMessage(file);
+        if (!error.empty())
+            return format("%s (reading file %s)", error.c_str(), it->c_str());
+        ++summary.numFiles;
+        summary.fileBytes += file.contents().size();
+        summary.fileSizes.push(file.contents().size());
+    }
+    for (auto it = header.directories().begin();
+         it != header.directories().end();
+         ++it) {
+        Snapshot::Section section;
+        error = stream.readMessage(section);
+        if (!error.empty()) {
+            return format("Couldn't read snapshot section for %s: %s",
+                          it->c_str(), error.c_str());
+        }
+        uint64_t start = stream.getBytesRead();
+        error = summary.scanDirectory(stream, 1);
+        if (!error.empty()) {
+            return format("Couldn't read snapshot section for %s: %s",
+                          it->c_str(), error.c_str());
+        }
+        uint64_t length = stream.getBytesRead() - start;
+        if (length != section.length()) {
+            return format("Snapshot section for %s should be %lu bytes but "
+                          "decoded %lu bytes",
+                          it->c_str(), section.length(), length);
+        }
+        ++summary.numSections;
+    }
+    return "";
 }
 
 
@@ -422,12 +968,14 @@ Tree::makeDirectory(const std::string& symbolicPath)
     Result result = mkdirLookup(path, &parent);
     if (result.status != Status::OK)
         return result;
-    if (parent->makeDirectory(path.target) == NULL) {
+    Directory* targetDir = parent->makeDirectory(path.target);
+    if (targetDir == NULL) {
         result.status = Status::TYPE_ERROR;
         result.error = format("%s already exists but is a file",
                               path.symbolic.c_str());
         return result;
     }
+    targetDir->lastModified = modificationCount;
     ++numMakeDirectorySuccess;
     return result;
 }
@@ -471,7 +1019,7 @@ Tree::removeDirectory(const std::string& symbolicPath)
     if (path.result.status != Status::OK)
         return path.result;
     Directory* parent;
-    Result result = normalLookup(path, &parent);
+    Result result = modifyLookup(path, &parent);
     if (result.status == Status::LOOKUP_ERROR) {
         // no parent, already done
         ++numRemoveDirectoryParentNotFound;
@@ -495,11 +1043,12 @@ Tree::removeDirectory(const std::string& symbolicPath)
         }
     }
     parent->removeDirectory(path.target);
+    parentCache.clear();
     if (parent == &superRoot) { // removeDirectory("/")
         // If the caller is trying to remove the root directory, we remove the
         // contents but not the directory itself. The easiest way to do this
         // is to drop but then recreate the directory.
-        parent->makeDirectory(path.target);
+        parent->makeDirectory(path.target)->lastModified = modificationCount;
     }
     ++numRemoveDirectoryDone;
     ++numRemoveDirectorySuccess;
@@ -514,7 +1063,7 @@ Tree::write(const std::string& symbolicPath, const std::string& contents)
     if (path.result.status != Status::OK)
         return path.result;
     Directory* parent;
-    Result result = normalLookup(path, &parent);
+    Result result = modifyLookup(path, &parent);
     if (result.status != Status::OK)
         return result;
     File* targetFile = parent->makeFile(path.target);
@@ -567,7 +1116,7 @@ Tree::removeFile(const std::string& symbolicPath)
     if (path.result.status != Status::OK)
         return path.result;
     Directory* parent;
-    Result result = normalLookup(path, &parent);
+    Result result = modifyLookup(path, &parent);
     if (result.status == Status::LOOKUP_ERROR) {
         // no parent, already done
         ++numRemoveFileParentNotFound;
@@ -590,6 +1139,84 @@ Tree::removeFile(const std::string& symbolicPath)
     return result;
 }
 
+Result
+Tree::exportDirectory(const std::string& symbolicPath,
+                      std::string& contents) const
+{
+    contents.clear();
+    Path path(symbolicPath);
+    if (path.result.status != Status::OK)
+        return path.result;
+    const Directory* parent;
+    Result result = normalLookup(path, &parent);
+    if (result.status != Status::OK)
+        return result;
+    const Directory* targetDir = parent->lookupDirectory(path.target);
+    if (targetDir == NULL) {
+        if (parent->lookupFile(path.target) == NULL) {
+            result.status = Status::LOOKUP_ERROR;
+            result.error = format("%s does not exist",
+                                  path.symbolic.c_str());
+        } else {
+            result.status = Status::TYPE_ERROR;
+            result.error = format("%s is a file",
+                                  path.symbolic.c_str());
+        }
+        return result;
+    }
+    Core::ProtoBuf::StringOutputStream stream(contents);
+    targetDir->dumpSnapshot(stream);
+    return result;
+}
+
+Result
+Tree::importDirectory(const std::string& symbolicPath,
+                      const std::string& contents)
+{
+    ++numImportDirectoryAttempted;
+    Path path(symbolicPath);
+    if (path.result.status != Status::OK)
+        return path.result;
+
+    // Decode the contents before touching the tree, so that malformed
+    // contents leave it unchanged.
+    Directory imported;
+    Result result;
+    Core::ProtoBuf::MemoryInputStream stream(contents.data(),
+                                             contents.size());
+    std::string error = imported.tryLoadSnapshot(stream, MAX_IMPORT_DEPTH);
+    if (error.empty() && stream.getBytesRemaining() != 0)
+        error = format("%lu bytes of trailing garbage",
+                       stream.getBytesRemaining());
+    if (!error.empty()) {
+        result.status = Status::INVALID_ARGUMENT;
+        result.error = format("Contents for %s are malformed: %s",
+                              path.symbolic.c_str(), error.c_str());
+        return result;
+    }
+
+    Directory* parent;
+    result = mkdirLookup(path, &parent);
+    if (result.status != Status::OK)
+        return result;
+    Directory* targetDir = parent->makeDirectory(path.target);
+    if (targetDir == NULL) {
+        result.status = Status::TYPE_ERROR;
+        result.error = format("%s already exists but is a file",
+                              path.symbolic.c_str());
+        return result;
+    }
+    *targetDir = std::move(imported);
+    // Any directories that used to be beneath the target are gone.
+    parentCache.clear();
+    if (parent == &superRoot) // importDirectory("/")
+        stampRootChildren();
+    else
+        targetDir->lastModified = modificationCount;
+    ++numImportDirectorySuccess;
+    return result;
+}
+
 void
 Tree::updateServerStats(Protocol::ServerStats::Tree& tstats) const
 {
@@ -633,6 +1260,10 @@ Tree::updateServerStats(Protocol::ServerStats::Tree& tstats) const
         numRemoveFileDone);
     tstats.set_num_remove_file_success(
         numRemoveFileSuccess);
+    tstats.set_num_import_directory_attempted(
+        numImportDirectoryAttempted);
+    tstats.set_num_import_directory_success(
+        numImportDirectorySuccess);
 }
 
 } // namespace LogCabin::Tree
@@ -18,6 +18,7 @@
 #include <string>
 #include <vector>
 
+#include "Core/Histogram.h"
 #include "Core/ProtoBuf.h"
 
 #ifndef LOGCABIN_TREE_TREE_H
@@ -105,10 +106,22 @@ class File {
      * Write the file to the stream.
      */
     void dumpSnapshot(Core::ProtoBuf::OutputStream& stream) const;
+    /**
+     * Return the number of bytes dumpSnapshot() would write, without
+     * encoding anything.
+     */
+    uint64_t getSnapshotBytes() const;
     /**
      * Load the file from the stream.
      */
     void loadSnapshot(Core::ProtoBuf::InputStream& stream);
+    /**
+     * Load the file from the stream, which may be malformed.
+     * \return
+     *      An error message if the stream couldn't be parsed, or the empty
+     *      string on success.
+     */
+    std::string tryLoadSnapshot(Core::ProtoBuf::InputStream& stream);
     /**
      * Opaque data stored in the File.
      */
@@ -204,10 +217,38 @@ class Directory {
      * Write the directory and its children to the stream.
      */
     void dumpSnapshot(Core::ProtoBuf::OutputStream& stream) const;
+    /**
+     * Return the number of bytes dumpSnapshot() would write for this
+     * directory and everything under it, without encoding anything.
+     */
+    uint64_t getSnapshotBytes() const;
     /**
      * Load the directory and its children from the stream.
      */
     void loadSnapshot(Core::ProtoBuf::InputStream& stream);
+    /**
+     * Load the directory and its children from the stream, which may be
+     * malformed (for example, because it came from a client).
+     * \param stream
+     *      The encoded directory.
+     * \param maxDepth
+     *      How many levels of directories may be nested beneath this one.
+     *      Deeper nesting is treated as malformed, which bounds the
+     *      recursion.
+     * \return
+     *      An error message if the stream couldn't be parsed, or the empty
+     *      string on success. On error, the directory may be partially
+     *      loaded.
+     */
+    std::string tryLoadSnapshot(Core::ProtoBuf::InputStream& stream,
+                                uint64_t maxDepth);
+
+    /**
+     * The Tree's modification counter as of the last time this directory or
+     * anything beneath it was changed. A directory created by loading a
+     * snapshot starts at 0; Tree takes care of stamping it.
+     */
+    uint64_t lastModified;
 
   private:
     /**
@@ -221,8 +262,85 @@ class Directory {
     std::map<std::string, File> files;
 };
 
+/**
+ * Locates the encoded sections of a snapshot that was previously written by
+ * Tree::dumpSnapshotSections(), so that a later dump can copy the sections of
+ * directories that have not changed since, rather than serializing them
+ * again. This saves the work of encoding them, not the cost of writing them
+ * out. See Tree::indexSnapshotSections().
+ */
+struct SnapshotSections {
+    /// Default constructor.
+    SnapshotSections();
+    /**
+     * The Tree's modification counter (see Tree::getModificationCount()) as
+     * of when the snapshot was written.
+     */
+    uint64_t modificationCount;
+    /**
+     * Map from names of the root directory's child directories to the
+     * encoded bytes of their sections. The bytes are not owned by this
+     * object.
+     */
+    std::map<std::string, std::pair<const char*, uint64_t>> sections;
+};
+
+/**
+ * Describes the contents of a snapshot without loading it into a Tree. This
+ * is filled in by Tree::summarizeSnapshot() and
+ * Tree::summarizeSnapshotSections(), which decode one message at a time, so
+ * they need only enough memory for the largest file.
+ */
+struct SnapshotSummary {
+    /// Default constructor.
+    SnapshotSummary();
+    /**
+     * Decode a directory and everything under it, as written by
+     * Directory::dumpSnapshot(), adding to the counts.
+     * \param stream
+     *      The stream to read from.
+     * \param depth
+     *      The number of directories above this one, not counting the super
+     *      root.
+     * \return
+     *      Empty string on success, otherwise an error message.
+     */
+    std::string scanDirectory(Core::ProtoBuf::InputStream& stream,
+                              uint64_t depth);
+    /**
+     * The number of directories, including the root directory.
+     */
+    uint64_t numDirectories;
+    /**
+     * The number of files.
+     */
+    uint64_t numFiles;
+    /**
+     * The total size of the files' contents, in bytes.
+     */
+    uint64_t fileBytes;
+    /**
+     * The number of directories above the deepest file or directory, not
+     * counting the super root (so a tree with only the root directory has
+     * depth 0).
+     */
+    uint64_t maxDepth;
+    /**
+     * For the sectioned format, the number of sections (one per child
+     * directory of the root directory).
+     */
+    uint64_t numSections;
+    /**
+     * The size in bytes of each file's contents.
+     */
+    Core::Histogram fileSizes;
+};
+
 /**
  * This is used by Tree to parse symbolic paths into their components.
+ * Parsing doesn't copy the path: the parent components are found on demand by
+ * scanning the caller's string, so a Path is cheap to construct for every
+ * operation.
  */
 class Path {
   public:
@@ -231,24 +349,43 @@ class Path {
      * \param symbolic
      *      A path delimited by slashes. This must begin with a slash.
      *      (It should not include "/root" to arrive at the root directory.)
+     *      The Path refers to this string, which must outlive it.
      * \warning
      *      The caller must check "result" to see if the path was parsed
      *      successfully.
      */
     explicit Path(const std::string& symbolic);
 
+    /**
+     * Paths may not refer to temporaries.
+     */
+    explicit Path(std::string&& symbolic) = delete;
+
+    /**
+     * Find the next directory needed to traverse to get to the target's
+     * parent, after the implicit "root" directory.
+     * \param[in,out] offset
+     *      The position in 'symbolic' to continue scanning from; start at 0.
+     *      This is advanced past the component returned.
+     * \param[out] name
+     *      Set to the name of the next directory.
+     * \return
+     *      True if a component was found; false if the parent has been
+     *      reached.
+     */
+    bool nextParent(size_t& offset, std::string& name) const;
+
     /**
      * Used to generate error messages during path lookup.
      * \param end
-     *      The last component of 'parents' to include in the returned string;
-     *      this is typically the component that caused an error in path
-     *      traversal.
+     *      An offset returned by nextParent(), typically just after the
+     *      component that caused an error in path traversal; 0 for the root
+     *      directory.
      * \return
-     *      The prefix of 'parents' up to and including the given end position.
+     *      The parents of the target up to the given position.
      *      This is returned as a slash-delimited string not including "/root".
      */
-    std::string
-    parentsThrough(std::vector<std::string>::const_iterator end) const;
+    std::string parentsThrough(size_t end) const;
 
   public:
     /**
@@ -260,15 +397,15 @@ class Path {
     /**
      * The exact argument given to the constructor.
      */
-    std::string symbolic;
+    const std::string& symbolic;
     /**
-     * The directories needed to traverse to get to the target.
-     * This usually begins with "root" to get from the super root to the root
-     * directory, then includes the components of the symbolic path up to but
-     * not including the target. If the symbolic path is "/", this will be
-     * empty.
+     * The length of the prefix of 'symbolic' that names the target's parent
+     * directory, including the trailing slash. This is 0 only if the
+     * symbolic path is "/", whose parent is the super root; otherwise the
+     * parent is reached through "root" followed by each component of the
+     * prefix (see nextParent()).
      */
-    std::vector<std::string> parents;
+    size_t parentsLength;
     /**
      * The final component of the path.
      * This is usually at the end of the symbolic path. If the symbolic path is
@@ -278,6 +415,83 @@ class Path {
     std::string target;
 };
 
+/**
+ * Remembers the chains of directories leading to recently used parent
+ * directories, so that operations on hot prefixes like "/app/table/" skip
+ * the map lookup for every component. Each prefix maps to a single slot by
+ * its hash, and a newer prefix simply evicts whatever held its slot.
+ *
+ * Cached Directory pointers are only valid until a directory is removed;
+ * Tree calls clear() whenever that might have happened.
+ */
+class ParentCache {
+  public:
+    /// Constructor.
+    ParentCache();
+    /// Copy constructor: the copy starts out empty.
+    ParentCache(const ParentCache& other);
+    /// Assignment: the cache is cleared.
+    ParentCache& operator=(const ParentCache& other);
+
+    /**
+     * Look up the directories leading to a path's parent.
+     * \return
+     *      The directories from the super root through the path's parent, or
+     *      NULL if the path's parents are not cached.
+     */
+    const std::vector<Directory*>* find(const Path& path) const;
+
+    /**
+     * Start caching the directories leading to a path's parent, evicting
+     * whatever prefix previously held its slot.
+     * \return
+     *      An empty list, which the caller should fill in with the directories
+     *      from the super root through the path's parent. If that lookup
+     *      fails, the caller must call erase().
+     */
+    std::vector<Directory*>& insert(const Path& path);
+
+    /**
+     * Forget the directories leading to a path's parent.
+     */
+    void erase(const Path& path);
+
+    /**
+     * Forget everything.
+     */
+    void clear();
+
+  private:
+    /**
+     * The number of slots, a power of two.
+     */
+    enum { NUM_SLOTS = 256 };
+
+    /**
+     * A cached prefix and its directories.
+     */
+    struct Slot {
+        /// Constructor.
+        Slot();
+        /// True if 'prefix' and 'directories' hold a valid entry.
+        bool valid;
+        /// Path::symbolic up to Path::parentsLength.
+        std::string prefix;
+        /// The super root through the directory named by 'prefix'.
+        std::vector<Directory*> directories;
+    };
+
+    /**
+     * Return the index of the slot that would hold the path's parents.
+     */
+    static size_t slotIndex(const Path& path);
+
+    /**
+     * Indexed by a hash of the prefix.
+     */
+    std::vector<Slot> slots;
+};
+
 } // LogCabin::Tree::Internal
 
 /**
@@ -303,6 +517,96 @@ class Tree {
      */
     void loadSnapshot(Core::ProtoBuf::InputStream& stream);
 
+    /**
+     * Write the tree to the given stream in the sectioned format: a header
+     * describing the root directory, then the subtree under each of the root
+     * directory's child directories as a separate, length-prefixed section.
+     * Each section's length is computed by a pass over its subtree, and then
+     * the subtree is written straight to 'stream', so no section is staged
+     * in memory.
+     * \param stream
+     *      The stream to write to.
+     * \param previous
+     *      If not NULL, the sections of an earlier snapshot of this same
+     *      Tree. Sections for directories that have not been modified since
+     *      that snapshot are copied from it verbatim rather than encoded
+     *      again. The copies are still written to 'stream', so the output is
+     *      always a complete snapshot of the same size.
+     * \return
+     *      The number of sections copied from 'previous'.
+     */
+    uint64_t dumpSnapshotSections(
+            Core::ProtoBuf::OutputStream& stream,
+            const Internal::SnapshotSections* previous = NULL) const;
+
+    /**
+     * Find the sections within a snapshot written by dumpSnapshotSections(),
+     * for use in a later call to dumpSnapshotSections().
+     * \param data
+     *      The snapshot's bytes, starting at the header written by
+     *      dumpSnapshotSections(). These must remain valid for as long as the
+     *      result is used.
+     * \param length
+     *      The number of bytes in 'data'.
+     * \param modificationCount
+     *      The value getModificationCount() returned when the snapshot was
+     *      written.
+     * \return
+     *      The location of each section in 'data'.
+     */
+    static Internal::SnapshotSections
+    indexSnapshotSections(const void* data, uint64_t length,
+                          uint64_t modificationCount);
+
+    /**
+     * Return a counter that increases every time the Tree is modified.
+     */
+    uint64_t getModificationCount() const;
+
+    /**
+     * Load the tree from a stream written by dumpSnapshotSections(). Sections
+     * are read from the stream one at a time but decoded concurrently, then
+     * attached to the root directory.
+     * \param stream
+     *      The stream to read from.
+     * \param numThreads
+     *      The maximum number of threads to decode sections with, including
+     *      the calling thread.
+     * \warning
+     *      This will blow away any existing files and directories.
+     */
+    void loadSnapshotSections(Core::ProtoBuf::InputStream& stream,
+                              uint32_t numThreads);
+
+    /**
+     * Count the files and directories in a stream written by dumpSnapshot(),
+     * without building a Tree.
+     * \param stream
+     *      The stream to read from.
+     * \param[out] summary
+     *      Filled in with what was found, up to any error.
+     * \return
+     *      Empty string on success, otherwise an error message.
+     */
+    static std::string
+    summarizeSnapshot(Core::ProtoBuf::InputStream& stream,
+                      Internal::SnapshotSummary& summary);
+
+    /**
+     * Count the files and directories in a stream written by
+     * dumpSnapshotSections(), without building a Tree. Each section's length
+     * is checked against what was decoded from it.
+     * \param stream
+     *      The stream to read from.
+     * \param[out] summary
+     *      Filled in with what was found, up to any error.
+     * \return
+     *      Empty string on success, otherwise an error message.
+     */
+    static std::string
+    summarizeSnapshotSections(Core::ProtoBuf::InputStream& stream,
+                              Internal::SnapshotSummary& summary);
+
     /**
      * Verify that the file at path has the given contents.
      * \param path
@@ -422,6 +726,51 @@ class Tree {
     Result
     removeFile(const std::string& path);
 
+    /**
+     * Write out a directory and everything beneath it, in the format that
+     * importDirectory() accepts.
+     * \param path
+     *      The directory to export.
+     * \param[out] contents
+     *      The encoded directory.
+     * \return
+     *      Status and error message. Possible errors are:
+     *       - INVALID_ARGUMENT if path is malformed.
+     *       - LOOKUP_ERROR if a parent of path does not exist.
+     *       - LOOKUP_ERROR if path does not exist.
+     *       - TYPE_ERROR if a parent of path is a file.
+     *       - TYPE_ERROR if path is a file.
+     */
+    Result
+    exportDirectory(const std::string& path, std::string& contents) const;
+
+    /**
+     * Replace a directory and everything beneath it with the contents of an
+     * encoded directory, as a single operation. This is much cheaper than
+     * building up the same directory one write at a time. Parent directories
+     * are created as needed.
+     * \param path
+     *      The directory to replace (or create).
+     * \param contents
+     *      A directory encoded by exportDirectory().
+     * \return
+     *      Status and error message. Possible errors are:
+     *       - INVALID_ARGUMENT if path is malformed.
+     *       - INVALID_ARGUMENT if contents is malformed.
+     *       - INVALID_ARGUMENT if contents nests directories more than
+     *         MAX_IMPORT_DEPTH levels deep.
+     *       - TYPE_ERROR if a parent of path is a file.
+     *       - TYPE_ERROR if path exists but is a file.
+     */
+    Result
+    importDirectory(const std::string& path, const std::string& contents);
+
+    /**
+     * The deepest nesting of directories that importDirectory() accepts, so
+     * that malformed contents can't exhaust the stack while being decoded.
+     */
+    enum { MAX_IMPORT_DEPTH = 1000 };
+
     /**
      * Add metrics about the tree to the given structure.
      */
@@ -455,7 +804,15 @@ class Tree {
                  const Internal::Directory** parent) const;
 
     /**
-     * Like normalLookup but creates parent directories as necessary.
+     * Like normalLookup but also marks every directory it passes through as
+     * modified. Used by operations that change the tree.
+     * \copydetails normalLookup
+     */
+    Result
+    modifyLookup(const Internal::Path& path, Internal::Directory** parent);
+
+    /**
+     * Like modifyLookup but creates parent directories as necessary.
      * \param[in] path
      *      The path whose parent directory to find.
      * \param[out] parent
@@ -467,6 +824,28 @@ class Tree {
     Result
     mkdirLookup(const Internal::Path& path, Internal::Directory** parent);
 
+    /**
+     * Find the directories leading to the given path's parent, consulting
+     * and filling in parentCache.
+     * \param[in] path
+     *      The path whose parent directory to find.
+     * \param[out] directories
+     *      Upon successful return, points to the directories from the super
+     *      root through the target's parent.
+     * \return
+     *      Status and error message, as in normalLookup().
+     */
+    Result
+    lookupParents(const Internal::Path& path,
+                  const std::vector<Internal::Directory*>** directories) const;
+
+    /**
+     * Mark the root directory and each of its child directories as modified.
+     * Called after loading a snapshot, since the loaded directories have no
+     * history.
+     */
+    void stampRootChildren();
+
     /**
      * This directory contains the root directory. The super root has a single
      * child directory named "root", and the rest of the tree lies below
@@ -479,6 +858,20 @@ class Tree {
      */
     Internal::Directory superRoot;
 
+    /**
+     * Speeds up normalLookup(), modifyLookup(), and mkdirLookup() for
+     * frequently used parent directories. This is mutable because const
+     * lookups fill it in too.
+     */
+    mutable Internal::ParentCache parentCache;
+
+    /**
+     * Incremented on every operation that may change the tree. Directories
+     * record its value in Internal::Directory::lastModified, which is what
+     * lets dumpSnapshotSections() skip unchanged subtrees.
+     */
+    uint64_t modificationCount;
+
     // Server stats collected in updateServerStats.
     // Note that when a condition fails, the operation is not invoked,
     // so operations whose conditions fail are not counted as 'Attempted'.
@@ -502,6 +895,8 @@ class Tree {
     uint64_t numRemoveFileTargetNotFound;
     uint64_t numRemoveFileDone;
     uint64_t numRemoveFileSuccess;
+    uint64_t numImportDirectoryAttempted;
+    uint64_t numImportDirectorySuccess;
 };
 
 
@@ -19,6 +19,8 @@
 #include <stdexcept>
 #include <sys/stat.h>
 
+#include "build/Protocol/ServerStats.pb.h"
+#include "build/Tree/Snapshot.pb.h"
 #include "Core/StringUtil.h"
 #include "Tree/Tree.h"
 #include "Storage/FilesystemUtil.h"
@@ -89,6 +91,20 @@ TEST(TreeFileTest, dumpSnapshot)
     }
 }
 
+TEST(TreeFileTest, getSnapshotBytes)
+{
+    File f;
+    for (uint64_t size : {0UL, 1UL, 127UL, 128UL, 20000UL}) {
+        f.contents = std::string(size, 'x');
+        std::string encoded;
+        {
+            Core::ProtoBuf::StringOutputStream stream(encoded);
+            f.dumpSnapshot(stream);
+        }
+        EXPECT_EQ(encoded.size(), f.getSnapshotBytes()) << size;
+    }
+}
+
 TEST(TreeDirectoryTest, getChildren)
 {
     Directory d;
@@ -229,46 +245,123 @@ TEST(TreeDirectoryTest, dumpSnapshot)
     }
 }
 
+TEST(TreeDirectoryTest, getSnapshotBytes)
+{
+    Tree tree;
+    EXPECT_EQ(4U, tree.superRoot.lookupDirectory("root")->getSnapshotBytes());
+    tree.makeDirectory("/a/b/c");
+    tree.makeDirectory("/" + std::string(200, 'd'));
+    tree.write("/a/b/x", std::string(300, 'v'));
+    tree.write("/a/y", "");
+    tree.write("/z", "rawr");
+    std::string encoded;
+    {
+        Core::ProtoBuf::StringOutputStream stream(encoded);
+        tree.superRoot.dumpSnapshot(stream);
+    }
+    EXPECT_EQ(encoded.size(), tree.superRoot.getSnapshotBytes());
+}
+
+/**
+ * Return the components of the path leading to its parent, as found by
+ * Path::nextParent().
+ */
+std::vector<std::string>
+parents(const Path& path)
+{
+    std::vector<std::string> components;
+    size_t offset = 0;
+    std::string name;
+    while (path.nextParent(offset, name))
+        components.push_back(name);
+    return components;
+}
+
 TEST(TreePathTest, constructor)
 {
-    Path p1("");
+    std::string s1 = "";
+    Path p1(s1);
     EXPECT_EQ(Status::INVALID_ARGUMENT, p1.result.status);
 
-    Path p2("/");
+    std::string s2 = "/";
+    Path p2(s2);
     EXPECT_OK(p2.result);
     EXPECT_EQ("/", p2.symbolic);
+    EXPECT_EQ(0U, p2.parentsLength);
     EXPECT_EQ((std::vector<std::string> {
-               }), p2.parents);
+               }), parents(p2));
     EXPECT_EQ("root", p2.target);
 
-    Path p3("/foo");
+    std::string s3 = "/foo";
+    Path p3(s3);
     EXPECT_OK(p3.result);
     EXPECT_EQ("/foo", p3.symbolic);
+    EXPECT_EQ(1U, p3.parentsLength);
     EXPECT_EQ((std::vector<std::string> {
-                   "root",
-               }), p3.parents);
+               }), parents(p3));
     EXPECT_EQ("foo", p3.target);
 
-    Path p4("/foo/bar/");
+    std::string s4 = "/foo/bar/";
+    Path p4(s4);
     EXPECT_OK(p4.result);
     EXPECT_EQ("/foo/bar/", p4.symbolic);
+    EXPECT_EQ(5U, p4.parentsLength);
     EXPECT_EQ((std::vector<std::string> {
-                   "root", "foo",
-               }), p4.parents);
+                   "foo",
+               }), parents(p4));
     EXPECT_EQ("bar", p4.target);
+
+    std::string s5 = "//foo//bar//baz";
+    Path p5(s5);
+    EXPECT_OK(p5.result);
+    EXPECT_EQ((std::vector<std::string> {
+                   "foo", "bar",
+               }), parents(p5));
+    EXPECT_EQ("baz", p5.target);
+
+    // the path is not copied
+    EXPECT_EQ(&s5, &p5.symbolic);
 }
 
 TEST(TreePathTest, parentsThrough)
 {
-    Path path("/a/b/c");
-    auto it = path.parents.begin(); // root
-    EXPECT_EQ("/", path.parentsThrough(it));
-    ++it; // a
-    EXPECT_EQ("/a", path.parentsThrough(it));
-    ++it; // b
-    EXPECT_EQ("/a/b", path.parentsThrough(it));
-    ++it; // c
-    EXPECT_EQ("/a/b/c", path.parentsThrough(it));
+    std::string s = "/a//b/c";
+    Path path(s);
+    size_t offset = 0;
+    std::string name;
+    EXPECT_EQ("/", path.parentsThrough(offset)); // root
+    EXPECT_TRUE(path.nextParent(offset, name));
+    EXPECT_EQ("/a", path.parentsThrough(offset));
+    EXPECT_TRUE(path.nextParent(offset, name));
+    EXPECT_EQ("/a/b", path.parentsThrough(offset));
+    EXPECT_FALSE(path.nextParent(offset, name));
+}
+
+TEST(TreeParentCacheTest, basics)
+{
+    ParentCache cache;
+    std::string s1 = "/a/b/c";
+    std::string s2 = "/a/b/d";
+    std::string s3 = "/a/c";
+    Path p1(s1);
+    Path p2(s2);
+    Path p3(s3);
+    Directory d1;
+    Directory d2;
+    EXPECT_TRUE(cache.find(p1) == NULL);
+    cache.insert(p1) = {&d1, &d2};
+    ASSERT_TRUE(cache.find(p2) != NULL); // same parent
+    EXPECT_EQ(&d2, cache.find(p2)->back());
+    EXPECT_TRUE(cache.find(p3) == NULL);
+    cache.erase(p3); // no effect
+    EXPECT_TRUE(cache.find(p1) != NULL);
+    cache.erase(p2);
+    EXPECT_TRUE(cache.find(p1) == NULL);
+    cache.insert(p1) = {&d1};
+    ParentCache copy(cache);
+    EXPECT_TRUE(copy.find(p1) == NULL);
+    cache.clear();
+    EXPECT_TRUE(cache.find(p1) == NULL);
 }
 
 class TreeTreeTest : public ::testing::Test {
@@ -302,6 +395,186 @@ TEST_F(TreeTreeTest, dumpSnapshot)
     EXPECT_EQ((std::vector<std::string>{ "c" }), children);
 }
 
+TEST_F(TreeTreeTest, dumpSnapshotSections)
+{
+    tree.makeDirectory("/a/b/c");
+    tree.write("/a/b/x", "foo");
+    tree.makeDirectory("/d");
+    tree.makeDirectory("/e");
+    tree.write("/e/f", "bar");
+    tree.write("/g", "baz");
+    for (uint32_t numThreads = 1; numThreads <= 4; numThreads *= 2) {
+        Storage::Layout layout;
+        layout.initTemporary();
+        {
+            Storage::SnapshotFile::Writer writer(layout);
+            tree.dumpSnapshotSections(writer);
+            writer.save();
+        }
+        Tree t2;
+        t2.write("/h", "gone");
+        {
+            Storage::SnapshotFile::Reader reader(layout);
+            t2.loadSnapshotSections(reader, numThreads);
+            EXPECT_EQ(reader.getSizeBytes(), reader.getBytesRead());
+        }
+        EXPECT_EQ(dumpTree(tree), dumpTree(t2));
+    }
+}
+
+TEST_F(TreeTreeTest, loadSnapshotSections_truncated)
+{
+    tree.makeDirectory("/a");
+    tree.write("/a/b", "foo");
+    std::string bytes;
+    {
+        Core::ProtoBuf::StringOutputStream stream(bytes);
+        tree.dumpSnapshotSections(stream);
+    }
+    Core::ProtoBuf::MemoryInputStream stream(bytes.data(), bytes.size() - 1);
+    EXPECT_DEATH(tree.loadSnapshotSections(stream, 2),
+                 "Couldn't read snapshot section 0: only");
+}
+
+TEST_F(TreeTreeTest, dumpSnapshotSections_incremental)
+{
+    tree.makeDirectory("/a");
+    tree.write("/a/x", "foo");
+    tree.makeDirectory("/b/c");
+    tree.makeDirectory("/d");
+    tree.write("/e", "root file");
+    std::string base;
+    {
+        Core::ProtoBuf::StringOutputStream stream(base);
+        EXPECT_EQ(0U, tree.dumpSnapshotSections(stream));
+    }
+    Internal::SnapshotSections index =
+        Tree::indexSnapshotSections(base.data(), base.size(),
+                                    tree.getModificationCount());
+    EXPECT_EQ(3U, index.sections.size());
+
+    // change /b and add /f; /a and /d are untouched
+    tree.write("/b/c/y", "bar");
+    tree.makeDirectory("/f");
+    tree.write("/e", "new root file");
+    std::string incremental;
+    {
+        Core::ProtoBuf::StringOutputStream stream(incremental);
+        EXPECT_EQ(2U, tree.dumpSnapshotSections(stream, &index));
+    }
+    std::string full;
+    {
+        Core::ProtoBuf::StringOutputStream stream(full);
+        tree.dumpSnapshotSections(stream);
+    }
+    EXPECT_EQ(full, incremental);
+
+    // unchanged sections really are copied from the previous snapshot
+    std::string fake = "not a section";
+    index.sections["d"] = {fake.data(), fake.size()};
+    std::string copied;
+    {
+        Core::ProtoBuf::StringOutputStream stream(copied);
+        tree.dumpSnapshotSections(stream, &index);
+    }
+    EXPECT_NE(std::string::npos, copied.find(fake));
+
+    // anything modified after the snapshot is written out again
+    tree.removeFile("/a/x");
+    tree.removeDirectory("/d");
+    tree.makeDirectory("/d");
+    std::string later;
+    {
+        Core::ProtoBuf::StringOutputStream stream(later);
+        EXPECT_EQ(0U, tree.dumpSnapshotSections(stream, &index));
+    }
+    EXPECT_EQ(std::string::npos, later.find(fake));
+
+    // loading a snapshot invalidates sections of earlier snapshots
+    Core::ProtoBuf::MemoryInputStream stream(base.data(), base.size());
+    tree.loadSnapshotSections(stream, 1);
+    std::string reloaded;
+    {
+        Core::ProtoBuf::StringOutputStream stream(reloaded);
+        EXPECT_EQ(0U, tree.dumpSnapshotSections(stream, &index));
+    }
+    EXPECT_EQ(base, reloaded);
+}
+
+TEST_F(TreeTreeTest, summarizeSnapshot)
+{
+    tree.makeDirectory("/a/b/c");
+    tree.write("/a/b/x", "foo");
+    tree.makeDirectory("/d");
+    tree.makeDirectory("/e");
+    tree.write("/e/f", "bar");
+    tree.write("/g", "bazz");
+    std::string plain;
+    {
+        Core::ProtoBuf::StringOutputStream stream(plain);
+        tree.dumpSnapshot(stream);
+    }
+    std::string sectioned;
+    {
+        Core::ProtoBuf::StringOutputStream stream(sectioned);
+        tree.dumpSnapshotSections(stream);
+    }
+
+    Internal::SnapshotSummary s1;
+    Core::ProtoBuf::MemoryInputStream stream1(plain.data(), plain.size());
+    EXPECT_EQ("", Tree::summarizeSnapshot(stream1, s1));
+    EXPECT_EQ(0U, stream1.getBytesRemaining());
+    Internal::SnapshotSummary s2;
+    Core::ProtoBuf::MemoryInputStream stream2(sectioned.data(),
+                                              sectioned.size());
+    EXPECT_EQ("", Tree::summarizeSnapshotSections(stream2, s2));
+    EXPECT_EQ(0U, stream2.getBytesRemaining());
+
+    for (auto* s : {&s1, &s2}) {
+        EXPECT_EQ(6U, s->numDirectories);
+        EXPECT_EQ(3U, s->numFiles);
+        EXPECT_EQ(10U, s->fileBytes);
+        EXPECT_EQ(3U, s->maxDepth);
+        EXPECT_EQ(3U, s->fileSizes.getCount());
+        EXPECT_EQ(4U, s->fileSizes.getPercentile(100));
+    }
+    EXPECT_EQ(0U, s1.numSections);
+    EXPECT_EQ(3U, s2.numSections);
+
+    // an empty tree
+    Tree empty;
+    std::string bytes;
+    {
+        Core::ProtoBuf::StringOutputStream stream(bytes);
+        empty.dumpSnapshotSections(stream);
+    }
+    Internal::SnapshotSummary s3;
+    Core::ProtoBuf::MemoryInputStream stream3(bytes.data(), bytes.size());
+    EXPECT_EQ("", Tree::summarizeSnapshotSections(stream3, s3));
+    EXPECT_EQ(1U, s3.numDirectories);
+    EXPECT_EQ(0U, s3.maxDepth);
+}
+
+TEST_F(TreeTreeTest, summarizeSnapshot_errors)
+{
+    tree.makeDirectory("/a");
+    tree.write("/a/b", "foo");
+    std::string bytes;
+    {
+        Core::ProtoBuf::StringOutputStream stream(bytes);
+        tree.dumpSnapshotSections(stream);
+    }
+    Internal::SnapshotSummary summary;
+    Core::ProtoBuf::MemoryInputStream truncated(bytes.data(),
+                                                bytes.size() - 1);
+    EXPECT_EQ(0U, Tree::summarizeSnapshotSections(truncated, summary).find(
+        "Couldn't read snapshot section for a: "));
+
+    // a sectioned snapshot isn't a plain one
+    Core::ProtoBuf::MemoryInputStream wrongFormat(bytes.data(), bytes.size());
+    EXPECT_EQ("Super root should contain just the root directory",
+              Tree::summarizeSnapshot(wrongFormat, summary));
+}
 
 TEST_F(TreeTreeTest, normalLookup)
 {
@@ -343,6 +616,34 @@ TEST_F(TreeTreeTest, mkdirLookup)
     EXPECT_EQ("Parent /c of /c/d is a file", result.error);
 }
 
+TEST_F(TreeTreeTest, lookup_cached)
+{
+    std::string contents;
+    EXPECT_OK(tree.makeDirectory("/a/b"));
+    EXPECT_OK(tree.write("/a/b/c", "x"));
+    EXPECT_OK(tree.read("/a/b/c", contents));
+    EXPECT_EQ("x", contents);
+    uint64_t before = tree.getModificationCount();
+    EXPECT_OK(tree.write("/a/b/d", "y"));
+    EXPECT_LT(before, tree.superRoot.lookupDirectory("root")->
+                          lookupDirectory("a")->lastModified);
+
+    // removing a directory must not leave stale cached parents behind
+    EXPECT_OK(tree.removeDirectory("/a/b"));
+    Result result = tree.read("/a/b/c", contents);
+    EXPECT_EQ(Status::LOOKUP_ERROR, result.status);
+    EXPECT_EQ("Parent /a/b of /a/b/c does not exist", result.error);
+    EXPECT_OK(tree.makeDirectory("/a/b"));
+    EXPECT_OK(tree.write("/a/b/c", "z"));
+    EXPECT_OK(tree.read("/a/b/c", contents));
+    EXPECT_EQ("z", contents);
+
+    EXPECT_OK(tree.removeDirectory("/"));
+    EXPECT_OK(tree.makeDirectory("/a/b"));
+    EXPECT_OK(tree.write("/a/b/c", "w"));
+    EXPECT_EQ("/ /a/ /a/b/ /a/b/c", dumpTree(tree));
+}
+
 TEST_F(TreeTreeTest, checkCondition)
 {
     tree.write("/a", "b");
@@ -494,6 +795,146 @@ TEST_F(TreeTreeTest, removeFile)
     EXPECT_EQ("/e is a directory", result.error);
 }
 
+TEST_F(TreeTreeTest, exportDirectory)
+{
+    std::string contents;
+    Result result;
+    EXPECT_EQ(Status::INVALID_ARGUMENT,
+              tree.exportDirectory("", contents).status);
+    result = tree.exportDirectory("/a", contents);
+    EXPECT_EQ(Status::LOOKUP_ERROR, result.status);
+    EXPECT_EQ("/a does not exist", result.error);
+    EXPECT_OK(tree.write("/b", "foo"));
+    result = tree.exportDirectory("/b", contents);
+    EXPECT_EQ(Status::TYPE_ERROR, result.status);
+    EXPECT_EQ("/b is a file", result.error);
+
+    EXPECT_OK(tree.makeDirectory("/a/c"));
+    EXPECT_OK(tree.write("/a/c/d", "dd"));
+    EXPECT_OK(tree.exportDirectory("/a", contents));
+    Directory dir;
+    Core::ProtoBuf::MemoryInputStream stream(contents.data(),
+                                             contents.size());
+    EXPECT_EQ("", dir.tryLoadSnapshot(stream, 1));
+    EXPECT_EQ(0U, stream.getBytesRemaining());
+    EXPECT_EQ((std::vector<std::string>{"c/"}), dir.getChildren());
+}
+
+TEST_F(TreeTreeTest, importDirectory)
+{
+    Tree source;
+    EXPECT_OK(source.makeDirectory("/x/y"));
+    EXPECT_OK(source.write("/x/y/z", "zz"));
+    EXPECT_OK(source.write("/x/w", "ww"));
+    std::string contents;
+    EXPECT_OK(source.exportDirectory("/x", contents));
+
+    Result result;
+    EXPECT_EQ(Status::INVALID_ARGUMENT,
+              tree.importDirectory("", contents).status);
+    result = tree.importDirectory("/a", contents + "x");
+    EXPECT_EQ(Status::INVALID_ARGUMENT, result.status);
+    EXPECT_EQ("Contents for /a are malformed: 1 bytes of trailing garbage",
+              result.error);
+    result = tree.importDirectory("/a", contents.substr(0, 10));
+    EXPECT_EQ(Status::INVALID_ARGUMENT, result.status);
+    EXPECT_EQ("/", dumpTree(tree));
+
+    EXPECT_OK(tree.write("/f", "ff"));
+    result = tree.importDirectory("/f", contents);
+    EXPECT_EQ(Status::TYPE_ERROR, result.status);
+    EXPECT_EQ("/f already exists but is a file", result.error);
+    result = tree.importDirectory("/f/g", contents);
+    EXPECT_EQ(Status::TYPE_ERROR, result.status);
+    EXPECT_EQ("Parent /f of /f/g is a file", result.error);
+    EXPECT_OK(tree.removeFile("/f"));
+
+    // creates parents, replaces existing contents
+    EXPECT_OK(tree.makeDirectory("/a/b/old"));
+    EXPECT_OK(tree.importDirectory("/a/b", contents));
+    EXPECT_EQ("/ /a/ /a/b/ /a/b/y/ /a/b/y/z /a/b/w", dumpTree(tree));
+    std::string value;
+    EXPECT_OK(tree.read("/a/b/y/z", value));
+    EXPECT_EQ("zz", value);
+    EXPECT_EQ(tree.getModificationCount(),
+              tree.superRoot.lookupDirectory("root")->
+                  lookupDirectory("a")->lastModified);
+
+    // the root directory can be replaced too
+    uint64_t before = tree.getModificationCount();
+    EXPECT_OK(tree.importDirectory("/", contents));
+    EXPECT_EQ("/ /y/ /y/z /w", dumpTree(tree));
+    EXPECT_LT(before, tree.superRoot.lookupDirectory("root")->
+                          lookupDirectory("y")->lastModified);
+
+    Protocol::ServerStats::Tree stats;
+    tree.updateServerStats(stats);
+    EXPECT_EQ(7U, stats.num_import_directory_attempted());
+    EXPECT_EQ(2U, stats.num_import_directory_success());
+}
+
+TEST_F(TreeTreeTest, importDirectory_badNames)
+{
+    Snapshot::File file;
+    file.set_contents("");
+    Snapshot::Directory dir;
+    dir.add_files("a/b");
+    std::string contents;
+    {
+        Core::ProtoBuf::StringOutputStream stream(contents);
+        stream.writeMessage(dir);
+        stream.writeMessage(file);
+    }
+    Result result = tree.importDirectory("/x", contents);
+    EXPECT_EQ(Status::INVALID_ARGUMENT, result.status);
+    EXPECT_EQ("Contents for /x are malformed: Invalid file name 'a/b'",
+              result.error);
+
+    dir.Clear();
+    dir.add_directories("a");
+    dir.add_files("a");
+    contents.clear();
+    {
+        Core::ProtoBuf::StringOutputStream stream(contents);
+        stream.writeMessage(dir);
+        stream.writeMessage(Snapshot::Directory());
+        stream.writeMessage(file);
+    }
+    result = tree.importDirectory("/x", contents);
+    EXPECT_EQ(Status::INVALID_ARGUMENT, result.status);
+    EXPECT_EQ("Contents for /x are malformed: Invalid file name 'a'",
+              result.error);
+}
+
+TEST_F(TreeTreeTest, importDirectory_tooDeep)
+{
+    Snapshot::Directory dir;
+    dir.add_directories("d");
+    std::string contents;
+    {
+        Core::ProtoBuf::StringOutputStream stream(contents);
+        for (uint64_t i = 0; i < Tree::MAX_IMPORT_DEPTH; ++i)
+            stream.writeMessage(dir);
+        stream.writeMessage(Snapshot::Directory());
+    }
+    EXPECT_OK(tree.importDirectory("/x", contents));
+
+    contents.clear();
+    {
+        Core::ProtoBuf::StringOutputStream stream(contents);
+        for (uint64_t i = 0; i < Tree::MAX_IMPORT_DEPTH + 1; ++i)
+            stream.writeMessage(dir);
+        stream.writeMessage(Snapshot::Directory());
+    }
+    Result result = tree.importDirectory("/y", contents);
+    EXPECT_EQ(Status::INVALID_ARGUMENT, result.status);
+    EXPECT_EQ("Contents for /y are malformed: Directories are nested too "
+              "deeply", result.error);
+    std::vector<std::string> children;
+    EXPECT_OK(tree.listDirectory("/", children));
+    EXPECT_EQ((std::vector<std::string>{"x/"}), children);
+}
+
 } // namespace LogCabin::Tree::<anonymous>
 } // namespace LogCabin::Tree
 } // namespace LogCabin
@@ -162,6 +162,13 @@ struct GetConfigurationResult {
      */
     Configuration servers;
 
+    /**
+     * If status is OK, the non-voting members (learners) of the
+     * configuration. These replicate the log and may answer non-linearizable
+     * reads, but they don't count toward a quorum.
+     */
+    Configuration learners;
+
     /**
      * Error message, if status is not OK.
      */
@@ -217,6 +224,35 @@ enum class Status {
 std::ostream&
 operator<<(std::ostream& os, Status status);
 
+/**
+ * Controls which servers may answer read-only Tree operations (listDirectory
+ * and read). See Tree::setReadConsistency().
+ */
+enum class ReadConsistency {
+
+    /**
+     * Reads are answered by the cluster leader after it confirms that it is
+     * still the leader. Reads reflect all operations that completed before
+     * the read began. This is the default.
+     */
+    LINEARIZABLE = 0,
+
+    /**
+     * Reads may be answered by any server that was caught up with the
+     * current leader's commit index within the staleness bound given to
+     * Tree::setReadConsistency().
+     * This spreads reads across the cluster, but a read may miss recent
+     * writes.
+     */
+    BOUNDED_STALENESS = 1,
+
+    /**
+     * Reads may be answered by any server from whatever state it has, even
+     * if it has lost contact with the rest of the cluster.
+     */
+    ANY_REPLICA = 2,
+};
+
 /**
  * Returned by Tree operations; contain a status code and an error message.
  */
@@ -416,6 +452,35 @@ class Tree {
      */
     void setTimeout(uint64_t nanoseconds);
 
+    /**
+     * Return the read consistency set by a previous call to
+     * setReadConsistency().
+     */
+    ReadConsistency getReadConsistency() const;
+
+    /**
+     * Return the staleness bound set by a previous call to
+     * setReadConsistency().
+     * \return
+     *      The staleness bound (in nanoseconds) for BOUNDED_STALENESS reads.
+     */
+    uint64_t getMaxStaleness() const;
+
+    /**
+     * Choose which servers may answer future read-only operations
+     * (listDirectory and read). Regardless of this setting, successive reads
+     * through the same Cluster never observe older state than a previous read
+     * did.
+     * \param consistency
+     *      See ReadConsistency.
+     * \param maxStalenessNanos
+     *      For BOUNDED_STALENESS, the maximum time (in nanoseconds) since the
+     *      answering server last heard from the cluster leader. Ignored
+     *      otherwise.
+     */
+    void setReadConsistency(ReadConsistency consistency,
+                            uint64_t maxStalenessNanos);
+
     /**
      * Make sure a directory exists at the given path.
      * Create parent directories listed in path as necessary.
@@ -564,6 +629,39 @@ class Tree {
     void
     removeFileEx(const std::string& path);
 
+    /**
+     * Replace a directory and everything beneath it with a prebuilt
+     * directory, in a single operation. This is much faster than writing the
+     * same files one at a time, so it's useful for loading large data sets;
+     * see logcabin-import for building the contents. Parent directories are
+     * created as needed.
+     * \param path
+     *      The directory to replace (or create).
+     * \param contents
+     *      An encoded directory, as built by logcabin-import --output. The
+     *      whole thing is replicated as one log entry, so it must be smaller
+     *      than the maximum RPC size; split larger data sets across several
+     *      directories.
+     * \return
+     *      Status and error message. Possible errors are:
+     *       - INVALID_ARGUMENT if path is malformed.
+     *       - INVALID_ARGUMENT if contents is malformed.
+     *       - INVALID_ARGUMENT if the cluster's state machine is older than
+     *         version 3.
+     *       - TYPE_ERROR if a parent of path is a file.
+     *       - TYPE_ERROR if path exists but is a file.
+     *       - CONDITION_NOT_MET if predicate from setCondition() was false.
+     *       - TIMEOUT if timeout elapsed before the operation completed.
+     */
+    Result
+    importDirectory(const std::string& path, const std::string& contents);
+
+    /**
+     * Like importDirectory but throws exceptions upon errors.
+     */
+    void
+    importDirectoryEx(const std::string& path, const std::string& contents);
+
   private:
     /**
      * Get a reference to the implementation-specific members of this class.
@@ -770,6 +868,30 @@ class Cluster {
                                 const Configuration& newConfiguration,
                                 uint64_t timeoutNanoseconds);
 
+    /**
+     * Like setConfiguration2 but also sets the non-voting members of the
+     * cluster.
+     * \param oldId
+     *      The ID of the cluster's current configuration.
+     * \param newConfiguration
+     *      The list of voting servers in the new configuration.
+     * \param newLearners
+     *      The list of non-voting servers (learners) in the new
+     *      configuration. These replace any existing learners (the other
+     *      forms of setConfiguration keep them, except for learners that
+     *      become voters). Learners receive the log but never vote or count
+     *      toward a quorum, so they add read capacity without slowing down
+     *      commits. A server may not be listed as both a voter and a learner.
+     * \param timeoutNanoseconds
+     *      Amount of time to wait for the call to complete. 0=wait
+     *      forever
+     */
+    ConfigurationResult setConfiguration2(
+                                uint64_t oldId,
+                                const Configuration& newConfiguration,
+                                const Configuration& newLearners,
+                                uint64_t timeoutNanoseconds);
+
     /**
      * Retrieve basic information from the given server, like its ID and the
      * addresses on which it is listening.
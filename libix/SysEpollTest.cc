@@ -0,0 +1,194 @@
+/* Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include "libix/ix.h"
+#include "net/ip.h"
+}
+
+namespace LogCabin {
+namespace {
+
+// Not Protocol::Common::DEFAULT_PORT, which other tests bind.
+const uint16_t PORT = 61254;
+
+const unsigned long CLIENT_COOKIE = 1;
+const unsigned long SERVER_COOKIE = 2;
+
+/**
+ * What the callbacks saw.
+ */
+struct Events {
+    Events()
+        : clientHandle(-1)
+        , connectResult(1)
+        , serverHandle(-1)
+        , received()
+        , sent(0)
+        , serverDead(false)
+        , timerFired(false)
+    {
+    }
+    hid_t clientHandle;
+    long connectResult;
+    hid_t serverHandle;
+    std::string received;
+    size_t sent;
+    bool serverDead;
+    bool timerFired;
+} events;
+
+void
+tcpConnected(hid_t handle, unsigned long cookie, long ret)
+{
+    EXPECT_EQ(CLIENT_COOKIE, cookie);
+    events.clientHandle = handle;
+    events.connectResult = ret;
+}
+
+void
+tcpKnock(hid_t handle, struct ip_tuple* id)
+{
+    EXPECT_EQ(PORT, id->dst_port);
+    events.serverHandle = handle;
+    ix_tcp_accept(handle, SERVER_COOKIE);
+}
+
+void
+tcpRecv(hid_t handle, unsigned long cookie, void* addr, size_t len)
+{
+    EXPECT_EQ(SERVER_COOKIE, cookie);
+    events.received.append(static_cast<char*>(addr), len);
+    ix_tcp_recv_done(handle, len);
+}
+
+void
+tcpSent(hid_t handle, unsigned long cookie, size_t len)
+{
+    EXPECT_EQ(CLIENT_COOKIE, cookie);
+    events.sent += len;
+}
+
+void
+tcpDead(hid_t handle, unsigned long cookie)
+{
+    EXPECT_EQ(SERVER_COOKIE, cookie);
+    events.serverDead = true;
+}
+
+void
+timerEvent(unsigned long cookie)
+{
+    events.timerFired = true;
+}
+
+/**
+ * Run the libix event loop until 'done' returns true or a few seconds pass.
+ */
+bool
+pollUntil(std::function<bool()> done)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(5);
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        ix_poll();
+        karr->len = 0;
+        ix_handle_events();
+    }
+    return true;
+}
+
+/**
+ * Releases libIX's state when the test ends, even if an assertion fails, so
+ * that it does not leak into the rest of the test binary.
+ */
+struct Teardown {
+    Teardown() {}
+    ~Teardown() {
+        ix_exit();
+        ix_epoll_shutdown();
+        ix_set_backend("ix");
+    }
+};
+
+TEST(LibixSysEpollTest, basics) {
+    ASSERT_EQ(-EINVAL, ix_set_backend("bogus"));
+    ASSERT_EQ(0, ix_set_backend("epoll"));
+    Teardown teardown;
+    events = Events();
+    ASSERT_EQ(0, ix_epoll_listen(MAKE_IP_ADDR(127, 0, 0, 1), PORT));
+    EXPECT_EQ(-EBUSY, ix_epoll_listen(MAKE_IP_ADDR(127, 0, 0, 1), PORT));
+
+    struct ix_ops ops;
+    memset(&ops, 0, sizeof(ops));
+    ops.tcp_connected = tcpConnected;
+    ops.tcp_knock = tcpKnock;
+    ops.tcp_recv = tcpRecv;
+    ops.tcp_sent = tcpSent;
+    ops.tcp_dead = tcpDead;
+    ops.timer_event = timerEvent;
+    ASSERT_EQ(0, ix_init(&ops, 64));
+
+    // connect
+    struct ip_tuple id;
+    memset(&id, 0, sizeof(id));
+    id.dst_ip = MAKE_IP_ADDR(127, 0, 0, 1);
+    id.dst_port = PORT;
+    ix_tcp_connect(&id, CLIENT_COOKIE);
+    ASSERT_TRUE(pollUntil([] {
+        return events.connectResult != 1 && events.serverHandle >= 0;
+    }));
+    EXPECT_EQ(0, events.connectResult);
+
+    // send and receive
+    char message[] = "hello world";
+    ix_tcp_send(events.clientHandle, message, strlen(message));
+    ASSERT_TRUE(pollUntil([] {
+        return events.received.size() == 11;
+    }));
+    EXPECT_EQ("hello world", events.received);
+    EXPECT_EQ(11U, events.sent);
+
+    // timers
+    int timer = sys_timer_init(NULL);
+    ASSERT_LE(0, timer);
+    EXPECT_EQ(0, sys_timer_ctl(timer, 10));
+    ASSERT_TRUE(pollUntil([] { return events.timerFired; }));
+
+    // wake: with nothing else to do, this poll would block forever
+    int wake = sys_wake_init();
+    ASSERT_LE(0, wake);
+    EXPECT_EQ(wake, sys_wake_init());
+    std::thread waker([wake] { EXPECT_EQ(0, sys_wake(wake)); });
+    EXPECT_EQ(0, ix_poll());
+    waker.join();
+
+    // close
+    ix_tcp_close(events.clientHandle);
+    ASSERT_TRUE(pollUntil([] { return events.serverDead; }));
+    ix_tcp_close(events.serverHandle);
+    ix_flush();
+}
+
+} // namespace LogCabin::<anonymous>
+} // namespace LogCabin
@@ -140,4 +140,8 @@ extern void ix_free_pages(void *addr, int nrpages);
 extern void ix_handle_events(void);
 extern int ix_poll(void);
 extern int ix_init(struct ix_ops *ops, int batch_depth);
+extern void ix_exit(void);
+extern int ix_set_backend(const char *name);
+extern int ix_epoll_listen(uint32_t ip, uint16_t port);
+extern void ix_epoll_shutdown(void);
 
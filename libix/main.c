@@ -35,6 +35,28 @@ static __thread struct bsys_arr *uarr;
 
 __thread struct bsys_arr *karr;
 
+const struct ix_sys_ops *ix_sys = &ix_sys_kernel;
+
+/**
+ * ix_set_backend - chooses how libIX performs system calls
+ * @name: "ix" to call into the IX kernel (the default), or "epoll" to
+ *        emulate IX over ordinary Linux sockets (see sys_epoll.c)
+ *
+ * Call before any other libIX function.
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int ix_set_backend(const char *name)
+{
+	if (!strcmp(name, ix_sys_kernel.name))
+		ix_sys = &ix_sys_kernel;
+	else if (!strcmp(name, ix_sys_epoll.name))
+		ix_sys = &ix_sys_epoll;
+	else
+		return -EINVAL;
+	return 0;
+}
+
 /**
  * ix_poll - flush pending commands and check for new commands
  *
@@ -133,3 +155,16 @@ int ix_init(struct ix_ops *ops, int batch_depth)
 	return 0;
 }
 
+/**
+ * ix_exit - releases the calling thread's libIX state
+ *
+ * Undoes ix_init(); requests that have not been flushed are dropped.
+ */
+void ix_exit(void)
+{
+	free(karr);
+	karr = NULL;
+	uarr = NULL;
+	memset(usys_tbl, 0, sizeof(usys_tbl));
+}
+
@@ -0,0 +1,835 @@
+/*
+ * Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * sys_epoll.c - an emulation of the IX system calls over Linux epoll
+ *
+ * This lets libix, ixev, and the applications built on them run on a stock
+ * Linux kernel, which is handy for testing, profiling, and benchmarking the
+ * dataplane code paths without IX hardware. It is not meant to be fast.
+ *
+ * Each thread that calls ix_init() gets its own epoll set, event array, and
+ * timers, as it would get its own queues in IX. Flow handles are the file
+ * descriptors of ordinary non-blocking TCP sockets. Batched calls are
+ * executed in order, and their return values are written over their
+ * descriptors, as IX does. Received data is read into heap buffers that are
+ * handed to the application and freed once it calls recv_done; sent data is
+ * copied into the socket, so it is reported as sent right away.
+ *
+ * IX accepts connections on the ports its control plane assigns; here, the
+ * application must call ix_epoll_listen() before ix_init(), and incoming
+ * connections are delivered to the first thread that initializes.
+ */
+
+#define _GNU_SOURCE /* for accept4 */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "syscall.h"
+#include "ix.h"
+
+/* the capacity of each thread's event array */
+#define EMU_EVENT_DEPTH		1024
+/* the size of each receive buffer */
+#define EMU_RECV_BUF_SIZE	16384
+/*
+ * the most receive buffers a flow may have outstanding before the
+ * application calls recv_done (must stay well below IXEV_RECV_DEPTH)
+ */
+#define EMU_RECV_BUFS		64
+/* the most epoll events handled per bpoll */
+#define EMU_EPOLL_BATCH		64
+
+struct emu_buf {
+	struct emu_buf *next;
+	size_t len;
+	char data[];
+};
+
+struct emu_flow {
+	int fd;
+	unsigned long cookie;
+	struct ip_tuple id;
+	bool accepted;		/* accept or connect was called */
+	bool connecting;	/* waiting for connect() to complete */
+	bool dead;		/* TCP_DEAD has been delivered */
+	bool want_out;		/* a send came up short */
+	uint32_t epoll_mask;	/* the events currently registered */
+	struct emu_buf *recv_head;
+	struct emu_buf *recv_tail;
+	size_t recv_head_off;	/* bytes of recv_head already released */
+	unsigned int nr_recv;	/* buffers handed to the application */
+};
+
+struct emu_timer {
+	unsigned long cookie;
+	uint64_t deadline;	/* in nanoseconds, or 0 if not armed */
+};
+
+struct emu_thread {
+	int epfd;
+	/* an eventfd that other threads write to end epoll_wait, or -1 */
+	int wakefd;
+	struct bsys_arr *uarr;
+	/* events waiting for room in uarr, a ring buffer */
+	struct bsys_desc *pending;
+	size_t pending_head;
+	size_t pending_len;
+	size_t pending_cap;
+	/* indexed by file descriptor */
+	struct emu_flow **flows;
+	size_t flows_cap;
+	struct emu_timer *timers;
+	int nr_timers;
+};
+
+static __thread struct emu_thread *emu;
+
+static int emu_listen_fd = -1;
+static int emu_listen_claimed;
+
+static uint64_t emu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000UL + (uint64_t) ts.tv_nsec;
+}
+
+static void emu_push_event(struct bsys_desc *ev)
+{
+	if (emu->pending_len == emu->pending_cap) {
+		size_t cap = emu->pending_cap ? emu->pending_cap * 2 : 256;
+		struct bsys_desc *ring = malloc(sizeof(*ring) * cap);
+		size_t i;
+
+		if (!ring)
+			abort();
+		for (i = 0; i < emu->pending_len; i++)
+			ring[i] = emu->pending[(emu->pending_head + i) %
+					       emu->pending_cap];
+		free(emu->pending);
+		emu->pending = ring;
+		emu->pending_head = 0;
+		emu->pending_cap = cap;
+	}
+
+	emu->pending[(emu->pending_head + emu->pending_len) %
+		     emu->pending_cap] = *ev;
+	emu->pending_len++;
+}
+
+static void emu_tcp_event(uint64_t sysnr, struct emu_flow *f,
+			  uint64_t argc, uint64_t argd)
+{
+	struct bsys_desc ev;
+
+	ev.sysnr = sysnr;
+	ev.arga = (uint64_t) f->fd;
+	ev.argb = f->cookie;
+	ev.argc = argc;
+	ev.argd = argd;
+	emu_push_event(&ev);
+}
+
+/* drop undelivered events for a flow that is going away */
+static void emu_forget_events(int fd)
+{
+	size_t i, kept = 0;
+
+	for (i = 0; i < emu->pending_len; i++) {
+		struct bsys_desc *ev = &emu->pending[(emu->pending_head + i) %
+						     emu->pending_cap];
+		if (ev->sysnr != USYS_TIMER && ev->arga == (uint64_t) fd)
+			continue;
+		emu->pending[(emu->pending_head + kept) % emu->pending_cap] =
+			*ev;
+		kept++;
+	}
+	emu->pending_len = kept;
+}
+
+static struct emu_flow *emu_flow_get(hid_t handle)
+{
+	if (handle < 0 || (size_t) handle >= emu->flows_cap)
+		return NULL;
+	return emu->flows[handle];
+}
+
+static struct emu_flow *emu_flow_create(int fd)
+{
+	struct emu_flow *f;
+	int one = 1;
+
+	if ((size_t) fd >= emu->flows_cap) {
+		size_t cap = emu->flows_cap ? emu->flows_cap : 64;
+		struct emu_flow **flows;
+
+		while (cap <= (size_t) fd)
+			cap *= 2;
+		flows = realloc(emu->flows, sizeof(*flows) * cap);
+		if (!flows)
+			return NULL;
+		memset(flows + emu->flows_cap, 0,
+		       sizeof(*flows) * (cap - emu->flows_cap));
+		emu->flows = flows;
+		emu->flows_cap = cap;
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+	f->fd = fd;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	emu->flows[fd] = f;
+	return f;
+}
+
+static void emu_flow_destroy(struct emu_flow *f)
+{
+	struct emu_buf *b = f->recv_head;
+
+	while (b) {
+		struct emu_buf *next = b->next;
+		free(b);
+		b = next;
+	}
+	if (f->epoll_mask)
+		epoll_ctl(emu->epfd, EPOLL_CTL_DEL, f->fd, NULL);
+	emu_forget_events(f->fd);
+	emu->flows[f->fd] = NULL;
+	close(f->fd);
+	free(f);
+}
+
+/* register interest in the events the flow currently needs */
+static void emu_flow_update(struct emu_flow *f)
+{
+	struct epoll_event ev;
+	uint32_t mask = 0;
+
+	if (f->accepted && !f->dead) {
+		if (f->connecting || f->want_out)
+			mask |= EPOLLOUT;
+		if (!f->connecting && f->nr_recv < EMU_RECV_BUFS)
+			mask |= EPOLLIN;
+	}
+	if (mask == f->epoll_mask)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = mask;
+	ev.data.fd = f->fd;
+	if (!f->epoll_mask)
+		epoll_ctl(emu->epfd, EPOLL_CTL_ADD, f->fd, &ev);
+	else if (!mask)
+		epoll_ctl(emu->epfd, EPOLL_CTL_DEL, f->fd, NULL);
+	else
+		epoll_ctl(emu->epfd, EPOLL_CTL_MOD, f->fd, &ev);
+	f->epoll_mask = mask;
+}
+
+static void emu_flow_kill(struct emu_flow *f)
+{
+	if (f->dead)
+		return;
+	f->dead = true;
+	emu_flow_update(f);
+	emu_tcp_event(USYS_TCP_DEAD, f, 0, 0);
+}
+
+static long emu_tcp_connect(struct ip_tuple *id, unsigned long cookie)
+{
+	struct sockaddr_in addr;
+	struct emu_flow *f;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -RET_NOMEM;
+	f = emu_flow_create(fd);
+	if (!f) {
+		close(fd);
+		return -RET_NOMEM;
+	}
+
+	f->cookie = cookie;
+	f->id = *id;
+	f->accepted = true;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(id->dst_ip);
+	addr.sin_port = htons(id->dst_port);
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+		emu_tcp_event(USYS_TCP_CONNECTED, f, RET_OK, 0);
+	} else if (errno == EINPROGRESS) {
+		f->connecting = true;
+	} else {
+		f->dead = true;
+		emu_tcp_event(USYS_TCP_CONNECTED, f,
+			      (uint64_t) -RET_CONNREFUSED, 0);
+	}
+	emu_flow_update(f);
+	return fd;
+}
+
+static long emu_tcp_sendv(struct emu_flow *f, struct sg_entry *ents,
+			  unsigned int nrents)
+{
+	struct iovec iov[MAX_SG_ENTRIES];
+	struct msghdr msg;
+	size_t total = 0;
+	unsigned int i;
+	ssize_t ret;
+
+	if (f->dead)
+		return -RET_CLOSED;
+	if (f->connecting) {
+		f->want_out = true;
+		return 0;
+	}
+	if (nrents > MAX_SG_ENTRIES)
+		nrents = MAX_SG_ENTRIES;
+
+	for (i = 0; i < nrents; i++) {
+		iov[i].iov_base = ents[i].base;
+		iov[i].iov_len = ents[i].len;
+		total += ents[i].len;
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = nrents;
+
+	ret = sendmsg(f->fd, &msg, MSG_NOSIGNAL);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return -RET_CLOSED;
+		ret = 0;
+	}
+	if (ret > 0)
+		emu_tcp_event(USYS_TCP_SENT, f, (uint64_t) ret, 0);
+	if ((size_t) ret < total) {
+		f->want_out = true;
+		emu_flow_update(f);
+	}
+	return ret;
+}
+
+static long emu_tcp_recv_done(struct emu_flow *f, size_t len)
+{
+	while (len > 0 && f->recv_head) {
+		struct emu_buf *b = f->recv_head;
+		size_t n = b->len - f->recv_head_off;
+
+		if (n > len)
+			n = len;
+		f->recv_head_off += n;
+		len -= n;
+		if (f->recv_head_off == b->len) {
+			f->recv_head = b->next;
+			if (!f->recv_head)
+				f->recv_tail = NULL;
+			f->recv_head_off = 0;
+			f->nr_recv--;
+			free(b);
+		}
+	}
+	emu_flow_update(f);
+	return len ? -RET_INVAL : RET_OK;
+}
+
+/* execute one batched call, overwriting it with its return value */
+static void emu_bcall_one(struct bsys_desc *d)
+{
+	struct bsys_ret *r = (struct bsys_ret *) d;
+	uint64_t sysnr = d->sysnr;
+	uint64_t arga = d->arga, argb = d->argb, argc = d->argc;
+	unsigned long cookie = 0;
+	struct emu_flow *f = NULL;
+	long ret;
+
+	if (sysnr != KSYS_TCP_CONNECT &&
+	    sysnr >= KSYS_TCP_ACCEPT && sysnr <= KSYS_TCP_CLOSE) {
+		f = emu_flow_get((hid_t) arga);
+		if (!f) {
+			ret = -RET_BADH;
+			goto out;
+		}
+		cookie = f->cookie;
+	}
+
+	switch (sysnr) {
+	case KSYS_TCP_CONNECT:
+		cookie = argb;
+		ret = emu_tcp_connect((struct ip_tuple *) arga, argb);
+		break;
+	case KSYS_TCP_ACCEPT:
+		f->cookie = cookie = argb;
+		f->accepted = true;
+		emu_flow_update(f);
+		ret = RET_OK;
+		break;
+	case KSYS_TCP_REJECT:
+		emu_flow_destroy(f);
+		ret = RET_OK;
+		break;
+	case KSYS_TCP_SEND: {
+		struct sg_entry ent = { .base = (void *) argb, .len = argc };
+		ret = emu_tcp_sendv(f, &ent, 1);
+		break;
+	}
+	case KSYS_TCP_SENDV:
+		ret = emu_tcp_sendv(f, (struct sg_entry *) argb,
+				    (unsigned int) argc);
+		break;
+	case KSYS_TCP_RECV_DONE:
+		ret = emu_tcp_recv_done(f, argb);
+		break;
+	case KSYS_TCP_CLOSE:
+		emu_flow_destroy(f);
+		ret = RET_OK;
+		break;
+	default:
+		/* UDP is not emulated */
+		ret = -RET_NOTSUP;
+	}
+
+out:
+	r->sysnr = sysnr;
+	r->cookie = cookie;
+	r->ret = ret;
+}
+
+static int emu_bcall(struct bsys_desc *d, unsigned int nr)
+{
+	unsigned int i;
+
+	if (!emu)
+		return -RET_FAULT;
+	for (i = 0; i < nr; i++)
+		emu_bcall_one(&d[i]);
+	return 0;
+}
+
+static void emu_handle_listener(void)
+{
+	struct sockaddr_in peer, local;
+	struct bsys_desc ev;
+	socklen_t len;
+	struct emu_flow *f;
+	int fd;
+
+	len = sizeof(peer);
+	fd = accept4(emu_listen_fd, (struct sockaddr *) &peer, &len,
+		     SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+	f = emu_flow_create(fd);
+	if (!f) {
+		close(fd);
+		return;
+	}
+
+	len = sizeof(local);
+	memset(&local, 0, sizeof(local));
+	getsockname(fd, (struct sockaddr *) &local, &len);
+	f->id.src_ip = ntohl(peer.sin_addr.s_addr);
+	f->id.src_port = ntohs(peer.sin_port);
+	f->id.dst_ip = ntohl(local.sin_addr.s_addr);
+	f->id.dst_port = ntohs(local.sin_port);
+
+	ev.sysnr = USYS_TCP_KNOCK;
+	ev.arga = (uint64_t) fd;
+	ev.argb = (uint64_t) &f->id;
+	ev.argc = 0;
+	ev.argd = 0;
+	emu_push_event(&ev);
+}
+
+static void emu_handle_flow(struct emu_flow *f, uint32_t events)
+{
+	if (f->connecting) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+
+		getsockopt(f->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		f->connecting = false;
+		if (err) {
+			f->dead = true;
+			emu_tcp_event(USYS_TCP_CONNECTED, f,
+				      (uint64_t) -RET_CONNREFUSED, 0);
+		} else {
+			emu_tcp_event(USYS_TCP_CONNECTED, f, RET_OK, 0);
+			/* let ixev retry sends issued before the connect */
+			if (f->want_out)
+				emu_tcp_event(USYS_TCP_SENT, f, 0, 0);
+		}
+		f->want_out = false;
+		emu_flow_update(f);
+		return;
+	}
+
+	if ((events & EPOLLOUT) && f->want_out) {
+		f->want_out = false;
+		emu_tcp_event(USYS_TCP_SENT, f, 0, 0);
+	}
+
+	if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+	    f->nr_recv < EMU_RECV_BUFS) {
+		struct emu_buf *b = malloc(sizeof(*b) + EMU_RECV_BUF_SIZE);
+		ssize_t n;
+
+		if (!b)
+			abort();
+		n = read(f->fd, b->data, EMU_RECV_BUF_SIZE);
+		if (n > 0) {
+			b->len = (size_t) n;
+			b->next = NULL;
+			if (f->recv_tail)
+				f->recv_tail->next = b;
+			else
+				f->recv_head = b;
+			f->recv_tail = b;
+			f->nr_recv++;
+			emu_tcp_event(USYS_TCP_RECV, f, (uint64_t) b->data,
+				      (uint64_t) n);
+		} else {
+			free(b);
+			if (n == 0 || (errno != EAGAIN && errno != EINTR))
+				emu_flow_kill(f);
+		}
+	}
+
+	emu_flow_update(f);
+}
+
+static void emu_fire_timers(uint64_t now)
+{
+	int i;
+
+	for (i = 0; i < emu->nr_timers; i++) {
+		struct emu_timer *t = &emu->timers[i];
+		struct bsys_desc ev;
+
+		if (!t->deadline || t->deadline > now)
+			continue;
+		t->deadline = 0;
+		ev.sysnr = USYS_TIMER;
+		ev.arga = t->cookie;
+		ev.argb = ev.argc = ev.argd = 0;
+		emu_push_event(&ev);
+	}
+}
+
+/* how long epoll_wait may block, in milliseconds */
+static int emu_poll_timeout(uint64_t now)
+{
+	uint64_t next = 0;
+	int i;
+
+	if (emu->pending_len)
+		return 0;
+	for (i = 0; i < emu->nr_timers; i++) {
+		uint64_t d = emu->timers[i].deadline;
+		if (d && (!next || d < next))
+			next = d;
+	}
+	if (!next)
+		return -1;
+	/*
+	 * epoll only has millisecond resolution; IX would busy-poll, so do
+	 * the same for timers that are due sooner than that.
+	 */
+	if (next <= now + 1000000UL)
+		return 0;
+	return (int) ((next - now) / 1000000UL);
+}
+
+static int emu_bpoll(struct bsys_desc *d, unsigned int nr)
+{
+	struct epoll_event events[EMU_EPOLL_BATCH];
+	int i, n;
+
+	if (emu_bcall(d, nr))
+		return -RET_FAULT;
+
+	n = epoll_wait(emu->epfd, events, EMU_EPOLL_BATCH,
+		       emu_poll_timeout(emu_now()));
+	for (i = 0; i < n; i++) {
+		int fd = events[i].data.fd;
+		struct emu_flow *f;
+
+		if (fd == emu_listen_fd) {
+			emu_handle_listener();
+			continue;
+		}
+		if (fd == emu->wakefd) {
+			uint64_t count;
+
+			/* reset the counter; later wakes will signal again */
+			while (read(fd, &count, sizeof(count)) == sizeof(count))
+				;
+			continue;
+		}
+		f = emu_flow_get(fd);
+		if (f)
+			emu_handle_flow(f, events[i].events);
+	}
+	emu_fire_timers(emu_now());
+
+	emu->uarr->len = 0;
+	while (emu->pending_len && emu->uarr->len < emu->uarr->max_len) {
+		emu->uarr->descs[emu->uarr->len++] =
+			emu->pending[emu->pending_head];
+		emu->pending_head = (emu->pending_head + 1) %
+				    emu->pending_cap;
+		emu->pending_len--;
+	}
+	return 0;
+}
+
+static struct bsys_arr *emu_baddr(void)
+{
+	if (emu)
+		return emu->uarr;
+
+	emu = calloc(1, sizeof(*emu));
+	if (!emu)
+		return NULL;
+	emu->epfd = epoll_create1(EPOLL_CLOEXEC);
+	emu->wakefd = -1;
+	emu->uarr = malloc(sizeof(struct bsys_arr) +
+			   sizeof(struct bsys_desc) * EMU_EVENT_DEPTH);
+	if (emu->epfd < 0 || !emu->uarr) {
+		if (emu->epfd >= 0)
+			close(emu->epfd);
+		free(emu->uarr);
+		free(emu);
+		emu = NULL;
+		return NULL;
+	}
+	emu->uarr->len = 0;
+	emu->uarr->max_len = EMU_EVENT_DEPTH;
+
+	if (emu_listen_fd >= 0 &&
+	    __sync_bool_compare_and_swap(&emu_listen_claimed, 0, 1)) {
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = emu_listen_fd;
+		epoll_ctl(emu->epfd, EPOLL_CTL_ADD, emu_listen_fd, &ev);
+	}
+	return emu->uarr;
+}
+
+static int emu_mmap(void *addr, int nr, int size, int perm)
+{
+	size_t len = (size_t) nr * (size_t) size;
+	int prot = 0;
+	void *ret;
+
+	if (perm & VM_PERM_R)
+		prot |= PROT_READ;
+	if (perm & VM_PERM_W)
+		prot |= PROT_WRITE;
+
+	/* libix picks the addresses, so they must be honored exactly */
+	ret = mmap(addr, len, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ret == MAP_FAILED)
+		return -RET_NOMEM;
+	if (ret != addr) {
+		munmap(ret, len);
+		return -RET_NOMEM;
+	}
+	return 0;
+}
+
+static int emu_unmap(void *addr, int nr, int size)
+{
+	return munmap(addr, (size_t) nr * (size_t) size) ? -RET_INVAL : 0;
+}
+
+static int emu_spawnmode(bool spawn_cores)
+{
+	return 0;
+}
+
+static int emu_nrcpus(void)
+{
+	return (int) sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+static int emu_timer_init(void *addr)
+{
+	struct emu_timer *timers;
+
+	if (!emu)
+		return -1;
+	timers = realloc(emu->timers,
+			 sizeof(*timers) * (size_t) (emu->nr_timers + 1));
+	if (!timers)
+		return -1;
+	emu->timers = timers;
+	timers[emu->nr_timers].cookie = (unsigned long) addr;
+	timers[emu->nr_timers].deadline = 0;
+	return emu->nr_timers++;
+}
+
+static int emu_wake_init(void)
+{
+	struct epoll_event ev;
+
+	if (!emu)
+		return -RET_INVAL;
+	if (emu->wakefd >= 0)
+		return emu->wakefd;
+
+	emu->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (emu->wakefd < 0)
+		return -RET_NOMEM;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = emu->wakefd;
+	if (epoll_ctl(emu->epfd, EPOLL_CTL_ADD, emu->wakefd, &ev)) {
+		close(emu->wakefd);
+		emu->wakefd = -1;
+		return -RET_NOMEM;
+	}
+	return emu->wakefd;
+}
+
+/* may be called from any thread */
+static int emu_wake(int wake_id)
+{
+	uint64_t one = 1;
+
+	if (write(wake_id, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		return -RET_INVAL;
+	return 0;
+}
+
+static int emu_timer_ctl(int timer_id, uint64_t delay)
+{
+	if (!emu || timer_id < 0 || timer_id >= emu->nr_timers)
+		return -RET_INVAL;
+	/* delay is in microseconds; a deadline of 0 means disarmed */
+	emu->timers[timer_id].deadline = emu_now() + delay * 1000UL + 1;
+	return 0;
+}
+
+/**
+ * ix_epoll_listen - accept connections when emulating IX over epoll
+ * @ip: the local IPv4 address to listen on (host byte order), or 0 for any
+ * @port: the TCP port to listen on (host byte order)
+ *
+ * Call before ix_init(), and not again until ix_epoll_shutdown().
+ *
+ * Returns 0 if successful, otherwise a negative errno.
+ */
+int ix_epoll_listen(uint32_t ip, uint16_t port)
+{
+	struct sockaddr_in addr;
+	int fd, one = 1;
+
+	if (emu_listen_fd >= 0)
+		return -EBUSY;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(ip);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+	    listen(fd, SOMAXCONN)) {
+		int ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	emu_listen_fd = fd;
+	return 0;
+}
+
+/**
+ * ix_epoll_shutdown - releases the epoll emulation's resources
+ *
+ * Closes the calling thread's flows, epoll set, and timers, and closes the
+ * listener so that ix_epoll_listen() may be called again. Call after the
+ * calling thread is done with libIX, once every other thread is done too.
+ */
+void ix_epoll_shutdown(void)
+{
+	size_t fd;
+
+	if (emu) {
+		for (fd = 0; fd < emu->flows_cap; fd++) {
+			if (emu->flows[fd])
+				emu_flow_destroy(emu->flows[fd]);
+		}
+		if (emu->wakefd >= 0)
+			close(emu->wakefd);
+		close(emu->epfd);
+		free(emu->flows);
+		free(emu->pending);
+		free(emu->timers);
+		free(emu->uarr);
+		free(emu);
+		emu = NULL;
+	}
+	if (emu_listen_fd >= 0) {
+		close(emu_listen_fd);
+		emu_listen_fd = -1;
+		emu_listen_claimed = 0;
+	}
+}
+
+const struct ix_sys_ops ix_sys_epoll = {
+	.name		= "epoll",
+	.bpoll		= emu_bpoll,
+	.bcall		= emu_bcall,
+	.baddr		= emu_baddr,
+	.mmap		= emu_mmap,
+	.unmap		= emu_unmap,
+	.spawnmode	= emu_spawnmode,
+	.nrcpus		= emu_nrcpus,
+	.timer_init	= emu_timer_init,
+	.timer_ctl	= emu_timer_ctl,
+	.wake_init	= emu_wake_init,
+	.wake		= emu_wake,
+};
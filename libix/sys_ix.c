@@ -0,0 +1,101 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ * Copyright (c) 2015 Diego Ongaro
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * sys_ix.c - system calls into the IX dataplane kernel
+ */
+
+#include "syscall.h"
+#include "syscall_raw.h"
+
+static int ix_kernel_bpoll(struct bsys_desc *d, unsigned int nr)
+{
+	return (int) SYSCALL(SYS_BPOLL, d, nr);
+}
+
+static int ix_kernel_bcall(struct bsys_desc *d, unsigned int nr)
+{
+	return (int) SYSCALL(SYS_BCALL, d, nr);
+}
+
+static struct bsys_arr *ix_kernel_baddr(void)
+{
+	return (struct bsys_arr *) SYSCALL(SYS_BADDR);
+}
+
+static int ix_kernel_mmap(void *addr, int nr, int size, int perm)
+{
+	return (int) SYSCALL(SYS_MMAP, addr, nr, size, perm);
+}
+
+static int ix_kernel_unmap(void *addr, int nr, int size)
+{
+	return (int) SYSCALL(SYS_MUNMAP, addr, nr, size);
+}
+
+static int ix_kernel_spawnmode(bool spawn_cores)
+{
+	return (int) SYSCALL(SYS_SPAWNMODE, spawn_cores);
+}
+
+static int ix_kernel_nrcpus(void)
+{
+	return (int) SYSCALL(SYS_NRCPUS);
+}
+
+static int ix_kernel_timer_init(void *addr)
+{
+	return (int) SYSCALL(SYS_TIMER_INIT, addr);
+}
+
+static int ix_kernel_timer_ctl(int timer_id, uint64_t delay)
+{
+	return (int) SYSCALL(SYS_TIMER_CTL, timer_id, delay);
+}
+
+/* IX has no way for one thread to interrupt another's bpoll */
+static int ix_kernel_wake_init(void)
+{
+	return -RET_NOTSUP;
+}
+
+static int ix_kernel_wake(int wake_id)
+{
+	return -RET_NOTSUP;
+}
+
+const struct ix_sys_ops ix_sys_kernel = {
+	.name		= "ix",
+	.bpoll		= ix_kernel_bpoll,
+	.bcall		= ix_kernel_bcall,
+	.baddr		= ix_kernel_baddr,
+	.mmap		= ix_kernel_mmap,
+	.unmap		= ix_kernel_unmap,
+	.spawnmode	= ix_kernel_spawnmode,
+	.nrcpus		= ix_kernel_nrcpus,
+	.timer_init	= ix_kernel_timer_init,
+	.timer_ctl	= ix_kernel_timer_ctl,
+	.wake_init	= ix_kernel_wake_init,
+	.wake		= ix_kernel_wake,
+};
@@ -30,49 +30,88 @@
 #include <ix/syscall.h>
 #include <ix/mem.h>
 #include <ix/vm.h>
-#include "syscall_raw.h"
+
+/*
+ * The system calls libix needs, as provided by one backend. The "ix" backend
+ * traps into the IX dataplane kernel; the "epoll" backend emulates it over
+ * ordinary Linux sockets so that the same code can run on a stock kernel.
+ * See ix_set_backend().
+ */
+struct ix_sys_ops {
+	const char *name;
+	int (*bpoll)(struct bsys_desc *d, unsigned int nr);
+	int (*bcall)(struct bsys_desc *d, unsigned int nr);
+	struct bsys_arr *(*baddr)(void);
+	int (*mmap)(void *addr, int nr, int size, int perm);
+	int (*unmap)(void *addr, int nr, int size);
+	int (*spawnmode)(bool spawn_cores);
+	int (*nrcpus)(void);
+	int (*timer_init)(void *addr);
+	int (*timer_ctl)(int timer_id, uint64_t delay);
+	int (*wake_init)(void);
+	int (*wake)(int wake_id);
+};
+
+extern const struct ix_sys_ops ix_sys_kernel;
+extern const struct ix_sys_ops ix_sys_epoll;
+extern const struct ix_sys_ops *ix_sys;
 
 static inline int sys_bpoll(struct bsys_desc *d, unsigned int nr)
 {
-	return (int) SYSCALL(SYS_BPOLL, d, nr);
+	return ix_sys->bpoll(d, nr);
 }
 
 static inline int sys_bcall(struct bsys_desc *d, unsigned int nr)
 {
-	return (int) SYSCALL(SYS_BCALL, d, nr);
+	return ix_sys->bcall(d, nr);
 }
 
 static inline void *sys_baddr(void)
 {
-	return (struct bsys_arr *) SYSCALL(SYS_BADDR);
+	return ix_sys->baddr();
 }
 
 static inline int sys_mmap(void *addr, int nr, int size, int perm)
 {
-	return (int) SYSCALL(SYS_MMAP, addr, nr, size, perm);
+	return ix_sys->mmap(addr, nr, size, perm);
 }
 
 static inline int sys_unmap(void *addr, int nr, int size)
 {
-	return (int) SYSCALL(SYS_MUNMAP, addr, nr, size);
+	return ix_sys->unmap(addr, nr, size);
 }
 
 static inline int sys_spawnmode(bool spawn_cores)
 {
-	return (int) SYSCALL(SYS_SPAWNMODE, spawn_cores);
+	return ix_sys->spawnmode(spawn_cores);
 }
 
 static inline int sys_nrcpus(void)
 {
-	return (int) SYSCALL(SYS_NRCPUS);
+	return ix_sys->nrcpus();
 }
 
 static inline int sys_timer_init(void * addr)
 {
-	return (int) SYSCALL(SYS_TIMER_INIT, addr);
+	return ix_sys->timer_init(addr);
 }
 
 static inline int sys_timer_ctl(int timer_id, uint64_t delay)
 {
-	return (int) SYSCALL(SYS_TIMER_CTL, timer_id, delay);
+	return ix_sys->timer_ctl(timer_id, delay);
+}
+
+/*
+ * sys_wake_init() returns an id that other threads can pass to sys_wake()
+ * to make the calling thread's next (or current) sys_bpoll() return, or a
+ * negative value if the backend cannot do that.
+ */
+static inline int sys_wake_init(void)
+{
+	return ix_sys->wake_init();
+}
+
+static inline int sys_wake(int wake_id)
+{
+	return ix_sys->wake(wake_id);
 }
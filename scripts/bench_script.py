@@ -87,7 +87,7 @@ def main():
     if arguments['--sharedfs']:
         sharedfs=True
     
-    client_command = 'build/Examples/Benchmark'
+    client_command = 'build/Client/Benchmark'
     server_command = 'build/LogCabin'
 
     num_servers = len(smokehosts)
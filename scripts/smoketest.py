@@ -25,7 +25,7 @@ Options:
   -h --help            Show this help message and exit
   --binary=<cmd>       Server binary to execute [default: build/LogCabin]
   --client=<cmd>       Client binary to execute
-                       [default: build/Examples/Benchmark]
+                       [default: build/Client/Benchmark]
   --reconf=<opts>      Additional options to pass through to the Reconfigure
                        binary. [default: '']
   --clientops=<opts>   Additional options for client binary. [default: '']